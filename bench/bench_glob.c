@@ -0,0 +1,97 @@
+#include "glob_expand.h"
+#include "shell.h"
+#include "vars.h"
+#include <fcntl.h>
+#include <glob.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Usage: bench_glob [file_count] [directory]
+// The directory is populated once and reused by later runs.
+
+static double now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void populate(const char *dir, long count) {
+  char marker[4096];
+  snprintf(marker, sizeof(marker), "%s/.populated_%ld", dir, count);
+  if (access(marker, F_OK) == 0)
+    return;
+
+  mkdir(dir, 0755);
+  printf("creating %ld files in %s...\n", count, dir);
+  char path[4096];
+  for (long i = 0; i < count; i++) {
+    snprintf(path, sizeof(path), "%s/file_%07ld.%s", dir, i,
+             i % 2 ? "txt" : "log");
+    int fd = open(path, O_WRONLY | O_CREAT, 0644);
+    if (fd == -1) {
+      perror(path);
+      exit(EXIT_FAILURE);
+    }
+    close(fd);
+  }
+  close(open(marker, O_WRONLY | O_CREAT, 0644));
+}
+
+static double time_line(const char *line, size_t *argc) {
+  char *copy = strdup(line);
+  double start = now_ms();
+  Command *cmd = parse_pipeline(copy);
+  double elapsed = now_ms() - start;
+  *argc = cmd->argc;
+  free_commands(&cmd);
+  free(copy);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  long count = argc > 1 ? atol(argv[1]) : 1000000;
+  const char *dir = argc > 2 ? argv[2] : "/tmp/bench_glob";
+
+  char *initial[] = {NULL};
+  vars_init(initial);
+  populate(dir, count);
+  if (chdir(dir) != 0) {
+    perror(dir);
+    return EXIT_FAILURE;
+  }
+
+  size_t args = 0;
+  double single = time_line("echo *.log", &args);
+  printf("single glob '*.log':            %9.2f ms  (%zu args)\n", single,
+         args);
+
+  double shared = time_line("echo *.log *.txt file_00*", &args);
+  printf("three globs, shared listing:    %9.2f ms  (%zu args)\n", shared,
+         args);
+
+  double separate = 0;
+  size_t part = 0;
+  separate += time_line("echo *.log", &part);
+  separate += time_line("echo *.txt", &part);
+  separate += time_line("echo file_00*", &part);
+  printf("three globs, separate lines:    %9.2f ms\n", separate);
+
+  double pathological = time_line("echo *f*i*l*e*_*0*x", &args);
+  printf("pathological '*f*i*l*e*_*0*x':  %9.2f ms  (%zu args)\n",
+         pathological, args);
+
+  glob_t results;
+  double start = now_ms();
+  glob("*.log", 0, NULL, &results);
+  double libc = now_ms() - start;
+  printf("libc glob(3) '*.log':           %9.2f ms  (%zu args)\n", libc,
+         (size_t)results.gl_pathc);
+  globfree(&results);
+
+  vars_free();
+  return EXIT_SUCCESS;
+}
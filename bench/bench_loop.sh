@@ -0,0 +1,49 @@
+#!/usr/bin/env bash
+# Usage: bench_loop.sh [shell] [iterations]
+# Times loop-heavy scripts in the given shell and in bash and dash when they
+# are installed. Each figure is the best of three runs, in seconds.
+
+shell=${1:-./shell}
+iterations=${2:-1000000}
+
+workloads=(
+  "while-arith:i=0; while [ \$i -lt $iterations ]; do i=\$((i+1)); done"
+  "for-seq:n=0; for i in \$(seq 1 $iterations); do n=\$((n+i)); done"
+  "function:f() { x=\$1; }; i=0; while [ \$i -lt $iterations ]; do f \$i; i=\$((i+1)); done"
+  "if-else:i=0; while [ \$i -lt $iterations ]; do if [ \$((i%2)) = 0 ]; then e=1; else o=1; fi; i=\$((i+1)); done"
+)
+
+# Microseconds from bash's EPOCHREALTIME, printed as seconds
+best_of_three() {
+  local best=""
+  for _ in 1 2 3; do
+    local start=${EPOCHREALTIME/./}
+    "$1" -c "$2" >/dev/null
+    local elapsed=$((${EPOCHREALTIME/./} - start))
+    if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+      best=$elapsed
+    fi
+  done
+  printf "%d.%03d" $((best / 1000000)) $((best / 1000 % 1000))
+}
+
+shells=("$shell")
+for other in bash dash; do
+  command -v "$other" >/dev/null && shells+=("$other")
+done
+
+printf "%-12s" "workload"
+for sh in "${shells[@]}"; do
+  printf "%12s" "$(basename "$sh")"
+done
+printf "\n"
+
+for entry in "${workloads[@]}"; do
+  name=${entry%%:*}
+  script=${entry#*:}
+  printf "%-12s" "$name"
+  for sh in "${shells[@]}"; do
+    printf "%12s" "$(best_of_three "$sh" "$script")"
+  done
+  printf "\n"
+done
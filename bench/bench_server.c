@@ -0,0 +1,114 @@
+#include "server.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Usage: bench_server [shell] [requests] [clients] [command]
+// Runs the command `requests` times from `clients` concurrent processes,
+// once by spawning `shell -c` per request and once through a warm
+// `shell --server`, and prints the throughput of each.
+
+extern char **environ;
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void spawn_one(const char *shell, const char *command) {
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  char *argv[] = {(char *)shell, "-c", (char *)command, NULL};
+  pid_t pid;
+  if (posix_spawn(&pid, shell, &actions, NULL, argv, environ) == 0)
+    waitpid(pid, NULL, 0);
+  posix_spawn_file_actions_destroy(&actions);
+}
+
+static void request_one(const char *sock_path, const char *command) {
+  int null_fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+  const int stdio[3] = {null_fd, null_fd, STDERR_FILENO};
+  int sock = server_connect(sock_path);
+  ServerReply reply;
+  if (sock == -1 || !server_request(sock, NULL, NULL, command, stdio, &reply)) {
+    perror("server_request");
+    exit(EXIT_FAILURE);
+  }
+  close(sock);
+  close(null_fd);
+}
+
+// Seconds for `clients` processes to share `requests` runs between them
+static double run_clients(const char *shell, const char *sock_path,
+                          long requests, long clients, const char *command) {
+  pid_t *pids = (pid_t *)calloc(clients, sizeof(pid_t));
+  double start = now_seconds();
+  for (long c = 0; c < clients; c++) {
+    if ((pids[c] = fork()) == 0) {
+      for (long i = c; i < requests; i += clients) {
+        if (sock_path)
+          request_one(sock_path, command);
+        else
+          spawn_one(shell, command);
+      }
+      _exit(0);
+    }
+  }
+  for (long c = 0; c < clients; c++) {
+    waitpid(pids[c], NULL, 0);
+  }
+  double elapsed = now_seconds() - start;
+  free(pids);
+  return elapsed;
+}
+
+static pid_t start_server(const char *shell, const char *sock_path) {
+  char *argv[] = {(char *)shell, "--server", (char *)sock_path, NULL};
+  pid_t pid;
+  if (posix_spawn(&pid, shell, NULL, NULL, argv, environ) != 0) {
+    perror(shell);
+    exit(EXIT_FAILURE);
+  }
+
+  for (int tries = 0; tries < 200; tries++) {
+    int sock = server_connect(sock_path);
+    if (sock != -1) {
+      close(sock);
+      return pid;
+    }
+    usleep(10000);
+  }
+  fprintf(stderr, "server did not start\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  const char *shell = argc > 1 ? argv[1] : "./shell";
+  long requests = argc > 2 ? atol(argv[2]) : 2000;
+  long clients = argc > 3 ? atol(argv[3]) : 4;
+  const char *command = argc > 4 ? argv[4] : "x=$((1 + 2)); echo $x";
+
+  char sock_path[64];
+  snprintf(sock_path, sizeof(sock_path), "/tmp/bench_server_%d.sock",
+           (int)getpid());
+  pid_t server = start_server(shell, sock_path);
+
+  printf("%ld requests, %ld clients: %s\n", requests, clients, command);
+  double spawned = run_clients(shell, NULL, requests, clients, command);
+  printf("spawn   %8.3f s  %10.0f req/s\n", spawned, requests / spawned);
+  double served = run_clients(shell, sock_path, requests, clients, command);
+  printf("server  %8.3f s  %10.0f req/s\n", served, requests / served);
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  return 0;
+}
@@ -0,0 +1,620 @@
+#include "dirs.h"
+#include "scan.h"
+#include "shell.h"
+#include "snapshot.h"
+#include "suggest.h"
+#include "vars.h"
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Usage: bench_suite [-o results.json] [-f filter] [-q]
+// Micro- and macrobenchmarks of the interactive paths. Each figure is the
+// median of BENCH_REPEATS runs, each run long enough to be measurable; -q
+// shortens the runs for a smoke test. Results are written as JSON for
+// bench/compare.py.
+
+#define BENCH_REPEATS 5
+#define BENCH_MIN_SECONDS 0.2
+#define BENCH_MAX_RESULTS 96
+
+typedef struct BenchResult {
+  char name[64];
+  const char *unit;
+  double value;
+  bool higher_is_better;
+} BenchResult;
+
+typedef void (*bench_fn)(void *ctx, long iterations);
+
+extern char **environ;
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static size_t result_count = 0;
+static double min_seconds = BENCH_MIN_SECONDS;
+static const char *filter = NULL;
+static char work_dir[PATH_MAX];
+
+/***********************************************
+ * MEASUREMENT
+ ***********************************************/
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static bool selected(const char *name) {
+  return !filter || strstr(name, filter) != NULL;
+}
+
+static void record(const char *name, const char *unit, double value,
+                   bool higher_is_better) {
+  if (result_count == BENCH_MAX_RESULTS)
+    return;
+  BenchResult *r = &results[result_count++];
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->unit = unit;
+  r->value = value;
+  r->higher_is_better = higher_is_better;
+  fprintf(stderr, "%-32s %12.3f %s\n", name, value, unit);
+}
+
+// Median seconds per iteration. The iteration count doubles until one run
+// takes min_seconds, then that count is repeated.
+static double time_per_op(bench_fn fn, void *ctx) {
+  long iterations = 1;
+  double elapsed;
+  while (true) {
+    double start = now_seconds();
+    fn(ctx, iterations);
+    elapsed = now_seconds() - start;
+    if (elapsed >= min_seconds || iterations >= (1L << 30))
+      break;
+    iterations *= 2;
+  }
+
+  double samples[BENCH_REPEATS];
+  samples[0] = elapsed / iterations;
+  for (int i = 1; i < BENCH_REPEATS; i++) {
+    double start = now_seconds();
+    fn(ctx, iterations);
+    samples[i] = (now_seconds() - start) / iterations;
+  }
+  qsort(samples, BENCH_REPEATS, sizeof(double), compare_doubles);
+  return samples[BENCH_REPEATS / 2];
+}
+
+// Runs fn with stdout on /dev/null, for benchmarks of printing code
+static double time_quietly(bench_fn fn, void *ctx) {
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+
+  double per_op = time_per_op(fn, ctx);
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+  return per_op;
+}
+
+/***********************************************
+ * PARSING
+ ***********************************************/
+
+static void parse_lines(void *ctx, long iterations) {
+  const char *line = (const char *)ctx;
+  char copy[INPUT_LEN * 4];
+  for (long i = 0; i < iterations; i++) {
+    strcpy(copy, line);
+    Command *cmd = parse_pipeline(copy);
+    free_commands(&cmd);
+  }
+}
+
+static void bench_parse() {
+  static const struct {
+    const char *name;
+    const char *line;
+  } lines[] = {
+      {"parse/simple", "ls -la /tmp"},
+      {"parse/pipeline", "cat input.txt | grep -v '^#' | sort -u | wc -l"},
+      {"parse/redirect", "sort -k2 < data.txt > sorted.txt"},
+      {"parse/expand", "echo \"$HOME\" ${USER} $((1 + 2)) 'quoted $x'"},
+  };
+
+  for (size_t i = 0; i < sizeof(lines) / sizeof(*lines); i++) {
+    if (selected(lines[i].name))
+      record(lines[i].name, "ns/op",
+             time_per_op(parse_lines, (void *)lines[i].line) * 1e9, false);
+  }
+}
+
+/***********************************************
+ * HISTORY
+ ***********************************************/
+
+static void write_history_file(long lines) {
+  FILE *file = fopen("history.txt", "w");
+  if (!file) {
+    perror("history.txt");
+    exit(EXIT_FAILURE);
+  }
+  for (long i = 0; i < lines; i++) {
+    fprintf(file, "%ld\tgit commit -m 'change number %ld'\n", i, i);
+  }
+  fclose(file);
+}
+
+static void load_history(void *ctx, long iterations) {
+  (void)ctx;
+  for (long i = 0; i < iterations; i++) {
+    init_history();
+    free_history();
+  }
+}
+
+static void add_history(void *ctx, long iterations) {
+  long *next = (long *)ctx;
+  char line[64];
+  for (long i = 0; i < iterations; i++) {
+    snprintf(line, sizeof(line), "make test # %ld", (*next)++);
+    history_add(line);
+  }
+}
+
+static void bench_history() {
+  static const long sizes[] = {100, 10000, 100000};
+  char name[64];
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+    snprintf(name, sizeof(name), "history/init/%ld", sizes[i]);
+    if (selected(name)) {
+      write_history_file(sizes[i]);
+      record(name, "us/op", time_per_op(load_history, NULL) * 1e6, false);
+    }
+
+    // Each add appends, so the file is rewritten before every size
+    snprintf(name, sizeof(name), "history/add/%ld", sizes[i]);
+    if (selected(name)) {
+      write_history_file(sizes[i]);
+      init_history();
+      long next = 0;
+      record(name, "us/op", time_per_op(add_history, &next) * 1e6, false);
+      free_history();
+    }
+  }
+  unlink("history.txt");
+}
+
+/***********************************************
+ * PROCESS LAUNCH
+ ***********************************************/
+
+static void launch(void *ctx, long iterations) {
+  const Command *cmd = (const Command *)ctx;
+  int unused[2] = {-1, -1};
+  for (long i = 0; i < iterations; i++) {
+    pid_t pid = execute_command(cmd, NULL, -1, unused);
+    waitpid(pid, NULL, 0);
+  }
+}
+
+static void bench_launch() {
+  static const struct {
+    const char *name;
+    const char *line;
+  } commands[] = {
+      {"launch/path_search", "sleep 0"},
+      {"launch/absolute", "/bin/sleep 0"},
+  };
+
+  for (size_t i = 0; i < sizeof(commands) / sizeof(*commands); i++) {
+    if (!selected(commands[i].name))
+      continue;
+    // Not `true`, which would run as a builtin in the child
+    char line[64];
+    snprintf(line, sizeof(line), "%s", commands[i].line);
+    Command *cmd = parse_pipeline(line);
+    record(commands[i].name, "us/op", time_per_op(launch, cmd) * 1e6, false);
+    free_commands(&cmd);
+  }
+}
+
+/***********************************************
+ * PIPELINES
+ ***********************************************/
+
+#define PIPE_BENCH_BYTES (64L << 20)
+
+static void run_pipeline(void *ctx, long iterations) {
+  const char *line = (const char *)ctx;
+  for (long i = 0; i < iterations; i++) {
+    char *copy = strdup(line);
+    run_line(copy);
+    free(copy);
+  }
+}
+
+static void bench_pipeline() {
+  static const int stages[] = {1, 2, 4, 8};
+  char name[64];
+
+  for (size_t i = 0; i < sizeof(stages) / sizeof(*stages); i++) {
+    snprintf(name, sizeof(name), "pipeline/%d_stages", stages[i]);
+    if (!selected(name))
+      continue;
+
+    char line[256];
+    int len = snprintf(line, sizeof(line), "head -c %ld /dev/zero",
+                       PIPE_BENCH_BYTES);
+    for (int s = 1; s < stages[i]; s++) {
+      len += snprintf(line + len, sizeof(line) - len, " | cat");
+    }
+    snprintf(line + len, sizeof(line) - len, " > /dev/null");
+    double seconds = time_per_op(run_pipeline, line);
+    record(name, "MB/s", PIPE_BENCH_BYTES / seconds / 1e6, true);
+
+    // The same stages pinned one per CPU, pipe neighbours side by side
+    snprintf(name, sizeof(name), "pipeline/%d_stages_colocated", stages[i]);
+    if (stages[i] < 2 || !selected(name))
+      continue;
+    char pinned[300];
+    snprintf(pinned, sizeof(pinned), "sched --colocate -- '%s'", line);
+    seconds = time_per_op(run_pipeline, pinned);
+    record(name, "MB/s", PIPE_BENCH_BYTES / seconds / 1e6, true);
+  }
+}
+
+/***********************************************
+ * TREE
+ ***********************************************/
+
+// fanout^depth leaf files under fanout^(depth-1) directories
+static void make_tree(const char *dir, int depth, int fanout) {
+  mkdir(dir, 0755);
+  char path[PATH_MAX];
+  for (int i = 0; i < fanout; i++) {
+    int len = snprintf(path, sizeof(path), "%s/%s_%02d", dir,
+                       depth > 1 ? "dir" : "file", i);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+      fprintf(stderr, "%s: path too long for the tree\n", dir);
+      exit(EXIT_FAILURE);
+    }
+    if (depth > 1) {
+      make_tree(path, depth - 1, fanout);
+    } else {
+      close(open(path, O_WRONLY | O_CREAT, 0644));
+    }
+  }
+}
+
+static void walk_tree(void *ctx, long iterations) {
+  const char *dir = (const char *)ctx;
+  for (long i = 0; i < iterations; i++) {
+    tree(dir, 0);
+  }
+}
+
+static void bench_tree() {
+  static const struct {
+    int depth;
+    int fanout;
+  } shapes[] = {{3, 10}, {4, 10}};
+  char name[64];
+  char dir[PATH_MAX + 32];
+
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(*shapes); i++) {
+    snprintf(name, sizeof(name), "tree/%dx%d", shapes[i].depth,
+             shapes[i].fanout);
+    if (!selected(name))
+      continue;
+    snprintf(dir, sizeof(dir), "%s/tree_%d_%d", work_dir, shapes[i].depth,
+             shapes[i].fanout);
+    make_tree(dir, shapes[i].depth, shapes[i].fanout);
+    record(name, "ms/op", time_quietly(walk_tree, dir) * 1e3, false);
+  }
+}
+
+/***********************************************
+ * STARTUP
+ ***********************************************/
+
+// What an interactive shell has to have before the first prompt or the
+// first `z` and typo: history, the names on PATH, the visited directories
+static void forget_state() {
+  free_history();
+  suggest_free();
+  dirs_free();
+}
+
+static void start_cold(void *ctx, long iterations) {
+  (void)ctx;
+  for (long i = 0; i < iterations; i++) {
+    forget_state();
+    init_history();
+    suggest_index();
+    dirs_index();
+  }
+}
+
+static void start_warm(void *ctx, long iterations) {
+  (void)ctx;
+  for (long i = 0; i < iterations; i++) {
+    forget_state();
+    if (!(snapshot_load() & SNAPSHOT_HISTORY))
+      init_history();
+    suggest_index();
+    dirs_index();
+  }
+}
+
+static void bench_startup() {
+  if (!selected("startup/"))
+    return;
+  char path[PATH_MAX + 32];
+  snprintf(path, sizeof(path), "%s/dirs", work_dir);
+  var_set("DIRS_INDEX", path, 0);
+  snprintf(path, sizeof(path), "%s/snapshot", work_dir);
+  var_set("SHELL_SNAPSHOT", path, 0);
+
+  // Two visits each to 5000 directories stays under the compaction point
+  write_history_file(10000);
+  FILE *journal = fopen(dirs_index_path(), "w");
+  if (!journal) {
+    perror(dirs_index_path());
+    exit(EXIT_FAILURE);
+  }
+  for (int visit = 0; visit < 2; visit++) {
+    for (int i = 0; i < 5000; i++) {
+      fprintf(journal, "1|%ld|/home/bench/src/project%04d/module\n",
+              1700000000L + i, i);
+    }
+  }
+  fclose(journal);
+
+  if (selected("startup/cold"))
+    record("startup/cold", "us/op", time_per_op(start_cold, NULL) * 1e6,
+           false);
+  start_cold(NULL, 1);
+  snapshot_save();
+  if (selected("startup/warm"))
+    record("startup/warm", "us/op", time_per_op(start_warm, NULL) * 1e6,
+           false);
+  forget_state();
+  unlink("history.txt");
+}
+
+/***********************************************
+ * FILTERS
+ ***********************************************/
+
+#define FILTER_BENCH_LINES 400000
+#define KERNEL_BENCH_BYTES (1L << 20)
+
+static long write_filter_input(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  static const char *words[] = {"alpha", "be", "gamma42", "", "needle"};
+  srand(11);
+  for (long i = 0; i < FILTER_BENCH_LINES; i++) {
+    int fields = rand() % 10;
+    for (int f = 0; f < fields; f++) {
+      fprintf(file, "%s%s", f > 0 ? ":" : "", words[rand() % 5]);
+    }
+    fputc('\n', file);
+  }
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+static char *slurp(const char *path, long *len) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return NULL;
+  fseek(file, 0, SEEK_END);
+  *len = ftell(file);
+  rewind(file);
+  char *data = (char *)malloc(*len + 1);
+  *len = (long)fread(data, 1, *len, file);
+  fclose(file);
+  return data;
+}
+
+// The builtin must print what the real command does before its speed
+// means anything
+static void check_filter(const char *cmd, const char *input) {
+  char line[256];
+  const char *outputs[] = {"filter_external.out", "filter_builtin.out"};
+  for (int builtin = 0; builtin < 2; builtin++) {
+    set_option("filters", builtin);
+    snprintf(line, sizeof(line), "%s < %s > %s", cmd, input,
+             outputs[builtin]);
+    run_line(line);
+  }
+  long len[2];
+  char *data[2];
+  for (int i = 0; i < 2; i++) {
+    data[i] = slurp(outputs[i], &len[i]);
+  }
+  if (!data[0] || !data[1] || len[0] != len[1] ||
+      memcmp(data[0], data[1], len[0]) != 0) {
+    fprintf(stderr, "%s: the builtin's output differs\n", cmd);
+    exit(EXIT_FAILURE);
+  }
+  free(data[0]);
+  free(data[1]);
+}
+
+static void count_lines(void *ctx, long iterations) {
+  const char *data = (const char *)ctx;
+  size_t total = 0;
+  for (long i = 0; i < iterations; i++) {
+    total += scan_count(data, KERNEL_BENCH_BYTES, '\n');
+  }
+  if (total == 1)
+    fprintf(stderr, "unreachable\n");
+}
+
+static void bench_filters() {
+  static const struct {
+    const char *name;
+    const char *cmd;
+  } commands[] = {
+      {"wc_l", "wc -l"},
+      {"grep_f", "grep -F gamma42:be"},
+      {"head", "head -n 200000"},
+      {"tail", "tail -n 100"},
+      {"cut_f", "cut -d: -f2,4"},
+  };
+  static const char *modes[] = {"external", "builtin"};
+  const char *input = "filter_input";
+  long bytes = 0;
+  char name[64];
+  char line[256];
+
+  for (size_t i = 0; i < sizeof(commands) / sizeof(*commands); i++) {
+    snprintf(name, sizeof(name), "filter/%s/", commands[i].name);
+    if (!selected(name))
+      continue;
+    if (bytes == 0)
+      bytes = write_filter_input(input);
+    check_filter(commands[i].cmd, input);
+
+    // At the end of a pipeline, and reading a file
+    for (int builtin = 0; builtin < 2; builtin++) {
+      set_option("filters", builtin);
+      snprintf(name, sizeof(name), "filter/%s/pipe_%s", commands[i].name,
+               modes[builtin]);
+      snprintf(line, sizeof(line), "cat %s | %s > filter.out", input,
+               commands[i].cmd);
+      record(name, "MB/s", bytes / time_per_op(run_pipeline, line) / 1e6,
+             true);
+      snprintf(name, sizeof(name), "filter/%s/file_%s", commands[i].name,
+               modes[builtin]);
+      snprintf(line, sizeof(line), "%s < %s > filter.out", commands[i].cmd,
+               input);
+      record(name, "MB/s", bytes / time_per_op(run_pipeline, line) / 1e6,
+             true);
+    }
+  }
+  set_option("filters", false);
+
+  // The newline count at each level this CPU has
+  char *data = (char *)malloc(KERNEL_BENCH_BYTES);
+  for (long i = 0; i < KERNEL_BENCH_BYTES; i++) {
+    data[i] = i % 37 == 0 ? '\n' : 'x';
+  }
+  for (int level = SCAN_SCALAR; level <= (int)scan_best(); level++) {
+    snprintf(name, sizeof(name), "filter/count_%s",
+             scan_level_name((ScanLevel)level));
+    if (!selected(name))
+      continue;
+    scan_select((ScanLevel)level);
+    record(name, "GB/s",
+           KERNEL_BENCH_BYTES / time_per_op(count_lines, data) / 1e9, true);
+  }
+  scan_select(scan_best());
+  free(data);
+}
+
+/***********************************************
+ * OUTPUT
+ ***********************************************/
+
+static void write_json(FILE *out) {
+  fprintf(out, "{\n  \"schema\": 1,\n  \"results\": [\n");
+  for (size_t i = 0; i < result_count; i++) {
+    fprintf(out,
+            "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.6g, "
+            "\"higher_is_better\": %s}%s\n",
+            results[i].name, results[i].unit, results[i].value,
+            results[i].higher_is_better ? "true" : "false",
+            i + 1 < result_count ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  const char *output = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:f:q")) != -1) {
+    switch (opt) {
+    case 'o':
+      output = optarg;
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    case 'q':
+      min_seconds = 0.01;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-o results.json] [-f filter] [-q]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  // Fixed environment and a scratch directory, so runs are comparable
+  char *env[] = {"PATH=/usr/local/bin:/usr/bin:/bin", "HOME=/tmp",
+                 "USER=bench", NULL};
+  vars_init(env);
+  snprintf(work_dir, sizeof(work_dir), "/tmp/bench_suite_%d", (int)getpid());
+  mkdir(work_dir, 0755);
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)) || chdir(work_dir) == -1) {
+    perror(work_dir);
+    return 1;
+  }
+
+  bench_parse();
+  bench_history();
+  bench_launch();
+  bench_pipeline();
+  bench_tree();
+  bench_startup();
+  bench_filters();
+
+  if (chdir(cwd) == -1)
+    perror(cwd);
+  char *rm[] = {"rm", "-rf", work_dir, NULL};
+  pid_t pid = fork();
+  if (pid == 0) {
+    execvp("rm", rm);
+    _exit(127);
+  }
+  waitpid(pid, NULL, 0);
+
+  FILE *out = output ? fopen(output, "w") : stdout;
+  if (!out) {
+    perror(output);
+    return 1;
+  }
+  write_json(out);
+  if (out != stdout)
+    fclose(out);
+  vars_free();
+  return 0;
+}
@@ -0,0 +1,64 @@
+#!/usr/bin/env python3
+"""Compare bench_suite results against a baseline.
+
+Usage: compare.py baseline.json results.json [--threshold 0.10]
+
+Prints every benchmark with its change from the baseline and exits with
+status 1 when any of them got worse by more than the threshold (a
+fraction, 10% by default). Benchmarks missing from either file are
+reported but never fail the comparison.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    if data.get("schema") != 1:
+        sys.exit(f"{path}: unsupported schema {data.get('schema')}")
+    return {r["name"]: r for r in data["results"]}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("results")
+    parser.add_argument("--threshold", type=float, default=0.10)
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    results = load(args.results)
+    regressions = 0
+
+    print(f"{'benchmark':32} {'baseline':>12} {'current':>12} {'change':>8}")
+    for name in sorted(baseline.keys() | results.keys()):
+        if name not in results or name not in baseline:
+            where = "results" if name not in results else "baseline"
+            print(f"{name:32} {'missing from ' + where:>34}")
+            continue
+
+        old = baseline[name]["value"]
+        new = results[name]["value"]
+        unit = results[name]["unit"]
+        change = (new - old) / old if old else 0.0
+        # Positive `worse` means slower, whichever direction is better
+        worse = -change if results[name]["higher_is_better"] else change
+        flag = ""
+        if worse > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif worse < -args.threshold:
+            flag = "  improved"
+        print(f"{name:32} {old:12.3f} {new:12.3f} {change:+8.1%} {unit}{flag}")
+
+    if regressions:
+        print(f"{regressions} regression(s) beyond {args.threshold:.0%}")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,32 @@
+#pragma once
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct Alias {
+  char *name;
+  char *value;
+} Alias;
+
+// Kept sorted by name for lookup by binary search and ordered listing
+typedef struct AliasTable {
+  Alias *items;
+  size_t count;
+  size_t cap;
+  unsigned long epoch; // bumped on every change
+} AliasTable;
+
+/***********************************************
+ * ALIASES
+ ***********************************************/
+const char *alias_get(const char *name, size_t len);
+void alias_set(const char *name, const char *value);
+bool alias_remove(const char *name);
+void aliases_free();
+unsigned long aliases_epoch();
+const AliasTable *aliases_table();
+void alias_builtin(const Command *cmd);
+void unalias_builtin(const Command *cmd);
@@ -0,0 +1,7 @@
+#pragma once
+#include <stdbool.h>
+
+/***********************************************
+ * ARITHMETIC EXPANSION
+ ***********************************************/
+bool arith_eval(const char *expr, long *result);
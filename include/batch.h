@@ -0,0 +1,46 @@
+#pragma once
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+// Bytes left free below the kernel limit, as POSIX xargs does
+#define BATCH_HEADROOM 2048
+// Linux rejects any single argument longer than 32 pages
+#define BATCH_MAX_ARG_STRLEN (32 * 4096)
+#define BATCH_READ_SIZE 65536
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct BatchOptions {
+  size_t jobs;       // chunks allowed to run at once
+  size_t size_limit; // argument bytes per chunk, 0 for the kernel limit
+  size_t max_args;   // variable arguments per chunk, 0 for no limit
+  long prefix;       // fixed arguments after the name, -1 to detect options
+  bool trailing;     // repeat the last argument in every chunk
+} BatchOptions;
+
+typedef struct BatchChunk {
+  size_t start;
+  size_t count;
+} BatchChunk;
+
+/***********************************************
+ * ARGUMENT ACCOUNTING
+ ***********************************************/
+size_t batch_arg_cost(const char *arg);
+size_t batch_arg_limit(char *const *envp);
+size_t batch_plan(char *const *args, size_t count, size_t fixed_cost,
+                  size_t limit, size_t max_args, BatchChunk **chunks);
+
+/***********************************************
+ * BATCHED EXECUTION
+ ***********************************************/
+int batch_run(const Command *cmd, char **argv, size_t argc,
+              const BatchOptions *opts);
+bool batch_is_marked(const char *name);
+bool batch_should_split(const Command *cmd);
+void batch_builtin(const Command *cmd);
@@ -0,0 +1,21 @@
+#pragma once
+#include <stddef.h>
+
+/***********************************************
+ * GROWABLE BYTE BUFFER
+ ***********************************************/
+typedef struct Buffer {
+  char *data;
+  size_t len;
+  size_t cap;
+} Buffer;
+
+void buffer_init(Buffer *buf);
+void buffer_reserve(Buffer *buf, size_t extra);
+void buffer_append(Buffer *buf, const char *data, size_t len);
+void buffer_append_str(Buffer *buf, const char *str);
+void buffer_push(Buffer *buf, char c);
+void buffer_clear(Buffer *buf);
+char *buffer_detach(Buffer *buf);
+void buffer_free(Buffer *buf);
+size_t buffer_read_fd(Buffer *buf, int fd, size_t chunk);
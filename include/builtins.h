@@ -0,0 +1,51 @@
+#pragma once
+#include "shell.h"
+#include "shell_builtin.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+// Output can be captured by redirecting stdout in the shell itself
+#define BUILTIN_INLINE 0x1
+// Stands in for an external command, only while `set -o filters` is on
+#define BUILTIN_FILTER 0x2
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef void (*BuiltinFn)(const Command *cmd);
+
+// Core builtins have `run`; loaded ones have `plugin` and its library
+typedef struct Builtin {
+  char *name;
+  BuiltinFn run;
+  const ShellBuiltin *plugin;
+  void *handle;
+  unsigned flags;
+} Builtin;
+
+// Kept sorted by name for lookup by binary search
+typedef struct BuiltinTable {
+  Builtin *items;
+  size_t count;
+  size_t cap;
+} BuiltinTable;
+
+/***********************************************
+ * REGISTRY
+ ***********************************************/
+void builtins_init();
+void builtins_free();
+void builtin_register(const char *name, BuiltinFn run, unsigned flags);
+const Builtin *builtin_find(const char *name);
+const BuiltinTable *builtins_table();
+void builtin_run(const Builtin *builtin, const Command *cmd);
+
+/***********************************************
+ * PLUGINS
+ ***********************************************/
+bool builtin_load(const char *path, const char *name);
+bool builtin_unload(const char *name);
+void enable_builtin(const Command *cmd);
@@ -0,0 +1,54 @@
+#pragma once
+#include "shell.h"
+#include "vm.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define PROGRAM_CACHE_SIZE 64
+#define PROGRAM_CACHE_BUCKETS 128 // power of two
+#define PROGRAM_CACHE_MAX_TEXT 4096
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// A compiled line, shared read-only by every run of the same text. Entries
+// link into a hash bucket and into the recency list by index; -1 ends both.
+typedef struct CacheEntry {
+  char *text;
+  unsigned hash;
+  unsigned long alias_epoch; // aliases are spliced in at compile time
+  Program *prog;
+  int bucket_next;
+  int newer;
+  int older;
+} CacheEntry;
+
+typedef struct CacheStats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long invalidations;
+  unsigned long path_lookups; // executables searched for in PATH
+  unsigned long path_reuses;  // runs that skipped the search
+} CacheStats;
+
+typedef struct ProgramCache {
+  CacheEntry entries[PROGRAM_CACHE_SIZE];
+  int buckets[PROGRAM_CACHE_BUCKETS];
+  size_t count;
+  int newest;
+  int oldest;
+  CacheStats stats;
+} ProgramCache;
+
+/***********************************************
+ * PROGRAM CACHE
+ ***********************************************/
+CompileResult cache_compile(const char *src, Program **out);
+void cache_clear();
+void cache_count_path(bool reused);
+const CacheStats *cache_stats();
+void hash_builtin(const Command *cmd);
@@ -0,0 +1,65 @@
+#pragma once
+#include "buffer.h"
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define CAPTURE_DEFAULT_BYTES (1 << 20) // ring size unless $CAPTURE_BYTES
+#define CAPTURE_MIN_BYTES 4096
+#define CAPTURE_MAX_BYTES (1L << 30)
+#define CAPTURE_MAX_ENTRIES 64
+#define CAPTURE_CHUNK 65536
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// Offsets count every byte ever captured; byte x lives at x % size in the
+// ring, so an entry older than `size` bytes has been partly overwritten
+typedef struct CaptureEntry {
+  unsigned long id;
+  char *command;
+  unsigned long long start;
+  unsigned long long len;
+  int status;
+} CaptureEntry;
+
+typedef struct CaptureRing {
+  int memfd;
+  size_t size;
+  unsigned long long written;
+  CaptureEntry entries[CAPTURE_MAX_ENTRIES]; // oldest replaced first
+  size_t entry_count;
+  unsigned long next_id;
+  bool use_splice;
+  int stash[2]; // tee() target on its way into the ring
+} CaptureRing;
+
+// The final stage of the pipeline being run, while it is captured
+typedef struct CaptureSession {
+  bool active;
+  int out[2];
+  int err[2];
+  CaptureEntry *entry;
+} CaptureSession;
+
+/***********************************************
+ * CAPTURE
+ ***********************************************/
+void capture_claim();
+bool capture_begin(const Command *head);
+void capture_child();
+void capture_pump();
+void capture_end(int status);
+void capture_free();
+const CaptureEntry *capture_entry(size_t n);
+size_t capture_read(const CaptureEntry *entry, Buffer *out);
+
+/***********************************************
+ * BUILTINS
+ ***********************************************/
+void out_builtin(const Command *cmd);
+void last_builtin(const Command *cmd);
@@ -0,0 +1,101 @@
+#pragma once
+#include "shell.h"
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define COPY_DEPTH 32      // files in flight at once by default
+#define COPY_MAX_DEPTH 256
+#define COPY_CHUNK 131072  // bytes per read and write
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// A file, directory or link to copy, with what to give the copy
+typedef struct CopyJob {
+  char *src;
+  char *dst;
+  mode_t mode;
+  off_t size;
+  struct timespec times[2]; // access and modification, for utimensat
+} CopyJob;
+
+typedef struct CopyList {
+  CopyJob *items;
+  size_t count;
+  size_t cap;
+} CopyList;
+
+// Everything one ucp or umv does. Directories are made while walking and
+// given their times last, deepest first; files are copied in between.
+typedef struct CopyPlan {
+  CopyList dirs;
+  CopyList files;
+  CopyList links;
+  size_t depth;
+  bool sync;        // copy_file_range one file at a time, never io_uring
+  bool failed;
+  bool uring;       // whether io_uring copied the files
+  uint64_t bytes;   // copied so far
+  size_t done;      // files and links copied
+  const char *name; // of the builtin, for messages
+} CopyPlan;
+
+typedef enum CopyStep {
+  COPY_OPEN_SRC,
+  COPY_OPEN_DST,
+  COPY_READ,
+  COPY_WRITE,
+  COPY_CLOSE,
+} CopyStep;
+
+// One file on its way through the ring: each completion moves it a step
+typedef struct CopySlot {
+  const CopyJob *job;
+  CopyStep step;
+  int src;
+  int dst;
+  off_t offset;
+  size_t filled;  // by the last read
+  size_t written; // of those
+  int closing;    // closes still in flight
+  char *buf;
+} CopySlot;
+
+// io_uring's shared queues, mapped after io_uring_setup()
+typedef struct CopyRing {
+  int fd;
+  unsigned entries;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  void *sq_map;
+  size_t sq_map_size;
+  void *cq_map;
+  size_t cq_map_size;
+  size_t sqes_size;
+  unsigned queued; // since the last io_uring_enter()
+} CopyRing;
+
+/***********************************************
+ * COPYING
+ ***********************************************/
+bool copy_plan_add(CopyPlan *plan, const char *src, const char *dst);
+bool copy_ring_init(CopyRing *ring, unsigned entries);
+void copy_ring_free(CopyRing *ring);
+void copy_run(CopyPlan *plan);
+void copy_plan_free(CopyPlan *plan);
+void ucp_builtin(const Command *cmd);
+void umv_builtin(const Command *cmd);
@@ -0,0 +1,68 @@
+#pragma once
+#include "buffer.h"
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define DIRS_INDEX_NAME "shell-dirs" // under $XDG_DATA_HOME, or $DIRS_INDEX
+#define DIRS_MAX_RANK 100000.0 // total rank before every entry is aged
+#define DIRS_AGED_RANK 90000.0  // total rank after aging
+#define DIRS_COMPACT_SLACK 1024 // journal lines allowed beyond 2 per entry
+#define DIRS_LIST_LIMIT 20
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// A visited directory. Paths live in the index arena, with a lowercase copy
+// at the same offset in `folded` for case-insensitive matching.
+typedef struct DirEntry {
+  uint32_t path; // offset into the arena
+  uint32_t len;
+  uint32_t hash;
+  double rank; // visits, decayed by aging
+  time_t time; // last visit
+} DirEntry;
+
+// The frecency index: an append-only journal of visits, folded into a hash
+// table the first time `z` needs it and then only read from where it was
+// left. Compacted when the journal grows well past the number of entries.
+typedef struct DirIndex {
+  bool loaded;
+  Buffer arena;  // every path, each NUL-terminated
+  Buffer folded; // the same in lowercase
+  DirEntry *entries;
+  size_t count;
+  size_t cap;
+  uint32_t *slots; // entry index + 1, 0 for empty
+  size_t slot_cap; // always a power of two
+  off_t read_to;   // journal bytes already folded in
+  size_t lines;    // journal records folded in
+  ino_t inode;     // of the journal, to notice it being replaced
+} DirIndex;
+
+/***********************************************
+ * DIRECTORY STACK AND CD
+ ***********************************************/
+bool dirs_chdir(const char *path, bool announce);
+void change_dir(const Command *cmd);
+void pushd_builtin(const Command *cmd);
+void popd_builtin(const Command *cmd);
+void dirs_builtin(const Command *cmd);
+void dirs_free();
+
+/***********************************************
+ * FRECENCY
+ ***********************************************/
+const char *dirs_index_path();
+void dirs_visit(const char *path);
+const DirIndex *dirs_index();
+void dirs_adopt(const DirIndex *index);
+double dirs_frecency(const DirEntry *entry, time_t now);
+const char *dirs_best(char *const *terms, size_t count);
+void z_builtin(const Command *cmd);
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct WordList {
+  char **words;
+  size_t count;
+  size_t cap;
+} WordList;
+
+/***********************************************
+ * WORD LISTS
+ ***********************************************/
+void wordlist_init(WordList *list);
+void wordlist_push(WordList *list, char *word);
+void wordlist_free(WordList *list);
+
+/***********************************************
+ * WORD EXPANSION
+ ***********************************************/
+void expand_word(const char *raw, WordList *out);
+char *expand_word_single(const char *raw);
+char *expand_heredoc(const char *body);
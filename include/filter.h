@@ -0,0 +1,63 @@
+#pragma once
+#include "buffer.h"
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define FILTER_BLOCK 131072 // bytes per read of a pipe or terminal
+#define FILTER_KEEP 1048576 // input tail holds before dropping early lines
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// One input of a filter builtin: a regular file is mapped whole, anything
+// else is read a block at a time
+typedef struct FilterInput {
+  int fd;
+  const char *name; // for messages
+  bool regular;
+  off_t size;       // of a regular file, when opened
+  char *map;
+  size_t map_len;
+  off_t start;      // where the file offset was; the data begins there
+  Buffer buf;       // what was read, and any partial line after the last
+  size_t taken;     // bytes of buf handed out by the last read
+  bool eof;
+  int error;        // errno of a failed read
+} FilterInput;
+
+// A range of 1-based fields or bytes for cut; hi is SIZE_MAX for N-
+typedef struct CutRange {
+  size_t lo;
+  size_t hi;
+} CutRange;
+
+// Sorted and merged, so each position is checked against one range
+typedef struct CutList {
+  CutRange *items;
+  size_t count;
+  size_t cap;
+} CutList;
+
+/***********************************************
+ * INPUT
+ ***********************************************/
+bool filter_open(FilterInput *in, int fd, const char *name);
+bool filter_read(FilterInput *in, const char **data, size_t *len);
+bool filter_lines(FilterInput *in, const char **data, size_t *len);
+void filter_close(FilterInput *in, size_t unread);
+void filter_external(const Command *cmd, const char *held, size_t len);
+
+/***********************************************
+ * BUILTINS
+ ***********************************************/
+bool cut_parse_list(const char *text, CutList *list);
+void cut_builtin(const Command *cmd);
+void grep_builtin(const Command *cmd);
+void head_builtin(const Command *cmd);
+void tail_builtin(const Command *cmd);
+void wc_builtin(const Command *cmd);
@@ -0,0 +1,72 @@
+#pragma once
+#include "expand.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define GLOB_DIR_BUCKETS 64
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef enum GlobOpType {
+  GLOB_LITERAL,
+  GLOB_ANY,
+  GLOB_STAR,
+  GLOB_CLASS,
+} GlobOpType;
+
+typedef struct GlobOp {
+  GlobOpType type;
+  unsigned char ch;
+  uint8_t class_bits[32]; // 256-bit membership set for GLOB_CLASS
+} GlobOp;
+
+// One '/'-separated component of a pattern, compiled once per expansion
+typedef struct GlobSegment {
+  GlobOp *ops;
+  size_t op_count;
+  size_t min_len;   // number of non-star ops, for quick rejection
+  char *literal;    // unescaped text when the segment has no wildcards
+  bool is_globstar; // the segment is exactly "**"
+  bool match_dot;   // the segment starts with a literal '.'
+} GlobSegment;
+
+typedef struct GlobPattern {
+  GlobSegment *segments;
+  size_t count;
+  bool absolute;
+  bool dirs_only; // pattern ended with '/'
+} GlobPattern;
+
+typedef struct GlobEntry {
+  size_t name; // offset into DirListing.names
+  unsigned char type;
+} GlobEntry;
+
+// Snapshot of one directory in readdir order, shared by every glob on a line
+typedef struct DirListing {
+  char *path;
+  char *names; // packed, NUL-terminated entry names
+  GlobEntry *entries;
+  size_t count;
+  struct DirListing *next;
+} DirListing;
+
+/***********************************************
+ * PATTERN COMPILATION AND MATCHING
+ ***********************************************/
+bool glob_has_magic(const char *pattern);
+bool glob_compile(const char *pattern, GlobPattern *out);
+void glob_pattern_free(GlobPattern *pattern);
+bool glob_match_segment(const GlobSegment *segment, const char *name);
+
+/***********************************************
+ * PATHNAME EXPANSION
+ ***********************************************/
+size_t glob_expand(const char *pattern, WordList *out);
+const DirListing *glob_list_dir(const char *path);
+void glob_cache_reset();
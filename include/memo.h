@@ -0,0 +1,45 @@
+#pragma once
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define MEMO_DEFAULT_MAX_BYTES (256L << 20) // unless $MEMO_MAX_BYTES
+#define MEMO_DEFAULT_MAX_AGE (7L * 24 * 60 * 60) // seconds, or $MEMO_MAX_AGE
+#define MEMO_COPY_SIZE 65536
+#define MEMO_HASH_INIT 14695981039346656037ULL
+#define MEMO_MAGIC "memo 1\n"
+#define MEMO_EVICT_EVERY 64 // new results between eviction passes
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// Files a memoized command reads, named with --dep or by `<`. Each adds its
+// size and modification time to the key.
+typedef struct MemoDeps {
+  char **paths;
+  size_t count;
+  size_t cap;
+} MemoDeps;
+
+// One stored result, as seen by the eviction pass
+typedef struct MemoRecord {
+  char *name; // file under keys/
+  char object[40];
+  struct timespec used; // the record is touched on every hit
+  off_t size;
+} MemoRecord;
+
+/***********************************************
+ * MEMOIZATION
+ ***********************************************/
+void memo_note_input(const char *path);
+void memo_forget_inputs();
+uint64_t memo_hash(uint64_t hash, const void *data, size_t len);
+const char *memo_dir();
+size_t memo_evict(long max_bytes, long max_age);
+void memo_builtin(const Command *cmd);
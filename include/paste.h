@@ -0,0 +1,32 @@
+#pragma once
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define PASTE_ON "\033[?2004h"  // asks the terminal to bracket pastes
+#define PASTE_OFF "\033[?2004l"
+#define PASTE_START "\033[200~" // what the terminal sends around a paste
+#define PASTE_END "\033[201~"
+#define PASTE_READ_SIZE 65536
+#define PASTE_SHOWN 5 // lines of a multi-line paste shown before asking
+
+/***********************************************
+ * KEY INPUT
+ ***********************************************/
+ssize_t key_read(int fd, char *c);
+bool key_match(int fd, const char *text);
+void key_discard();
+
+/***********************************************
+ * BRACKETED PASTE
+ ***********************************************/
+bool paste_read(int fd, Buffer *out);
+size_t paste_insert(const char *text, char *line, size_t size, size_t len);
+bool paste_confirm(const Buffer *text, int fd);
+const Buffer *paste_batch();
+void paste_hold(Buffer *text);
+void paste_run(Buffer *pending);
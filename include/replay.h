@@ -0,0 +1,75 @@
+#pragma once
+#include "buffer.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define REPLAY_QUIET_MS 5      // output idle this long ends a key's answer
+#define REPLAY_ECHO_MS 500     // a key with no output by then is silent
+#define REPLAY_LIMIT_MS 10000  // the longest a key's answer may take
+#define REPLAY_EXIT_MS 1000    // after the last key, before the kill
+#define REPLAY_ROWS 24         // terminal size when recording has none
+#define REPLAY_COLS 80
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// One keystroke of a session: the bytes of one read from the terminal, so
+// an arrow key's escape sequence or a whole paste is one key
+typedef struct ReplayKey {
+  char *bytes;
+  size_t len;
+  uint64_t at_us;       // when it was typed, from the start of the session
+  size_t recorded_len;  // bytes written in answer when it was recorded
+  uint64_t latency_ns;  // sent to the first byte of the answer; 0 if none
+  size_t out_at;        // the answer, within the report's output
+  size_t out_len;
+} ReplayKey;
+
+typedef struct ReplaySession {
+  ReplayKey *keys;
+  size_t count;
+  size_t cap;
+} ReplaySession;
+
+// Zero fields take the REPLAY_ defaults
+typedef struct ReplayOptions {
+  const char *dir; // run there, with HOME pointing at it
+  int quiet_ms;
+  int echo_ms;
+} ReplayOptions;
+
+typedef struct ReplayReport {
+  LatencyHistogram latency; // keys that were answered
+  uint64_t keys;
+  uint64_t silent;          // keys with no output at all
+  uint64_t bytes;
+  uint64_t max_bytes;       // the largest answer to one key
+  uint64_t recorded_bytes;
+  int status;               // of the program, as $? would report it
+  Buffer output;            // everything it wrote, answers in order
+} ReplayReport;
+
+/***********************************************
+ * SESSION LOGS
+ ***********************************************/
+void replay_escape(Buffer *out, const char *bytes, size_t len);
+bool replay_unescape(const char *text, Buffer *out);
+bool replay_load(FILE *in, ReplaySession *session);
+void replay_add_key(ReplaySession *session, const char *bytes, size_t len,
+                    uint64_t at_us);
+void replay_free(ReplaySession *session);
+
+/***********************************************
+ * RECORDING AND REPLAY
+ ***********************************************/
+int replay_record(int in_fd, int out_fd, FILE *log, char *const argv[]);
+bool replay_run(ReplaySession *session, char *const argv[],
+                const ReplayOptions *options, ReplayReport *report);
+void replay_report_free(ReplayReport *report);
+void replay_print(const ReplayReport *report, FILE *out);
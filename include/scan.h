@@ -0,0 +1,29 @@
+#pragma once
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+// The widest vector instructions the kernels use, picked at runtime
+typedef enum ScanLevel {
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2,
+} ScanLevel;
+
+/***********************************************
+ * DISPATCH
+ ***********************************************/
+ScanLevel scan_best();
+ScanLevel scan_level();
+ScanLevel scan_select(ScanLevel level);
+const char *scan_level_name(ScanLevel level);
+
+/***********************************************
+ * KERNELS
+ ***********************************************/
+size_t scan_count(const char *p, size_t len, char c);
+const char *scan_find2(const char *p, size_t len, char a, char b);
+const char *scan_high(const char *p, size_t len);
+const char *scan_find(const char *p, size_t len, const char *needle,
+                      size_t needle_len);
@@ -0,0 +1,47 @@
+#pragma once
+#include "shell.h"
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/resource.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SCHED_MAX_LIMITS 16
+#define SCHED_TOPOLOGY_DIR "/sys/devices/system/cpu"
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct SchedLimit {
+  int resource;
+  rlim_t value;
+} SchedLimit;
+
+// What `sched` applies to every stage it launches. Set in the shell, read
+// by forked children between setup_pipes() and exec.
+typedef struct SchedPolicy {
+  bool active;
+  bool pin;      // restrict stages to `cpus`
+  bool colocate; // one CPU per stage, neighbours on sibling cores
+  cpu_set_t cpus;
+  int order[CPU_SETSIZE]; // allowed CPUs in topology order, for colocate
+  size_t order_count;
+  bool renice;
+  int nice;
+  int policy; // SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, or -1 to keep
+  SchedLimit limits[SCHED_MAX_LIMITS];
+  size_t limit_count;
+} SchedPolicy;
+
+/***********************************************
+ * SCHEDULING
+ ***********************************************/
+bool sched_parse_cpus(const char *list, cpu_set_t *set);
+bool sched_parse_size(const char *text, rlim_t *value);
+size_t sched_topology_order(const cpu_set_t *allowed, int *order);
+const SchedPolicy *sched_policy();
+void sched_stage(size_t index);
+void sched_child();
+void sched_builtin(const Command *cmd);
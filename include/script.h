@@ -0,0 +1,37 @@
+#pragma once
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SCRIPT_READ_SIZE 65536
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// Hands out one line at a time from a mapped file, a string or a stream
+typedef struct ScriptReader {
+  int fd;          // stream being read, -1 for mapped input
+  const char *map; // whole input when mapped or given as a string
+  size_t map_len;
+  bool unmap;      // map came from mmap and must be released
+  Buffer pending;  // streamed bytes not yet handed out
+  size_t pos;      // next unread byte in map or pending
+  bool eof;
+  Buffer line;     // writable copy of the current line
+} ScriptReader;
+
+/***********************************************
+ * SCRIPT MODE
+ ***********************************************/
+void script_mark_start();
+void script_order_stderr();
+void script_open_fd(ScriptReader *reader, int fd);
+void script_open_string(ScriptReader *reader, const char *text);
+char *script_next_line(ScriptReader *reader);
+void script_close(ScriptReader *reader);
+int script_run(ScriptReader *reader);
+int script_run_fd(int fd);
+int script_run_string(const char *text);
@@ -0,0 +1,58 @@
+#pragma once
+#include "buffer.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SERVER_MAGIC 0x31534853u // "SHS1"
+#define SERVER_MAX_REQUEST (1 << 20)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_BACKLOG 128
+#define SERVER_READ_SIZE 65536
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// A request is this header, then the working directory, the environment
+// overlay as NUL-terminated NAME=VALUE entries, and the command line. The
+// client's stdin, stdout and stderr travel with it as SCM_RIGHTS.
+typedef struct ServerRequestHeader {
+  uint32_t magic;
+  uint32_t cwd_len; // 0 keeps the server's directory
+  uint32_t env_len;
+  uint32_t command_len;
+} ServerRequestHeader;
+
+// Sent back once the command has finished
+typedef struct ServerReply {
+  int32_t status; // as $? would report it
+  int32_t reserved;
+  int64_t user_usec;
+  int64_t system_usec;
+  int64_t max_rss_kb;
+} ServerReply;
+
+// One client, from connection until its reply is sent
+typedef struct ServerConn {
+  int fd;
+  int stdio[3]; // -1 until received
+  Buffer request;
+  pid_t pid; // worker running the request, or 0
+  int pidfd;
+} ServerConn;
+
+/***********************************************
+ * SERVER
+ ***********************************************/
+int server_run(const char *path);
+
+/***********************************************
+ * CLIENT
+ ***********************************************/
+int server_connect(const char *path);
+bool server_request(int sock, const char *cwd, char *const *env,
+                    const char *command, const int stdio[3],
+                    ServerReply *reply);
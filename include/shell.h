@@ -1,36 +1,85 @@
 #pragma once
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/types.h>
 #include <termios.h>
 
 /***********************************************
  * CONSTANTS AND DEFINITIONS
  ***********************************************/
-#define MAX_ARGS 20
+#define MAX_ARGS 20 // initial argv capacity; argv grows as needed
 #define INPUT_LEN 256
 #define HISTORY_LEN 100
 #define PIPE_BUF 4096
+#define REDIRECT_MIN_FD 10 // fds opened for redirections sit above 0-9
 
 /***********************************************
  * DATA STRUCTURES
  ***********************************************/
+// One <(...) or >(...): the parent's pipe end and the child feeding it
+typedef struct ProcSub {
+  int fd;
+  pid_t pid;
+} ProcSub;
+
+typedef enum RedirectKind {
+  REDIRECT_IN,      // n<file
+  REDIRECT_OUT,     // n>file, n>|file
+  REDIRECT_APPEND,  // n>>file
+  REDIRECT_DUP,     // n>&m, n<&m; a target of - closes n
+  REDIRECT_BOTH,    // &>file, stdout and stderr together
+  REDIRECT_STRING,  // n<<<word
+  REDIRECT_HEREDOC, // n<<delimiter, n<<-delimiter
+} RedirectKind;
+
+// Before expansion `target` is the word as written, or a here-document's
+// body. Files are opened by the shell before it forks, into `opened`.
+typedef struct Redirect {
+  RedirectKind kind;
+  int fd;
+  char *target;
+  bool literal; // a here-document with a quoted delimiter is not expanded
+  int opened;
+} Redirect;
+
 typedef struct Command {
   int argc;
   char *name;
-  char *argv[MAX_ARGS];
-  bool is_out_redirect;
-  bool is_in_redirect;
-  char *in_file_name;
-  char *out_file_name;
+  char **argv;
+  size_t argv_cap;
+  int assign_count;
+  char **assigns;
+  Redirect *redirects; // applied in order
+  size_t redirect_count;
+  ProcSub *procsubs;
+  size_t procsub_count;
+  const char *exec_path; // resolved executable, borrowed from a template
+  int subst_status;      // of the last $(...) in its words, or -1
   struct Command *next;
 } Command;
 
+typedef struct ShellOptions {
+  bool capture_output;
+  bool filters;
+  bool parallel_subst;
+  bool report_latency;
+} ShellOptions;
+
+// Called by tree_walk() for each directory entry; returns whether to go
+// into it
+typedef bool (*TreeVisit)(const char *dir, const char *name,
+                          unsigned char type, size_t level, void *ctx);
+
 typedef struct History {
   char *history[HISTORY_LEN];
   int count;
   int current_index;
 } History;
 
+extern int last_status;
+extern ShellOptions shell_options;
+extern History cmd_history;
+
 /***********************************************
  * TERMINAL MODE MANAGEMENT
  ***********************************************/
@@ -44,6 +93,7 @@ size_t handle_arrow_key(char *buffer, size_t buffer_size,
  * INPUT HANDLING AND PROMPT
  ***********************************************/
 void prompt(char cmd[], size_t size);
+void prompt_continue(char cmd[], size_t size);
 void read_line(char *buffer, size_t size);
 
 /***********************************************
@@ -51,6 +101,7 @@ void read_line(char *buffer, size_t size);
  ***********************************************/
 void init_history();
 void history_add(const char *cmd);
+void history_add_lines(const char *text);
 void history_display();
 char *read_last_line_from_fd(int fd);
 void free_history();
@@ -61,29 +112,50 @@ void free_history();
 Command *create_command();
 Command *parse_pipeline(char *src);
 Command *parse_redirect(char *src);
+size_t take_redirects(char *src, Redirect **redirects);
+void set_redirects(Command *cmd, const Redirect *raw, size_t count);
+void free_redirects(Redirect *redirects, size_t count);
+const Redirect *redirect_of(const Command *cmd, int fd);
 Command *parse_command(char *src);
+Command *expand_command(char *const *raw, size_t count, size_t assign_count);
 void free_commands(Command **head);
 
 /***********************************************
  * COMMAND EXECUTION
  ***********************************************/
+int run_line(char *line);
 void run_commands(const Command *head);
+bool is_builtin(const char *name);
 bool handle_builtins(const Command *cmd);
-pid_t execute_command(const Command *cmd, int prev_pipe, int pipefd[2]);
+pid_t execute_command(const Command *cmd, const char *path, int prev_pipe,
+                      int pipefd[2]);
+bool open_redirects(const Command *cmd);
+void close_redirects(const Command *cmd);
 void setup_redirections(const Command *cmd);
 void setup_pipes(int prev_pipe, int pipefd[2], bool has_next);
 bool execute(const Command *cmd);
-void try_paths(const char *paths, const Command *cmd);
+void try_paths(char *const *dirs, const Command *cmd);
+char *const *path_dirs();
+char *resolve_command(const char *name);
+void apply_assignments(const Command *cmd, unsigned flags);
 
 /***********************************************
  * BUILT-IN COMMANDS
  ***********************************************/
-void change_dir(const Command *cmd);
+void tree_walk(const char *path, size_t level, TreeVisit visit, void *ctx);
 void tree(const char *cwd, size_t level);
+void export_vars(const Command *cmd);
+void unset_vars(const Command *cmd);
+void echo_args(const Command *cmd);
+void set_options(const Command *cmd);
+bool set_option(const char *name, bool enable);
+void test_builtin(const Command *cmd);
 
 /***********************************************
  * STRING UTILITIES
  ***********************************************/
 char *strtok_q(char *str, const char *delim, char **saveptr);
+char *scan_word(char **cursor);
+size_t substitution_length(const char *p);
 char *trim(char *str);
 void print_command(const Command *cmd);
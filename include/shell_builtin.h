@@ -0,0 +1,33 @@
+#pragma once
+// Stable interface for builtins loaded with `enable -f`. A plugin exports
+// one ShellBuiltin named `<name>_builtin` and needs nothing else from the
+// shell: it receives its arguments and the descriptors to use for stdio.
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SHELL_BUILTIN_ABI_VERSION 1
+
+// The builtin never reads its input, so $(...) can run it without a fork
+#define SHELL_BUILTIN_NO_STDIN 0x1
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct ShellBuiltinIO {
+  int in;
+  int out;
+  int err;
+} ShellBuiltinIO;
+
+// Returns the exit status; argv[argc] is NULL
+typedef int (*ShellBuiltinFn)(int argc, char *const argv[],
+                              const ShellBuiltinIO *io);
+
+typedef struct ShellBuiltin {
+  unsigned abi_version; // SHELL_BUILTIN_ABI_VERSION
+  const char *name;
+  ShellBuiltinFn run;
+  unsigned flags;
+  const char *usage;
+} ShellBuiltin;
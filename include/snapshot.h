@@ -0,0 +1,63 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SNAPSHOT_NAME "shell-snapshot" // under $XDG_CACHE_HOME
+#define SNAPSHOT_MAGIC "shsnap\n"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_EVERY 50 // interactive lines between periodic saves
+
+// What a load restored
+#define SNAPSHOT_HISTORY 0x1
+#define SNAPSHOT_NAMES 0x2
+#define SNAPSHOT_DIRS 0x4
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct SnapshotSpan {
+  uint64_t offset; // from the start of the file, 8-byte aligned
+  uint64_t length; // 0 when the section was not saved
+} SnapshotSpan;
+
+// The start of the file. Every section is laid out as it is used in
+// memory, so loading is a map, a few comparisons and a copy per array.
+typedef struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t layout; // sizes of the saved structures, changing with the build
+  uint64_t file_size;
+  // History: valid while history.txt is unchanged
+  int64_t history_mtime_sec;
+  int64_t history_mtime_nsec;
+  uint64_t history_size;
+  uint64_t history_count;
+  SnapshotSpan history;
+  // PATH names: valid for the same PATH; directory mtimes are checked on use
+  uint64_t path_hash;
+  uint64_t name_dirs;
+  uint64_t name_count;
+  uint64_t name_bytes;
+  SnapshotSpan names;
+  // Visited directories: the journal is read on from `dirs_read_to`
+  uint64_t dirs_path_hash; // of the journal's name
+  uint64_t dirs_inode;
+  uint64_t dirs_read_to;
+  uint64_t dirs_lines;
+  uint64_t dirs_count;
+  uint64_t dirs_bytes;
+  SnapshotSpan dirs;
+} SnapshotHeader;
+
+/***********************************************
+ * SNAPSHOT
+ ***********************************************/
+const char *snapshot_path();
+bool snapshot_save();
+unsigned snapshot_load();
+void snapshot_tick();
+void snapshot_save_at_exit();
@@ -0,0 +1,77 @@
+#pragma once
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define STATS_SUB_BITS 3 // linear steps per power of two: 12.5% resolution
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+#define STATS_DEFAULT_INTERVAL 60 // seconds between dumps
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// Durations in nanoseconds, counted in log-spaced buckets as HdrHistogram
+// does: values below 2^STATS_SUB_BITS exactly, larger ones in steps of an
+// eighth of their power of two
+typedef struct LatencyHistogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+  uint64_t buckets[STATS_BUCKETS];
+} LatencyHistogram;
+
+// What the shell itself costs. Lives in memory shared with every process
+// the shell forks, so execs and allocations in children are counted too.
+typedef struct ShellStats {
+  uint64_t allocations;
+  uint64_t allocated_bytes;
+  uint64_t forks;
+  uint64_t fork_failures;
+  uint64_t execs;
+  uint64_t failed_execs;
+  uint64_t history_read_bytes;
+  uint64_t history_written_bytes;
+  LatencyHistogram parse;  // source text to a program, cached or not
+  LatencyHistogram launch; // a pipeline's first fork to its last
+  LatencyHistogram wait;   // its last fork to its status
+  LatencyHistogram key;    // a key read at the prompt to its echo
+} ShellStats;
+
+/***********************************************
+ * COUNTERS
+ ***********************************************/
+void stats_init();
+ShellStats *shell_stats();
+void stats_reset();
+void stats_count(uint64_t *counter, uint64_t n);
+uint64_t stats_now();
+void stats_record(LatencyHistogram *histogram, uint64_t start);
+void stats_record_ns(LatencyHistogram *histogram, uint64_t ns);
+size_t stats_bucket(uint64_t ns);
+uint64_t stats_bucket_floor(size_t bucket);
+uint64_t stats_percentile(const LatencyHistogram *histogram, double fraction);
+long stats_rss_bytes();
+
+/***********************************************
+ * COUNTED ALLOCATION AND PROCESSES
+ ***********************************************/
+void *shell_malloc(size_t size);
+void *shell_calloc(size_t count, size_t size);
+void *shell_realloc(void *ptr, size_t size);
+char *shell_strdup(const char *text);
+char *shell_strndup(const char *text, size_t len);
+pid_t shell_fork();
+
+/***********************************************
+ * REPORTING
+ ***********************************************/
+void stats_write_json(FILE *out);
+void stats_tick();
+void shellstats_builtin(const Command *cmd);
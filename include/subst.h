@@ -0,0 +1,40 @@
+#pragma once
+#include "buffer.h"
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SUBST_READ_SIZE 65536
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// A substitution started ahead of expansion when parallel_subst is set
+typedef struct PendingSubst {
+  char *text;
+  pid_t pid;
+  int fd;
+  int status;
+  Buffer output;
+  bool consumed;
+} PendingSubst;
+
+/***********************************************
+ * COMMAND SUBSTITUTION
+ ***********************************************/
+void command_substitute(const char *text, Buffer *out);
+int subst_take_status();
+bool subst_is_inline_builtin(const char *name);
+void subst_prefetch(const char *line);
+void subst_finish();
+
+/***********************************************
+ * PROCESS SUBSTITUTION
+ ***********************************************/
+char *process_substitute(const char *text, bool input);
+void procsub_claim(Command *cmd);
+void procsub_release(Command *cmd);
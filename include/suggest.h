@@ -0,0 +1,45 @@
+#pragma once
+#include "buffer.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define SUGGEST_MAX_NAME 64 // longest name compared, one machine word
+#define SUGGEST_MAX_DISTANCE 3
+#define SUGGEST_MAX_SHOWN 3
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct NameRef {
+  uint32_t offset; // into the index names
+  uint32_t len;
+} NameRef;
+
+// Every name in the PATH directories, sorted by length and then name so a
+// lookup only visits the lengths that can be close enough. Rebuilt when
+// PATH changes or one of its directories is modified.
+typedef struct NameIndex {
+  bool built;
+  unsigned long path_epoch;
+  struct timespec *mtimes; // of each PATH directory when it was read
+  size_t dir_count;
+  Buffer names; // NUL-terminated
+  NameRef *refs;
+  size_t count;
+  size_t by_length[SUGGEST_MAX_NAME + SUGGEST_MAX_DISTANCE + 2];
+} NameIndex;
+
+/***********************************************
+ * SUGGESTIONS
+ ***********************************************/
+size_t suggest_distance(const char *pattern, const char *text);
+const NameIndex *suggest_index();
+void suggest_adopt(const NameIndex *index);
+size_t suggest_commands(const char *name, char **out, size_t max);
+void suggest_not_found(const char *name);
+void suggest_free();
@@ -0,0 +1,47 @@
+#pragma once
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define TIMEOUT_STATUS 124 // as timeout(1): the deadline passed
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct TimeoutStage {
+  pid_t pid;
+  int pidfd;
+  char *name;
+  int status;
+  bool done;
+} TimeoutStage;
+
+// The deadline `timeout` puts on the pipelines it starts. Stages are put
+// in one process group so a signal reaches everything they started.
+typedef struct Deadline {
+  bool active;
+  struct timespec start; // CLOCK_MONOTONIC
+  struct timespec at;
+  long grace_ms; // SIGKILL this long after the first signal; -1 never
+  int signal;
+  pid_t group; // of the pipeline being launched, 0 before its first stage
+  bool took_terminal;
+  TimeoutStage *stages; // of the pipeline being waited for
+  size_t stage_count;
+  size_t stage_cap;
+} Deadline;
+
+/***********************************************
+ * TIMEOUT
+ ***********************************************/
+bool timeout_parse_duration(const char *text, long *ms);
+bool timeout_active();
+void timeout_child();
+void timeout_track(pid_t pid, const char *name);
+int timeout_wait();
+void timeout_builtin(const Command *cmd);
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define VARS_INITIAL_CAP 64
+
+// Variables are shell-local unless VAR_EXPORTED is set
+#define VAR_EXPORTED 0x1
+#define VAR_TOMBSTONE 0x80
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct Var {
+  char *name;
+  char *value;     // NULL when exported but never assigned
+  char *env_entry; // cached "NAME=VALUE", only for exported variables
+  unsigned hash;
+  unsigned flags;
+} Var;
+
+// $0 and $1..$n; functions swap in their own arguments
+typedef struct Positional {
+  char *arg0;
+  char **args;
+  int count;
+} Positional;
+
+typedef struct VarTable {
+  Var *slots;
+  size_t cap;      // always a power of two
+  size_t used;     // live entries plus tombstones
+  size_t count;    // live entries
+  size_t exported; // live entries with an env_entry
+  char **envp;     // cached environment handed to execve
+  bool envp_dirty;
+  unsigned long path_epoch;
+  Positional params;
+} VarTable;
+
+typedef void (*var_visitor)(const Var *var, void *ctx);
+
+/***********************************************
+ * VARIABLE STORE
+ ***********************************************/
+void vars_init(char **envp);
+void vars_free();
+const char *var_get(const char *name);
+void var_set(const char *name, const char *value, unsigned flags);
+bool var_unset(const char *name);
+void var_export(const char *name);
+bool var_assign(const char *word);
+bool var_is_assignment(const char *word);
+bool var_is_valid_name(const char *name, size_t len);
+void vars_foreach_sorted(var_visitor visit, void *ctx);
+
+/***********************************************
+ * ENVIRONMENT MATERIALIZATION
+ ***********************************************/
+char **vars_envp();
+unsigned long vars_path_epoch();
+void vars_forget_paths();
+
+/***********************************************
+ * POSITIONAL PARAMETERS
+ ***********************************************/
+void vars_set_arg0(const char *name);
+void vars_set_positional(char *const *args, int count, Positional *saved);
+void vars_restore_positional(Positional *saved);
+const char *var_positional(int n);
+int vars_positional_count();
+bool vars_shift(int n);
@@ -0,0 +1,93 @@
+#pragma once
+#include "buffer.h"
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define VM_MAX_CALL_DEPTH 1000
+
+typedef enum OpCode {
+  OP_RUN,          // run simple command a
+  OP_PIPELINE,     // run b commands from a on as one pipeline
+  OP_NOT,          // invert $?
+  OP_STATUS,       // set $? to a
+  OP_JUMP,         // continue at a
+  OP_JUMP_IF_FAIL, // continue at a when $? != 0
+  OP_JUMP_IF_OK,   // continue at a when $? == 0
+  OP_FOR_INIT,     // expand the words of command a into a new iterator
+  OP_FOR_NEXT,     // set variable a to the next word, or continue at b
+  OP_FOR_POP,      // drop the innermost iterator
+  OP_DEFINE,       // bind function a
+} OpCode;
+
+typedef enum CompileResult {
+  COMPILE_OK,
+  COMPILE_INCOMPLETE, // an if/while/for/{, quote or && is still open
+  COMPILE_ERROR,
+} CompileResult;
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+typedef struct Instr {
+  unsigned op;
+  unsigned a;
+  unsigned b;
+} Instr;
+
+// Words of a simple command as written, expanded afresh on every run. The
+// first assign_count words are NAME=value assignments. A command name that
+// expands to itself has its executable looked up once per PATH epoch.
+typedef struct SimpleCommand {
+  char **words;
+  size_t count;
+  size_t assign_count;
+  Redirect *redirects; // targets unexpanded
+  size_t redirect_count;
+  bool literal_name;
+  char *path; // resolved executable, valid while path_epoch is current
+  unsigned long path_epoch;
+} SimpleCommand;
+
+typedef struct Program Program;
+
+typedef struct FunctionDef {
+  char *name;
+  Program *body;
+} FunctionDef;
+
+// Compiled once, then shared: function bodies outlive the line defining them
+struct Program {
+  int refs;
+  Instr *code;
+  size_t len;
+  size_t cap;
+  SimpleCommand *commands;
+  size_t command_count;
+  char **strings; // loop variable names
+  size_t string_count;
+  FunctionDef *functions;
+  size_t function_count;
+};
+
+/***********************************************
+ * COMPILER
+ ***********************************************/
+CompileResult compile_program(const char *src, Program **out);
+bool program_is_simple(const Program *prog);
+void program_retain(Program *prog);
+void program_release(Program *prog);
+
+/***********************************************
+ * VIRTUAL MACHINE
+ ***********************************************/
+int vm_execute(Program *prog);
+Command *program_pipeline(Program *prog);
+int run_source(const char *src);
+bool run_source_line(Buffer *pending, const char *line);
+Program *function_lookup(const char *name);
+bool vm_call_function(const Command *cmd);
+void functions_free();
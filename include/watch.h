@@ -0,0 +1,39 @@
+#pragma once
+#include "shell.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+/***********************************************
+ * CONSTANTS AND DEFINITIONS
+ ***********************************************/
+#define WATCH_DEFAULT_DEBOUNCE_MS 100
+#define WATCH_EVENTS                                                           \
+  (IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE | IN_MOVED_FROM |        \
+   IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define WATCH_READ_SIZE 16384
+
+/***********************************************
+ * DATA STRUCTURES
+ ***********************************************/
+// Watched path by inotify watch descriptor, to re-add files that editors
+// replace and to name new subdirectories
+typedef struct WatchPath {
+  int wd;
+  char *path;
+} WatchPath;
+
+typedef struct WatchStats {
+  unsigned long runs;      // runs that finished
+  unsigned long cancelled; // runs killed by a newer change
+  unsigned long events;
+  unsigned long bursts; // changes after debouncing, one rerun each
+  unsigned long long latency_usec; // first event of a burst to its rerun
+} WatchStats;
+
+/***********************************************
+ * WATCH
+ ***********************************************/
+const WatchStats *watch_stats();
+void watch_builtin(const Command *cmd);
@@ -0,0 +1,65 @@
+// Sample loadable builtin: upper-cases its arguments, or its input when it
+// has none, without a fork or exec.
+//
+//   enable -f ./upcase.so upcase
+//   upcase hello world
+//   cat notes.txt | upcase
+
+#include "shell_builtin.h"
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+
+static int write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0)
+      return -1;
+    data += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static int upcase_chunk(int fd, char *buf, const char *text, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    buf[i] = toupper((unsigned char)text[i]);
+  }
+  return write_all(fd, buf, len);
+}
+
+static int upcase(int argc, char *const argv[], const ShellBuiltinIO *io) {
+  char buf[65536];
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      const char *text = argv[i];
+      size_t left = strlen(text);
+      while (left > 0) {
+        size_t len = left < sizeof(buf) ? left : sizeof(buf);
+        if (upcase_chunk(io->out, buf, text, len))
+          return 1;
+        text += len;
+        left -= len;
+      }
+      if (write_all(io->out, i + 1 < argc ? " " : "\n", 1))
+        return 1;
+    }
+    return 0;
+  }
+
+  ssize_t n;
+  while ((n = read(io->in, buf, sizeof(buf))) > 0) {
+    if (upcase_chunk(io->out, buf, buf, n))
+      return 1;
+  }
+  return n < 0 ? 1 : 0;
+}
+
+const ShellBuiltin upcase_builtin = {
+    .abi_version = SHELL_BUILTIN_ABI_VERSION,
+    .name = "upcase",
+    .run = upcase,
+    .flags = 0,
+    .usage = "upcase [word ...]",
+};
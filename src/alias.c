@@ -0,0 +1,166 @@
+#include "alias.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static AliasTable aliases = {0};
+
+/***********************************************
+ * TABLE
+ ***********************************************/
+
+// Index of `name`, or of where it would be inserted
+static size_t find(const char *name, size_t len, bool *found) {
+  size_t lo = 0;
+  size_t hi = aliases.count;
+  *found = false;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strncmp(aliases.items[mid].name, name, len);
+    if (cmp == 0 && aliases.items[mid].name[len] != '\0')
+      cmp = 1;
+    if (cmp == 0) {
+      *found = true;
+      return mid;
+    }
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+const char *alias_get(const char *name, size_t len) {
+  if (aliases.count == 0)
+    return NULL;
+  bool found;
+  size_t i = find(name, len, &found);
+  return found ? aliases.items[i].value : NULL;
+}
+
+void alias_set(const char *name, const char *value) {
+  bool found;
+  size_t i = find(name, strlen(name), &found);
+  aliases.epoch++;
+
+  if (found) {
+    free(aliases.items[i].value);
+    aliases.items[i].value = strdup(value);
+    return;
+  }
+
+  if (aliases.count == aliases.cap) {
+    aliases.cap = aliases.cap ? aliases.cap * 2 : 16;
+    aliases.items =
+        (Alias *)realloc(aliases.items, aliases.cap * sizeof(Alias));
+    if (!aliases.items) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memmove(&aliases.items[i + 1], &aliases.items[i],
+          (aliases.count - i) * sizeof(Alias));
+  aliases.items[i] = (Alias){.name = strdup(name), .value = strdup(value)};
+  aliases.count++;
+}
+
+bool alias_remove(const char *name) {
+  bool found;
+  size_t i = find(name, strlen(name), &found);
+  if (!found)
+    return false;
+
+  free(aliases.items[i].name);
+  free(aliases.items[i].value);
+  memmove(&aliases.items[i], &aliases.items[i + 1],
+          (aliases.count - i - 1) * sizeof(Alias));
+  aliases.count--;
+  aliases.epoch++;
+  return true;
+}
+
+void aliases_free() {
+  for (size_t i = 0; i < aliases.count; i++) {
+    free(aliases.items[i].name);
+    free(aliases.items[i].value);
+  }
+  free(aliases.items);
+  unsigned long epoch = aliases.epoch;
+  aliases = (AliasTable){0};
+  aliases.epoch = epoch + 1;
+}
+
+unsigned long aliases_epoch() { return aliases.epoch; }
+
+const AliasTable *aliases_table() { return &aliases; }
+
+/***********************************************
+ * BUILTINS
+ ***********************************************/
+
+static void print_alias(const Alias *alias) {
+  printf("alias %s='", alias->name);
+  for (const char *p = alias->value; *p; p++) {
+    if (*p == '\'')
+      fputs("'\\''", stdout);
+    else
+      putchar(*p);
+  }
+  printf("'\n");
+}
+
+// alias [name[=value] ...]
+void alias_builtin(const Command *cmd) {
+  last_status = 0;
+  if (cmd->argc == 1) {
+    for (size_t i = 0; i < aliases.count; i++) {
+      print_alias(&aliases.items[i]);
+    }
+    return;
+  }
+
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    const char *eq = strchr(arg, '=');
+    if (!eq) {
+      bool found;
+      size_t at = find(arg, strlen(arg), &found);
+      if (found) {
+        print_alias(&aliases.items[at]);
+      } else {
+        fprintf(stderr, "alias: %s: not found\n", arg);
+        last_status = 1;
+      }
+      continue;
+    }
+
+    size_t len = eq - arg;
+    if (len == 0 || strcspn(arg, " \t\n|&;<>()$`\\\"'") < len) {
+      fprintf(stderr, "alias: `%.*s': invalid alias name\n", (int)len, arg);
+      last_status = 1;
+      continue;
+    }
+    char *name = strndup(arg, len);
+    alias_set(name, eq + 1);
+    free(name);
+  }
+}
+
+// unalias -a | name ...
+void unalias_builtin(const Command *cmd) {
+  last_status = 0;
+  if (cmd->argc == 2 && strcmp(cmd->argv[1], "-a") == 0) {
+    aliases_free();
+    return;
+  }
+
+  for (int i = 1; i < cmd->argc; i++) {
+    if (!alias_remove(cmd->argv[i])) {
+      fprintf(stderr, "unalias: %s: not found\n", cmd->argv[i]);
+      last_status = 1;
+    }
+  }
+}
@@ -0,0 +1,318 @@
+#include "arith.h"
+#include "vars.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Recursive descent over the C operator table used by $((...)). Variables
+// are read and written by name; `skip` evaluates without side effects, for
+// the untaken side of && || and ?:.
+typedef struct Arith {
+  const char *p;
+  const char *error;
+  int skip;
+} Arith;
+
+typedef struct BinaryOp {
+  const char *text;
+  int prec;
+} BinaryOp;
+
+static long parse_assign(Arith *a);
+
+/***********************************************
+ * LEXING
+ ***********************************************/
+
+static void skip_space(Arith *a) {
+  while (isspace((unsigned char)*a->p))
+    a->p++;
+}
+
+// Consumes the one-character token `c` when it is next
+static bool accept(Arith *a, char c) {
+  skip_space(a);
+  if (*a->p != c)
+    return false;
+  a->p++;
+  return true;
+}
+
+static void fail(Arith *a, const char *message) {
+  if (!a->error)
+    a->error = message;
+}
+
+static long var_value(const char *name) {
+  const char *value = var_get(name);
+  return value ? strtol(value, NULL, 0) : 0;
+}
+
+static void var_store(Arith *a, const char *name, long value) {
+  if (a->skip)
+    return;
+  char number[32];
+  snprintf(number, sizeof(number), "%ld", value);
+  var_set(name, number, 0);
+}
+
+static size_t name_length(const char *p) {
+  size_t len = 0;
+  if (isalpha((unsigned char)*p) || *p == '_') {
+    while (isalnum((unsigned char)p[len]) || p[len] == '_')
+      len++;
+  }
+  return len;
+}
+
+/***********************************************
+ * EXPRESSIONS
+ ***********************************************/
+
+static long parse_primary(Arith *a) {
+  skip_space(a);
+
+  if (accept(a, '(')) {
+    long value = parse_assign(a);
+    if (!accept(a, ')'))
+      fail(a, "missing `)'");
+    return value;
+  }
+
+  if (isdigit((unsigned char)*a->p)) {
+    char *end;
+    long value = strtol(a->p, &end, 0);
+    a->p = end;
+    if (isalnum((unsigned char)*a->p))
+      fail(a, "invalid number");
+    return value;
+  }
+
+  size_t len = name_length(a->p);
+  if (len == 0) {
+    fail(a, "syntax error: operand expected");
+    return 0;
+  }
+
+  char *name = strndup(a->p, len);
+  a->p += len;
+  long value = var_value(name);
+  skip_space(a);
+  if (strncmp(a->p, "++", 2) == 0 || strncmp(a->p, "--", 2) == 0) {
+    var_store(a, name, a->p[0] == '+' ? value + 1 : value - 1);
+    a->p += 2;
+  }
+  free(name);
+  return value;
+}
+
+static long parse_unary(Arith *a) {
+  skip_space(a);
+  if (strncmp(a->p, "++", 2) == 0 || strncmp(a->p, "--", 2) == 0) {
+    long delta = a->p[0] == '+' ? 1 : -1;
+    a->p += 2;
+    skip_space(a);
+    size_t len = name_length(a->p);
+    if (len == 0) {
+      fail(a, "syntax error: variable expected");
+      return 0;
+    }
+    char *name = strndup(a->p, len);
+    a->p += len;
+    long value = var_value(name) + delta;
+    var_store(a, name, value);
+    free(name);
+    return value;
+  }
+
+  if (accept(a, '-'))
+    return -parse_unary(a);
+  if (accept(a, '+'))
+    return parse_unary(a);
+  if (accept(a, '!'))
+    return !parse_unary(a);
+  if (accept(a, '~'))
+    return ~parse_unary(a);
+  return parse_primary(a);
+}
+
+// Longest operators first; precedence as in C, ** binding tightest
+static const BinaryOp binary_ops[] = {
+    {"||", 1}, {"&&", 2}, {"==", 6}, {"!=", 6}, {"<=", 7}, {">=", 7},
+    {"<<", 8}, {">>", 8}, {"**", 11}, {"|", 3}, {"^", 4},  {"&", 5},
+    {"<", 7},  {">", 7},  {"+", 9},  {"-", 9},  {"*", 10}, {"/", 10},
+    {"%", 10}};
+
+// The binary operator at the cursor, or NULL. `+=` and friends are
+// assignments, handled by parse_assign.
+static const BinaryOp *peek_binary(Arith *a) {
+  skip_space(a);
+  for (size_t i = 0; i < sizeof(binary_ops) / sizeof(*binary_ops); i++) {
+    const BinaryOp *op = &binary_ops[i];
+    if (a->p[0] != op->text[0] || (op->text[1] && a->p[1] != op->text[1]))
+      continue;
+
+    size_t len = op->text[1] ? 2 : 1;
+    bool compare = op->prec == 6 || (op->prec == 7 && len == 2);
+    if (a->p[len] == '=' && !compare)
+      return NULL;
+    return op;
+  }
+  return NULL;
+}
+
+// By squaring, so a huge exponent costs a few dozen steps. Overflow wraps,
+// as in bash.
+static long power(Arith *a, long base, long exp) {
+  if (exp < 0) {
+    if (!a->skip)
+      fail(a, "exponent less than 0");
+    return 0;
+  }
+  unsigned long value = 1;
+  unsigned long square = (unsigned long)base;
+  for (; exp > 0; exp >>= 1) {
+    if (exp & 1)
+      value *= square;
+    square *= square;
+  }
+  return (long)value;
+}
+
+// `/` or `%`. LONG_MIN / -1 overflows, and traps on x86, so -1 is done by
+// hand: the quotient wraps to LONG_MIN as in bash.
+static long divide(Arith *a, char op, long lhs, long rhs) {
+  if (rhs == 0) {
+    if (!a->skip)
+      fail(a, "division by 0");
+    return 0;
+  }
+  if (rhs == -1)
+    return op == '/' ? (long)(0UL - (unsigned long)lhs) : 0;
+  return op == '/' ? lhs / rhs : lhs % rhs;
+}
+
+static long apply_binary(Arith *a, const char *op, long lhs, long rhs) {
+  switch (op[0]) {
+  case '|': return lhs | rhs;
+  case '^': return lhs ^ rhs;
+  case '&': return lhs & rhs;
+  case '=': return lhs == rhs;
+  case '!': return lhs != rhs;
+  case '<':
+    return op[1] == '=' ? lhs <= rhs : op[1] == '<' ? lhs << rhs : lhs < rhs;
+  case '>':
+    return op[1] == '=' ? lhs >= rhs : op[1] == '>' ? lhs >> rhs : lhs > rhs;
+  case '+': return lhs + rhs;
+  case '-': return lhs - rhs;
+  case '*': return op[1] == '*' ? power(a, lhs, rhs) : lhs * rhs;
+  }
+  return divide(a, op[0], lhs, rhs);
+}
+
+// Precedence climbing over binary_ops, short-circuiting && and ||
+static long parse_binary(Arith *a, int min_prec) {
+  long lhs = parse_unary(a);
+  const BinaryOp *op;
+
+  while ((op = peek_binary(a)) != NULL && op->prec >= min_prec) {
+    a->p += op->text[1] ? 2 : 1;
+    // ** is right-associative
+    int next_prec = op->prec == 11 ? op->prec : op->prec + 1;
+
+    if (op->prec <= 2) {
+      bool decided = op->prec == 1 ? lhs != 0 : lhs == 0;
+      a->skip += decided;
+      long rhs = parse_binary(a, next_prec);
+      a->skip -= decided;
+      lhs = op->prec == 1 ? (lhs || rhs) : (lhs && rhs);
+    } else {
+      long rhs = parse_binary(a, next_prec);
+      lhs = apply_binary(a, op->text, lhs, rhs);
+    }
+  }
+  return lhs;
+}
+
+static long parse_ternary(Arith *a) {
+  long cond = parse_binary(a, 1);
+  if (!accept(a, '?'))
+    return cond;
+
+  a->skip += !cond;
+  long then = parse_assign(a);
+  a->skip -= !cond;
+  if (!accept(a, ':')) {
+    fail(a, "`:' expected");
+    return 0;
+  }
+  a->skip += !!cond;
+  long otherwise = parse_ternary(a);
+  a->skip -= !!cond;
+  return cond ? then : otherwise;
+}
+
+static long parse_assign(Arith *a) {
+  static const char *ops[] = {"=",  "+=", "-=",  "*=",  "/=", "%=",
+                              "&=", "|=", "^=", "<<=", ">>="};
+
+  skip_space(a);
+  size_t len = name_length(a->p);
+  if (len > 0) {
+    const char *after = a->p + len;
+    while (isspace((unsigned char)*after))
+      after++;
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+      size_t op_len = strlen(ops[i]);
+      if (strncmp(after, ops[i], op_len) != 0 ||
+          (op_len == 1 && after[1] == '='))
+        continue;
+
+      char *name = strndup(a->p, len);
+      a->p = after + op_len;
+      long rhs = parse_assign(a);
+      long value = var_value(name);
+      switch (ops[i][0]) {
+      case '=': value = rhs; break;
+      case '+': value += rhs; break;
+      case '-': value -= rhs; break;
+      case '*': value *= rhs; break;
+      case '&': value &= rhs; break;
+      case '|': value |= rhs; break;
+      case '^': value ^= rhs; break;
+      case '<': value <<= rhs; break;
+      case '>': value >>= rhs; break;
+      default: value = divide(a, ops[i][0], value, rhs); break;
+      }
+      // A failed expression leaves the variable as it was
+      if (!a->error)
+        var_store(a, name, value);
+      free(name);
+      return value;
+    }
+  }
+
+  return parse_ternary(a);
+}
+
+/***********************************************
+ * ENTRY POINT
+ ***********************************************/
+
+// Evaluates an already parameter-expanded expression. Empty means 0.
+bool arith_eval(const char *expr, long *result) {
+  Arith a = {.p = expr, .error = NULL, .skip = 0};
+  skip_space(&a);
+  *result = *a.p ? parse_assign(&a) : 0;
+  skip_space(&a);
+  if (!a.error && *a.p)
+    fail(&a, "syntax error in expression");
+
+  if (a.error) {
+    fprintf(stderr, "%s: %s\n", expr, a.error);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,413 @@
+#include "batch.h"
+#include "buffer.h"
+#include "expand.h"
+#include "stats.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static WordList marked_commands = {0};
+
+typedef struct BatchJob {
+  pid_t pid;
+  int fd; // read end of the chunk's output pipe, -1 once drained
+  Buffer output;
+  bool started;
+  bool finished;
+  int status;
+} BatchJob;
+
+/***********************************************
+ * ARGUMENT ACCOUNTING
+ ***********************************************/
+
+// What an argument costs against ARG_MAX: its bytes, NUL and argv slot
+size_t batch_arg_cost(const char *arg) {
+  return strlen(arg) + 1 + sizeof(char *);
+}
+
+size_t batch_arg_limit(char *const *envp) {
+  long arg_max = sysconf(_SC_ARG_MAX);
+  if (arg_max <= 0)
+    arg_max = 131072;
+
+  size_t env_size = sizeof(char *);
+  for (char *const *env = envp; env && *env; env++) {
+    env_size += batch_arg_cost(*env);
+  }
+
+  if ((size_t)arg_max <= env_size + BATCH_HEADROOM)
+    return 0;
+  return (size_t)arg_max - env_size - BATCH_HEADROOM;
+}
+
+// Splits args into maximal chunks whose cost plus fixed_cost stays within
+// limit. Returns the number of chunks, or 0 if some argument cannot fit.
+size_t batch_plan(char *const *args, size_t count, size_t fixed_cost,
+                  size_t limit, size_t max_args, BatchChunk **chunks) {
+  *chunks = NULL;
+  if (fixed_cost >= limit)
+    return 0;
+
+  size_t budget = limit - fixed_cost;
+  size_t cap = 8;
+  size_t n = 0;
+  BatchChunk *plan = (BatchChunk *)shell_malloc(cap * sizeof(BatchChunk));
+
+  size_t i = 0;
+  do {
+    size_t used = 0;
+    size_t start = i;
+    while (i < count && (max_args == 0 || i - start < max_args)) {
+      size_t cost = batch_arg_cost(args[i]);
+      if (strlen(args[i]) >= BATCH_MAX_ARG_STRLEN || cost > budget) {
+        free(plan);
+        return 0;
+      }
+      if (used + cost > budget)
+        break;
+      used += cost;
+      i++;
+    }
+
+    if (n == cap) {
+      cap *= 2;
+      plan = (BatchChunk *)shell_realloc(plan, cap * sizeof(BatchChunk));
+    }
+    plan[n++] = (BatchChunk){.start = start, .count = i - start};
+  } while (i < count);
+
+  *chunks = plan;
+  return n;
+}
+
+/***********************************************
+ * BATCHED EXECUTION
+ ***********************************************/
+
+static bool write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+static pid_t spawn_chunk(const Command *cmd, char **argv, size_t argc,
+                         int out_fd) {
+  fflush(stdout);
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    setup_redirections(cmd);
+    // Parallel chunks write to their own pipe, whatever stdout points at
+    if (out_fd != STDOUT_FILENO) {
+      dup2(out_fd, STDOUT_FILENO);
+      close(out_fd);
+    }
+    apply_assignments(cmd, VAR_EXPORTED);
+
+    Command chunk = *cmd;
+    chunk.argv = argv;
+    chunk.argc = argc;
+    chunk.name = argv[0];
+    execute(&chunk);
+    exit(127);
+  }
+
+  return pid;
+}
+
+static int exit_code(int status) {
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Runs the planned chunks, at most opts->jobs at a time. Every chunk writes
+// into its own pipe; the lowest unfinished chunk is streamed straight to
+// out_fd and later chunks are held in memory until their turn.
+static int run_ordered(const Command *cmd, char ***argvs, size_t *argcs,
+                       size_t count, size_t jobs, int out_fd) {
+  BatchJob *job = (BatchJob *)shell_calloc(count, sizeof(BatchJob));
+  struct pollfd *fds =
+      (struct pollfd *)shell_malloc(count * sizeof(struct pollfd));
+  size_t *polled = (size_t *)shell_malloc(count * sizeof(size_t));
+  size_t next_start = 0;
+  size_t next_flush = 0;
+  size_t running = 0;
+
+  while (next_flush < count) {
+    while (running < jobs && next_start < count) {
+      int pipefd[2];
+      if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+      }
+      BatchJob *j = &job[next_start];
+      j->pid = spawn_chunk(cmd, argvs[next_start], argcs[next_start], pipefd[1]);
+      close(pipefd[1]);
+      j->fd = pipefd[0];
+      j->started = true;
+      buffer_init(&j->output);
+      next_start++;
+      running++;
+    }
+
+    size_t nfds = 0;
+    for (size_t i = next_flush; i < next_start; i++) {
+      if (job[i].fd != -1) {
+        fds[nfds] = (struct pollfd){.fd = job[i].fd, .events = POLLIN};
+        polled[nfds++] = i;
+      }
+    }
+
+    if (nfds > 0 && poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    for (size_t k = 0; k < nfds; k++) {
+      if (!(fds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      BatchJob *j = &job[polled[k]];
+      char chunk[BATCH_READ_SIZE];
+      ssize_t n = read(j->fd, chunk, sizeof(chunk));
+      if (n > 0) {
+        if (polled[k] == next_flush)
+          write_all(out_fd, chunk, n);
+        else
+          buffer_append(&j->output, chunk, n);
+      } else if (n == 0 || errno != EINTR) {
+        close(j->fd);
+        j->fd = -1;
+        waitpid(j->pid, &j->status, 0);
+        j->finished = true;
+        running--;
+      }
+    }
+
+    while (next_flush < count && job[next_flush].finished) {
+      next_flush++;
+      if (next_flush < count && job[next_flush].output.len > 0) {
+        write_all(out_fd, job[next_flush].output.data,
+                  job[next_flush].output.len);
+        buffer_free(&job[next_flush].output);
+      }
+    }
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (status == 0 && exit_code(job[i].status) != 0)
+      status = exit_code(job[i].status);
+    buffer_free(&job[i].output);
+  }
+
+  free(polled);
+  free(fds);
+  free(job);
+  return status;
+}
+
+static size_t detect_prefix(char **argv, size_t argc) {
+  size_t prefix = 0;
+  while (1 + prefix < argc && argv[1 + prefix][0] == '-') {
+    prefix++;
+    if (strcmp(argv[prefix], "--") == 0)
+      break;
+  }
+  return prefix;
+}
+
+// argv[0] is the program; the arguments after the fixed prefix (and before
+// the trailing argument, if any) are split across as many runs as needed.
+int batch_run(const Command *cmd, char **argv, size_t argc,
+              const BatchOptions *opts) {
+  size_t prefix = opts->prefix >= 0 ? (size_t)opts->prefix
+                                    : detect_prefix(argv, argc);
+  if (1 + prefix > argc)
+    prefix = argc - 1;
+  size_t trailing = opts->trailing && argc > 1 + prefix ? 1 : 0;
+
+  size_t fixed_cost = sizeof(char *);
+  for (size_t i = 0; i < 1 + prefix; i++) {
+    fixed_cost += batch_arg_cost(argv[i]);
+  }
+  if (trailing)
+    fixed_cost += batch_arg_cost(argv[argc - 1]);
+
+  size_t limit = batch_arg_limit(vars_envp());
+  if (opts->size_limit > 0 && opts->size_limit < limit)
+    limit = opts->size_limit;
+
+  char **args = argv + 1 + prefix;
+  size_t nargs = argc - 1 - prefix - trailing;
+  BatchChunk *plan;
+  size_t count = batch_plan(args, nargs, fixed_cost, limit, opts->max_args,
+                            &plan);
+  if (count == 0) {
+    fprintf(stderr, "batch: argument list too long for a single command\n");
+    return 126;
+  }
+
+  // Chunk argvs point into the original argv; only the arrays are new
+  char ***argvs = (char ***)shell_malloc(count * sizeof(char **));
+  size_t *argcs = (size_t *)shell_malloc(count * sizeof(size_t));
+  for (size_t c = 0; c < count; c++) {
+    size_t n = 1 + prefix + plan[c].count + trailing;
+    argvs[c] = (char **)shell_malloc((n + 1) * sizeof(char *));
+    memcpy(argvs[c], argv, (1 + prefix) * sizeof(char *));
+    memcpy(argvs[c] + 1 + prefix, args + plan[c].start,
+           plan[c].count * sizeof(char *));
+    if (trailing)
+      argvs[c][n - 1] = argv[argc - 1];
+    argvs[c][n] = NULL;
+    argcs[c] = n;
+  }
+
+  int status = 0;
+  if (!open_redirects(cmd)) {
+    status = 1;
+  } else if (opts->jobs <= 1) {
+    // Sequential chunks write directly, no output staging needed
+    for (size_t c = 0; c < count; c++) {
+      int chunk_status;
+      waitpid(spawn_chunk(cmd, argvs[c], argcs[c], STDOUT_FILENO),
+              &chunk_status, 0);
+      if (status == 0)
+        status = exit_code(chunk_status);
+    }
+  } else {
+    // Ordered output is written by the shell, so it goes to the file itself
+    const Redirect *out = redirect_of(cmd, STDOUT_FILENO);
+    int out_fd = out && out->opened != -1 ? out->opened : STDOUT_FILENO;
+    fflush(stdout);
+    status = run_ordered(cmd, argvs, argcs, count, opts->jobs, out_fd);
+  }
+
+  close_redirects(cmd);
+  for (size_t c = 0; c < count; c++) {
+    free(argvs[c]);
+  }
+  free(argvs);
+  free(argcs);
+  free(plan);
+  return status;
+}
+
+bool batch_is_marked(const char *name) {
+  for (size_t i = 0; i < marked_commands.count; i++) {
+    if (strcmp(marked_commands.words[i], name) == 0)
+      return true;
+  }
+  return false;
+}
+
+// True when a marked command's argv would not fit in a single execve()
+bool batch_should_split(const Command *cmd) {
+  if (!cmd->name || !batch_is_marked(cmd->name))
+    return false;
+
+  size_t cost = sizeof(char *);
+  for (int i = 0; i < cmd->argc; i++) {
+    cost += batch_arg_cost(cmd->argv[i]);
+  }
+  return cost > batch_arg_limit(vars_envp());
+}
+
+static void unmark(const char *name) {
+  for (size_t i = 0; i < marked_commands.count; i++) {
+    if (strcmp(marked_commands.words[i], name) == 0) {
+      free(marked_commands.words[i]);
+      marked_commands.words[i] = marked_commands.words[--marked_commands.count];
+      marked_commands.words[marked_commands.count] = NULL;
+      return;
+    }
+  }
+}
+
+// batch [-j jobs] [-s bytes] [-n args] [-p fixed] [-t] cmd args...
+// batch -m name...   split name automatically when its argv is too long
+// batch -u name...   stop splitting name automatically
+// batch -l           list automatically split commands
+void batch_builtin(const Command *cmd) {
+  BatchOptions opts = {.jobs = 1, .prefix = -1};
+  char mode = '\0';
+  int opt;
+
+  optind = 1;
+  while ((opt = getopt(cmd->argc, cmd->argv, "+j:s:n:p:tmul")) != -1) {
+    switch (opt) {
+    case 'j':
+      opts.jobs = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      opts.size_limit = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      opts.max_args = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      opts.prefix = strtol(optarg, NULL, 10);
+      break;
+    case 't':
+      opts.trailing = true;
+      break;
+    case 'm':
+    case 'u':
+    case 'l':
+      mode = (char)opt;
+      break;
+    default:
+      last_status = 2;
+      return;
+    }
+  }
+
+  if (mode == 'l') {
+    for (size_t i = 0; i < marked_commands.count; i++) {
+      printf("%s\n", marked_commands.words[i]);
+    }
+    last_status = 0;
+    return;
+  }
+
+  if (mode == 'm' || mode == 'u') {
+    for (int i = optind; i < cmd->argc; i++) {
+      if (mode == 'm' && !batch_is_marked(cmd->argv[i]))
+        wordlist_push(&marked_commands, shell_strdup(cmd->argv[i]));
+      else if (mode == 'u')
+        unmark(cmd->argv[i]);
+    }
+    last_status = 0;
+    return;
+  }
+
+  if (optind >= cmd->argc) {
+    fprintf(stderr, "batch: usage: batch [-j jobs] [-s bytes] [-n args] "
+                    "[-p fixed] [-t] cmd args...\n");
+    last_status = 2;
+    return;
+  }
+
+  last_status = batch_run(cmd, cmd->argv + optind, cmd->argc - optind, &opts);
+}
@@ -0,0 +1,87 @@
+#include "buffer.h"
+#include "stats.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/***********************************************
+ * GROWABLE BYTE BUFFER
+ ***********************************************/
+
+void buffer_init(Buffer *buf) {
+  buf->data = NULL;
+  buf->len = 0;
+  buf->cap = 0;
+}
+
+void buffer_reserve(Buffer *buf, size_t extra) {
+  // Always keep room for the terminating NUL
+  size_t needed = buf->len + extra + 1;
+  if (needed <= buf->cap) {
+    return;
+  }
+
+  size_t cap = buf->cap ? buf->cap : 64;
+  while (cap < needed) {
+    cap *= 2;
+  }
+
+  buf->data = (char *)shell_realloc(buf->data, cap);
+  buf->data[buf->len] = '\0';
+  buf->cap = cap;
+}
+
+void buffer_append(Buffer *buf, const char *data, size_t len) {
+  buffer_reserve(buf, len);
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+}
+
+void buffer_append_str(Buffer *buf, const char *str) {
+  buffer_append(buf, str, strlen(str));
+}
+
+void buffer_push(Buffer *buf, char c) {
+  buffer_reserve(buf, 1);
+  buf->data[buf->len++] = c;
+  buf->data[buf->len] = '\0';
+}
+
+void buffer_clear(Buffer *buf) {
+  buf->len = 0;
+  if (buf->data) {
+    buf->data[0] = '\0';
+  }
+}
+
+char *buffer_detach(Buffer *buf) {
+  buffer_reserve(buf, 0);
+  char *data = buf->data;
+  buffer_init(buf);
+  return data;
+}
+
+void buffer_free(Buffer *buf) {
+  free(buf->data);
+  buffer_init(buf);
+}
+
+// Reads fd to end of file straight into the buffer's spare capacity
+size_t buffer_read_fd(Buffer *buf, int fd, size_t chunk) {
+  size_t start = buf->len;
+  while (true) {
+    buffer_reserve(buf, chunk);
+    ssize_t n = read(fd, buf->data + buf->len, buf->cap - buf->len - 1);
+    if (n > 0) {
+      buf->len += n;
+    } else if (n == 0 || errno != EINTR) {
+      break;
+    }
+  }
+  buf->data[buf->len] = '\0';
+  return buf->len - start;
+}
@@ -0,0 +1,311 @@
+#include "builtins.h"
+#include "alias.h"
+#include "batch.h"
+#include "cache.h"
+#include "capture.h"
+#include "copy.h"
+#include "dirs.h"
+#include "filter.h"
+#include "memo.h"
+#include "schedule.h"
+#include "stats.h"
+#include "timeout.h"
+#include "vars.h"
+#include "watch.h"
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static BuiltinTable builtins = {0};
+
+/***********************************************
+ * CORE BUILTINS
+ ***********************************************/
+
+static void exit_builtin(const Command *cmd) {
+  exit(cmd->argc > 1 ? atoi(cmd->argv[1]) : last_status);
+}
+
+static void history_builtin(const Command *cmd) {
+  (void)cmd;
+  history_display();
+}
+
+static void tree_builtin(const Command *cmd) {
+  (void)cmd;
+  char cwd[INPUT_LEN] = {0};
+  getcwd(cwd, INPUT_LEN);
+  tree(cwd, 0);
+}
+
+static void pwd_builtin(const Command *cmd) {
+  (void)cmd;
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd))) {
+    printf("%s\n", cwd);
+    last_status = 0;
+  } else {
+    perror("pwd");
+    last_status = 1;
+  }
+}
+
+static void true_builtin(const Command *cmd) {
+  (void)cmd;
+  last_status = 0;
+}
+
+static void false_builtin(const Command *cmd) {
+  (void)cmd;
+  last_status = 1;
+}
+
+static void shift_builtin(const Command *cmd) {
+  int n = cmd->argc > 1 ? atoi(cmd->argv[1]) : 1;
+  last_status = vars_shift(n) ? 0 : 1;
+}
+
+static const struct {
+  const char *name;
+  BuiltinFn run;
+  unsigned flags;
+} core_builtins[] = {
+    {":", true_builtin, 0},
+    {"[", test_builtin, 0},
+    {"alias", alias_builtin, 0},
+    {"batch", batch_builtin, 0},
+    {"cd", change_dir, 0},
+    {"cut", cut_builtin, BUILTIN_FILTER},
+    {"dirs", dirs_builtin, 0},
+    {"echo", echo_args, BUILTIN_INLINE},
+    {"enable", enable_builtin, 0},
+    {"exit", exit_builtin, 0},
+    {"export", export_vars, 0},
+    {"false", false_builtin, 0},
+    {"grep", grep_builtin, BUILTIN_FILTER},
+    {"hash", hash_builtin, 0},
+    {"head", head_builtin, BUILTIN_FILTER},
+    {"history", history_builtin, BUILTIN_INLINE},
+    {"last", last_builtin, 0},
+    {"memo", memo_builtin, 0},
+    {"out", out_builtin, 0},
+    {"popd", popd_builtin, 0},
+    {"pushd", pushd_builtin, 0},
+    {"pwd", pwd_builtin, BUILTIN_INLINE},
+    {"sched", sched_builtin, 0},
+    {"set", set_options, 0},
+    {"shellstats", shellstats_builtin, BUILTIN_INLINE},
+    {"shift", shift_builtin, 0},
+    {"tail", tail_builtin, BUILTIN_FILTER},
+    {"test", test_builtin, 0},
+    {"timeout", timeout_builtin, 0},
+    {"tree", tree_builtin, BUILTIN_INLINE},
+    {"true", true_builtin, 0},
+    {"ucp", ucp_builtin, 0},
+    {"umv", umv_builtin, 0},
+    {"unalias", unalias_builtin, 0},
+    {"unset", unset_vars, 0},
+    {"watch", watch_builtin, 0},
+    {"wc", wc_builtin, BUILTIN_FILTER},
+    {"z", z_builtin, 0},
+};
+
+/***********************************************
+ * REGISTRY
+ ***********************************************/
+
+// Index of `name`, or of where it would be inserted
+static size_t find(const char *name, bool *found) {
+  size_t lo = 0;
+  size_t hi = builtins.count;
+  *found = false;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(builtins.items[mid].name, name);
+    if (cmp == 0) {
+      *found = true;
+      return mid;
+    }
+    if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Adds or replaces `name`, returning its slot with everything but the
+// name cleared
+static Builtin *insert(const char *name) {
+  bool found;
+  size_t i = find(name, &found);
+  if (found) {
+    Builtin *builtin = &builtins.items[i];
+    if (builtin->handle)
+      dlclose(builtin->handle);
+    *builtin = (Builtin){.name = builtin->name};
+    return builtin;
+  }
+
+  if (builtins.count == builtins.cap) {
+    builtins.cap = builtins.cap ? builtins.cap * 2 : 32;
+    builtins.items =
+        (Builtin *)realloc(builtins.items, builtins.cap * sizeof(Builtin));
+    if (!builtins.items) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memmove(&builtins.items[i + 1], &builtins.items[i],
+          (builtins.count - i) * sizeof(Builtin));
+  builtins.items[i] = (Builtin){.name = strdup(name)};
+  builtins.count++;
+  return &builtins.items[i];
+}
+
+void builtins_init() {
+  if (builtins.count > 0)
+    return;
+  for (size_t i = 0; i < sizeof(core_builtins) / sizeof(*core_builtins);
+       i++) {
+    builtin_register(core_builtins[i].name, core_builtins[i].run,
+                     core_builtins[i].flags);
+  }
+}
+
+void builtins_free() {
+  for (size_t i = 0; i < builtins.count; i++) {
+    if (builtins.items[i].handle)
+      dlclose(builtins.items[i].handle);
+    free(builtins.items[i].name);
+  }
+  free(builtins.items);
+  builtins = (BuiltinTable){0};
+}
+
+void builtin_register(const char *name, BuiltinFn run, unsigned flags) {
+  Builtin *builtin = insert(name);
+  builtin->run = run;
+  builtin->flags = flags;
+}
+
+const Builtin *builtin_find(const char *name) {
+  if (builtins.count == 0)
+    builtins_init();
+  bool found;
+  size_t i = find(name, &found);
+  if (found && (builtins.items[i].flags & BUILTIN_FILTER) &&
+      !shell_options.filters)
+    return NULL;
+  return found ? &builtins.items[i] : NULL;
+}
+
+const BuiltinTable *builtins_table() {
+  if (builtins.count == 0)
+    builtins_init();
+  return &builtins;
+}
+
+void builtin_run(const Builtin *builtin, const Command *cmd) {
+  if (builtin->run) {
+    builtin->run(cmd);
+    return;
+  }
+
+  // Plugins write to the descriptors directly, after anything buffered
+  fflush(stdout);
+  fflush(stderr);
+  ShellBuiltinIO io = {.in = STDIN_FILENO,
+                       .out = STDOUT_FILENO,
+                       .err = STDERR_FILENO};
+  last_status = builtin->plugin->run(cmd->argc, cmd->argv, &io);
+}
+
+/***********************************************
+ * PLUGINS
+ ***********************************************/
+
+// Loads the builtin `name` from the shared object at `path`, replacing any
+// builtin of that name
+bool builtin_load(const char *path, const char *name) {
+  void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!handle) {
+    fprintf(stderr, "enable: %s\n", dlerror());
+    return false;
+  }
+
+  char symbol[256];
+  snprintf(symbol, sizeof(symbol), "%s_builtin", name);
+  const ShellBuiltin *plugin = (const ShellBuiltin *)dlsym(handle, symbol);
+  if (!plugin) {
+    fprintf(stderr, "enable: %s: no %s in %s\n", name, symbol, path);
+    dlclose(handle);
+    return false;
+  }
+  if (plugin->abi_version != SHELL_BUILTIN_ABI_VERSION || !plugin->run) {
+    fprintf(stderr, "enable: %s: unsupported builtin ABI version %u\n", name,
+            plugin->abi_version);
+    dlclose(handle);
+    return false;
+  }
+
+  builtin_find(name); // core builtins first, so a plugin can replace one
+  Builtin *builtin = insert(name);
+  builtin->plugin = plugin;
+  builtin->handle = handle;
+  builtin->flags = plugin->flags & SHELL_BUILTIN_NO_STDIN ? BUILTIN_INLINE : 0;
+  return true;
+}
+
+// Removes a loaded builtin, bringing back the core one it replaced
+bool builtin_unload(const char *name) {
+  bool found;
+  size_t i = find(name, &found);
+  if (!found || !builtins.items[i].handle)
+    return false;
+
+  dlclose(builtins.items[i].handle);
+  free(builtins.items[i].name);
+  memmove(&builtins.items[i], &builtins.items[i + 1],
+          (builtins.count - i - 1) * sizeof(Builtin));
+  builtins.count--;
+
+  for (size_t j = 0; j < sizeof(core_builtins) / sizeof(*core_builtins);
+       j++) {
+    if (strcmp(core_builtins[j].name, name) == 0)
+      builtin_register(name, core_builtins[j].run, core_builtins[j].flags);
+  }
+  return true;
+}
+
+// enable [-f file name ... | -d name ...]
+void enable_builtin(const Command *cmd) {
+  last_status = 0;
+  if (cmd->argc == 1) {
+    for (size_t i = 0; i < builtins.count; i++) {
+      printf("enable %s\n", builtins.items[i].name);
+    }
+    return;
+  }
+
+  if (strcmp(cmd->argv[1], "-f") == 0 && cmd->argc >= 4) {
+    for (int i = 3; i < cmd->argc; i++) {
+      if (!builtin_load(cmd->argv[2], cmd->argv[i]))
+        last_status = 1;
+    }
+  } else if (strcmp(cmd->argv[1], "-d") == 0) {
+    for (int i = 2; i < cmd->argc; i++) {
+      if (!builtin_unload(cmd->argv[i])) {
+        fprintf(stderr, "enable: %s: not a loaded builtin\n", cmd->argv[i]);
+        last_status = 1;
+      }
+    }
+  } else {
+    fprintf(stderr, "enable: usage: enable [-f file name ...] [-d name ...]\n");
+    last_status = 2;
+  }
+}
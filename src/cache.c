@@ -0,0 +1,193 @@
+#include "cache.h"
+#include "alias.h"
+#include "vars.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static ProgramCache cache = {.count = 0, .newest = -1, .oldest = -1};
+static bool buckets_ready = false;
+
+/***********************************************
+ * RECENCY LIST
+ ***********************************************/
+
+static void unlink_entry(int i) {
+  CacheEntry *entry = &cache.entries[i];
+  if (entry->newer >= 0)
+    cache.entries[entry->newer].older = entry->older;
+  else
+    cache.newest = entry->older;
+  if (entry->older >= 0)
+    cache.entries[entry->older].newer = entry->newer;
+  else
+    cache.oldest = entry->newer;
+}
+
+static void push_newest(int i) {
+  CacheEntry *entry = &cache.entries[i];
+  entry->newer = -1;
+  entry->older = cache.newest;
+  if (cache.newest >= 0)
+    cache.entries[cache.newest].newer = i;
+  cache.newest = i;
+  if (cache.oldest < 0)
+    cache.oldest = i;
+}
+
+/***********************************************
+ * HASH BUCKETS
+ ***********************************************/
+
+static unsigned hash_text(const char *text) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (; *text; text++) {
+    hash ^= (unsigned char)*text;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void init_buckets() {
+  for (size_t i = 0; i < PROGRAM_CACHE_BUCKETS; i++) {
+    cache.buckets[i] = -1;
+  }
+  buckets_ready = true;
+}
+
+static int find_entry(const char *text, unsigned hash) {
+  int i = cache.buckets[hash & (PROGRAM_CACHE_BUCKETS - 1)];
+  while (i >= 0) {
+    const CacheEntry *entry = &cache.entries[i];
+    if (entry->hash == hash && strcmp(entry->text, text) == 0)
+      return i;
+    i = entry->bucket_next;
+  }
+  return -1;
+}
+
+// Drops entry i from its bucket and the recency list, leaving the slot free
+static void remove_entry(int i) {
+  CacheEntry *entry = &cache.entries[i];
+  int *link = &cache.buckets[entry->hash & (PROGRAM_CACHE_BUCKETS - 1)];
+  while (*link != i) {
+    link = &cache.entries[*link].bucket_next;
+  }
+  *link = entry->bucket_next;
+  unlink_entry(i);
+
+  free(entry->text);
+  program_release(entry->prog);
+  entry->text = NULL;
+  entry->prog = NULL;
+}
+
+/***********************************************
+ * PROGRAM CACHE
+ ***********************************************/
+
+// Compiles `src`, reusing the program from an earlier run of the same text.
+// The caller owns a reference to the result.
+CompileResult cache_compile(const char *src, Program **out) {
+  if (!buckets_ready)
+    init_buckets();
+
+  unsigned hash = hash_text(src);
+  int i = find_entry(src, hash);
+  if (i >= 0 && cache.entries[i].alias_epoch == aliases_epoch()) {
+    cache.stats.hits++;
+    unlink_entry(i);
+    push_newest(i);
+    program_retain(cache.entries[i].prog);
+    *out = cache.entries[i].prog;
+    return COMPILE_OK;
+  }
+
+  // An alias changed since this line was compiled
+  if (i >= 0) {
+    cache.stats.invalidations++;
+    remove_entry(i);
+    cache.count--;
+  }
+
+  cache.stats.misses++;
+  CompileResult result = compile_program(src, out);
+  if (result != COMPILE_OK || strlen(src) > PROGRAM_CACHE_MAX_TEXT)
+    return result;
+
+  if (cache.count < PROGRAM_CACHE_SIZE) {
+    // Free slots are the ones past count, or left by invalidations
+    for (i = 0; cache.entries[i].prog; i++)
+      ;
+    cache.count++;
+  } else {
+    i = cache.oldest;
+    remove_entry(i);
+    cache.stats.evictions++;
+  }
+
+  CacheEntry *entry = &cache.entries[i];
+  size_t bucket = hash & (PROGRAM_CACHE_BUCKETS - 1);
+  entry->text = strdup(src);
+  entry->hash = hash;
+  entry->alias_epoch = aliases_epoch();
+  entry->prog = *out;
+  entry->bucket_next = cache.buckets[bucket];
+  cache.buckets[bucket] = i;
+  program_retain(*out);
+  push_newest(i);
+  return result;
+}
+
+void cache_clear() {
+  while (cache.newest >= 0) {
+    remove_entry(cache.newest);
+  }
+  cache.count = 0;
+}
+
+void cache_count_path(bool reused) {
+  if (reused)
+    cache.stats.path_reuses++;
+  else
+    cache.stats.path_lookups++;
+}
+
+const CacheStats *cache_stats() { return &cache.stats; }
+
+/***********************************************
+ * BUILTIN
+ ***********************************************/
+
+static double percent(unsigned long part, unsigned long whole) {
+  return whole ? 100.0 * part / whole : 0.0;
+}
+
+// hash [-r]: reports cache effectiveness; -r forgets every compiled line
+// and resolved command path
+void hash_builtin(const Command *cmd) {
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-r") == 0) {
+    cache_clear();
+    vars_forget_paths();
+    last_status = 0;
+    return;
+  }
+  if (cmd->argc > 1) {
+    fprintf(stderr, "hash: usage: hash [-r]\n");
+    last_status = 2;
+    return;
+  }
+
+  const CacheStats *s = &cache.stats;
+  printf("lines: %lu hits, %lu misses (%.1f%% hit rate), %zu cached\n",
+         s->hits, s->misses, percent(s->hits, s->hits + s->misses),
+         cache.count);
+  printf("       %lu evictions, %lu invalidations\n", s->evictions,
+         s->invalidations);
+  printf("paths: %lu lookups, %lu reuses (%.1f%% hit rate)\n", s->path_lookups,
+         s->path_reuses,
+         percent(s->path_reuses, s->path_lookups + s->path_reuses));
+  last_status = 0;
+}
@@ -0,0 +1,399 @@
+#include "capture.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static CaptureRing ring = {.memfd = -1, .stash = {-1, -1}};
+static CaptureSession session = {0};
+static pid_t owner = 0; // only this process captures; its children never do
+
+/***********************************************
+ * RING STORAGE
+ ***********************************************/
+
+static size_t configured_size() {
+  const char *value = var_get("CAPTURE_BYTES");
+  if (!value || !*value)
+    return CAPTURE_DEFAULT_BYTES;
+
+  char *end;
+  long size = strtol(value, &end, 10);
+  if (*end || size < CAPTURE_MIN_BYTES)
+    return CAPTURE_MIN_BYTES;
+  return size > CAPTURE_MAX_BYTES ? CAPTURE_MAX_BYTES : (size_t)size;
+}
+
+static void forget_entries() {
+  for (size_t i = 0; i < CAPTURE_MAX_ENTRIES; i++) {
+    free(ring.entries[i].command);
+    ring.entries[i].command = NULL;
+  }
+  ring.entry_count = 0;
+}
+
+void capture_free() {
+  forget_entries();
+  if (ring.memfd != -1)
+    close(ring.memfd);
+  if (ring.stash[0] != -1) {
+    close(ring.stash[0]);
+    close(ring.stash[1]);
+  }
+  ring = (CaptureRing){.memfd = -1, .stash = {-1, -1}};
+}
+
+// (Re)creates the ring when first used or when $CAPTURE_BYTES changed;
+// a new size drops everything captured so far
+static bool ring_ready() {
+  size_t size = configured_size();
+  if (ring.memfd != -1 && ring.size == size)
+    return true;
+
+  capture_free();
+  ring.memfd = memfd_create("capture", MFD_CLOEXEC);
+  if (ring.memfd == -1 || ftruncate(ring.memfd, size) == -1) {
+    perror("capture");
+    capture_free();
+    return false;
+  }
+  ring.size = size;
+  ring.next_id = 1;
+  ring.use_splice = pipe2(ring.stash, O_CLOEXEC) == 0;
+  return true;
+}
+
+static void ring_write(const char *data, size_t len) {
+  // Bytes that would be overwritten within this same write are skipped
+  if (len > ring.size) {
+    ring.written += len - ring.size;
+    data += len - ring.size;
+    len = ring.size;
+  }
+
+  while (len > 0) {
+    size_t pos = ring.written % ring.size;
+    size_t chunk = len < ring.size - pos ? len : ring.size - pos;
+    ssize_t n = pwrite(ring.memfd, data, chunk, pos);
+    if (n <= 0)
+      return;
+    ring.written += n;
+    data += n;
+    len -= n;
+  }
+}
+
+// Moves `len` bytes sitting in the stash pipe into the ring
+static void stash_to_ring(size_t len) {
+  while (len > 0) {
+    loff_t pos = ring.written % ring.size;
+    size_t chunk = len < ring.size - pos ? len : ring.size - pos;
+    ssize_t n = splice(ring.stash[0], NULL, ring.memfd, &pos, chunk, 0);
+    if (n <= 0) {
+      char buf[CAPTURE_CHUNK];
+      n = read(ring.stash[0], buf, chunk < sizeof(buf) ? chunk : sizeof(buf));
+      if (n <= 0)
+        return;
+      ring_write(buf, n);
+    } else {
+      ring.written += n;
+    }
+    len -= n;
+  }
+}
+
+/***********************************************
+ * CAPTURE
+ ***********************************************/
+
+// Called when the option is turned on, by the shell that will capture
+void capture_claim() { owner = getpid(); }
+
+static char *describe(const Command *head) {
+  Buffer text;
+  buffer_init(&text);
+  for (const Command *cmd = head; cmd; cmd = cmd->next) {
+    if (cmd != head)
+      buffer_append_str(&text, " | ");
+    for (int i = 0; i < cmd->argc; i++) {
+      if (i > 0)
+        buffer_push(&text, ' ');
+      buffer_append_str(&text, cmd->argv[i]);
+    }
+  }
+  return buffer_detach(&text);
+}
+
+// Called just before the final stage of `head` is forked. Its stdout and
+// stderr then go through the shell, which copies them into the ring.
+bool capture_begin(const Command *head) {
+  if (!shell_options.capture_output || owner != getpid() || !ring_ready())
+    return false;
+
+  if (pipe2(session.out, O_CLOEXEC) == -1)
+    return false;
+  if (pipe2(session.err, O_CLOEXEC) == -1) {
+    close(session.out[0]);
+    close(session.out[1]);
+    return false;
+  }
+
+  CaptureEntry *entry = &ring.entries[(ring.next_id - 1) % CAPTURE_MAX_ENTRIES];
+  free(entry->command);
+  *entry = (CaptureEntry){.id = ring.next_id++,
+                          .command = describe(head),
+                          .start = ring.written};
+  if (ring.entry_count < CAPTURE_MAX_ENTRIES)
+    ring.entry_count++;
+
+  session.entry = entry;
+  session.active = true;
+  return true;
+}
+
+// In the forked final stage, before its own redirections are applied
+void capture_child() {
+  if (!session.active)
+    return;
+  dup2(session.out[1], STDOUT_FILENO);
+  dup2(session.err[1], STDERR_FILENO);
+  close(session.out[0]);
+  close(session.out[1]);
+  close(session.err[0]);
+  close(session.err[1]);
+  session.active = false;
+}
+
+static void write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return; // the reader went away; the ring still gets a copy
+    data += n;
+    len -= n;
+  }
+}
+
+// Sends `len` bytes already duplicated into the stash on to `dst`
+static void forward(int src, int dst, size_t len) {
+  while (len > 0) {
+    ssize_t n = splice(src, NULL, dst, NULL, len, 0);
+    if (n <= 0) {
+      // Terminals and closed readers: copy (or just drain) by hand
+      char buf[CAPTURE_CHUNK];
+      n = read(src, buf, len < sizeof(buf) ? len : sizeof(buf));
+      if (n <= 0)
+        return;
+      write_all(dst, buf, n);
+    }
+    len -= n;
+  }
+}
+
+// Copies one chunk from `src` to both `dst` and the ring. Returns false at
+// end of file.
+static bool pump_once(int src, int dst) {
+  if (ring.use_splice) {
+    ssize_t n = tee(src, ring.stash[1], CAPTURE_CHUNK, SPLICE_F_NONBLOCK);
+    if (n == 0)
+      return false;
+    if (n > 0) {
+      forward(src, dst, n);
+      stash_to_ring(n);
+      return true;
+    }
+    if (errno == EINTR || errno == EAGAIN)
+      return true;
+    ring.use_splice = false;
+  }
+
+  char buf[CAPTURE_CHUNK];
+  ssize_t n = read(src, buf, sizeof(buf));
+  if (n < 0)
+    return errno == EINTR;
+  write_all(dst, buf, n);
+  ring_write(buf, n);
+  return n > 0;
+}
+
+// Runs in the shell once every stage has been forked, until the final
+// stage and anything it started close their output
+void capture_pump() {
+  if (!session.active)
+    return;
+  session.active = false;
+  close(session.out[1]);
+  close(session.err[1]);
+
+  struct pollfd fds[2] = {{.fd = session.out[0], .events = POLLIN},
+                          {.fd = session.err[0], .events = POLLIN}};
+  int dst[2] = {STDOUT_FILENO, STDERR_FILENO};
+  int open_count = 2;
+  while (open_count > 0) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd == -1 || !fds[i].revents)
+        continue;
+      if (!pump_once(fds[i].fd, dst[i])) {
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        open_count--;
+      }
+    }
+  }
+  for (int i = 0; i < 2; i++) {
+    if (fds[i].fd != -1)
+      close(fds[i].fd);
+  }
+
+  session.entry->len = ring.written - session.entry->start;
+}
+
+void capture_end(int status) {
+  if (session.entry)
+    session.entry->status = status;
+  session.entry = NULL;
+}
+
+// The nth most recent capture, counting from 1
+const CaptureEntry *capture_entry(size_t n) {
+  if (n == 0 || n > ring.entry_count)
+    return NULL;
+  return &ring.entries[(ring.next_id - 1 - n) % CAPTURE_MAX_ENTRIES];
+}
+
+// Appends what is left of `entry` to `out`; returns how many of its bytes
+// have already been overwritten
+size_t capture_read(const CaptureEntry *entry, Buffer *out) {
+  unsigned long long oldest =
+      ring.written > ring.size ? ring.written - ring.size : 0;
+  unsigned long long from = entry->start > oldest ? entry->start : oldest;
+  unsigned long long end = entry->start + entry->len;
+  if (from >= end)
+    return entry->len;
+
+  size_t len = end - from;
+  buffer_reserve(out, len);
+  size_t done = 0;
+  while (done < len) {
+    size_t pos = (from + done) % ring.size;
+    size_t chunk = len - done < ring.size - pos ? len - done : ring.size - pos;
+    ssize_t n = pread(ring.memfd, out->data + out->len + done, chunk, pos);
+    if (n <= 0)
+      break;
+    done += n;
+  }
+  out->len += done;
+  out->data[out->len] = '\0';
+  return from - entry->start;
+}
+
+/***********************************************
+ * BUILTINS
+ ***********************************************/
+
+static void show_lines(const char *data, size_t len, const char *pattern,
+                       FILE *to) {
+  const char *end = data + len;
+  while (data < end) {
+    const char *nl = memchr(data, '\n', end - data);
+    const char *next = nl ? nl + 1 : end;
+    if (!pattern || memmem(data, next - data, pattern, strlen(pattern)))
+      fwrite(data, 1, next - data, to);
+    data = next;
+  }
+}
+
+static void list_entries() {
+  for (size_t n = ring.entry_count; n >= 1; n--) {
+    const CaptureEntry *entry = capture_entry(n);
+    unsigned long long oldest =
+        ring.written > ring.size ? ring.written - ring.size : 0;
+    const char *state = entry->start + entry->len <= oldest && entry->len
+                            ? "overwritten"
+                        : entry->start < oldest ? "partial"
+                                                : "kept";
+    printf("%4zu  %10llu  %-11s  %3d  %s\n", n, entry->len, state,
+           entry->status, entry->command);
+  }
+}
+
+// out [n] [-g text] [-p]: replays the nth most recent captured output,
+// keeping only lines containing `text`, optionally through $PAGER
+static void replay(const Command *cmd, bool list_by_default) {
+  size_t n = 1;
+  const char *pattern = NULL;
+  bool page = false;
+  bool numbered = false;
+
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    if (strcmp(arg, "-g") == 0 && i + 1 < cmd->argc) {
+      pattern = cmd->argv[++i];
+    } else if (strcmp(arg, "-p") == 0) {
+      page = true;
+    } else if (list_by_default && arg[0] >= '0' && arg[0] <= '9') {
+      n = strtoul(arg, NULL, 10);
+      numbered = true;
+    } else {
+      fprintf(stderr, "%s: usage: %s\n", cmd->argv[0],
+              list_by_default ? "out [n] [-g text] [-p]"
+                              : "last [-g text] [-p]");
+      last_status = 2;
+      return;
+    }
+  }
+
+  if (list_by_default && !numbered && !pattern && !page) {
+    list_entries();
+    last_status = 0;
+    return;
+  }
+
+  const CaptureEntry *entry = capture_entry(n);
+  if (!entry) {
+    fprintf(stderr, "%s: no captured output%s\n", cmd->argv[0],
+            shell_options.capture_output ? "" : " (set -o capture)");
+    last_status = 1;
+    return;
+  }
+
+  Buffer text;
+  buffer_init(&text);
+  size_t lost = capture_read(entry, &text);
+  if (lost)
+    fprintf(stderr, "%s: first %zu bytes overwritten\n", cmd->argv[0], lost);
+
+  fflush(stdout);
+  FILE *to = stdout;
+  if (page) {
+    const char *pager = var_get("PAGER");
+    to = popen(pager && *pager ? pager : "less", "w");
+    if (!to) {
+      perror("popen");
+      to = stdout;
+    }
+  }
+  show_lines(text.data ? text.data : "", text.len, pattern, to);
+  if (to != stdout)
+    pclose(to);
+  fflush(stdout);
+  buffer_free(&text);
+  last_status = 0;
+}
+
+void out_builtin(const Command *cmd) { replay(cmd, true); }
+
+void last_builtin(const Command *cmd) { replay(cmd, false); }
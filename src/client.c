@@ -0,0 +1,79 @@
+#include "buffer.h"
+#include "server.h"
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Stand-in client for `shell --server`: runs one command line in the
+// server with this process's stdio, cwd and any -e overlays, then exits
+// with its status.
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-C dir] [-e NAME=VALUE]... [-v] socket command...\n",
+          name);
+}
+
+int main(int argc, char **argv) {
+  char cwd[PATH_MAX];
+  const char *dir = getcwd(cwd, sizeof(cwd));
+  char **env = (char **)calloc(argc + 1, sizeof(char *));
+  size_t env_count = 0;
+  bool verbose = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "+C:e:v")) != -1) {
+    switch (opt) {
+    case 'C':
+      dir = optarg;
+      break;
+    case 'e':
+      env[env_count++] = optarg;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (argc - optind < 2) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  Buffer command;
+  buffer_init(&command);
+  for (int i = optind + 1; i < argc; i++) {
+    if (i > optind + 1)
+      buffer_push(&command, ' ');
+    buffer_append_str(&command, argv[i]);
+  }
+
+  int sock = server_connect(argv[optind]);
+  if (sock == -1) {
+    perror(argv[optind]);
+    return 127;
+  }
+
+  const int stdio[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  ServerReply reply;
+  if (!server_request(sock, dir, env, command.data, stdio, &reply)) {
+    fprintf(stderr, "%s: no reply from server\n", argv[0]);
+    return 127;
+  }
+  close(sock);
+
+  if (verbose) {
+    fprintf(stderr, "status %d, user %.3f ms, system %.3f ms, max rss %lld KB\n",
+            reply.status, reply.user_usec / 1000.0, reply.system_usec / 1000.0,
+            (long long)reply.max_rss_kb);
+  }
+  buffer_free(&command);
+  free(env);
+  return reply.status;
+}
@@ -0,0 +1,869 @@
+#include "alias.h"
+#include "expand.h"
+#include "shell.h"
+#include "vars.h"
+#include "vm.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Loop {
+  size_t continue_at;
+  size_t *breaks; // jumps to patch with the loop's exit
+  size_t break_count;
+  bool is_for; // has an iterator to pop on the way out
+} Loop;
+
+// An alias being expanded; it is not expanded again before `end`
+typedef struct AliasGuard {
+  char *name;
+  size_t end;
+} AliasGuard;
+
+// Source text produced by alias expansion, shared with function bodies
+typedef struct Splices {
+  char **texts;
+  size_t count;
+  AliasGuard *guards;
+  size_t guard_count;
+} Splices;
+
+// Here-document bodies cut out of the source, in order of their operators
+typedef struct Heredocs {
+  char **bodies;
+  size_t count;
+  size_t next;
+} Heredocs;
+
+typedef struct Compiler {
+  const char *p;
+  Program *prog;
+  Loop *loops;
+  size_t loop_count;
+  Splices *splices;
+  Heredocs *heredocs;
+  CompileResult status;
+} Compiler;
+
+static const char *keywords[] = {"if", "then", "elif", "else", "fi",
+                                 "while", "until", "do", "done", "for",
+                                 "in", "{", "}", "!", "function"};
+
+static void compile_list(Compiler *c, const char *const *terminators);
+static void compile_pipeline(Compiler *c);
+
+/***********************************************
+ * PROGRAM CONSTRUCTION
+ ***********************************************/
+
+static void *grow(void *items, size_t *cap, size_t need, size_t size) {
+  if (need <= *cap)
+    return items;
+
+  size_t new_cap = *cap ? *cap * 2 : 8;
+  while (new_cap < need)
+    new_cap *= 2;
+  void *grown = realloc(items, new_cap * size);
+  if (!grown) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+  *cap = new_cap;
+  return grown;
+}
+
+static Program *program_new() {
+  Program *prog = (Program *)calloc(1, sizeof(Program));
+  if (!prog) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  prog->refs = 1;
+  return prog;
+}
+
+static size_t emit(Compiler *c, unsigned op, unsigned a, unsigned b) {
+  Program *prog = c->prog;
+  prog->code = (Instr *)grow(prog->code, &prog->cap, prog->len + 1,
+                             sizeof(Instr));
+  prog->code[prog->len] = (Instr){.op = op, .a = a, .b = b};
+  return prog->len++;
+}
+
+static void patch(Compiler *c, size_t at) { c->prog->code[at].a = c->prog->len; }
+
+static unsigned add_string(Compiler *c, char *str) {
+  Program *prog = c->prog;
+  prog->strings = (char **)realloc(prog->strings,
+                                   (prog->string_count + 1) * sizeof(char *));
+  prog->strings[prog->string_count] = str;
+  return prog->string_count++;
+}
+
+// Splits `text` into raw words; expansion waits until the command runs
+static unsigned add_command(Compiler *c, const char *text, bool assignments) {
+  Program *prog = c->prog;
+  prog->commands = (SimpleCommand *)realloc(
+      prog->commands, (prog->command_count + 1) * sizeof(SimpleCommand));
+  SimpleCommand *sc = &prog->commands[prog->command_count];
+  *sc = (SimpleCommand){0};
+
+  char *copy = strdup(text);
+  char *cursor = copy;
+  char *word;
+  while ((word = scan_word(&cursor)) != NULL) {
+    sc->words = (char **)realloc(sc->words, (sc->count + 1) * sizeof(char *));
+    sc->words[sc->count++] = strdup(word);
+    if (assignments && sc->assign_count + 1 == sc->count &&
+        var_is_assignment(word))
+      sc->assign_count++;
+  }
+  free(copy);
+
+  // Builtins and names that expansion could change are never looked up
+  if (sc->count > sc->assign_count) {
+    const char *name = sc->words[sc->assign_count];
+    sc->literal_name = !strpbrk(name, "\\'\"$`*?[<>~/") && !is_builtin(name);
+  }
+  return prog->command_count++;
+}
+
+void program_retain(Program *prog) { prog->refs++; }
+
+void program_release(Program *prog) {
+  if (!prog || --prog->refs > 0)
+    return;
+
+  for (size_t i = 0; i < prog->command_count; i++) {
+    for (size_t j = 0; j < prog->commands[i].count; j++) {
+      free(prog->commands[i].words[j]);
+    }
+    free(prog->commands[i].words);
+    free_redirects(prog->commands[i].redirects,
+                   prog->commands[i].redirect_count);
+    free(prog->commands[i].path);
+  }
+  for (size_t i = 0; i < prog->string_count; i++) {
+    free(prog->strings[i]);
+  }
+  for (size_t i = 0; i < prog->function_count; i++) {
+    free(prog->functions[i].name);
+    program_release(prog->functions[i].body);
+  }
+  free(prog->commands);
+  free(prog->strings);
+  free(prog->functions);
+  free(prog->code);
+  free(prog);
+}
+
+// One command that the plain pipeline path can run on its own
+bool program_is_simple(const Program *prog) {
+  return prog->len == 1 &&
+         (prog->code[0].op == OP_RUN || prog->code[0].op == OP_PIPELINE);
+}
+
+/***********************************************
+ * LEXING
+ ***********************************************/
+
+static void fail(Compiler *c, const char *token) {
+  if (c->status != COMPILE_OK)
+    return;
+  if (*token == '\0') {
+    c->status = COMPILE_INCOMPLETE;
+    return;
+  }
+
+  size_t len = strcspn(token, " \t\n;");
+  fprintf(stderr, "syntax error near unexpected token `%.*s'\n",
+          (int)(len ? len : 1), token);
+  c->status = COMPILE_ERROR;
+}
+
+// Skips blanks, escaped newlines and comments
+static void skip_blanks(Compiler *c) {
+  while (true) {
+    if (*c->p == ' ' || *c->p == '\t') {
+      c->p++;
+    } else if (c->p[0] == '\\' && c->p[1] == '\n') {
+      c->p += 2;
+    } else if (*c->p == '#') {
+      c->p += strcspn(c->p, "\n");
+    } else {
+      return;
+    }
+  }
+}
+
+static void skip_separators(Compiler *c) {
+  skip_blanks(c);
+  while (*c->p == '\n' || *c->p == ';') {
+    c->p++;
+    skip_blanks(c);
+  }
+}
+
+static void skip_newlines(Compiler *c) {
+  skip_blanks(c);
+  while (*c->p == '\n') {
+    c->p++;
+    skip_blanks(c);
+  }
+}
+
+static size_t word_length(const char *p) {
+  return strcspn(p, " \t\n;&|()<>");
+}
+
+static bool at_word(Compiler *c, const char *word) {
+  skip_blanks(c);
+  size_t len = strlen(word);
+  if (strncmp(c->p, word, len) != 0)
+    return false;
+  // `{`, `}` and `!` stand alone only when followed by a delimiter
+  return word_length(c->p) == len || (len == 1 && strchr("{}!", *word) &&
+                                      strchr(" \t\n;", c->p[1]));
+}
+
+static bool accept_word(Compiler *c, const char *word) {
+  if (!at_word(c, word))
+    return false;
+  c->p += strlen(word);
+  return true;
+}
+
+static void expect_word(Compiler *c, const char *word) {
+  if (c->status == COMPILE_OK && !accept_word(c, word))
+    fail(c, c->p);
+}
+
+static bool at_any(Compiler *c, const char *const *words) {
+  for (; words && *words; words++) {
+    if (at_word(c, *words))
+      return true;
+  }
+  return false;
+}
+
+static bool at_keyword(Compiler *c) {
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(*keywords); i++) {
+    if (at_word(c, keywords[i]))
+      return true;
+  }
+  return false;
+}
+
+// Length of a function name followed by `()`, or 0
+static size_t function_header(const char *p, const char **body) {
+  size_t len = 0;
+  if (isalpha((unsigned char)*p) || *p == '_') {
+    while (isalnum((unsigned char)p[len]) || (p[len] && strchr("_-.", p[len])))
+      len++;
+  }
+  if (len == 0)
+    return 0;
+
+  const char *q = p + len;
+  q += strspn(q, " \t");
+  if (*q != '(')
+    return 0;
+  q++;
+  q += strspn(q, " \t");
+  if (*q != ')')
+    return 0;
+  *body = q + 1;
+  return len;
+}
+
+/***********************************************
+ * HERE-DOCUMENTS
+ ***********************************************/
+
+// Reads a here-document delimiter at `p`, without its quotes, into
+// `delim`. Returns the end of the word.
+static const char *heredoc_delimiter(const char *p, Buffer *delim) {
+  while (*p && !strchr(" \t\n;&|<>()", *p)) {
+    if (*p == '\'' || *p == '"') {
+      char quote = *p++;
+      while (*p && *p != quote)
+        buffer_push(delim, *p++);
+      if (*p)
+        p++;
+    } else if (*p == '\\' && p[1]) {
+      buffer_push(delim, p[1]);
+      p += 2;
+    } else {
+      buffer_push(delim, *p++);
+    }
+  }
+  return p;
+}
+
+// Cuts the body of the here-document ending at `delim` from the lines at
+// `*p` into `docs`. Returns false if the input ends first.
+static bool take_body(const char **p, const char *delim, bool strip_tabs,
+                      Heredocs *docs) {
+  Buffer body;
+  buffer_init(&body);
+  size_t delim_len = strlen(delim);
+
+  while (true) {
+    if (**p == '\0') {
+      buffer_free(&body);
+      return false;
+    }
+    const char *line = *p;
+    size_t len = strcspn(line, "\n");
+    *p += len + (line[len] == '\n');
+    while (strip_tabs && len > 0 && *line == '\t') {
+      line++;
+      len--;
+    }
+    if (len == delim_len && strncmp(line, delim, len) == 0)
+      break;
+    buffer_append(&body, line, len);
+    buffer_push(&body, '\n');
+  }
+
+  docs->bodies =
+      (char **)realloc(docs->bodies, (docs->count + 1) * sizeof(char *));
+  docs->bodies[docs->count++] = body.data ? buffer_detach(&body) : strdup("");
+  return true;
+}
+
+// Copies `src` to `out` without here-document bodies, which are moved to
+// `docs`. A body starts on the line after its << operator, after the
+// bodies of earlier operators on that line.
+static CompileResult take_heredocs(const char *src, Buffer *out,
+                                   Heredocs *docs) {
+  WordList delims;
+  wordlist_init(&delims);
+  bool strip[64];
+  char quote = '\0';
+  const char *p = src;
+  CompileResult status = COMPILE_OK;
+
+  while (*p && status == COMPILE_OK) {
+    size_t subst = quote == '\'' ? 0 : substitution_length(p);
+    size_t len = 1;
+    if (subst > 0) {
+      len = subst;
+    } else if (quote) {
+      if (*p == '\\' && quote == '"' && p[1])
+        len = 2;
+      else if (*p == quote)
+        quote = '\0';
+    } else if (*p == '\\' && p[1]) {
+      len = 2;
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else if (*p == '#' && (p == src || isspace((unsigned char)p[-1]))) {
+      len = strcspn(p, "\n");
+    } else if (p[0] == '<' && p[1] == '<' && p[2] != '<' &&
+               (p == src || p[-1] != '<') && delims.count < 64) {
+      const char *q = p + 2;
+      bool strip_tabs = *q == '-';
+      q += strip_tabs;
+      q += strspn(q, " \t");
+      Buffer delim;
+      buffer_init(&delim);
+      q = heredoc_delimiter(q, &delim);
+      if (delim.len > 0) {
+        strip[delims.count] = strip_tabs;
+        wordlist_push(&delims, buffer_detach(&delim));
+      }
+      buffer_free(&delim);
+      len = q - p;
+    } else if (*p == '\n' && delims.count > 0) {
+      buffer_push(out, *p++);
+      for (size_t i = 0; i < delims.count && status == COMPILE_OK; i++) {
+        if (!take_body(&p, delims.words[i], strip[i], docs))
+          status = COMPILE_INCOMPLETE;
+      }
+      wordlist_free(&delims);
+      wordlist_init(&delims);
+      continue;
+    }
+
+    buffer_append(out, p, len);
+    p += len;
+  }
+
+  if (delims.count > 0)
+    status = COMPILE_INCOMPLETE;
+  wordlist_free(&delims);
+  return status;
+}
+
+// Gives each here-document redirection the next body in order
+static void attach_heredocs(Compiler *c, Redirect *redirects, size_t count) {
+  Heredocs *docs = c->heredocs;
+  for (size_t i = 0; i < count; i++) {
+    if (redirects[i].kind != REDIRECT_HEREDOC)
+      continue;
+    free(redirects[i].target);
+    if (docs->next < docs->count) {
+      redirects[i].target = docs->bodies[docs->next];
+      docs->bodies[docs->next++] = NULL;
+    } else {
+      redirects[i].target = strdup("");
+    }
+  }
+}
+
+/***********************************************
+ * SIMPLE COMMANDS
+ ***********************************************/
+
+// Scans one command up to a separator or && ||, keeping quotes and
+// substitutions intact. Pipelines and redirections are split into their
+// stages here so that running them needs no parsing.
+static void compile_simple(Compiler *c) {
+  const char *start = c->p;
+  const char *p = start;
+  char quote = '\0';
+  bool piped = false;
+  const char *last = NULL; // last non-blank character outside quotes
+
+  while (*p) {
+    size_t subst = quote == '\'' ? 0 : substitution_length(p);
+    if (subst > 0) {
+      char close = *p == '`' ? '`' : ')';
+      if (subst < 2 || p[subst - 1] != close) {
+        fail(c, "");
+        return;
+      }
+      p += subst;
+      last = p - 1;
+      continue;
+    }
+
+    if (quote) {
+      if (*p == '\\' && quote == '"' && p[1])
+        p++;
+      else if (*p == quote)
+        quote = '\0';
+    } else if (*p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else if (*p == '&' && ((p > start && (p[-1] == '>' || p[-1] == '<')) ||
+                             p[1] == '>')) {
+      piped = true;
+    } else if (*p == ';' || *p == '&' || (p[0] == '|' && p[1] == '|')) {
+      break;
+    } else if (*p == '\n') {
+      // A trailing | continues the pipeline on the next line
+      if (!last || *last != '|')
+        break;
+    } else if (*p == '#' && (p == start || isspace((unsigned char)p[-1]))) {
+      p += strcspn(p, "\n");
+      continue;
+    } else if (*p == '|' || *p == '<' || *p == '>') {
+      piped = true;
+    }
+
+    if (!isspace((unsigned char)*p))
+      last = p;
+    p++;
+  }
+
+  if (quote || (last && *last == '|' && *p == '\0')) {
+    fail(c, "");
+    return;
+  }
+  if (p == start || !last) {
+    fail(c, p);
+    return;
+  }
+
+  char *text = strndup(start, last + 1 - start);
+  c->p = p;
+  if (!piped) {
+    emit(c, OP_RUN, add_command(c, text, true), 0);
+    free(text);
+    return;
+  }
+
+  unsigned first = c->prog->command_count;
+  unsigned stages = 0;
+  char *saveptr;
+  char *segment = strtok_q(text, "|", &saveptr);
+  while (segment != NULL) {
+    Redirect *redirects;
+    size_t count = take_redirects(segment, &redirects);
+    attach_heredocs(c, redirects, count);
+    unsigned index = add_command(c, segment, true);
+    SimpleCommand *sc = &c->prog->commands[index];
+    sc->redirects = redirects;
+    sc->redirect_count = count;
+    stages++;
+    segment = strtok_q(NULL, "|", &saveptr);
+  }
+  emit(c, OP_PIPELINE, first, stages);
+  free(text);
+}
+
+/***********************************************
+ * CONTROL FLOW
+ ***********************************************/
+
+static void compile_if(Compiler *c) {
+  static const char *const then_words[] = {"then", NULL};
+  static const char *const branch_end[] = {"elif", "else", "fi", NULL};
+  static const char *const fi_words[] = {"fi", NULL};
+  size_t *ends = NULL;
+  size_t end_count = 0;
+
+  do {
+    compile_list(c, then_words);
+    expect_word(c, "then");
+    size_t skip = emit(c, OP_JUMP_IF_FAIL, 0, 0);
+    compile_list(c, branch_end);
+    ends = (size_t *)realloc(ends, (end_count + 1) * sizeof(size_t));
+    ends[end_count++] = emit(c, OP_JUMP, 0, 0);
+    patch(c, skip);
+  } while (c->status == COMPILE_OK && accept_word(c, "elif"));
+
+  if (c->status == COMPILE_OK && accept_word(c, "else")) {
+    compile_list(c, fi_words);
+  } else {
+    emit(c, OP_STATUS, 0, 0);
+  }
+  expect_word(c, "fi");
+
+  for (size_t i = 0; i < end_count; i++) {
+    patch(c, ends[i]);
+  }
+  free(ends);
+}
+
+static void push_loop(Compiler *c, size_t continue_at, bool is_for) {
+  c->loops = (Loop *)realloc(c->loops, (c->loop_count + 1) * sizeof(Loop));
+  c->loops[c->loop_count++] =
+      (Loop){.continue_at = continue_at, .is_for = is_for};
+}
+
+static void pop_loop(Compiler *c) {
+  Loop *loop = &c->loops[--c->loop_count];
+  for (size_t i = 0; i < loop->break_count; i++) {
+    patch(c, loop->breaks[i]);
+  }
+  free(loop->breaks);
+}
+
+static void compile_body(Compiler *c) {
+  static const char *const done_words[] = {"done", NULL};
+  skip_separators(c);
+  expect_word(c, "do");
+  compile_list(c, done_words);
+  expect_word(c, "done");
+}
+
+static void compile_while(Compiler *c, bool until) {
+  static const char *const do_words[] = {"do", NULL};
+  size_t top = c->prog->len;
+  compile_list(c, do_words);
+  size_t exit = emit(c, until ? OP_JUMP_IF_OK : OP_JUMP_IF_FAIL, 0, 0);
+
+  push_loop(c, top, false);
+  compile_body(c);
+  emit(c, OP_JUMP, top, 0);
+  patch(c, exit);
+  pop_loop(c);
+  emit(c, OP_STATUS, 0, 0);
+}
+
+static void compile_for(Compiler *c) {
+  skip_blanks(c);
+  size_t len = 0;
+  while (isalnum((unsigned char)c->p[len]) || c->p[len] == '_')
+    len++;
+  if (len == 0 || !var_is_valid_name(c->p, len)) {
+    fail(c, c->p);
+    return;
+  }
+  unsigned name = add_string(c, strndup(c->p, len));
+  c->p += len;
+
+  // Without `in`, iterate over the positional parameters
+  unsigned words;
+  skip_newlines(c);
+  if (accept_word(c, "in")) {
+    size_t list_len = strcspn(c->p, ";\n");
+    char *list = strndup(c->p, list_len);
+    words = add_command(c, list, false);
+    free(list);
+    c->p += list_len;
+  } else {
+    words = add_command(c, "\"$@\"", false);
+  }
+
+  emit(c, OP_FOR_INIT, words, 0);
+  size_t top = emit(c, OP_FOR_NEXT, name, 0);
+  push_loop(c, top, true);
+  compile_body(c);
+  emit(c, OP_JUMP, top, 0);
+
+  // Exhaustion and break both land on the pop
+  c->prog->code[top].b = c->prog->len;
+  pop_loop(c);
+  emit(c, OP_FOR_POP, 0, 0);
+}
+
+// break and continue resolve to jumps; iterators of the loops being left
+// are popped on the way.
+static void compile_loop_exit(Compiler *c, bool is_break) {
+  skip_blanks(c);
+  long levels = 1;
+  if (isdigit((unsigned char)*c->p)) {
+    levels = strtol(c->p, (char **)&c->p, 10);
+  }
+  if (levels < 1) {
+    fail(c, c->p);
+    return;
+  }
+  if (c->loop_count == 0) {
+    emit(c, OP_STATUS, 0, 0);
+    return;
+  }
+  if ((size_t)levels > c->loop_count)
+    levels = c->loop_count;
+
+  for (long i = 1; i < levels; i++) {
+    if (c->loops[c->loop_count - i].is_for)
+      emit(c, OP_FOR_POP, 0, 0);
+  }
+
+  Loop *target = &c->loops[c->loop_count - levels];
+  if (is_break) {
+    target->breaks = (size_t *)realloc(
+        target->breaks, (target->break_count + 1) * sizeof(size_t));
+    target->breaks[target->break_count++] = emit(c, OP_JUMP, 0, 0);
+  } else {
+    emit(c, OP_JUMP, target->continue_at, 0);
+  }
+}
+
+// Function bodies compile into their own program, which outlives this one
+static void compile_function(Compiler *c, const char *name, size_t len) {
+  Compiler body = {.p = c->p,
+                   .prog = program_new(),
+                   .splices = c->splices,
+                   .heredocs = c->heredocs};
+  static const char *const close_words[] = {"}", NULL};
+
+  skip_newlines(&body);
+  expect_word(&body, "{");
+  compile_list(&body, close_words);
+  expect_word(&body, "}");
+  c->p = body.p;
+  c->status = body.status;
+  free(body.loops);
+
+  Program *prog = c->prog;
+  prog->functions = (FunctionDef *)realloc(
+      prog->functions, (prog->function_count + 1) * sizeof(FunctionDef));
+  prog->functions[prog->function_count] =
+      (FunctionDef){.name = strndup(name, len), .body = body.prog};
+  emit(c, OP_DEFINE, prog->function_count++, 0);
+}
+
+/***********************************************
+ * ALIASES
+ ***********************************************/
+
+// Replaces an alias in command position with its value. Returns false when
+// the word is not an alias or is already being expanded.
+static bool expand_alias(Compiler *c) {
+  size_t len = word_length(c->p);
+  const char *value = len > 0 ? alias_get(c->p, len) : NULL;
+  if (!value)
+    return false;
+
+  // Once an alias is spliced, the rest of the source is read from its copy
+  Splices *sp = c->splices;
+  size_t at = sp->count ? (size_t)(c->p - sp->texts[sp->count - 1]) : 0;
+  for (size_t i = 0; i < sp->guard_count; i++) {
+    if (at < sp->guards[i].end && strlen(sp->guards[i].name) == len &&
+        strncmp(sp->guards[i].name, c->p, len) == 0)
+      return false;
+  }
+
+  // Open guards carry over to the new text; one ending inside the replaced
+  // word now covers the whole value
+  size_t value_len = strlen(value);
+  size_t kept = 0;
+  for (size_t i = 0; i < sp->guard_count; i++) {
+    AliasGuard guard = sp->guards[i];
+    if (at >= guard.end) {
+      free(guard.name);
+      continue;
+    }
+    guard.end = guard.end <= at + len ? value_len
+                                      : value_len + guard.end - (at + len);
+    sp->guards[kept++] = guard;
+  }
+  sp->guards = (AliasGuard *)realloc(sp->guards,
+                                     (kept + 1) * sizeof(AliasGuard));
+  sp->guards[kept] = (AliasGuard){.name = strndup(c->p, len), .end = value_len};
+  sp->guard_count = kept + 1;
+
+  Buffer spliced;
+  buffer_init(&spliced);
+  buffer_append(&spliced, value, value_len);
+  buffer_append_str(&spliced, c->p + len);
+  sp->texts = (char **)realloc(sp->texts, (sp->count + 1) * sizeof(char *));
+  sp->texts[sp->count++] = buffer_detach(&spliced);
+  c->p = sp->texts[sp->count - 1];
+  return true;
+}
+
+/***********************************************
+ * COMMAND LISTS
+ ***********************************************/
+
+static void compile_command(Compiler *c) {
+  static const char *const close_words[] = {"}", NULL};
+  const char *body;
+  size_t len;
+
+  if (accept_word(c, "if")) {
+    compile_if(c);
+  } else if (accept_word(c, "while")) {
+    compile_while(c, false);
+  } else if (accept_word(c, "until")) {
+    compile_while(c, true);
+  } else if (accept_word(c, "for")) {
+    compile_for(c);
+  } else if (accept_word(c, "{")) {
+    compile_list(c, close_words);
+    expect_word(c, "}");
+  } else if (accept_word(c, "function")) {
+    skip_blanks(c);
+    const char *name = c->p;
+    len = function_header(name, &body);
+    if (len > 0) {
+      c->p = body;
+    } else {
+      len = word_length(name);
+      c->p += len;
+    }
+    if (len == 0) {
+      fail(c, c->p);
+      return;
+    }
+    compile_function(c, name, len);
+  } else if (expand_alias(c)) {
+    compile_command(c);
+  } else if ((len = function_header(c->p, &body)) > 0) {
+    const char *name = c->p;
+    c->p = body;
+    compile_function(c, name, len);
+  } else if (accept_word(c, "break")) {
+    compile_loop_exit(c, true);
+  } else if (accept_word(c, "continue")) {
+    compile_loop_exit(c, false);
+  } else if (at_keyword(c)) {
+    fail(c, c->p);
+  } else {
+    compile_simple(c);
+  }
+}
+
+static void compile_pipeline(Compiler *c) {
+  if (accept_word(c, "!")) {
+    compile_command(c);
+    emit(c, OP_NOT, 0, 0);
+  } else {
+    compile_command(c);
+  }
+}
+
+// a && b || c: each operator skips the next pipeline on the wrong status
+static void compile_and_or(Compiler *c) {
+  compile_pipeline(c);
+  while (c->status == COMPILE_OK) {
+    skip_blanks(c);
+    unsigned op;
+    if (strncmp(c->p, "&&", 2) == 0)
+      op = OP_JUMP_IF_FAIL;
+    else if (strncmp(c->p, "||", 2) == 0)
+      op = OP_JUMP_IF_OK;
+    else
+      return;
+
+    c->p += 2;
+    skip_newlines(c);
+    size_t skip = emit(c, op, 0, 0);
+    compile_pipeline(c);
+    patch(c, skip);
+  }
+}
+
+// Compiles commands until one of `terminators` or the end of the input
+static void compile_list(Compiler *c, const char *const *terminators) {
+  while (c->status == COMPILE_OK) {
+    skip_separators(c);
+    if (*c->p == '\0') {
+      if (terminators)
+        fail(c, "");
+      return;
+    }
+    if (at_any(c, terminators))
+      return;
+
+    compile_and_or(c);
+    if (c->status != COMPILE_OK)
+      return;
+
+    skip_blanks(c);
+    if (*c->p == '&' && c->p[1] != '&') {
+      fprintf(stderr, "background jobs are not supported\n");
+      c->status = COMPILE_ERROR;
+    } else if (*c->p && *c->p != ';' && *c->p != '\n' &&
+               !at_any(c, terminators)) {
+      fail(c, c->p);
+    }
+  }
+}
+
+CompileResult compile_program(const char *src, Program **out) {
+  Splices splices = {0};
+  Heredocs heredocs = {0};
+  Buffer text;
+  buffer_init(&text);
+  CompileResult status = take_heredocs(src, &text, &heredocs);
+
+  Compiler c = {.p = text.data ? text.data : "",
+                .prog = program_new(),
+                .splices = &splices,
+                .heredocs = &heredocs,
+                .status = status};
+  if (status == COMPILE_OK)
+    compile_list(&c, NULL);
+  free(c.loops);
+  buffer_free(&text);
+  for (size_t i = 0; i < heredocs.count; i++) {
+    free(heredocs.bodies[i]);
+  }
+  free(heredocs.bodies);
+
+  for (size_t i = 0; i < splices.count; i++) {
+    free(splices.texts[i]);
+  }
+  free(splices.texts);
+  for (size_t i = 0; i < splices.guard_count; i++) {
+    free(splices.guards[i].name);
+  }
+  free(splices.guards);
+
+  if (c.status != COMPILE_OK) {
+    program_release(c.prog);
+    c.prog = NULL;
+  }
+  *out = c.prog;
+  return c.status;
+}
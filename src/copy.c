@@ -0,0 +1,673 @@
+#include "copy.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// The files of one copy_run() going through the ring
+typedef struct CopyEngine {
+  CopyPlan *plan;
+  CopyRing *ring;
+  CopySlot *slots;
+  size_t next; // job to start
+  size_t active;
+} CopyEngine;
+
+// What tree_walk() needs to plan one source directory
+typedef struct CopyWalk {
+  CopyPlan *plan;
+  size_t src_len;
+  const char *dst;
+} CopyWalk;
+
+static void copy_error(CopyPlan *plan, const char *path, int error) {
+  fprintf(stderr, "%s: %s: %s\n", plan->name, path, strerror(error));
+  plan->failed = true;
+}
+
+/***********************************************
+ * PLANNING
+ ***********************************************/
+
+static void list_add(CopyList *list, const char *src, const char *dst,
+                     const struct stat *st) {
+  if (list->count == list->cap) {
+    list->cap = list->cap ? list->cap * 2 : 64;
+    list->items =
+        (CopyJob *)shell_realloc(list->items, list->cap * sizeof(CopyJob));
+  }
+  list->items[list->count++] = (CopyJob){
+      .src = shell_strdup(src),
+      .dst = shell_strdup(dst),
+      .mode = st->st_mode,
+      .size = st->st_size,
+      .times = {st->st_atim, st->st_mtim},
+  };
+}
+
+static void list_free(CopyList *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->items[i].src);
+    free(list->items[i].dst);
+  }
+  free(list->items);
+  *list = (CopyList){0};
+}
+
+// Directories are made writable for the copy and get their own mode last
+static bool make_dir(CopyPlan *plan, const char *dst) {
+  struct stat st;
+  if (mkdir(dst, 0700) == 0 ||
+      (errno == EEXIST && stat(dst, &st) == 0 && S_ISDIR(st.st_mode)))
+    return true;
+  copy_error(plan, dst, errno == EEXIST ? ENOTDIR : errno);
+  return false;
+}
+
+static bool plan_entry(CopyPlan *plan, const char *src, const char *dst,
+                       const struct stat *st) {
+  if (S_ISDIR(st->st_mode)) {
+    if (!make_dir(plan, dst))
+      return false;
+    list_add(&plan->dirs, src, dst, st);
+    return true;
+  }
+  struct stat existing;
+  if (S_ISREG(st->st_mode) && stat(dst, &existing) == 0 &&
+      existing.st_dev == st->st_dev && existing.st_ino == st->st_ino) {
+    // Opening the copy would truncate the source
+    fprintf(stderr, "%s: %s and %s are the same file\n", plan->name, src,
+            dst);
+    plan->failed = true;
+  } else if (S_ISREG(st->st_mode)) {
+    list_add(&plan->files, src, dst, st);
+  } else if (S_ISLNK(st->st_mode)) {
+    list_add(&plan->links, src, dst, st);
+  } else {
+    fprintf(stderr, "%s: %s: not a file, directory or link\n", plan->name,
+            src);
+    plan->failed = true;
+  }
+  return false;
+}
+
+static bool plan_visit(const char *dir, const char *name, unsigned char type,
+                       size_t level, void *ctx) {
+  (void)type;
+  (void)level;
+  CopyWalk *walk = (CopyWalk *)ctx;
+  if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+    return false;
+
+  char src[PATH_MAX];
+  char dst[PATH_MAX];
+  snprintf(src, sizeof(src), "%s/%s", dir, name);
+  snprintf(dst, sizeof(dst), "%s%s", walk->dst, src + walk->src_len);
+  struct stat st;
+  if (lstat(src, &st) == -1) {
+    copy_error(walk->plan, src, errno);
+    return false;
+  }
+  return plan_entry(walk->plan, src, dst, &st);
+}
+
+// Whether `dst` is `src` or lies below it
+static bool inside(const char *src, const char *dst) {
+  char from[PATH_MAX];
+  char to[PATH_MAX];
+  if (!realpath(src, from) || !realpath(dst, to))
+    return false;
+  size_t len = strlen(from);
+  return strncmp(from, to, len) == 0 && (to[len] == '/' || to[len] == '\0');
+}
+
+// Adds `src`, and everything under it if it is a directory, to the plan.
+// Directories are made as they are found, so the files have somewhere to
+// go; nothing else is written yet.
+bool copy_plan_add(CopyPlan *plan, const char *src, const char *dst) {
+  bool failed = plan->failed;
+  plan->failed = false;
+  struct stat st;
+  if (lstat(src, &st) == -1) {
+    copy_error(plan, src, errno);
+  } else if (S_ISDIR(st.st_mode)) {
+    bool existed = access(dst, F_OK) == 0;
+    if (make_dir(plan, dst) && inside(src, dst)) {
+      fprintf(stderr, "%s: %s: cannot copy a directory into itself\n",
+              plan->name, src);
+      plan->failed = true;
+      if (!existed)
+        rmdir(dst);
+    } else if (!plan->failed) {
+      list_add(&plan->dirs, src, dst, &st);
+      CopyWalk walk = {.plan = plan, .src_len = strlen(src), .dst = dst};
+      tree_walk(src, 0, plan_visit, &walk);
+    }
+  } else {
+    plan_entry(plan, src, dst, &st);
+  }
+  bool ok = !plan->failed;
+  plan->failed = plan->failed || failed;
+  return ok;
+}
+
+void copy_plan_free(CopyPlan *plan) {
+  list_free(&plan->dirs);
+  list_free(&plan->files);
+  list_free(&plan->links);
+}
+
+/***********************************************
+ * IO_URING
+ ***********************************************/
+
+// Sets up a ring with room for `entries` requests. Fails where io_uring is
+// missing, forbidden (as in many containers) or too old to open, read and
+// write files.
+bool copy_ring_init(CopyRing *ring, unsigned entries) {
+  struct io_uring_params p = {0};
+  int fd = (int)syscall(SYS_io_uring_setup, entries, &p);
+  if (fd < 0)
+    return false;
+  // Opening and reading by io_uring came with reads at the file position
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+    close(fd);
+    return false;
+  }
+
+  *ring = (CopyRing){.fd = fd, .entries = p.sq_entries};
+  ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_map_size =
+      p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  // Both queues in one mapping, unmapped with the submission queue
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) {
+    if (ring->cq_map_size > ring->sq_map_size)
+      ring->sq_map_size = ring->cq_map_size;
+    ring->cq_map_size = 0;
+  }
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  ring->cq_map = single ? ring->sq_map
+                        : mmap(NULL, ring->cq_map_size,
+                               PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, fd,
+                               IORING_OFF_CQ_RING);
+  ring->sqes = (struct io_uring_sqe *)mmap(
+      NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED ||
+      ring->sqes == MAP_FAILED) {
+    copy_ring_free(ring);
+    return false;
+  }
+
+  char *sq = (char *)ring->sq_map;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+  char *cq = (char *)ring->cq_map;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return true;
+}
+
+void copy_ring_free(CopyRing *ring) {
+  if (ring->sqes && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map_size)
+    munmap(ring->cq_map, ring->cq_map_size);
+  if (ring->sq_map && ring->sq_map != MAP_FAILED)
+    munmap(ring->sq_map, ring->sq_map_size);
+  close(ring->fd);
+  *ring = (CopyRing){.fd = -1};
+}
+
+// The ring holds two requests per slot, which is all a slot ever has in
+// flight, so there is always room
+static void ring_push(CopyRing *ring, const struct io_uring_sqe *sqe) {
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+  ring->sqes[index] = *sqe;
+  ring->sq_array[index] = index;
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ring->queued++;
+}
+
+static bool ring_submit_and_wait(CopyRing *ring) {
+  while (syscall(SYS_io_uring_enter, ring->fd, ring->queued, 1,
+                 IORING_ENTER_GETEVENTS, NULL, 0) == -1) {
+    if (errno != EINTR)
+      return false;
+  }
+  ring->queued = 0;
+  return true;
+}
+
+static void queue_open(CopyEngine *engine, size_t slot, const char *path,
+                       int flags) {
+  struct io_uring_sqe sqe = {.opcode = IORING_OP_OPENAT,
+                             .fd = AT_FDCWD,
+                             .addr = (uintptr_t)path,
+                             .len = 0600,
+                             .open_flags = (uint32_t)(flags | O_CLOEXEC),
+                             .user_data = slot};
+  ring_push(engine->ring, &sqe);
+}
+
+static void queue_io(CopyEngine *engine, size_t slot, uint8_t opcode, int fd,
+                     char *buf, size_t len, off_t offset) {
+  struct io_uring_sqe sqe = {.opcode = opcode,
+                             .fd = fd,
+                             .addr = (uintptr_t)buf,
+                             .len = (uint32_t)len,
+                             .off = (uint64_t)offset,
+                             .user_data = slot};
+  ring_push(engine->ring, &sqe);
+}
+
+static void slot_start(CopyEngine *engine, size_t i);
+
+// Closes what the slot opened; the slot takes the next file once both
+// closes are back
+static void slot_close(CopyEngine *engine, size_t i) {
+  CopySlot *slot = &engine->slots[i];
+  slot->step = COPY_CLOSE;
+  slot->closing = 0;
+  int fds[] = {slot->src, slot->dst};
+  for (size_t f = 0; f < 2; f++) {
+    if (fds[f] == -1)
+      continue;
+    struct io_uring_sqe sqe = {
+        .opcode = IORING_OP_CLOSE, .fd = fds[f], .user_data = i};
+    ring_push(engine->ring, &sqe);
+    slot->closing++;
+  }
+  if (slot->closing == 0)
+    slot_start(engine, i);
+}
+
+// Gives the copy its mode and times, through the descriptor, before it is
+// closed
+static void slot_finish(CopyEngine *engine, size_t i) {
+  CopySlot *slot = &engine->slots[i];
+  const CopyJob *job = slot->job;
+  if (fchmod(slot->dst, job->mode & 07777) == -1 ||
+      futimens(slot->dst, job->times) == -1)
+    copy_error(engine->plan, job->dst, errno);
+  else
+    engine->plan->done++;
+  slot_close(engine, i);
+}
+
+static void slot_step(CopyEngine *engine, size_t i, int res) {
+  CopySlot *slot = &engine->slots[i];
+  const CopyJob *job = slot->job;
+  switch (slot->step) {
+  case COPY_OPEN_SRC:
+    if (res < 0) {
+      copy_error(engine->plan, job->src, -res);
+      slot_close(engine, i);
+      return;
+    }
+    slot->src = res;
+    slot->step = COPY_OPEN_DST;
+    queue_open(engine, i, job->dst, O_WRONLY | O_CREAT | O_TRUNC);
+    return;
+  case COPY_OPEN_DST:
+    if (res < 0) {
+      copy_error(engine->plan, job->dst, -res);
+      slot_close(engine, i);
+      return;
+    }
+    slot->dst = res;
+    slot->step = COPY_READ;
+    queue_io(engine, i, IORING_OP_READ, slot->src, slot->buf, COPY_CHUNK,
+             slot->offset);
+    return;
+  case COPY_READ:
+    if (res < 0) {
+      copy_error(engine->plan, job->src, -res);
+      slot_close(engine, i);
+    } else if (res == 0) {
+      slot_finish(engine, i);
+    } else {
+      slot->filled = res;
+      slot->written = 0;
+      slot->step = COPY_WRITE;
+      queue_io(engine, i, IORING_OP_WRITE, slot->dst, slot->buf, res,
+               slot->offset);
+    }
+    return;
+  case COPY_WRITE:
+    if (res <= 0) {
+      copy_error(engine->plan, job->dst, res == 0 ? EIO : -res);
+      slot_close(engine, i);
+      return;
+    }
+    slot->written += res;
+    if (slot->written < slot->filled) {
+      queue_io(engine, i, IORING_OP_WRITE, slot->dst,
+               slot->buf + slot->written, slot->filled - slot->written,
+               slot->offset + slot->written);
+      return;
+    }
+    slot->offset += slot->filled;
+    engine->plan->bytes += slot->filled;
+    slot->step = COPY_READ;
+    queue_io(engine, i, IORING_OP_READ, slot->src, slot->buf, COPY_CHUNK,
+             slot->offset);
+    return;
+  case COPY_CLOSE:
+    if (--slot->closing == 0)
+      slot_start(engine, i);
+    return;
+  }
+}
+
+// Puts the next file into slot `i`, or retires the slot
+static void slot_start(CopyEngine *engine, size_t i) {
+  CopySlot *slot = &engine->slots[i];
+  const CopyList *files = &engine->plan->files;
+  if (engine->next == files->count) {
+    if (slot->job)
+      engine->active--;
+    slot->job = NULL;
+    return;
+  }
+  if (!slot->job)
+    engine->active++;
+  slot->job = &files->items[engine->next++];
+  slot->step = COPY_OPEN_SRC;
+  slot->src = -1;
+  slot->dst = -1;
+  slot->offset = 0;
+  queue_open(engine, i, slot->job->src, O_RDONLY);
+}
+
+// Keeps up to `depth` files moving through the ring at once, each with one
+// request in flight
+static void copy_files_ring(CopyPlan *plan, CopyRing *ring) {
+  size_t depth = plan->depth < plan->files.count ? plan->depth
+                                                 : plan->files.count;
+  CopyEngine engine = {.plan = plan, .ring = ring};
+  engine.slots = (CopySlot *)shell_calloc(depth, sizeof(CopySlot));
+  char *buffers = (char *)shell_malloc(depth * COPY_CHUNK);
+  for (size_t i = 0; i < depth; i++) {
+    engine.slots[i].buf = buffers + i * COPY_CHUNK;
+    slot_start(&engine, i);
+  }
+
+  while (engine.active > 0) {
+    if (!ring_submit_and_wait(ring)) {
+      copy_error(plan, "io_uring", errno);
+      break;
+    }
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      slot_step(&engine, (size_t)cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+  free(buffers);
+  free(engine.slots);
+}
+
+/***********************************************
+ * COPY_FILE_RANGE
+ ***********************************************/
+
+static bool copy_by_reading(int in, int out, uint64_t *bytes) {
+  char buf[COPY_CHUNK / 2];
+  ssize_t n;
+  while ((n = read(in, buf, sizeof(buf))) > 0) {
+    for (ssize_t done = 0; done < n;) {
+      ssize_t w = write(out, buf + done, n - done);
+      if (w == -1)
+        return false;
+      done += w;
+    }
+    *bytes += n;
+  }
+  return n == 0;
+}
+
+// One file in the calling thread. The kernel copies without a trip through
+// user memory, or shares the blocks where the filesystem can.
+static void copy_file_sync(CopyPlan *plan, const CopyJob *job) {
+  int in = open(job->src, O_RDONLY | O_CLOEXEC);
+  if (in == -1) {
+    copy_error(plan, job->src, errno);
+    return;
+  }
+  int out = open(job->dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (out == -1) {
+    copy_error(plan, job->dst, errno);
+    close(in);
+    return;
+  }
+
+  bool ok = true;
+  uint64_t copied = 0;
+  ssize_t n;
+  while ((n = copy_file_range(in, NULL, out, NULL, SSIZE_MAX, 0)) > 0) {
+    copied += n;
+  }
+  if (n == -1 && copied == 0 &&
+      (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+       errno == EOPNOTSUPP))
+    ok = copy_by_reading(in, out, &copied);
+  else
+    ok = n == 0;
+  plan->bytes += copied;
+
+  if (!ok || fchmod(out, job->mode & 07777) == -1 ||
+      futimens(out, job->times) == -1)
+    copy_error(plan, job->dst, errno);
+  else
+    plan->done++;
+  close(in);
+  close(out);
+}
+
+/***********************************************
+ * COPYING
+ ***********************************************/
+
+static void copy_link(CopyPlan *plan, const CopyJob *job) {
+  char target[PATH_MAX];
+  ssize_t len = readlink(job->src, target, sizeof(target) - 1);
+  if (len == -1) {
+    copy_error(plan, job->src, errno);
+    return;
+  }
+  target[len] = '\0';
+  if (symlink(target, job->dst) == -1 &&
+      (errno != EEXIST || unlink(job->dst) == -1 ||
+       symlink(target, job->dst) == -1)) {
+    copy_error(plan, job->dst, errno);
+    return;
+  }
+  utimensat(AT_FDCWD, job->dst, job->times, AT_SYMLINK_NOFOLLOW);
+  plan->done++;
+}
+
+// Copies the planned links and files, then gives the directories their
+// modes and times, deepest first so making an entry does not touch them
+// again
+void copy_run(CopyPlan *plan) {
+  for (size_t i = 0; i < plan->links.count; i++) {
+    copy_link(plan, &plan->links.items[i]);
+  }
+
+  CopyRing ring;
+  unsigned entries = 2 * (unsigned)plan->depth;
+  plan->uring = !plan->sync && plan->files.count > 0 &&
+                copy_ring_init(&ring, entries);
+  if (plan->uring) {
+    copy_files_ring(plan, &ring);
+    copy_ring_free(&ring);
+  } else {
+    for (size_t i = 0; i < plan->files.count; i++) {
+      copy_file_sync(plan, &plan->files.items[i]);
+    }
+  }
+
+  for (size_t i = plan->dirs.count; i > 0; i--) {
+    const CopyJob *dir = &plan->dirs.items[i - 1];
+    if (chmod(dir->dst, dir->mode & 07777) == -1 ||
+        utimensat(AT_FDCWD, dir->dst, dir->times, 0) == -1)
+      copy_error(plan, dir->dst, errno);
+  }
+}
+
+// Removes what a move copied from another filesystem
+static void remove_sources(CopyPlan *plan) {
+  const CopyList *lists[] = {&plan->files, &plan->links};
+  for (size_t l = 0; l < 2; l++) {
+    for (size_t i = 0; i < lists[l]->count; i++) {
+      if (unlink(lists[l]->items[i].src) == -1)
+        copy_error(plan, lists[l]->items[i].src, errno);
+    }
+  }
+  for (size_t i = plan->dirs.count; i > 0; i--) {
+    if (rmdir(plan->dirs.items[i - 1].src) == -1)
+      copy_error(plan, plan->dirs.items[i - 1].src, errno);
+  }
+}
+
+static void report(const CopyPlan *plan, size_t moved, uint64_t start) {
+  double seconds = (stats_now() - start) / 1e9;
+  double mib = plan->bytes / 1048576.0;
+  fprintf(stderr, "%s: %zu files, %.1f MiB in %.3f s", plan->name,
+          plan->done + moved, mib, seconds);
+  if (seconds > 0 && plan->bytes > 0)
+    fprintf(stderr, ", %.1f MiB/s", mib / seconds);
+  if (plan->bytes > 0 && plan->uring)
+    fprintf(stderr, " (io_uring, %zu in flight)", plan->depth);
+  else if (plan->bytes > 0)
+    fprintf(stderr, " (copy_file_range)");
+  fprintf(stderr, "\n");
+}
+
+// Where `src` goes: into `dest` under its own name, or to `dest` itself
+static void target_for(const char *src, const char *dest, bool into,
+                       char *out, size_t size) {
+  if (!into) {
+    snprintf(out, size, "%s", dest);
+    return;
+  }
+  size_t len = strlen(src);
+  while (len > 1 && src[len - 1] == '/') {
+    len--;
+  }
+  const char *base = src + len;
+  while (base > src && base[-1] != '/') {
+    base--;
+  }
+  snprintf(out, size, "%s/%.*s", dest, (int)(src + len - base), base);
+}
+
+// ucp/umv [-q] [-s] [-j depth] source... dest
+static void copy_builtin(const Command *cmd, bool move) {
+  CopyPlan plan = {.depth = COPY_DEPTH, .name = cmd->argv[0]};
+  bool quiet = false;
+  bool bad = false;
+  int i = 1;
+  for (; i < cmd->argc && cmd->argv[i][0] == '-' && !bad; i++) {
+    const char *arg = cmd->argv[i];
+    if (strcmp(arg, "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(arg, "-q") == 0) {
+      quiet = true;
+    } else if (strcmp(arg, "-s") == 0) {
+      plan.sync = true;
+    } else if (strcmp(arg, "-j") == 0 && i + 1 < cmd->argc) {
+      char *end;
+      long depth = strtol(cmd->argv[++i], &end, 10);
+      bad = *end || depth < 1 || depth > COPY_MAX_DEPTH;
+      plan.depth = depth;
+    } else {
+      bad = true;
+    }
+  }
+  int sources = cmd->argc - i - 1;
+  if (sources < 1 || bad) {
+    fprintf(stderr,
+            "%s: usage: %s [-q] [-s] [-j depth] source... destination\n",
+            plan.name, plan.name);
+    last_status = 2;
+    return;
+  }
+
+  const char *dest = cmd->argv[cmd->argc - 1];
+  struct stat st;
+  bool into = stat(dest, &st) == 0 && S_ISDIR(st.st_mode);
+  if (sources > 1 && !into) {
+    fprintf(stderr, "%s: %s: not a directory\n", plan.name, dest);
+    last_status = 1;
+    return;
+  }
+
+  uint64_t start = stats_now();
+  size_t moved = 0;
+  for (int s = i; s < cmd->argc - 1; s++) {
+    const char *src = cmd->argv[s];
+    char target[PATH_MAX];
+    target_for(src, dest, into, target, sizeof(target));
+    if (!move) {
+      copy_plan_add(&plan, src, target);
+      continue;
+    }
+    if (rename(src, target) == 0) {
+      moved++;
+      continue;
+    }
+    if (errno != EXDEV) {
+      copy_error(&plan, src, errno);
+      continue;
+    }
+
+    // Across filesystems a move is a copy, and the source goes only if
+    // all of it arrived
+    CopyPlan across = plan;
+    across.dirs = across.files = across.links = (CopyList){0};
+    across.failed = false;
+    if (copy_plan_add(&across, src, target)) {
+      copy_run(&across);
+      if (!across.failed)
+        remove_sources(&across);
+    }
+    plan.failed = plan.failed || across.failed;
+    plan.bytes += across.bytes;
+    plan.done += across.done;
+    plan.uring = plan.uring || across.uring;
+    copy_plan_free(&across);
+  }
+  if (!move)
+    copy_run(&plan);
+
+  if (!quiet)
+    report(&plan, moved, start);
+  last_status = plan.failed ? 1 : 0;
+  copy_plan_free(&plan);
+}
+
+void ucp_builtin(const Command *cmd) { copy_builtin(cmd, false); }
+
+void umv_builtin(const Command *cmd) { copy_builtin(cmd, true); }
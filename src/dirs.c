@@ -0,0 +1,727 @@
+#include "dirs.h"
+#include "expand.h"
+#include "stats.h"
+#include "vars.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static WordList stack = {0}; // saved directories, most recent first
+static DirIndex visited = {0};
+
+/***********************************************
+ * CD
+ ***********************************************/
+
+// $PWD while it still names the current directory, which spares a
+// getcwd() walk for every pushd and dirs
+static char *current_dir() {
+  const char *pwd = var_get("PWD");
+  struct stat here;
+  struct stat there;
+  if (pwd && pwd[0] == '/' && stat(".", &here) == 0 &&
+      stat(pwd, &there) == 0 && here.st_dev == there.st_dev &&
+      here.st_ino == there.st_ino)
+    return shell_strdup(pwd);
+
+  char *cwd = getcwd(NULL, 0);
+  return cwd ? cwd : shell_strdup(".");
+}
+
+// Changes directory, keeps $PWD and $OLDPWD up to date and records the
+// visit for `z`
+bool dirs_chdir(const char *path, bool announce) {
+  char *old = current_dir();
+  if (chdir(path) != 0) {
+    fprintf(stderr, "cd: %s: %s\n", path, strerror(errno));
+    free(old);
+    return false;
+  }
+
+  char *cwd = getcwd(NULL, 0);
+  if (!cwd)
+    cwd = shell_strdup(path);
+  var_set("OLDPWD", old, 0);
+  var_set("PWD", cwd, 0);
+  if (announce)
+    printf("%s\n", cwd);
+  dirs_visit(cwd);
+  free(old);
+  free(cwd);
+  return true;
+}
+
+// Where `cd target` goes: ~ is $HOME, - is $OLDPWD, and other relative
+// names are looked up in $CDPATH. Sets `announce` when the shell should
+// print the directory it ends up in.
+static char *resolve(const char *target, bool *announce) {
+  *announce = false;
+  if (strcmp(target, "-") == 0) {
+    const char *old = var_get("OLDPWD");
+    if (!old || !*old) {
+      fprintf(stderr, "cd: OLDPWD not set\n");
+      return NULL;
+    }
+    *announce = true;
+    return shell_strdup(old);
+  }
+
+  if (target[0] == '~' && (target[1] == '\0' || target[1] == '/')) {
+    const char *home = var_get("HOME");
+    if (!home) {
+      fprintf(stderr, "cd: HOME not set\n");
+      return NULL;
+    }
+    Buffer path;
+    buffer_init(&path);
+    buffer_append_str(&path, home);
+    buffer_append_str(&path, target + 1);
+    return buffer_detach(&path);
+  }
+
+  const char *cdpath = var_get("CDPATH");
+  bool searched = target[0] != '/' && strcmp(target, ".") != 0 &&
+                  strcmp(target, "..") != 0 && strncmp(target, "./", 2) != 0 &&
+                  strncmp(target, "../", 3) != 0;
+  for (const char *p = cdpath; searched && p && *p;) {
+    size_t len = strcspn(p, ":");
+    Buffer path;
+    buffer_init(&path);
+    if (len == 0)
+      buffer_push(&path, '.');
+    else
+      buffer_append(&path, p, len);
+    buffer_push(&path, '/');
+    buffer_append_str(&path, target);
+
+    struct stat st;
+    if (stat(path.data, &st) == 0 && S_ISDIR(st.st_mode)) {
+      *announce = len > 0 && !(len == 1 && *p == '.');
+      return buffer_detach(&path);
+    }
+    buffer_free(&path);
+    p += len + (p[len] == ':');
+  }
+  return shell_strdup(target);
+}
+
+void change_dir(const Command *cmd) {
+  const char *target = cmd->argc > 1 ? cmd->argv[1] : var_get("HOME");
+  if (!target) {
+    fprintf(stderr, "cd: HOME not set\n");
+    last_status = 1;
+    return;
+  }
+
+  bool announce;
+  char *path = resolve(target, &announce);
+  last_status = path && dirs_chdir(path, announce) ? 0 : 1;
+  free(path);
+}
+
+/***********************************************
+ * DIRECTORY STACK
+ ***********************************************/
+
+static void stack_insert(size_t at, char *dir) {
+  wordlist_push(&stack, dir);
+  memmove(stack.words + at + 1, stack.words + at,
+          (stack.count - 1 - at) * sizeof(char *));
+  stack.words[at] = dir;
+}
+
+static void stack_remove(size_t at) {
+  free(stack.words[at]);
+  memmove(stack.words + at, stack.words + at + 1,
+          (stack.count - 1 - at) * sizeof(char *));
+  stack.count--;
+}
+
+static void print_dir(const char *dir, bool long_form) {
+  const char *home = var_get("HOME");
+  size_t len = home ? strlen(home) : 0;
+  if (!long_form && len > 1 && strncmp(dir, home, len) == 0 &&
+      (dir[len] == '/' || dir[len] == '\0')) {
+    printf("~%s", dir + len);
+  } else {
+    printf("%s", dir);
+  }
+}
+
+// The current directory, then the stack
+static void print_stack(bool long_form, bool numbered) {
+  char *cwd = current_dir();
+  for (size_t i = 0; i <= stack.count; i++) {
+    if (numbered)
+      printf("%2zu  ", i);
+    else if (i > 0)
+      putchar(' ');
+    print_dir(i == 0 ? cwd : stack.words[i - 1], long_form);
+    if (numbered)
+      putchar('\n');
+  }
+  if (!numbered)
+    putchar('\n');
+  free(cwd);
+}
+
+// "+N" as an index into the current directory and the stack
+static bool stack_index(const char *arg, const char *builtin, size_t *n) {
+  char *end;
+  long value = strtol(arg + 1, &end, 10);
+  if (arg[0] != '+' || end == arg + 1 || *end || value < 0 ||
+      (size_t)value > stack.count) {
+    fprintf(stderr, "%s: %s: directory stack index out of range\n", builtin,
+            arg);
+    return false;
+  }
+  *n = value;
+  return true;
+}
+
+// pushd dir: cd, saving the old directory on the stack. pushd alone swaps
+// the top two directories; pushd +N rotates the Nth to the top.
+void pushd_builtin(const Command *cmd) {
+  last_status = 1;
+  if (cmd->argc > 2) {
+    fprintf(stderr, "pushd: usage: pushd [dir | +N]\n");
+    last_status = 2;
+    return;
+  }
+  const char *arg = cmd->argc > 1 ? cmd->argv[1] : NULL;
+  if (!arg && stack.count == 0) {
+    fprintf(stderr, "pushd: no other directory\n");
+    return;
+  }
+
+  char *cwd = current_dir();
+  if (!arg || arg[0] == '+') {
+    size_t n = 1;
+    if (arg && !stack_index(arg, "pushd", &n)) {
+      free(cwd);
+      return;
+    }
+    if (n == 0) {
+      free(cwd);
+      print_stack(false, false);
+      last_status = 0;
+      return;
+    }
+    if (!dirs_chdir(stack.words[n - 1], false)) {
+      free(cwd);
+      return;
+    }
+    // [cwd, s0 .. sn-1 .. ] becomes [sn-1 .., cwd, s0 ..]: the directories
+    // before the new top go, in order, to the bottom
+    WordList rotated;
+    wordlist_init(&rotated);
+    for (size_t i = n; i < stack.count; i++) {
+      wordlist_push(&rotated, stack.words[i]);
+    }
+    wordlist_push(&rotated, cwd);
+    for (size_t i = 0; i + 1 < n; i++) {
+      wordlist_push(&rotated, stack.words[i]);
+    }
+    free(stack.words[n - 1]);
+    free(stack.words);
+    stack = rotated;
+  } else {
+    bool announce;
+    char *path = resolve(arg, &announce);
+    if (!path || !dirs_chdir(path, false)) {
+      free(path);
+      free(cwd);
+      return;
+    }
+    free(path);
+    stack_insert(0, cwd);
+  }
+  print_stack(false, false);
+  last_status = 0;
+}
+
+// popd: cd to the top of the stack and drop it; popd +N drops the Nth
+// directory without moving
+void popd_builtin(const Command *cmd) {
+  last_status = 1;
+  if (stack.count == 0) {
+    fprintf(stderr, "popd: directory stack empty\n");
+    return;
+  }
+  size_t n = 0;
+  if (cmd->argc > 2) {
+    fprintf(stderr, "popd: usage: popd [+N]\n");
+    last_status = 2;
+    return;
+  }
+  if (cmd->argc == 2 && !stack_index(cmd->argv[1], "popd", &n))
+    return;
+
+  if (n == 0) {
+    if (!dirs_chdir(stack.words[0], false))
+      return;
+    stack_remove(0);
+  } else {
+    stack_remove(n - 1);
+  }
+  print_stack(false, false);
+  last_status = 0;
+}
+
+// dirs [-c] [-l] [-v]: clears, or prints without ~, or one per line
+// numbered
+void dirs_builtin(const Command *cmd) {
+  bool clear = false;
+  bool long_form = false;
+  bool numbered = false;
+  bool valid = true;
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    valid = valid && arg[0] == '-' && arg[1];
+    for (const char *c = arg + 1; valid && *c; c++) {
+      clear |= *c == 'c';
+      long_form |= *c == 'l';
+      numbered |= *c == 'v';
+      valid = strchr("clv", *c) != NULL;
+    }
+  }
+  if (!valid) {
+    fprintf(stderr, "dirs: usage: dirs [-c] [-l] [-v]\n");
+    last_status = 2;
+    return;
+  }
+
+  if (clear) {
+    while (stack.count > 0)
+      stack_remove(stack.count - 1);
+  } else {
+    print_stack(long_form, numbered);
+  }
+  last_status = 0;
+}
+
+/***********************************************
+ * FRECENCY INDEX
+ ***********************************************/
+
+// $DIRS_INDEX, or shell-dirs under the user's data directory
+const char *dirs_index_path() {
+  static char path[PATH_MAX];
+  const char *base = var_get("DIRS_INDEX");
+  if (base && *base) {
+    snprintf(path, sizeof(path), "%s", base);
+  } else if ((base = var_get("XDG_DATA_HOME")) && *base) {
+    snprintf(path, sizeof(path), "%s/" DIRS_INDEX_NAME, base);
+  } else {
+    base = var_get("HOME");
+    snprintf(path, sizeof(path), "%s/.local/share/" DIRS_INDEX_NAME,
+             base ? base : "/tmp");
+  }
+  return path;
+}
+
+static void make_parents(const char *file) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", file);
+  for (char *slash = strchr(path + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(path, 0700);
+    *slash = '/';
+  }
+}
+
+// Appends one visit to the journal; the index itself is not touched, so
+// `cd` never pays for loading it
+void dirs_visit(const char *path) {
+  const char *home = var_get("HOME");
+  if ((home && strcmp(path, home) == 0) || strchr(path, '\n'))
+    return;
+
+  char line[PATH_MAX + 64];
+  int len = snprintf(line, sizeof(line), "1|%lld|%s\n", (long long)time(NULL),
+                     path);
+  if (len < 0 || (size_t)len >= sizeof(line))
+    return;
+
+  const char *file = dirs_index_path();
+  int fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd == -1 && errno == ENOENT) {
+    make_parents(file);
+    fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  }
+  // An unwritable index must not make cd fail
+  if (fd != -1) {
+    ssize_t written = write(fd, line, len);
+    (void)written;
+    close(fd);
+  }
+}
+
+static void forget_index() {
+  buffer_free(&visited.arena);
+  buffer_free(&visited.folded);
+  free(visited.entries);
+  free(visited.slots);
+  visited = (DirIndex){0};
+}
+
+static uint32_t hash_path(const char *path, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)path[i]) * 16777619u;
+  }
+  return hash;
+}
+
+static const char *entry_path(const DirEntry *entry) {
+  return visited.arena.data + entry->path;
+}
+
+static void grow_slots() {
+  size_t cap = visited.slot_cap ? visited.slot_cap * 2 : 1024;
+  uint32_t *slots = (uint32_t *)shell_calloc(cap, sizeof(uint32_t));
+  for (size_t i = 0; i < visited.count; i++) {
+    size_t slot = visited.entries[i].hash & (cap - 1);
+    while (slots[slot])
+      slot = (slot + 1) & (cap - 1);
+    slots[slot] = i + 1;
+  }
+  free(visited.slots);
+  visited.slots = slots;
+  visited.slot_cap = cap;
+}
+
+static DirEntry *entry_for(const char *path, size_t len) {
+  if ((visited.count + 1) * 2 > visited.slot_cap)
+    grow_slots();
+
+  uint32_t hash = hash_path(path, len);
+  size_t slot = hash & (visited.slot_cap - 1);
+  while (visited.slots[slot]) {
+    DirEntry *entry = &visited.entries[visited.slots[slot] - 1];
+    if (entry->hash == hash && entry->len == len &&
+        memcmp(entry_path(entry), path, len) == 0)
+      return entry;
+    slot = (slot + 1) & (visited.slot_cap - 1);
+  }
+
+  if (visited.count == visited.cap) {
+    visited.cap = visited.cap ? visited.cap * 2 : 256;
+    visited.entries = (DirEntry *)shell_realloc(
+        visited.entries, visited.cap * sizeof(DirEntry));
+  }
+  DirEntry *entry = &visited.entries[visited.count++];
+  *entry = (DirEntry){.path = visited.arena.len, .len = len, .hash = hash};
+  buffer_append(&visited.arena, path, len);
+  buffer_push(&visited.arena, '\0');
+  for (size_t i = 0; i < len; i++) {
+    buffer_push(&visited.folded, tolower((unsigned char)path[i]));
+  }
+  buffer_push(&visited.folded, '\0');
+  visited.slots[slot] = visited.count;
+  return entry;
+}
+
+// One "rank|time|path" record
+static void fold_line(const char *line, size_t len) {
+  char *end;
+  double rank = strtod(line, &end);
+  if (*end != '|')
+    return;
+  long long when = strtoll(end + 1, &end, 10);
+  if (*end != '|' || end[1] != '/')
+    return;
+  const char *path = end + 1;
+  DirEntry *entry = entry_for(path, line + len - path);
+  entry->rank += rank;
+  if (when > entry->time)
+    entry->time = when;
+  visited.lines++;
+}
+
+static void fold_journal();
+
+// Rewrites the journal with one record per directory, aging every rank
+// once their total passes DIRS_MAX_RANK; directories that fall below one
+// visit are dropped
+static void compact(const char *file) {
+  double total = 0;
+  for (size_t i = 0; i < visited.count; i++) {
+    total += visited.entries[i].rank;
+  }
+  bool aging = total > DIRS_MAX_RANK;
+  if (!aging && visited.lines <= 2 * visited.count + DIRS_COMPACT_SLACK)
+    return;
+
+  char tmp[PATH_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d", file, (int)getpid());
+  FILE *out = fopen(tmp, "we");
+  if (!out)
+    return;
+  double scale = aging ? DIRS_AGED_RANK / total : 1;
+  for (size_t i = 0; i < visited.count; i++) {
+    const DirEntry *entry = &visited.entries[i];
+    double rank = entry->rank * scale;
+    if (rank >= 1 || !aging)
+      fprintf(out, "%.6g|%lld|%s\n", rank, (long long)entry->time,
+              entry_path(entry));
+  }
+  if (fclose(out) != 0 || rename(tmp, file) != 0) {
+    unlink(tmp);
+    return;
+  }
+  forget_index();
+  fold_journal();
+}
+
+// Brings the index up to date with the journal: the first call reads it
+// all, later ones only what this and other shells have appended since
+static void fold_journal() {
+  const char *file = dirs_index_path();
+  int fd = open(file, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    if (fd != -1)
+      close(fd);
+    visited.loaded = true;
+    return;
+  }
+  if (visited.loaded &&
+      (st.st_ino != visited.inode || st.st_size < visited.read_to))
+    forget_index(); // compacted by another shell
+  visited.loaded = true;
+  visited.inode = st.st_ino;
+
+  size_t len = st.st_size - visited.read_to;
+  char *data = len ? (char *)shell_malloc(len) : NULL;
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = pread(fd, data + got, len - got, visited.read_to + got);
+    if (n <= 0)
+      break;
+    got += n;
+  }
+  close(fd);
+
+  // A record still being written is left for next time
+  const char *p = data;
+  const char *end = data + got;
+  const char *nl;
+  while (p < end && (nl = memchr(p, '\n', end - p)) != NULL) {
+    fold_line(p, nl - p);
+    p = nl + 1;
+  }
+  visited.read_to += p - data;
+  free(data);
+  compact(file);
+}
+
+const DirIndex *dirs_index() {
+  fold_journal();
+  return &visited;
+}
+
+// Installs an index loaded elsewhere, taking over its buffers. Only the
+// hash table is rebuilt; what was appended to the journal since `index`
+// was saved is read on first use, as for an index loaded here.
+void dirs_adopt(const DirIndex *index) {
+  forget_index();
+  visited = *index;
+  visited.loaded = true;
+  visited.cap = visited.count;
+  visited.slots = NULL;
+  visited.slot_cap = 512;
+  while (visited.slot_cap < visited.count + 1)
+    visited.slot_cap *= 2;
+  grow_slots();
+}
+
+// Rank weighted by how recently the directory was visited, as z does
+double dirs_frecency(const DirEntry *entry, time_t now) {
+  time_t age = now - entry->time;
+  if (age < 60 * 60)
+    return entry->rank * 4;
+  if (age < 24 * 60 * 60)
+    return entry->rank * 2;
+  if (age < 7 * 24 * 60 * 60)
+    return entry->rank / 2;
+  return entry->rank / 4;
+}
+
+/***********************************************
+ * LOOKUP
+ ***********************************************/
+
+typedef struct DirMatch {
+  const DirEntry *entry;
+  double score;
+} DirMatch;
+
+static int compare_matches(const void *a, const void *b) {
+  const DirMatch *x = (const DirMatch *)a;
+  const DirMatch *y = (const DirMatch *)b;
+  if (x->score != y->score)
+    return x->score < y->score ? 1 : -1;
+  return (int)x->entry->len - (int)y->entry->len;
+}
+
+// The entry whose path holds arena offset `at`; entries are in arena order
+static size_t entry_at(size_t at) {
+  size_t low = 0;
+  size_t high = visited.count;
+  while (high - low > 1) {
+    size_t mid = low + (high - low) / 2;
+    if (visited.entries[mid].path <= at)
+      low = mid;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+// Whether terms[1..] occur in order in text[from..end)
+static bool rest_match(const char *text, size_t from, size_t end,
+                       char *const *terms, size_t count) {
+  for (size_t i = 1; i < count; i++) {
+    size_t len = strlen(terms[i]);
+    const char *hit = (const char *)memmem(text + from, end - from, terms[i],
+                                           len);
+    if (!hit)
+      return false;
+    from = hit - text + len;
+  }
+  return true;
+}
+
+static void add_match(DirMatch **found, size_t *count, size_t *cap,
+                      const DirEntry *entry, time_t now) {
+  if (*count == *cap) {
+    *cap = *cap ? *cap * 2 : 16;
+    *found = (DirMatch *)shell_realloc(*found, *cap * sizeof(DirMatch));
+  }
+  (*found)[(*count)++] =
+      (DirMatch){.entry = entry, .score = dirs_frecency(entry, now)};
+}
+
+// Every visited directory whose path holds the terms in order, best
+// first. Lowercase terms match either case. Rather than testing each path,
+// the first term is searched for through the whole arena at once and only
+// the paths it hits are looked at further.
+static size_t collect(char *const *terms, size_t count, DirMatch **out) {
+  fold_journal();
+  bool fold_case = true;
+  for (size_t i = 0; i < count; i++) {
+    for (const char *c = terms[i]; *c; c++) {
+      if (isupper((unsigned char)*c))
+        fold_case = false;
+    }
+  }
+
+  DirMatch *found = NULL;
+  size_t found_count = 0;
+  size_t found_cap = 0;
+  time_t now = time(NULL);
+  const Buffer *text = fold_case ? &visited.folded : &visited.arena;
+  if (count == 0) {
+    for (size_t i = 0; i < visited.count; i++) {
+      add_match(&found, &found_count, &found_cap, &visited.entries[i], now);
+    }
+  }
+  size_t first_len = count ? strlen(terms[0]) : 0;
+  size_t at = 0;
+  while (count > 0 && at < text->len) {
+    const char *hit = (const char *)memmem(text->data + at, text->len - at,
+                                           terms[0], first_len);
+    if (!hit)
+      break;
+    const DirEntry *entry = &visited.entries[entry_at(hit - text->data)];
+    size_t end = entry->path + entry->len;
+    if (rest_match(text->data, hit - text->data + first_len, end, terms,
+                   count))
+      add_match(&found, &found_count, &found_cap, entry, now);
+    at = end + 1;
+  }
+  qsort(found, found_count, sizeof(DirMatch), compare_matches);
+  *out = found;
+  return found_count;
+}
+
+// The best match that still exists and is not where the shell already is
+const char *dirs_best(char *const *terms, size_t count) {
+  DirMatch *found;
+  size_t found_count = collect(terms, count, &found);
+  const char *pwd = var_get("PWD");
+  const char *best = NULL;
+  for (size_t i = 0; i < found_count && !best; i++) {
+    const char *path = entry_path(found[i].entry);
+    struct stat st;
+    if ((!pwd || strcmp(path, pwd) != 0) && stat(path, &st) == 0 &&
+        S_ISDIR(st.st_mode))
+      best = path;
+  }
+  free(found);
+  return best;
+}
+
+// z [-l] [-e] terms...: goes to the highest-ranked visited directory whose
+// path contains the terms in order. -l lists the candidates instead, best
+// last; -e prints the choice.
+void z_builtin(const Command *cmd) {
+  bool list = false;
+  bool echo = false;
+  int i = 1;
+  for (; i < cmd->argc && cmd->argv[i][0] == '-' && cmd->argv[i][1]; i++) {
+    for (const char *c = cmd->argv[i] + 1; *c; c++) {
+      if (*c == 'l') {
+        list = true;
+      } else if (*c == 'e') {
+        echo = true;
+      } else {
+        fprintf(stderr, "z: usage: z [-l] [-e] terms...\n");
+        last_status = 2;
+        return;
+      }
+    }
+  }
+  char *const *terms = cmd->argv + i;
+  size_t count = cmd->argc - i;
+
+  if (list || count == 0) {
+    DirMatch *found;
+    size_t found_count = collect(terms, count, &found);
+    size_t shown = found_count < DIRS_LIST_LIMIT ? found_count
+                                                 : DIRS_LIST_LIMIT;
+    for (size_t j = shown; j > 0; j--) {
+      printf("%-10.1f %s\n", found[j - 1].score,
+             entry_path(found[j - 1].entry));
+    }
+    free(found);
+    last_status = found_count ? 0 : 1;
+    return;
+  }
+
+  const char *best = dirs_best(terms, count);
+  if (!best) {
+    fprintf(stderr, "z: no match\n");
+    last_status = 1;
+  } else if (echo) {
+    printf("%s\n", best);
+    last_status = 0;
+  } else {
+    // The visit is journaled; the arena holding `best` is left alone
+    last_status = dirs_chdir(best, false) ? 0 : 1;
+  }
+}
+
+void dirs_free() {
+  wordlist_free(&stack);
+  wordlist_init(&stack);
+  forget_index();
+}
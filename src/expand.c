@@ -0,0 +1,396 @@
+#include "expand.h"
+#include "arith.h"
+#include "buffer.h"
+#include "glob_expand.h"
+#include "subst.h"
+#include "shell.h"
+#include "vars.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct Expander {
+  WordList *out;
+  Buffer field;
+  Buffer pattern;  // the field with quoted glob characters escaped
+  bool have_field; // set once a field exists, even if it is empty ("")
+  bool has_magic;  // an unquoted glob character was seen in the field
+  bool split;      // split unquoted results into fields and expand globs
+} Expander;
+
+/***********************************************
+ * WORD LISTS
+ ***********************************************/
+
+void wordlist_init(WordList *list) {
+  list->words = NULL;
+  list->count = 0;
+  list->cap = 0;
+}
+
+void wordlist_push(WordList *list, char *word) {
+  if (list->count + 1 >= list->cap) {
+    size_t cap = list->cap ? list->cap * 2 : 8;
+    char **words = (char **)realloc(list->words, cap * sizeof(char *));
+    if (!words) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+    list->words = words;
+    list->cap = cap;
+  }
+  list->words[list->count++] = word;
+  list->words[list->count] = NULL;
+}
+
+void wordlist_free(WordList *list) {
+  for (size_t i = 0; i < list->count; i++) {
+    free(list->words[i]);
+  }
+  free(list->words);
+  wordlist_init(list);
+}
+
+/***********************************************
+ * FIELD BUILDING
+ ***********************************************/
+
+static void flush_field(Expander *ex) {
+  if (!ex->have_field)
+    return;
+
+  // Globs stream straight into the output list; no match keeps the word. A
+  // lone `[`, as in the test builtin, never touches the filesystem.
+  if (ex->has_magic && ex->split && glob_has_magic(ex->pattern.data) &&
+      glob_expand(ex->pattern.data, ex->out) > 0) {
+    buffer_clear(&ex->field);
+  } else {
+    wordlist_push(ex->out, buffer_detach(&ex->field));
+  }
+
+  buffer_clear(&ex->pattern);
+  ex->have_field = false;
+  ex->has_magic = false;
+}
+
+static void append_char(Expander *ex, char c, bool quoted) {
+  buffer_push(&ex->field, c);
+  ex->have_field = true;
+  if (!ex->split)
+    return;
+
+  if (quoted && strchr("*?[]\\", c)) {
+    buffer_push(&ex->pattern, '\\');
+  } else if (!quoted && (c == '*' || c == '?' || c == '[')) {
+    ex->has_magic = true;
+  }
+  buffer_push(&ex->pattern, c);
+}
+
+static void append_literal(Expander *ex, const char *text, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    append_char(ex, text[i], true);
+  }
+  ex->have_field = true;
+}
+
+// Appends the result of an expansion. Unquoted results are split on IFS
+// whitespace and remain subject to pathname expansion.
+static void append_expanded(Expander *ex, const char *text, bool quoted) {
+  if (quoted || !ex->split) {
+    append_literal(ex, text, strlen(text));
+    return;
+  }
+
+  for (const char *p = text; *p; p++) {
+    if (*p == ' ' || *p == '\t' || *p == '\n') {
+      flush_field(ex);
+    } else {
+      append_char(ex, *p, false);
+    }
+  }
+}
+
+/***********************************************
+ * PARAMETER EXPANSION
+ ***********************************************/
+
+// $@ and $*. Quoted "$@" keeps each parameter a separate field; everything
+// else joins them with spaces first.
+static void append_positional(Expander *ex, bool separate, bool quoted) {
+  int count = vars_positional_count();
+  if (separate && count == 0 && ex->field.len == 0) {
+    ex->have_field = false;
+    return;
+  }
+
+  for (int i = 1; i <= count; i++) {
+    if (i > 1) {
+      if (separate)
+        flush_field(ex);
+      else
+        append_expanded(ex, " ", quoted);
+      ex->have_field = true;
+    }
+    append_expanded(ex, var_positional(i), quoted);
+  }
+}
+
+// Expands the parameter starting after '$' and returns the number of source
+// bytes consumed, or 0 when the '$' should be taken literally.
+static size_t expand_parameter(Expander *ex, const char *src, bool quoted) {
+  char number[32];
+
+  if (*src == '?') {
+    snprintf(number, sizeof(number), "%d", last_status);
+    append_expanded(ex, number, quoted);
+    return 1;
+  }
+
+  if (*src == '$') {
+    snprintf(number, sizeof(number), "%d", (int)getpid());
+    append_expanded(ex, number, quoted);
+    return 1;
+  }
+
+  if (*src == '#') {
+    snprintf(number, sizeof(number), "%d", vars_positional_count());
+    append_expanded(ex, number, quoted);
+    return 1;
+  }
+
+  if (*src == '@' || *src == '*') {
+    append_positional(ex, quoted && *src == '@', quoted);
+    return 1;
+  }
+
+  if (isdigit((unsigned char)*src)) {
+    const char *value = var_positional(*src - '0');
+    if (value)
+      append_expanded(ex, value, quoted);
+    return 1;
+  }
+
+  if (*src == '{') {
+    const char *close = strchr(src, '}');
+    if (close && close > src + 1 &&
+        strspn(src + 1, "0123456789") == (size_t)(close - src - 1)) {
+      const char *value = var_positional(atoi(src + 1));
+      if (value)
+        append_expanded(ex, value, quoted);
+      return close - src + 1;
+    }
+    if (!close || !var_is_valid_name(src + 1, close - src - 1))
+      return 0;
+    char *name = strndup(src + 1, close - src - 1);
+    const char *value = var_get(name);
+    free(name);
+    if (value)
+      append_expanded(ex, value, quoted);
+    return close - src + 1;
+  }
+
+  size_t len = 0;
+  if (isalpha((unsigned char)*src) || *src == '_') {
+    while (isalnum((unsigned char)src[len]) || src[len] == '_')
+      len++;
+  }
+  if (len == 0)
+    return 0;
+
+  char *name = strndup(src, len);
+  const char *value = var_get(name);
+  free(name);
+  if (value)
+    append_expanded(ex, value, quoted);
+  return len;
+}
+
+/***********************************************
+ * COMMAND SUBSTITUTION
+ ***********************************************/
+
+// $((expr)): parameters and substitutions inside expand first
+static void expand_arithmetic(Expander *ex, const char *src, size_t len,
+                              bool quoted) {
+  char *body = strndup(src + 3, len - 5);
+  char *expr = strpbrk(body, "$`\\'\"") ? expand_word_single(body) : body;
+  long value;
+  char number[32] = "";
+
+  if (arith_eval(expr, &value)) {
+    snprintf(number, sizeof(number), "%ld", value);
+  } else {
+    last_status = 1;
+  }
+  append_expanded(ex, number, quoted);
+
+  if (expr != body)
+    free(expr);
+  free(body);
+}
+
+// Expands the $(...), $((...)) or `...` at src, of total length len
+static void expand_substitution(Expander *ex, const char *src, size_t len,
+                                bool quoted) {
+  if (len >= 5 && strncmp(src, "$((", 3) == 0 &&
+      strncmp(src + len - 2, "))", 2) == 0) {
+    expand_arithmetic(ex, src, len, quoted);
+    return;
+  }
+
+  Buffer body;
+  buffer_init(&body);
+
+  if (src[0] == '`') {
+    size_t end = len > 1 && src[len - 1] == '`' ? len - 1 : len;
+    for (size_t i = 1; i < end; i++) {
+      if (src[i] == '\\' && i + 1 < end && strchr("$`\\", src[i + 1]))
+        i++;
+      buffer_push(&body, src[i]);
+    }
+  } else {
+    size_t end = len > 2 && src[len - 1] == ')' ? len - 1 : len;
+    buffer_append(&body, src + 2, end - 2);
+  }
+
+  Buffer output;
+  buffer_init(&output);
+  command_substitute(body.data ? body.data : "", &output);
+  append_expanded(ex, output.data ? output.data : "", quoted);
+  if (quoted)
+    ex->have_field = true;
+
+  buffer_free(&output);
+  buffer_free(&body);
+}
+
+/***********************************************
+ * WORD EXPANSION
+ ***********************************************/
+
+// Expands the inside of double quotes up to the closing quote, or the
+// whole of a here-document body, where `"` is an ordinary character.
+// Returns where expansion stopped.
+static const char *expand_quoted(Expander *ex, const char *p, bool heredoc) {
+  const char *escapable = heredoc ? "$\\`" : "$\"\\`";
+  while (*p && (heredoc || *p != '"')) {
+    if (*p == '\\' && p[1] && strchr(escapable, p[1])) {
+      append_literal(ex, p + 1, 1);
+      p += 2;
+    } else if (*p == '\\' && p[1] == '\n' && heredoc) {
+      p += 2;
+    } else if ((*p == '$' || *p == '`') && substitution_length(p) > 0) {
+      size_t len = substitution_length(p);
+      expand_substitution(ex, p, len, true);
+      p += len;
+    } else if (*p == '$') {
+      size_t used = expand_parameter(ex, p + 1, true);
+      if (used == 0)
+        append_literal(ex, p, 1);
+      p += used + 1;
+    } else {
+      append_literal(ex, p++, 1);
+    }
+  }
+  return p;
+}
+
+static void expand_into(Expander *ex, const char *raw) {
+  const char *p = raw;
+
+  while (*p) {
+    if (*p == '\\' && p[1]) {
+      append_literal(ex, p + 1, 1);
+      p += 2;
+    } else if (*p == '\'') {
+      const char *close = strchr(p + 1, '\'');
+      size_t len = close ? (size_t)(close - p - 1) : strlen(p + 1);
+      append_literal(ex, p + 1, len);
+      p += len + (close ? 2 : 1);
+    } else if (*p == '"') {
+      ex->have_field = true;
+      p = expand_quoted(ex, p + 1, false);
+      if (*p == '"')
+        p++;
+    } else if ((*p == '<' || *p == '>') && substitution_length(p) > 0) {
+      size_t len = substitution_length(p);
+      size_t end = p[len - 1] == ')' ? len - 1 : len;
+      char *body = strndup(p + 2, end - 2);
+      char *path = process_substitute(body, *p == '<');
+      append_literal(ex, path, strlen(path));
+      free(path);
+      free(body);
+      p += len;
+    } else if (substitution_length(p) > 0) {
+      size_t len = substitution_length(p);
+      expand_substitution(ex, p, len, false);
+      p += len;
+    } else if (*p == '$') {
+      size_t used = expand_parameter(ex, p + 1, false);
+      if (used == 0)
+        append_literal(ex, p, 1);
+      p += used + 1;
+    } else {
+      append_char(ex, *p++, false);
+    }
+  }
+}
+
+void expand_word(const char *raw, WordList *out) {
+  // Plain words, the common case, need no expander at all
+  if (*raw && !strpbrk(raw, "\\'\"$`*?[<>")) {
+    wordlist_push(out, strdup(raw));
+    return;
+  }
+
+  Expander ex = {.out = out, .have_field = false, .split = true};
+  buffer_init(&ex.field);
+  buffer_init(&ex.pattern);
+  expand_into(&ex, raw);
+  flush_field(&ex);
+  buffer_free(&ex.field);
+  buffer_free(&ex.pattern);
+}
+
+// Only "$@" makes other than one field; they join back with spaces, and
+// with no positional parameters the word is empty
+static char *join_fields(WordList *fields) {
+  Buffer text;
+  buffer_init(&text);
+  for (size_t i = 0; i < fields->count; i++) {
+    if (i > 0)
+      buffer_push(&text, ' ');
+    buffer_append_str(&text, fields->words[i]);
+  }
+  wordlist_free(fields);
+  return buffer_detach(&text);
+}
+
+char *expand_word_single(const char *raw) {
+  WordList fields;
+  wordlist_init(&fields);
+  Expander ex = {.out = &fields, .have_field = true, .split = false};
+  buffer_init(&ex.field);
+  buffer_init(&ex.pattern);
+  expand_into(&ex, raw);
+  flush_field(&ex);
+  buffer_free(&ex.pattern);
+  return join_fields(&fields);
+}
+
+// A here-document body: parameters, substitutions and backslashes before
+// $ ` \ are expanded as in double quotes, and nothing is split
+char *expand_heredoc(const char *body) {
+  WordList fields;
+  wordlist_init(&fields);
+  Expander ex = {.out = &fields, .have_field = true, .split = false};
+  buffer_init(&ex.field);
+  buffer_init(&ex.pattern);
+  expand_quoted(&ex, body, true);
+  flush_field(&ex);
+  buffer_free(&ex.pattern);
+  return join_fields(&fields);
+}
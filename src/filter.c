@@ -0,0 +1,1122 @@
+#include "filter.h"
+#include "scan.h"
+#include "stats.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <langinfo.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Output collected between flushes; flushed after each block of input so
+// a slow stream still shows up as it arrives
+static Buffer out = {0};
+
+// Which bytes grep may print as text, from the locale it would run in
+typedef enum TextMode {
+  TEXT_BYTES, // a single-byte locale: anything but NUL
+  TEXT_UTF8,  // lines must be valid UTF-8
+  TEXT_OTHER, // a multibyte encoding left to grep itself
+} TextMode;
+
+/***********************************************
+ * INPUT
+ ***********************************************/
+
+// Takes `fd` as input, mapping it if it is a regular file with something
+// in it. Fails for what cannot be read, like a directory.
+bool filter_open(FilterInput *in, int fd, const char *name) {
+  *in = (FilterInput){.fd = fd, .name = name};
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    in->error = errno;
+    return false;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    in->error = EISDIR;
+    return false;
+  }
+  in->regular = S_ISREG(st.st_mode);
+  in->size = st.st_size;
+  if (!in->regular)
+    return true;
+
+  // Files in /proc say they are empty; those are read like a pipe
+  off_t start = lseek(fd, 0, SEEK_CUR);
+  if (start == -1 || start >= st.st_size)
+    return true;
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return true;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  in->map = (char *)map;
+  in->map_len = st.st_size;
+  in->start = start;
+  return true;
+}
+
+static ssize_t fill(FilterInput *in) {
+  buffer_reserve(&in->buf, FILTER_BLOCK);
+  ssize_t n;
+  do {
+    n = read(in->fd, in->buf.data + in->buf.len, FILTER_BLOCK);
+  } while (n == -1 && errno == EINTR);
+  if (n > 0) {
+    in->buf.len += n;
+  } else {
+    in->eof = true;
+    if (n == -1)
+      in->error = errno;
+  }
+  return n;
+}
+
+// The next block of input, however it falls; a mapped file is one block
+bool filter_read(FilterInput *in, const char **data, size_t *len) {
+  if (in->eof)
+    return false;
+  if (in->map) {
+    in->eof = true;
+    *data = in->map + in->start;
+    *len = in->map_len - in->start;
+    return true;
+  }
+  in->buf.len = 0;
+  in->taken = 0;
+  if (fill(in) <= 0)
+    return false;
+  *data = in->buf.data;
+  *len = in->taken = in->buf.len;
+  return true;
+}
+
+// The next block of whole lines. Only the last block of the input can
+// end without a newline.
+bool filter_lines(FilterInput *in, const char **data, size_t *len) {
+  if (in->map)
+    return filter_read(in, data, len);
+
+  Buffer *buf = &in->buf;
+  if (in->taken > 0) {
+    memmove(buf->data, buf->data + in->taken, buf->len - in->taken);
+    buf->len -= in->taken;
+    in->taken = 0;
+  }
+  while (!in->eof) {
+    size_t before = buf->len;
+    if (fill(in) <= 0)
+      break;
+    const char *nl = (const char *)memrchr(buf->data + before, '\n',
+                                           buf->len - before);
+    if (nl) {
+      in->taken = nl + 1 - buf->data;
+      break;
+    }
+  }
+  if (in->taken == 0)
+    in->taken = buf->len;
+  *data = buf->data;
+  *len = in->taken;
+  return in->taken > 0;
+}
+
+// Lets go of the input, leaving a seekable one positioned just past what
+// was used, as the real commands do. `unread` counts the bytes at the end
+// of the last block that were not.
+void filter_close(FilterInput *in, size_t unread) {
+  if (in->map) {
+    if (in->eof)
+      lseek(in->fd, (off_t)(in->map_len - unread), SEEK_SET);
+    munmap(in->map, in->map_len);
+  } else if (in->regular) {
+    off_t back = (off_t)(unread + in->buf.len - in->taken);
+    if (back > 0)
+      lseek(in->fd, -back, SEEK_CUR);
+  }
+  if (in->fd != STDIN_FILENO)
+    close(in->fd);
+  buffer_free(&in->buf);
+}
+
+// Opens each of `names`, where NULL or "-" is stdin. Fails with nothing
+// read if any cannot be opened, so the real command can say why.
+static bool open_inputs(char *const *names, size_t count,
+                        FilterInput *inputs) {
+  for (size_t i = 0; i < count; i++) {
+    const char *name = names[i];
+    bool stdin_input = !name || strcmp(name, "-") == 0;
+    int fd = stdin_input ? STDIN_FILENO : open(name, O_RDONLY | O_CLOEXEC);
+    if (fd != -1 && filter_open(&inputs[i], fd, name))
+      continue;
+    if (fd > STDIN_FILENO)
+      close(fd);
+    for (size_t j = 0; j < i; j++) {
+      filter_close(&inputs[j], 0);
+    }
+    return false;
+  }
+  return true;
+}
+
+static void read_error(const char *tool, const FilterInput *in) {
+  fprintf(stderr, "%s: %s: %s\n", tool, in->name ? in->name : "-",
+          strerror(in->error));
+}
+
+/***********************************************
+ * OUTPUT
+ ***********************************************/
+
+static void flush_out() {
+  if (out.len > 0)
+    fwrite(out.data, 1, out.len, stdout);
+  out.len = 0;
+  fflush(stdout);
+}
+
+static void emit(const char *data, size_t len) {
+  if (len >= FILTER_BLOCK) {
+    flush_out();
+    fwrite(data, 1, len, stdout);
+    return;
+  }
+  buffer_append(&out, data, len);
+  if (out.len >= FILTER_BLOCK)
+    flush_out();
+}
+
+// A line ending at `eol`, which is its newline or the end of the input;
+// a last line without one gets one, as the real commands give it
+static void emit_line(const char *line, const char *eol, const char *end) {
+  if (eol < end) {
+    emit(line, eol + 1 - line);
+    return;
+  }
+  emit(line, eol - line);
+  emit("\n", 1);
+}
+
+/***********************************************
+ * FALLBACK
+ ***********************************************/
+
+static bool write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Makes stdin a pipe fed by a child with `held`, then the rest of stdin
+static void feed_stdin(const char *held, size_t len) {
+  int pipefd[2];
+  if (pipe(pipefd) == -1) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(pipefd[0]);
+    char *block = (char *)shell_malloc(FILTER_BLOCK);
+    bool open = write_all(pipefd[1], held, len);
+    ssize_t n;
+    while (open && (n = read(STDIN_FILENO, block, FILTER_BLOCK)) > 0) {
+      open = write_all(pipefd[1], block, n);
+    }
+    _exit(0);
+  }
+  close(pipefd[1]);
+  dup2(pipefd[0], STDIN_FILENO);
+  close(pipefd[0]);
+}
+
+// Runs the real command for what a builtin leaves to it. `held` is input
+// the builtin already took from stdin; the command gets that first.
+void filter_external(const Command *cmd, const char *held, size_t len) {
+  flush_out();
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    if (len > 0)
+      feed_stdin(held, len);
+    apply_assignments(cmd, VAR_EXPORTED);
+    execute(cmd);
+    exit(EXIT_FAILURE);
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  last_status =
+      WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/***********************************************
+ * ARGUMENTS
+ ***********************************************/
+
+// A plain decimal count; suffixes and signs are left to the real command
+static bool parse_count(const char *text, size_t *n) {
+  if (!*text)
+    return false;
+  size_t value = 0;
+  for (const char *p = text; *p; p++) {
+    if (*p < '0' || *p > '9' || value > (SIZE_MAX - 9) / 10)
+      return false;
+    value = value * 10 + (*p - '0');
+  }
+  *n = value;
+  return true;
+}
+
+// The value of an option letter: the rest of its word, or the next word
+static const char *option_value(const Command *cmd, int *i, const char *rest) {
+  if (*rest)
+    return rest;
+  if (*i + 1 >= cmd->argc)
+    return NULL;
+  return cmd->argv[++*i];
+}
+
+// head and tail read one input, with -n N, -nN or -N as its first word.
+// `from_start` is set for tail's +N.
+static bool parse_lines_args(const Command *cmd, size_t *lines,
+                             bool *from_start, const char **name) {
+  *lines = 10;
+  *name = NULL;
+  bool operands = false;
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    if (operands || arg[0] != '-' || arg[1] == '\0') {
+      if (*name)
+        return false;
+      *name = arg;
+    } else if (strcmp(arg, "--") == 0) {
+      operands = true;
+    } else if (arg[1] == 'n') {
+      const char *value = option_value(cmd, &i, arg + 2);
+      if (!value)
+        return false;
+      bool plus = *value == '+';
+      if (plus && !from_start)
+        return false;
+      if (from_start)
+        *from_start = plus;
+      if (!parse_count(value + plus, lines))
+        return false;
+    } else if (i == 1 && parse_count(arg + 1, lines)) {
+      continue;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/***********************************************
+ * WC
+ ***********************************************/
+
+// As wc sizes its columns: wide enough for the total size of regular
+// files, at least 7 with anything else, and 1 for a lone count of one
+static int wc_width(const FilterInput *inputs, size_t count, bool single) {
+  if (single)
+    return 1;
+  int width = 1;
+  int minimum = 1;
+  uintmax_t total = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (inputs[i].regular)
+      total += inputs[i].size;
+    else
+      minimum = 7;
+  }
+  for (; total >= 10; total /= 10) {
+    width++;
+  }
+  return width < minimum ? minimum : width;
+}
+
+static void wc_print(int width, bool lines, bool bytes, uintmax_t line_count,
+                     uintmax_t byte_count, const char *name) {
+  const char *sep = "";
+  if (lines) {
+    printf("%*ju", width, line_count);
+    sep = " ";
+  }
+  if (bytes)
+    printf("%s%*ju", sep, width, byte_count);
+  if (name)
+    printf(" %s", name);
+  printf("\n");
+}
+
+// wc -l and -c; counting words needs the locale, so that is left to wc
+void wc_builtin(const Command *cmd) {
+  bool lines = false;
+  bool bytes = false;
+  char **names = (char **)shell_malloc((cmd->argc + 1) * sizeof(char *));
+  size_t count = 0;
+  bool operands = false;
+  bool supported = true;
+  for (int i = 1; i < cmd->argc && supported; i++) {
+    const char *arg = cmd->argv[i];
+    if (operands || arg[0] != '-' || arg[1] == '\0') {
+      names[count++] = cmd->argv[i];
+    } else if (strcmp(arg, "--") == 0) {
+      operands = true;
+    } else {
+      for (const char *p = arg + 1; *p && supported; p++) {
+        lines = lines || *p == 'l';
+        bytes = bytes || *p == 'c';
+        supported = *p == 'l' || *p == 'c';
+      }
+    }
+  }
+  bool implicit = count == 0;
+  if (implicit)
+    names[count++] = NULL;
+
+  FilterInput *inputs =
+      (FilterInput *)shell_malloc(count * sizeof(FilterInput));
+  if (!supported || !(lines || bytes) ||
+      !open_inputs(names, count, inputs)) {
+    free(inputs);
+    free(names);
+    filter_external(cmd, NULL, 0);
+    return;
+  }
+
+  int width = wc_width(inputs, count, count == 1 && lines != bytes);
+  uintmax_t total_lines = 0;
+  uintmax_t total_bytes = 0;
+  last_status = 0;
+  for (size_t i = 0; i < count; i++) {
+    FilterInput *in = &inputs[i];
+    uintmax_t line_count = 0;
+    uintmax_t byte_count = 0;
+    const char *data;
+    size_t len;
+    while (filter_read(in, &data, &len)) {
+      if (lines)
+        line_count += scan_count(data, len, '\n');
+      byte_count += len;
+    }
+    if (in->error) {
+      read_error("wc", in);
+      last_status = 1;
+    }
+    wc_print(width, lines, bytes, line_count, byte_count, in->name);
+    total_lines += line_count;
+    total_bytes += byte_count;
+    filter_close(in, 0);
+  }
+  if (count > 1)
+    wc_print(width, lines, bytes, total_lines, total_bytes, "total");
+  fflush(stdout);
+  free(inputs);
+  free(names);
+}
+
+/***********************************************
+ * HEAD AND TAIL
+ ***********************************************/
+
+// Where the `n`th newline of `data` ends, or NULL if there are fewer
+static const char *after_lines(const char *data, size_t len, size_t n) {
+  const char *p = data;
+  const char *end = data + len;
+  for (size_t i = 0; i < n; i++) {
+    p = (const char *)memchr(p, '\n', end - p);
+    if (!p)
+      return NULL;
+    p++;
+  }
+  return p;
+}
+
+// head -n N: copies blocks whole until the one holding the last line
+void head_builtin(const Command *cmd) {
+  size_t lines;
+  const char *name;
+  FilterInput in;
+  if (!parse_lines_args(cmd, &lines, NULL, &name) ||
+      !open_inputs((char *const *)&name, 1, &in)) {
+    filter_external(cmd, NULL, 0);
+    return;
+  }
+
+  size_t unread = 0;
+  const char *data;
+  size_t len;
+  while (lines > 0 && filter_read(&in, &data, &len)) {
+    size_t found = scan_count(data, len, '\n');
+    if (found < lines) {
+      emit(data, len);
+      lines -= found;
+      flush_out();
+      continue;
+    }
+    const char *end = after_lines(data, len, lines);
+    emit(data, end - data);
+    unread = data + len - end;
+    lines = 0;
+  }
+  flush_out();
+  last_status = 0;
+  if (in.error) {
+    read_error("head", &in);
+    last_status = 1;
+  }
+  filter_close(&in, unread);
+}
+
+// Where the last `n` lines of `data` start; a last line without a newline
+// counts as one
+static size_t tail_start(const char *data, size_t len, size_t n) {
+  size_t scan = len > 0 && data[len - 1] == '\n' ? len - 1 : len;
+  size_t start = len;
+  for (size_t i = 0; i < n; i++) {
+    const char *nl = (const char *)memrchr(data, '\n', scan);
+    if (!nl)
+      return 0;
+    start = nl + 1 - data;
+    scan = nl - data;
+  }
+  return start;
+}
+
+// The last lines of input that cannot be mapped; it is held in memory,
+// dropping what cannot be among the last `lines` as it grows
+static void tail_stream(FilterInput *in, size_t lines) {
+  Buffer kept;
+  buffer_init(&kept);
+  size_t limit = FILTER_KEEP;
+  const char *data;
+  size_t len;
+  while (filter_read(in, &data, &len)) {
+    buffer_append(&kept, data, len);
+    if (kept.len < limit)
+      continue;
+    size_t start = tail_start(kept.data, kept.len, lines);
+    memmove(kept.data, kept.data + start, kept.len - start);
+    kept.len -= start;
+    limit = kept.len * 2 > FILTER_KEEP ? kept.len * 2 : FILTER_KEEP;
+  }
+  size_t start = tail_start(kept.data, kept.len, lines);
+  emit(kept.data + start, kept.len - start);
+  buffer_free(&kept);
+}
+
+// tail -n N from the end, or -n +N from line N on
+void tail_builtin(const Command *cmd) {
+  size_t lines;
+  bool from_start = false;
+  const char *name;
+  FilterInput in;
+  if (!parse_lines_args(cmd, &lines, &from_start, &name) ||
+      !open_inputs((char *const *)&name, 1, &in)) {
+    filter_external(cmd, NULL, 0);
+    return;
+  }
+
+  const char *data;
+  size_t len;
+  if (from_start) {
+    size_t skip = lines > 0 ? lines - 1 : 0;
+    while (filter_read(&in, &data, &len)) {
+      const char *from = data;
+      if (skip > 0) {
+        size_t found = scan_count(data, len, '\n');
+        if (found < skip) {
+          skip -= found;
+          continue;
+        }
+        from = after_lines(data, len, skip);
+        skip = 0;
+      }
+      emit(from, data + len - from);
+      flush_out();
+    }
+  } else if (in.map && filter_read(&in, &data, &len)) {
+    // The whole file is there to scan back from its end
+    size_t start = tail_start(data, len, lines);
+    emit(data + start, len - start);
+  } else {
+    tail_stream(&in, lines);
+  }
+  flush_out();
+  last_status = 0;
+  if (in.error) {
+    read_error("tail", &in);
+    last_status = 1;
+  }
+  filter_close(&in, 0);
+}
+
+/***********************************************
+ * GREP
+ ***********************************************/
+
+typedef struct GrepOptions {
+  const char *pattern;
+  size_t pattern_len;
+  bool count;
+  bool invert;
+  bool number;
+  bool quiet;
+  TextMode text;
+} GrepOptions;
+
+// What grep reports as it goes through one input
+typedef struct GrepState {
+  const GrepOptions *opts;
+  uintmax_t selected;
+  uintmax_t line;        // lines before the one being looked at
+  bool binary;           // a NUL was seen; the next selected line ends it
+  bool hidden;           // a selected line was left out as binary
+  bool done;
+} GrepState;
+
+// A variable as the command would see it, prefix assignments included
+static const char *command_var(const Command *cmd, const char *name) {
+  size_t len = strlen(name);
+  for (int i = cmd->assign_count - 1; i >= 0; i--) {
+    if (strncmp(cmd->assigns[i], name, len) == 0 &&
+        cmd->assigns[i][len] == '=')
+      return cmd->assigns[i] + len + 1;
+  }
+  return var_get(name);
+}
+
+static TextMode text_mode(const Command *cmd) {
+  const char *name = NULL;
+  const char *vars[] = {"LC_ALL", "LC_CTYPE", "LANG"};
+  for (size_t i = 0; i < 3 && !(name && *name); i++) {
+    name = command_var(cmd, vars[i]);
+  }
+  if (!name || !*name || strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0)
+    return TEXT_BYTES;
+
+  // A locale that is not installed leaves grep in the C locale
+  locale_t locale = newlocale(LC_CTYPE_MASK, name, (locale_t)0);
+  if (!locale)
+    return TEXT_BYTES;
+  TextMode mode = TEXT_OTHER;
+  if (strcmp(nl_langinfo_l(CODESET, locale), "UTF-8") == 0) {
+    mode = TEXT_UTF8;
+  } else {
+    locale_t previous = uselocale(locale);
+    if (MB_CUR_MAX == 1)
+      mode = TEXT_BYTES;
+    uselocale(previous);
+  }
+  freelocale(locale);
+  return mode;
+}
+
+// Strict UTF-8: no overlong forms, surrogates or values past U+10FFFF
+static bool valid_utf8(const unsigned char *p, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    unsigned char c = p[i];
+    if (c < 0x80) {
+      i++;
+      continue;
+    }
+    size_t extra;
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+    if (c >= 0xc2 && c <= 0xdf) {
+      extra = 1;
+    } else if (c >= 0xe0 && c <= 0xef) {
+      extra = 2;
+      lo = c == 0xe0 ? 0xa0 : 0x80;
+      hi = c == 0xed ? 0x9f : 0xbf;
+    } else if (c >= 0xf0 && c <= 0xf4) {
+      extra = 3;
+      lo = c == 0xf0 ? 0x90 : 0x80;
+      hi = c == 0xf4 ? 0x8f : 0xbf;
+    } else {
+      return false;
+    }
+    if (len - i <= extra || p[i + 1] < lo || p[i + 1] > hi)
+      return false;
+    for (size_t k = 2; k <= extra; k++) {
+      if (p[i + k] < 0x80 || p[i + k] > 0xbf)
+        return false;
+    }
+    i += extra + 1;
+  }
+  return true;
+}
+
+// grep prints no line it takes for binary, and says so at the end
+static bool printable(const GrepState *state, const char *line, size_t len) {
+  if (state->opts->text != TEXT_UTF8 || !scan_high(line, len))
+    return true;
+  return valid_utf8((const unsigned char *)line, len);
+}
+
+static void grep_select(GrepState *state, const char *line, const char *eol,
+                        const char *end) {
+  const GrepOptions *opts = state->opts;
+  state->selected++;
+  if (opts->quiet || state->binary) {
+    state->hidden = state->binary && !opts->quiet;
+    state->done = true;
+    return;
+  }
+  if (opts->count)
+    return;
+  if (!printable(state, line, eol - line)) {
+    state->hidden = true;
+    return;
+  }
+  if (opts->number) {
+    char prefix[32];
+    int n = snprintf(prefix, sizeof(prefix), "%ju:", state->line + 1);
+    emit(prefix, n);
+  }
+  emit_line(line, eol, end);
+}
+
+// Selects every line in [from, to) for grep -v
+static void grep_range(GrepState *state, const char *from, const char *to,
+                       const char *end) {
+  const GrepOptions *opts = state->opts;
+  if (from == to)
+    return;
+  if (opts->count || (!opts->number && !opts->quiet && !state->binary &&
+                      printable(state, from, to - from))) {
+    // Whole lines at once, when none needs looking at
+    size_t lines = scan_count(from, to - from, '\n');
+    lines += to[-1] != '\n';
+    if (!opts->count)
+      emit_line(from, to[-1] == '\n' ? to - 1 : to, end);
+    state->selected += lines;
+    state->line += lines;
+    return;
+  }
+  const char *line = from;
+  while (line < to && !state->done) {
+    const char *eol = (const char *)memchr(line, '\n', to - line);
+    if (!eol)
+      eol = to;
+    grep_select(state, line, eol, end);
+    state->line++;
+    line = eol + 1;
+  }
+}
+
+// Goes through one block of whole lines
+static void grep_block(GrepState *state, const char *data, size_t len) {
+  const GrepOptions *opts = state->opts;
+  const char *p = data;
+  const char *end = data + len;
+  while (p < end && !state->done) {
+    const char *hit = scan_find(p, end - p, opts->pattern, opts->pattern_len);
+    const char *line = end;
+    const char *eol = end;
+    if (hit) {
+      const char *nl = (const char *)memrchr(p, '\n', hit - p);
+      line = nl ? nl + 1 : p;
+      eol = (const char *)memchr(hit, '\n', end - hit);
+      if (!eol)
+        eol = end;
+    }
+    if (opts->invert) {
+      grep_range(state, p, line, end);
+      if (!hit || state->done)
+        return;
+    } else {
+      if (!hit) {
+        if (opts->number)
+          state->line += scan_count(p, end - p, '\n');
+        return;
+      }
+      if (opts->number)
+        state->line += scan_count(p, line - p, '\n');
+      grep_select(state, line, eol, end);
+    }
+    state->line++;
+    p = eol < end ? eol + 1 : end;
+  }
+}
+
+// Leaves input grep sees as binary from the start to grep, with the block
+// of `len` bytes already read
+static void grep_binary_start(const Command *cmd, FilterInput *in,
+                              size_t len) {
+  if (in->map) {
+    filter_close(in, len);
+    filter_external(cmd, NULL, 0);
+  } else if (in->fd == STDIN_FILENO) {
+    filter_external(cmd, in->buf.data, in->buf.len);
+    filter_close(in, 0);
+  } else {
+    filter_close(in, 0);
+    filter_external(cmd, NULL, 0);
+  }
+}
+
+static bool parse_grep_args(const Command *cmd, GrepOptions *opts,
+                            const char **name) {
+  bool fixed = false;
+  bool operands = false;
+  size_t files = 0;
+  *name = NULL;
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    if (operands || arg[0] != '-' || arg[1] == '\0') {
+      if (!opts->pattern) {
+        opts->pattern = arg;
+      } else {
+        *name = arg;
+        files++;
+      }
+      continue;
+    }
+    if (strcmp(arg, "--") == 0) {
+      operands = true;
+      continue;
+    }
+    for (const char *p = arg + 1; *p; p++) {
+      if (*p == 'e') {
+        if (opts->pattern)
+          return false;
+        opts->pattern = option_value(cmd, &i, p + 1);
+        if (!opts->pattern)
+          return false;
+        break;
+      }
+      fixed = fixed || *p == 'F';
+      opts->count = opts->count || *p == 'c';
+      opts->invert = opts->invert || *p == 'v';
+      opts->number = opts->number || *p == 'n';
+      opts->quiet = opts->quiet || *p == 'q';
+      if (!strchr("Fcvnq", *p))
+        return false;
+    }
+  }
+
+  // Several files get their names on each line; that is left to grep
+  if (!opts->pattern || !*opts->pattern || files > 1 ||
+      strchr(opts->pattern, '\n'))
+    return false;
+  if (!fixed && strpbrk(opts->pattern, ".[]*^$\\"))
+    return false;
+  opts->pattern_len = strlen(opts->pattern);
+  opts->text = text_mode(cmd);
+  if (opts->text == TEXT_OTHER ||
+      (opts->text == TEXT_UTF8 &&
+       scan_high(opts->pattern, opts->pattern_len)))
+    return false;
+  return true;
+}
+
+// grep -F, or a pattern with nothing special in it, with -c, -n, -q and -v
+void grep_builtin(const Command *cmd) {
+  GrepOptions opts = {0};
+  const char *name;
+  FilterInput in;
+  if (!parse_grep_args(cmd, &opts, &name) ||
+      !open_inputs((char *const *)&name, 1, &in)) {
+    filter_external(cmd, NULL, 0);
+    return;
+  }
+
+  GrepState state = {.opts = &opts};
+  bool looking = !opts.count && !opts.quiet;
+  bool first = true;
+  const char *data;
+  size_t len;
+  while (!state.done && filter_lines(&in, &data, &len)) {
+    // grep looks at all it has read, partial line included
+    size_t read = in.map ? len : in.buf.len;
+    if (looking && !state.binary && memchr(data, '\0', read)) {
+      if (first) {
+        grep_binary_start(cmd, &in, len);
+        return;
+      }
+      state.binary = true;
+    }
+    first = false;
+    grep_block(&state, data, len);
+    flush_out();
+  }
+  if (opts.count)
+    printf("%ju\n", state.selected);
+  fflush(stdout);
+
+  last_status = state.selected > 0 ? 0 : 1;
+  if (state.hidden)
+    fprintf(stderr, "grep: %s: binary file matches\n",
+            name && strcmp(name, "-") != 0 ? name : "(standard input)");
+  if (in.error && !(opts.quiet && state.selected > 0)) {
+    read_error("grep", &in);
+    last_status = 2;
+  }
+  filter_close(&in, 0);
+}
+
+/***********************************************
+ * CUT
+ ***********************************************/
+
+static int compare_ranges(const void *a, const void *b) {
+  const CutRange *x = (const CutRange *)a;
+  const CutRange *y = (const CutRange *)b;
+  return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+static bool parse_position(const char **p, size_t *n) {
+  if (**p < '0' || **p > '9')
+    return false;
+  size_t value = 0;
+  for (; **p >= '0' && **p <= '9'; (*p)++) {
+    if (value > (SIZE_MAX - 9) / 10)
+      return false;
+    value = value * 10 + (**p - '0');
+  }
+  *n = value;
+  return value > 0;
+}
+
+// A cut LIST: N, N-, -M and N-M, separated by commas. Fails for anything
+// cut itself would complain about.
+bool cut_parse_list(const char *text, CutList *list) {
+  list->count = 0;
+  const char *p = text;
+  while (true) {
+    CutRange range = {1, SIZE_MAX};
+    bool open = *p == '-';
+    if (!open && !parse_position(&p, &range.lo))
+      return false;
+    if (*p == '-') {
+      p++;
+      if (*p >= '0' && *p <= '9') {
+        if (!parse_position(&p, &range.hi) || range.hi < range.lo)
+          return false;
+      } else if (open) {
+        return false;
+      }
+    } else {
+      range.hi = range.lo;
+    }
+    if (list->count == list->cap) {
+      list->cap = list->cap ? list->cap * 2 : 8;
+      list->items = (CutRange *)shell_realloc(list->items,
+                                              list->cap * sizeof(CutRange));
+    }
+    list->items[list->count++] = range;
+    if (*p == '\0')
+      break;
+    if (*p != ',')
+      return false;
+    p++;
+  }
+
+  qsort(list->items, list->count, sizeof(CutRange), compare_ranges);
+  size_t merged = 0;
+  for (size_t i = 1; i < list->count; i++) {
+    CutRange *last = &list->items[merged];
+    if (list->items[i].lo <= last->hi ||
+        list->items[i].lo - 1 == last->hi) {
+      if (list->items[i].hi > last->hi)
+        last->hi = list->items[i].hi;
+    } else {
+      list->items[++merged] = list->items[i];
+    }
+  }
+  list->count = merged + 1;
+  return true;
+}
+
+typedef struct CutOptions {
+  CutList list;
+  bool fields;
+  char delim;
+  bool only_delimited;
+} CutOptions;
+
+static void cut_bytes(const CutOptions *opts, const char *line,
+                      const char *eol) {
+  size_t len = eol - line;
+  for (size_t i = 0; i < opts->list.count; i++) {
+    const CutRange *range = &opts->list.items[i];
+    if (range->lo > len)
+      break;
+    size_t hi = range->hi < len ? range->hi : len;
+    emit(line + range->lo - 1, hi - range->lo + 1);
+  }
+  emit("\n", 1);
+}
+
+// One line of cut -f, returning where the next starts. Fields are split
+// by looking for the delimiter and the newline in one pass.
+static const char *cut_fields(const CutOptions *opts, const char *line,
+                              const char *end) {
+  char delim = opts->delim;
+  const char *stop = scan_find2(line, end - line, delim, '\n');
+  if (!stop || *stop == '\n') {
+    const char *eol = stop ? stop : end;
+    if (!opts->only_delimited)
+      emit_line(line, eol, end);
+    return eol < end ? eol + 1 : end;
+  }
+
+  const CutList *list = &opts->list;
+  size_t last = list->items[list->count - 1].hi;
+  size_t r = 0;
+  size_t field = 1;
+  bool printed = false;
+  const char *start = line;
+  while (true) {
+    while (r < list->count && list->items[r].hi < field) {
+      r++;
+    }
+    if (r < list->count && list->items[r].lo <= field) {
+      if (printed)
+        emit(&delim, 1);
+      emit(start, stop - start);
+      printed = true;
+    }
+    if (stop == end || *stop == '\n')
+      break;
+    field++;
+    start = stop + 1;
+    if (field > last) {
+      // Past the last field wanted; the rest of the line is skipped
+      stop = (const char *)memchr(start, '\n', end - start);
+      if (!stop)
+        stop = end;
+      break;
+    }
+    stop = scan_find2(start, end - start, delim, '\n');
+    if (!stop)
+      stop = end;
+  }
+  emit("\n", 1);
+  return stop < end ? stop + 1 : end;
+}
+
+static void cut_block(const CutOptions *opts, const char *data, size_t len) {
+  const char *p = data;
+  const char *end = data + len;
+  while (p < end) {
+    if (opts->fields) {
+      p = cut_fields(opts, p, end);
+      continue;
+    }
+    const char *eol = (const char *)memchr(p, '\n', end - p);
+    if (!eol)
+      eol = end;
+    cut_bytes(opts, p, eol);
+    p = eol < end ? eol + 1 : end;
+  }
+}
+
+static bool parse_cut_args(const Command *cmd, CutOptions *opts,
+                           char **names, size_t *count) {
+  const char *list = NULL;
+  const char *delim = NULL;
+  bool operands = false;
+  int modes = 0;
+  *count = 0;
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    if (operands || arg[0] != '-' || arg[1] == '\0') {
+      names[(*count)++] = cmd->argv[i];
+      continue;
+    }
+    if (strcmp(arg, "--") == 0) {
+      operands = true;
+      continue;
+    }
+    for (const char *p = arg + 1; *p; p++) {
+      if (*p == 's' || *p == 'n') {
+        opts->only_delimited = opts->only_delimited || *p == 's';
+        continue;
+      }
+      if (!strchr("bcfd", *p))
+        return false;
+      const char *value = option_value(cmd, &i, p + 1);
+      if (!value)
+        return false;
+      if (*p == 'd') {
+        delim = value;
+      } else {
+        list = value;
+        opts->fields = *p == 'f';
+        modes++;
+      }
+      break;
+    }
+  }
+  if (modes != 1 || !cut_parse_list(list, &opts->list))
+    return false;
+  if (!opts->fields)
+    return !delim && !opts->only_delimited;
+  if (delim && (strlen(delim) != 1 || *delim == '\n'))
+    return false;
+  opts->delim = delim ? *delim : '\t';
+  return true;
+}
+
+// cut -f with -d and -s, and -b or -c, which count bytes as cut does
+void cut_builtin(const Command *cmd) {
+  CutOptions opts = {0};
+  char **names = (char **)shell_malloc((cmd->argc + 1) * sizeof(char *));
+  size_t count;
+  bool supported = parse_cut_args(cmd, &opts, names, &count);
+  if (count == 0)
+    names[count++] = NULL;
+  FilterInput *inputs =
+      (FilterInput *)shell_malloc(count * sizeof(FilterInput));
+  if (!supported || !open_inputs(names, count, inputs)) {
+    free(opts.list.items);
+    free(inputs);
+    free(names);
+    filter_external(cmd, NULL, 0);
+    return;
+  }
+
+  last_status = 0;
+  for (size_t i = 0; i < count; i++) {
+    const char *data;
+    size_t len;
+    while (filter_lines(&inputs[i], &data, &len)) {
+      cut_block(&opts, data, len);
+      flush_out();
+    }
+    if (inputs[i].error) {
+      read_error("cut", &inputs[i]);
+      last_status = 1;
+    }
+    filter_close(&inputs[i], 0);
+  }
+  flush_out();
+  free(opts.list.items);
+  free(inputs);
+  free(names);
+}
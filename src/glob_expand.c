@@ -0,0 +1,509 @@
+#include "glob_expand.h"
+#include "buffer.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static DirListing *dir_cache[GLOB_DIR_BUCKETS];
+
+typedef struct GlobWalk {
+  const GlobPattern *pattern;
+  Buffer path;
+  WordList *out;
+  size_t matches;
+} GlobWalk;
+
+/***********************************************
+ * PATTERN COMPILATION AND MATCHING
+ ***********************************************/
+
+static void class_set(GlobOp *op, unsigned char c) {
+  op->class_bits[c >> 3] |= (uint8_t)(1u << (c & 7));
+}
+
+static bool class_has(const GlobOp *op, unsigned char c) {
+  return op->class_bits[c >> 3] & (1u << (c & 7));
+}
+
+// Parses a bracket expression starting at text[0] == '['. Returns the number
+// of bytes consumed, or 0 if the bracket is unterminated (and thus literal).
+static size_t compile_class(const char *text, size_t len, GlobOp *op) {
+  size_t i = 1;
+  bool negate = false;
+  memset(op, 0, sizeof(*op));
+
+  if (i < len && (text[i] == '!' || text[i] == '^')) {
+    negate = true;
+    i++;
+  }
+
+  bool first = true;
+  while (i < len && (text[i] != ']' || first)) {
+    unsigned char lo = (unsigned char)text[i];
+    if (lo == '\\' && i + 1 < len)
+      lo = (unsigned char)text[++i];
+    i++;
+
+    if (i + 1 < len && text[i] == '-' && text[i + 1] != ']') {
+      unsigned char hi = (unsigned char)text[i + 1];
+      if (hi == '\\' && i + 2 < len)
+        hi = (unsigned char)text[++i + 1];
+      i += 2;
+      for (unsigned c = lo; c <= hi; c++) {
+        class_set(op, (unsigned char)c);
+      }
+    } else {
+      class_set(op, lo);
+    }
+    first = false;
+  }
+
+  if (i >= len)
+    return 0;
+
+  op->type = GLOB_CLASS;
+  if (negate) {
+    for (size_t b = 0; b < sizeof(op->class_bits); b++) {
+      op->class_bits[b] = (uint8_t)~op->class_bits[b];
+    }
+  }
+  // A bracket expression never matches the path separator
+  op->class_bits['/' >> 3] &= (uint8_t)~(1u << ('/' & 7));
+  return i + 1;
+}
+
+static void push_op(GlobSegment *seg, size_t *cap, const GlobOp *op) {
+  if (seg->op_count == *cap) {
+    *cap = *cap ? *cap * 2 : 8;
+    seg->ops = (GlobOp *)realloc(seg->ops, *cap * sizeof(GlobOp));
+    if (!seg->ops) {
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  seg->ops[seg->op_count++] = *op;
+}
+
+static void compile_segment(const char *text, size_t len, GlobSegment *seg) {
+  size_t cap = 0;
+  bool magic = false;
+  Buffer literal;
+  buffer_init(&literal);
+  memset(seg, 0, sizeof(*seg));
+
+  seg->is_globstar = len == 2 && text[0] == '*' && text[1] == '*';
+
+  size_t i = 0;
+  while (i < len) {
+    GlobOp op = {.type = GLOB_LITERAL};
+    char c = text[i];
+    size_t consumed;
+
+    if (c == '\\' && i + 1 < len) {
+      op.ch = (unsigned char)text[i + 1];
+      i += 2;
+    } else if (c == '*') {
+      magic = true;
+      i++;
+      // Consecutive stars are equivalent to one
+      if (seg->op_count > 0 && seg->ops[seg->op_count - 1].type == GLOB_STAR)
+        continue;
+      op.type = GLOB_STAR;
+    } else if (c == '?') {
+      magic = true;
+      op.type = GLOB_ANY;
+      i++;
+    } else if (c == '[' &&
+               (consumed = compile_class(text + i, len - i, &op)) > 0) {
+      magic = true;
+      i += consumed;
+    } else {
+      op.type = GLOB_LITERAL;
+      op.ch = (unsigned char)c;
+      i++;
+    }
+
+    if (op.type == GLOB_LITERAL)
+      buffer_push(&literal, (char)op.ch);
+    if (op.type != GLOB_STAR)
+      seg->min_len++;
+    push_op(seg, &cap, &op);
+  }
+
+  seg->match_dot = seg->op_count > 0 && seg->ops[0].type == GLOB_LITERAL &&
+                   seg->ops[0].ch == '.';
+  if (magic) {
+    buffer_free(&literal);
+  } else {
+    seg->literal = buffer_detach(&literal);
+  }
+}
+
+bool glob_has_magic(const char *pattern) {
+  for (const char *p = pattern; *p; p++) {
+    if (*p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '*' || *p == '?') {
+      return true;
+    } else if (*p == '[') {
+      GlobOp op;
+      if (compile_class(p, strlen(p), &op))
+        return true;
+    }
+  }
+  return false;
+}
+
+bool glob_compile(const char *pattern, GlobPattern *out) {
+  memset(out, 0, sizeof(*out));
+  out->absolute = pattern[0] == '/';
+
+  const char *p = pattern;
+  while (*p == '/')
+    p++;
+
+  size_t cap = 0;
+  while (*p) {
+    const char *end = p;
+    while (*end && *end != '/') {
+      if (*end == '\\' && end[1])
+        end++;
+      end++;
+    }
+
+    if (out->count == cap) {
+      cap = cap ? cap * 2 : 4;
+      out->segments =
+          (GlobSegment *)realloc(out->segments, cap * sizeof(GlobSegment));
+      if (!out->segments) {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+    compile_segment(p, end - p, &out->segments[out->count++]);
+
+    p = end;
+    if (*p == '/') {
+      while (*p == '/')
+        p++;
+      if (*p == '\0')
+        out->dirs_only = true;
+    }
+  }
+
+  return out->count > 0;
+}
+
+void glob_pattern_free(GlobPattern *pattern) {
+  for (size_t i = 0; i < pattern->count; i++) {
+    free(pattern->segments[i].ops);
+    free(pattern->segments[i].literal);
+  }
+  free(pattern->segments);
+  memset(pattern, 0, sizeof(*pattern));
+}
+
+// Linear-time-per-star matcher: on mismatch only the most recent star is
+// widened, so patterns like "*a*a*a*b" cannot blow up exponentially.
+bool glob_match_segment(const GlobSegment *segment, const char *name) {
+  const GlobOp *ops = segment->ops;
+  size_t count = segment->op_count;
+  size_t pi = 0;
+  size_t ni = 0;
+  size_t star_pi = (size_t)-1;
+  size_t star_ni = 0;
+
+  if (segment->min_len > 0 && strnlen(name, segment->min_len) < segment->min_len)
+    return false;
+
+  while (name[ni]) {
+    unsigned char c = (unsigned char)name[ni];
+    if (pi < count && ops[pi].type == GLOB_STAR) {
+      star_pi = pi++;
+      star_ni = ni;
+      continue;
+    }
+
+    if (pi < count &&
+        ((ops[pi].type == GLOB_LITERAL && ops[pi].ch == c) ||
+         ops[pi].type == GLOB_ANY ||
+         (ops[pi].type == GLOB_CLASS && class_has(&ops[pi], c)))) {
+      pi++;
+      ni++;
+    } else if (star_pi != (size_t)-1) {
+      pi = star_pi + 1;
+      ni = ++star_ni;
+    } else {
+      return false;
+    }
+  }
+
+  while (pi < count && ops[pi].type == GLOB_STAR) {
+    pi++;
+  }
+  return pi == count;
+}
+
+/***********************************************
+ * DIRECTORY LISTING CACHE
+ ***********************************************/
+
+static unsigned hash_path(const char *path) {
+  unsigned hash = 2166136261u;
+  for (const char *p = path; *p; p++) {
+    hash ^= (unsigned char)*p;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+const DirListing *glob_list_dir(const char *path) {
+  unsigned bucket = hash_path(path) % GLOB_DIR_BUCKETS;
+  for (DirListing *listing = dir_cache[bucket]; listing;
+       listing = listing->next) {
+    if (strcmp(listing->path, path) == 0)
+      return listing;
+  }
+
+  DirListing *listing = (DirListing *)calloc(1, sizeof(DirListing));
+  if (!listing) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  listing->path = strdup(path);
+
+  // Failed opens are cached as empty listings too
+  DIR *dir = opendir(path[0] ? path : ".");
+  if (dir) {
+    Buffer names;
+    buffer_init(&names);
+    size_t cap = 0;
+    const struct dirent *direntp;
+
+    while ((direntp = readdir(dir)) != NULL) {
+      const char *name = direntp->d_name;
+      if (name[0] == '.' &&
+          (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        continue;
+
+      if (listing->count == cap) {
+        cap = cap ? cap * 2 : 64;
+        listing->entries =
+            (GlobEntry *)realloc(listing->entries, cap * sizeof(GlobEntry));
+        if (!listing->entries) {
+          perror("realloc");
+          exit(EXIT_FAILURE);
+        }
+      }
+      listing->entries[listing->count++] =
+          (GlobEntry){.name = names.len, .type = direntp->d_type};
+      buffer_append(&names, name, strlen(name) + 1);
+    }
+    closedir(dir);
+
+    listing->names = buffer_detach(&names);
+  }
+
+  listing->next = dir_cache[bucket];
+  dir_cache[bucket] = listing;
+  return listing;
+}
+
+void glob_cache_reset() {
+  for (size_t i = 0; i < GLOB_DIR_BUCKETS; i++) {
+    DirListing *listing = dir_cache[i];
+    while (listing) {
+      DirListing *next = listing->next;
+      free(listing->path);
+      free(listing->names);
+      free(listing->entries);
+      free(listing);
+      listing = next;
+    }
+    dir_cache[i] = NULL;
+  }
+}
+
+/***********************************************
+ * PATHNAME EXPANSION
+ ***********************************************/
+
+static bool is_directory(const char *path, unsigned char type, bool follow) {
+  if (type == DT_DIR)
+    return true;
+  if (type != DT_UNKNOWN && !(follow && type == DT_LNK))
+    return false;
+
+  struct stat st;
+  int rc = follow ? stat(path, &st) : lstat(path, &st);
+  return rc == 0 && S_ISDIR(st.st_mode);
+}
+
+static void emit(GlobWalk *walk) {
+  if (walk->pattern->dirs_only)
+    buffer_push(&walk->path, '/');
+  wordlist_push(walk->out, strdup(walk->path.data));
+  walk->matches++;
+}
+
+static void walk_segment(GlobWalk *walk, size_t index);
+
+static void walk_entry(GlobWalk *walk, size_t index, const char *name,
+                       unsigned char type) {
+  size_t base = walk->path.len;
+  bool last = index + 1 == walk->pattern->count;
+
+  buffer_append_str(&walk->path, name);
+  if (last) {
+    if (!walk->pattern->dirs_only || is_directory(walk->path.data, type, true))
+      emit(walk);
+  } else if (is_directory(walk->path.data, type, true)) {
+    buffer_push(&walk->path, '/');
+    walk_segment(walk, index + 1);
+  }
+
+  walk->path.len = base;
+  walk->path.data[base] = '\0';
+}
+
+static void walk_globstar(GlobWalk *walk, size_t index) {
+  const DirListing *listing = glob_list_dir(walk->path.data);
+  bool last = index + 1 == walk->pattern->count;
+  size_t base = walk->path.len;
+
+  if (!last)
+    walk_segment(walk, index + 1);
+
+  for (size_t i = 0; i < listing->count; i++) {
+    const char *name = listing->names + listing->entries[i].name;
+    if (name[0] == '.')
+      continue;
+
+    buffer_append_str(&walk->path, name);
+    bool is_dir = is_directory(walk->path.data, listing->entries[i].type, false);
+    if (last && (!walk->pattern->dirs_only || is_dir))
+      emit(walk);
+    if (is_dir) {
+      walk->path.len = base + strlen(name);
+      walk->path.data[walk->path.len] = '\0';
+      buffer_push(&walk->path, '/');
+      walk_globstar(walk, index);
+    }
+
+    walk->path.len = base;
+    walk->path.data[base] = '\0';
+  }
+}
+
+static void walk_segment(GlobWalk *walk, size_t index) {
+  const GlobSegment *seg = &walk->pattern->segments[index];
+
+  if (seg->literal) {
+    size_t base = walk->path.len;
+    buffer_append_str(&walk->path, seg->literal);
+
+    struct stat st;
+    if (index + 1 == walk->pattern->count) {
+      if (lstat(walk->path.data, &st) == 0 &&
+          (!walk->pattern->dirs_only || is_directory(walk->path.data,
+                                                     DT_UNKNOWN, true)))
+        emit(walk);
+    } else {
+      buffer_push(&walk->path, '/');
+      walk_segment(walk, index + 1);
+    }
+
+    walk->path.len = base;
+    walk->path.data[base] = '\0';
+    return;
+  }
+
+  if (seg->is_globstar) {
+    walk_globstar(walk, index);
+    return;
+  }
+
+  const DirListing *listing = glob_list_dir(walk->path.data);
+  for (size_t i = 0; i < listing->count; i++) {
+    const char *name = listing->names + listing->entries[i].name;
+    if (name[0] == '.' && !seg->match_dot)
+      continue;
+    if (glob_match_segment(seg, name))
+      walk_entry(walk, index, name, listing->entries[i].type);
+  }
+}
+
+static void swap_words(char **a, char **b) {
+  char *tmp = *a;
+  *a = *b;
+  *b = tmp;
+}
+
+// Multikey (three-way radix) quicksort: paths sharing long prefixes, as in
+// "file_000123.log" directories, are compared one byte column at a time
+// instead of re-scanning the prefix on every comparison.
+static void sort_words(char **words, size_t count, size_t depth) {
+  while (count > 1) {
+    if (count < 16) {
+      for (size_t i = 1; i < count; i++) {
+        for (size_t j = i;
+             j > 0 && strcmp(words[j - 1] + depth, words[j] + depth) > 0; j--) {
+          swap_words(&words[j - 1], &words[j]);
+        }
+      }
+      return;
+    }
+
+    swap_words(&words[0], &words[count / 2]);
+    unsigned char pivot = (unsigned char)words[0][depth];
+    size_t lt = 0;
+    size_t gt = count;
+    size_t i = 1;
+    while (i < gt) {
+      unsigned char c = (unsigned char)words[i][depth];
+      if (c < pivot) {
+        swap_words(&words[lt++], &words[i++]);
+      } else if (c > pivot) {
+        swap_words(&words[i], &words[--gt]);
+      } else {
+        i++;
+      }
+    }
+
+    sort_words(words, lt, depth);
+    sort_words(words + gt, count - gt, depth);
+    if (pivot == '\0')
+      return;
+
+    // Continue with the equal partition on the next byte column
+    words += lt;
+    count = gt - lt;
+    depth++;
+  }
+}
+
+// Appends the sorted matches of `pattern` to `out` and returns how many
+// were added. Directory listings stay cached until glob_cache_reset().
+size_t glob_expand(const char *pattern, WordList *out) {
+  GlobPattern compiled;
+  if (!glob_compile(pattern, &compiled)) {
+    glob_pattern_free(&compiled);
+    return 0;
+  }
+
+  GlobWalk walk = {.pattern = &compiled, .out = out, .matches = 0};
+  buffer_init(&walk.path);
+  buffer_append_str(&walk.path, compiled.absolute ? "/" : "");
+
+  size_t start = out->count;
+  walk_segment(&walk, 0);
+
+  // Listings are kept in readdir order, so only the matches get sorted
+  sort_words(out->words + start, out->count - start, 0);
+
+  buffer_free(&walk.path);
+  glob_pattern_free(&compiled);
+  return walk.matches;
+}
@@ -1,19 +1,113 @@
+#include "builtins.h"
+#include "paste.h"
+#include "script.h"
+#include "server.h"
 #include "shell.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "vars.h"
+#include "vm.h"
 #include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+extern char **environ;
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-o option] [-c command | script | --server socket]\n",
+          name);
+}
+
 int main(int argc, char **argv) {
-  init_history();
+  script_mark_start();
+  stats_init();
+  vars_init(environ);
+  vars_set_arg0(argv[0]);
+  builtins_init();
+
+  static const struct option long_options[] = {
+      {"server", required_argument, NULL, 'S'},
+      {NULL, 0, NULL, 0},
+  };
+  const char *command = NULL;
+  const char *socket_path = NULL;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "+c:o:", long_options, NULL)) != -1) {
+    switch (opt) {
+    case 'c':
+      command = optarg;
+      break;
+    case 'S':
+      socket_path = optarg;
+      break;
+    case 'o':
+      if (!set_option(optarg, true)) {
+        fprintf(stderr, "%s: %s: invalid option name\n", argv[0], optarg);
+        return 2;
+      }
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (socket_path) {
+    return server_run(socket_path);
+  }
+
+  // A script's output is often a pipe, and fully buffered
+  bool interactive = !command && optind >= argc && isatty(STDIN_FILENO);
+  if (!interactive)
+    script_order_stderr();
+
+  if (command) {
+    vars_set_positional(argv + optind, argc - optind, NULL);
+    return script_run_string(command);
+  }
+
+  if (optind < argc) {
+    vars_set_arg0(argv[optind]);
+    vars_set_positional(argv + optind + 1, argc - optind - 1, NULL);
+    int fd = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      perror(argv[optind]);
+      return 127;
+    }
+    int status = script_run_fd(fd);
+    close(fd);
+    return status;
+  }
+
+  if (!isatty(STDIN_FILENO)) {
+    return script_run_fd(STDIN_FILENO);
+  }
+
+  // History, PATH names and visited directories from the last session,
+  // where they are still current
+  if (!(snapshot_load() & SNAPSHOT_HISTORY))
+    init_history();
+  snapshot_save_at_exit();
   char cmd[INPUT_LEN];
+  Buffer pending;
+  buffer_init(&pending);
 
   while (true) {
-    prompt(cmd, INPUT_LEN);
-    if (strlen(cmd) > 0) {
+    if (pending.len == 0) {
+      prompt(cmd, INPUT_LEN);
+    } else {
+      prompt_continue(cmd, INPUT_LEN);
+    }
+    if (paste_batch()) {
+      paste_run(&pending);
+      snapshot_tick();
+    } else if (strlen(cmd) > 0 || pending.len > 0) {
       history_add(cmd);
-      Command *commands = parse_pipeline(cmd);
-      run_commands(commands);
-      free_commands(&commands);
+      run_source_line(&pending, cmd);
+      snapshot_tick();
     }
   }
 
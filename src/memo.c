@@ -0,0 +1,588 @@
+#include "memo.h"
+#include "buffer.h"
+#include "builtins.h"
+#include "stats.h"
+#include "vars.h"
+#include "vm.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Input redirections applied to the memo command itself
+static MemoDeps inputs = {0};
+
+/***********************************************
+ * KEYS
+ ***********************************************/
+
+static void deps_add(MemoDeps *deps, const char *path) {
+  if (deps->count == deps->cap) {
+    deps->cap = deps->cap ? deps->cap * 2 : 4;
+    deps->paths =
+        (char **)shell_realloc(deps->paths, deps->cap * sizeof(char *));
+  }
+  deps->paths[deps->count++] = shell_strdup(path);
+}
+
+static void deps_free(MemoDeps *deps) {
+  for (size_t i = 0; i < deps->count; i++) {
+    free(deps->paths[i]);
+  }
+  free(deps->paths);
+  *deps = (MemoDeps){0};
+}
+
+// Called from setup_redirections(), so `memo cmd < file` depends on file
+void memo_note_input(const char *path) { deps_add(&inputs, path); }
+
+void memo_forget_inputs() { deps_free(&inputs); }
+
+uint64_t memo_hash(uint64_t hash, const void *data, size_t len) {
+  // FNV-1a
+  const unsigned char *bytes = (const unsigned char *)data;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static void key_add(Buffer *key, const char *tag, const char *value) {
+  buffer_append_str(key, tag);
+  buffer_push(key, '=');
+  buffer_append_str(key, value ? value : "");
+  buffer_push(key, value ? '\0' : '\1');
+}
+
+static void key_add_file(Buffer *key, const char *tag, const char *path) {
+  key_add(key, tag, path);
+  struct stat st;
+  char stamp[64] = "missing";
+  if (stat(path, &st) == 0) {
+    snprintf(stamp, sizeof(stamp), "%lld:%lld.%09ld", (long long)st.st_size,
+             (long long)st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+  }
+  key_add(key, "stamp", stamp);
+}
+
+// Keys what the command would read on stdin. A regular file is keyed by
+// identity, size, modification time and offset. /dev/null and a terminal
+// need nothing: a command that reads the terminal is interactive, not one
+// to memoize. A pipe or socket could carry anything, and reading it ahead
+// would take input from whoever comes next, so returns false.
+static bool key_add_stdin(Buffer *key) {
+  struct stat st;
+  struct stat null;
+  char stamp[128] = "closed";
+  if (fstat(STDIN_FILENO, &st) == 0) {
+    if (S_ISREG(st.st_mode)) {
+      snprintf(stamp, sizeof(stamp), "%llx:%llx:%lld:%lld.%09ld@%lld",
+               (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+               (long long)st.st_size, (long long)st.st_mtim.tv_sec,
+               st.st_mtim.tv_nsec,
+               (long long)lseek(STDIN_FILENO, 0, SEEK_CUR));
+    } else if (S_ISCHR(st.st_mode) && stat("/dev/null", &null) == 0 &&
+               st.st_rdev == null.st_rdev) {
+      snprintf(stamp, sizeof(stamp), "null");
+    } else if (isatty(STDIN_FILENO)) {
+      snprintf(stamp, sizeof(stamp), "tty");
+    } else {
+      return false;
+    }
+  }
+  key_add(key, "stdin", stamp);
+  return true;
+}
+
+/***********************************************
+ * STORE
+ ***********************************************/
+
+// $MEMO_DIR, or shell-memo under the user's cache directory
+const char *memo_dir() {
+  static char dir[PATH_MAX];
+  const char *base = var_get("MEMO_DIR");
+  if (base && *base) {
+    snprintf(dir, sizeof(dir), "%s", base);
+  } else if ((base = var_get("XDG_CACHE_HOME")) && *base) {
+    snprintf(dir, sizeof(dir), "%s/shell-memo", base);
+  } else {
+    base = var_get("HOME");
+    snprintf(dir, sizeof(dir), "%s/.cache/shell-memo", base ? base : "/tmp");
+  }
+  return dir;
+}
+
+static bool make_store(const char *dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", dir);
+  for (char *slash = strchr(path + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(path, 0700);
+    *slash = '/';
+  }
+  if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+    perror(path);
+    return false;
+  }
+
+  const char *subdirs[] = {"keys", "objects"};
+  for (size_t i = 0; i < 2; i++) {
+    snprintf(path, sizeof(path), "%s/%s", dir, subdirs[i]);
+    if (mkdir(path, 0700) == -1 && errno != EEXIST) {
+      perror(path);
+      return false;
+    }
+  }
+  return true;
+}
+
+static long limit(const char *name, long fallback) {
+  const char *value = var_get(name);
+  if (!value || !*value)
+    return fallback;
+  char *end;
+  long n = strtol(value, &end, 10);
+  return *end || n < 0 ? fallback : n;
+}
+
+// Reads a record's header; its key follows at `*key_start`
+static bool read_record(int fd, Buffer *text, int *status, char object[40],
+                        size_t *key_start) {
+  buffer_read_fd(text, fd, MEMO_COPY_SIZE);
+  size_t magic = strlen(MEMO_MAGIC);
+  if (text->len < magic || memcmp(text->data, MEMO_MAGIC, magic) != 0)
+    return false;
+
+  int consumed = 0;
+  if (sscanf(text->data + magic, "status %d\nobject %39s\n%n", status, object,
+             &consumed) != 2 ||
+      consumed == 0)
+    return false;
+  *key_start = magic + consumed;
+  return true;
+}
+
+static void stream(int fd, off_t size) {
+  fflush(stdout);
+  off_t offset = 0;
+  while (offset < size) {
+    ssize_t n = sendfile(STDOUT_FILENO, fd, &offset, size - offset);
+    if (n > 0)
+      continue;
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == 0)
+      return;
+
+    // Targets sendfile() refuses, such as files opened for appending
+    char buf[MEMO_COPY_SIZE];
+    while ((n = pread(fd, buf, sizeof(buf), offset)) > 0) {
+      if (write(STDOUT_FILENO, buf, n) != n)
+        return;
+      offset += n;
+    }
+    return;
+  }
+}
+
+// Streams the stored output for `key` if there is one
+static bool replay(const char *dir, const char *name, const Buffer *key) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/keys/%s", dir, name);
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+
+  Buffer text;
+  buffer_init(&text);
+  int status;
+  char object[40];
+  size_t key_start;
+  bool hit = read_record(fd, &text, &status, object, &key_start) &&
+             text.len - key_start == key->len &&
+             memcmp(text.data + key_start, key->data, key->len) == 0;
+  buffer_free(&text);
+  if (!hit) {
+    close(fd);
+    return false;
+  }
+
+  snprintf(path, sizeof(path), "%s/objects/%s", dir, object);
+  int out = open(path, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (out == -1 || fstat(out, &st) == -1) {
+    // Evicted from under us by another shell
+    if (out != -1)
+      close(out);
+    close(fd);
+    return false;
+  }
+
+  // Age counts from the last use, not from when the result was stored
+  futimens(fd, NULL);
+  close(fd);
+  stream(out, st.st_size);
+  close(out);
+  last_status = status;
+  return true;
+}
+
+// Files the output in `tmp` under its content hash and points `name` at it.
+// Returns the bytes this added to the store, 0 for an output already
+// there, or -1.
+static off_t store(const char *dir, const char *name, const Buffer *key,
+                   int tmp, const char *tmp_path, int status) {
+  uint64_t hash = MEMO_HASH_INIT;
+  off_t size = 0;
+  char buf[MEMO_COPY_SIZE];
+  ssize_t n;
+  while ((n = pread(tmp, buf, sizeof(buf), size)) > 0) {
+    hash = memo_hash(hash, buf, n);
+    size += n;
+  }
+
+  char object[40];
+  snprintf(object, sizeof(object), "%016llx-%llx", (unsigned long long)hash,
+           (unsigned long long)size);
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/objects/%s", dir, object);
+  off_t added = size;
+  if (access(path, F_OK) == 0) {
+    unlink(tmp_path);
+    added = 0;
+  } else if (rename(tmp_path, path) == -1) {
+    perror(path);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  char record_tmp[PATH_MAX];
+  snprintf(record_tmp, sizeof(record_tmp), "%s/tmp.XXXXXX", dir);
+  int fd = mkostemp(record_tmp, O_CLOEXEC);
+  if (fd == -1) {
+    perror(record_tmp);
+    return -1;
+  }
+  FILE *record = fdopen(fd, "w");
+  fprintf(record, MEMO_MAGIC "status %d\nobject %s\n", status, object);
+  fwrite(key->data, 1, key->len, record);
+  bool ok = fclose(record) == 0;
+
+  snprintf(path, sizeof(path), "%s/keys/%s", dir, name);
+  if (!ok || rename(record_tmp, path) == -1) {
+    perror(path);
+    unlink(record_tmp);
+    return -1;
+  }
+  return added;
+}
+
+/***********************************************
+ * EVICTION
+ ***********************************************/
+
+// A running estimate of the store's size in `usage`, so a new result does
+// not cost a scan of every record. Eviction writes the exact figure; each
+// result stored since adds its output and counts towards the next pass.
+static void usage_read(const char *dir, long *bytes, long *added) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/usage", dir);
+  FILE *file = fopen(path, "re");
+  *bytes = 0;
+  *added = 0;
+  if (!file)
+    return;
+  if (fscanf(file, "%ld %ld", bytes, added) != 2)
+    *bytes = *added = 0;
+  fclose(file);
+}
+
+static void usage_write(const char *dir, long bytes, long added) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/usage", dir);
+  FILE *file = fopen(path, "we");
+  if (!file)
+    return;
+  fprintf(file, "%ld %ld\n", bytes, added);
+  fclose(file);
+}
+
+static int newest_first(const void *a, const void *b) {
+  const MemoRecord *x = (const MemoRecord *)a;
+  const MemoRecord *y = (const MemoRecord *)b;
+  if (x->used.tv_sec != y->used.tv_sec)
+    return (y->used.tv_sec > x->used.tv_sec) -
+           (y->used.tv_sec < x->used.tv_sec);
+  return (y->used.tv_nsec > x->used.tv_nsec) -
+         (y->used.tv_nsec < x->used.tv_nsec);
+}
+
+static bool keeps(const MemoRecord *records, size_t count, const char *object) {
+  for (size_t i = 0; i < count; i++) {
+    if (records[i].name && strcmp(records[i].object, object) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Drops records unused for `max_age` seconds, then the least recently used
+// until the outputs they share fit in `max_bytes`, then unreferenced
+// outputs. Returns the number of records dropped.
+size_t memo_evict(long max_bytes, long max_age) {
+  const char *dir = memo_dir();
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/keys", dir);
+  DIR *keys = opendir(path);
+  if (!keys)
+    return 0;
+
+  MemoRecord *records = NULL;
+  size_t count = 0;
+  struct dirent *ent;
+  while ((ent = readdir(keys)) != NULL) {
+    if (ent->d_name[0] == '.')
+      continue;
+    int fd = openat(dirfd(keys), ent->d_name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+      continue;
+
+    MemoRecord record = {.name = shell_strdup(ent->d_name)};
+    Buffer text;
+    buffer_init(&text);
+    int status;
+    size_t key_start;
+    struct stat st;
+    if (fstat(fd, &st) == 0)
+      record.used = st.st_mtim;
+    if (!read_record(fd, &text, &status, record.object, &key_start))
+      record.object[0] = '\0';
+    buffer_free(&text);
+    close(fd);
+
+    snprintf(path, sizeof(path), "%s/objects/%s", dir, record.object);
+    if (record.object[0] && stat(path, &st) == 0)
+      record.size = st.st_size;
+
+    records = (MemoRecord *)shell_realloc(records,
+                                          (count + 1) * sizeof(MemoRecord));
+    records[count++] = record;
+  }
+
+  qsort(records, count, sizeof(MemoRecord), newest_first);
+  time_t now = time(NULL);
+  long total = 0;
+  size_t dropped = 0;
+  for (size_t i = 0; i < count; i++) {
+    bool shared = keeps(records, i, records[i].object);
+    long size = shared ? 0 : records[i].size;
+    if (records[i].object[0] && now - records[i].used.tv_sec <= max_age &&
+        total + size <= max_bytes) {
+      total += size;
+      continue;
+    }
+    unlinkat(dirfd(keys), records[i].name, 0);
+    free(records[i].name);
+    records[i].name = NULL;
+    dropped++;
+  }
+  closedir(keys);
+
+  snprintf(path, sizeof(path), "%s/objects", dir);
+  DIR *objects = opendir(path);
+  while (objects && (ent = readdir(objects)) != NULL) {
+    if (ent->d_name[0] != '.' && !keeps(records, count, ent->d_name))
+      unlinkat(dirfd(objects), ent->d_name, 0);
+  }
+  if (objects)
+    closedir(objects);
+
+  for (size_t i = 0; i < count; i++) {
+    free(records[i].name);
+  }
+  free(records);
+  usage_write(dir, total, 0);
+  return dropped;
+}
+
+// Runs an eviction pass once the estimate is over `max_bytes` or enough
+// results have been added since the last one for some to have aged out
+static void maybe_evict(const char *dir, off_t stored) {
+  long max_bytes = limit("MEMO_MAX_BYTES", MEMO_DEFAULT_MAX_BYTES);
+  long bytes;
+  long added;
+  usage_read(dir, &bytes, &added);
+  bytes += stored;
+  added++;
+  if (bytes > max_bytes || added >= MEMO_EVICT_EVERY)
+    memo_evict(max_bytes, limit("MEMO_MAX_AGE", MEMO_DEFAULT_MAX_AGE));
+  else
+    usage_write(dir, bytes, added);
+}
+
+/***********************************************
+ * BUILTIN
+ ***********************************************/
+
+static int exit_code(int status) {
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Runs argv[first..] with stdout on `fd`
+static int run_into(const Command *cmd, int first, int fd) {
+  fflush(stdout);
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    Command sub = {.argc = cmd->argc - first,
+                   .name = cmd->argv[first],
+                   .argv = cmd->argv + first};
+    dup2(fd, STDOUT_FILENO);
+    if (vm_call_function(&sub) || handle_builtins(&sub))
+      exit(last_status);
+    execute(&sub);
+    exit(127);
+  }
+
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  return status;
+}
+
+// Reads options into `deps` and `key` and returns the index of the command
+// word, or 0 once the options have been handled on their own
+static int parse_options(const Command *cmd, MemoDeps *deps, Buffer *key) {
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    if (strcmp(arg, "--") == 0) {
+      if (i + 1 < cmd->argc)
+        return i + 1;
+      break;
+    } else if (strcmp(arg, "--gc") == 0) {
+      size_t dropped =
+          memo_evict(limit("MEMO_MAX_BYTES", MEMO_DEFAULT_MAX_BYTES),
+                     limit("MEMO_MAX_AGE", MEMO_DEFAULT_MAX_AGE));
+      printf("memo: dropped %zu results\n", dropped);
+      last_status = 0;
+      return 0;
+    } else if (strcmp(arg, "--clear") == 0) {
+      printf("memo: dropped %zu results\n", memo_evict(-1, -1));
+      last_status = 0;
+      return 0;
+    } else if (strcmp(arg, "--dep") == 0 && i + 1 < cmd->argc) {
+      deps_add(deps, cmd->argv[++i]);
+    } else if (strcmp(arg, "--env") == 0 && i + 1 < cmd->argc) {
+      key_add(key, "env", cmd->argv[i + 1]);
+      key_add(key, "value", var_get(cmd->argv[++i]));
+    } else if (arg[0] == '-' && arg[1] == '-') {
+      break;
+    } else {
+      return i;
+    }
+  }
+
+  fprintf(stderr, "memo: usage: memo [--dep file]... [--env name]... "
+                  "[--] command [args...]\n"
+                  "       memo --gc | --clear\n");
+  last_status = 2;
+  return 0;
+}
+
+static void memoize(const Command *cmd, int first, const MemoDeps *deps,
+                    Buffer *key) {
+  for (int i = first; i < cmd->argc; i++) {
+    key_add(key, "arg", cmd->argv[i]);
+  }
+  char cwd[PATH_MAX];
+  key_add(key, "cwd", getcwd(cwd, sizeof(cwd)));
+  key_add(key, "PATH", var_get("PATH"));
+
+  const char *name = cmd->argv[first];
+  if (strchr(name, '/')) {
+    key_add_file(key, "exe", name);
+  } else if (!is_builtin(name) && !function_lookup(name)) {
+    char *exe = resolve_command(name);
+    key_add_file(key, "exe", exe ? exe : name);
+    free(exe);
+  }
+  for (size_t i = 0; i < deps->count; i++) {
+    key_add_file(key, "dep", deps->paths[i]);
+  }
+  for (size_t i = 0; i < inputs.count; i++) {
+    key_add_file(key, "input", inputs.paths[i]);
+  }
+  if (!key_add_stdin(key)) {
+    last_status = exit_code(run_into(cmd, first, STDOUT_FILENO));
+    return;
+  }
+
+  const char *dir = memo_dir();
+  if (!make_store(dir)) {
+    last_status = 1;
+    return;
+  }
+  char record[20];
+  snprintf(record, sizeof(record), "%016llx",
+           (unsigned long long)memo_hash(MEMO_HASH_INIT, key->data, key->len));
+  if (replay(dir, record, key))
+    return;
+
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s/tmp.XXXXXX", dir);
+  int tmp = mkostemp(tmp_path, O_CLOEXEC);
+  if (tmp == -1) {
+    perror(tmp_path);
+    last_status = 1;
+    return;
+  }
+
+  int status = run_into(cmd, first, tmp);
+  struct stat st;
+  fstat(tmp, &st);
+  stream(tmp, st.st_size);
+  last_status = exit_code(status);
+
+  // An interrupted run says nothing about what the command outputs
+  if (WIFSIGNALED(status)) {
+    unlink(tmp_path);
+  } else {
+    off_t stored = store(dir, record, key, tmp, tmp_path, last_status);
+    if (stored >= 0)
+      maybe_evict(dir, stored);
+  }
+  close(tmp);
+}
+
+// memo [--dep file]... [--env name]... command [args...]: replays the
+// stored output and status of an earlier run with the same key, or runs
+// the command and stores them. The key covers the arguments, the working
+// directory, PATH and the named variables, the size and modification
+// time of the executable, of each --dep and of a `<` input, and a regular
+// file on stdin. With a pipe on stdin the command just runs.
+void memo_builtin(const Command *cmd) {
+  MemoDeps deps = {0};
+  Buffer key;
+  buffer_init(&key);
+
+  int first = parse_options(cmd, &deps, &key);
+  if (first > 0)
+    memoize(cmd, first, &deps, &key);
+
+  deps_free(&deps);
+  memo_forget_inputs();
+  buffer_free(&key);
+}
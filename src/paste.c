@@ -0,0 +1,200 @@
+#include "paste.h"
+#include "shell.h"
+#include "vm.h"
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+// Bytes read from the terminal but not handled yet. Typed keys arrive one
+// or two at a time; a paste fills this in a few reads.
+static char ahead[PASTE_READ_SIZE];
+static size_t ahead_len = 0;
+static size_t ahead_at = 0;
+
+// A multi-line paste the user agreed to run
+static Buffer batch = {0};
+static bool holding = false;
+
+/***********************************************
+ * KEY INPUT
+ ***********************************************/
+
+static ssize_t fill(int fd) {
+  if (ahead_at > 0) {
+    memmove(ahead, ahead + ahead_at, ahead_len - ahead_at);
+    ahead_len -= ahead_at;
+    ahead_at = 0;
+  }
+  ssize_t n = read(fd, ahead + ahead_len, sizeof(ahead) - ahead_len);
+  if (n > 0)
+    ahead_len += n;
+  return n;
+}
+
+// The next byte of input, as read() would return it
+ssize_t key_read(int fd, char *c) {
+  if (ahead_at == ahead_len) {
+    ssize_t n = fill(fd);
+    if (n <= 0)
+      return n;
+  }
+  *c = ahead[ahead_at++];
+  return 1;
+}
+
+// Whether the next bytes are `text`, reading on only while they could be.
+// They are consumed if so.
+bool key_match(int fd, const char *text) {
+  size_t len = strlen(text);
+  while (ahead_len - ahead_at < len) {
+    if (memcmp(ahead + ahead_at, text, ahead_len - ahead_at) != 0 ||
+        fill(fd) <= 0)
+      return false;
+  }
+  if (memcmp(ahead + ahead_at, text, len) != 0)
+    return false;
+  ahead_at += len;
+  return true;
+}
+
+// Drops keys typed ahead, so they cannot answer a question asked later
+void key_discard() { ahead_at = ahead_len = 0; }
+
+/***********************************************
+ * BRACKETED PASTE
+ ***********************************************/
+
+// Terminals send a pasted line end as \r, or \r\n; both become \n
+static void append_lines(Buffer *out, const char *text, size_t len,
+                         bool *after_cr) {
+  buffer_reserve(out, len);
+  char *to = out->data + out->len;
+  for (size_t i = 0; i < len; i++) {
+    char c = text[i];
+    if (c == '\n' && *after_cr) {
+      *after_cr = false;
+      continue;
+    }
+    *after_cr = c == '\r';
+    *to++ = *after_cr ? '\n' : c;
+  }
+  out->len = to - out->data;
+  out->data[out->len] = '\0';
+}
+
+// Appends the rest of a paste to `out` once PASTE_START has been read,
+// consuming PASTE_END. Returns false if the input ended before it.
+bool paste_read(int fd, Buffer *out) {
+  size_t end_len = strlen(PASTE_END);
+  bool after_cr = false;
+  buffer_reserve(out, 0);
+  while (true) {
+    const char *from = ahead + ahead_at;
+    size_t avail = ahead_len - ahead_at;
+    const char *end = (const char *)memmem(from, avail, PASTE_END, end_len);
+    // Without the marker, the last bytes may be the start of one
+    size_t take = end ? (size_t)(end - from)
+                      : avail >= end_len ? avail - (end_len - 1) : 0;
+    append_lines(out, from, take, &after_cr);
+    ahead_at += take;
+    if (end) {
+      ahead_at += end_len;
+      return true;
+    }
+    if (fill(fd) <= 0) {
+      append_lines(out, ahead + ahead_at, ahead_len - ahead_at, &after_cr);
+      ahead_at = ahead_len;
+      return false;
+    }
+  }
+}
+
+// Adds a one-line paste to the line being edited, as if typed, and echoes
+// it in one write. Returns the new length.
+size_t paste_insert(const char *text, char *line, size_t size, size_t len) {
+  size_t start = len;
+  for (const char *p = text; *p && len < size - 1; p++) {
+    char c = *p == '\t' ? ' ' : *p;
+    if (c >= 32 && c <= 126)
+      line[len++] = c;
+  }
+  line[len] = '\0';
+  fwrite(line + start, 1, len - start, stdout);
+  fflush(stdout);
+  return len;
+}
+
+static size_t count_lines(const Buffer *text) {
+  size_t lines = 0;
+  const char *end = text->data + text->len;
+  for (const char *p = text->data; p < end; p++) {
+    p = (const char *)memchr(p, '\n', end - p);
+    if (!p)
+      return lines + 1;
+    lines++;
+  }
+  return lines;
+}
+
+// Shows the start of a multi-line paste and asks whether to run it, with
+// the terminal still raw
+bool paste_confirm(const Buffer *text, int fd) {
+  size_t lines = count_lines(text);
+  const char *line = text->data;
+  printf("\r\n");
+  for (size_t i = 0; i < PASTE_SHOWN && i < lines; i++) {
+    const char *eol = strchr(line, '\n');
+    int len = eol ? (int)(eol - line) : (int)strlen(line);
+    printf("  %.*s\r\n", len, line);
+    line = eol ? eol + 1 : line + len;
+  }
+  if (lines > PASTE_SHOWN)
+    printf("  ... %zu more lines\r\n", lines - PASTE_SHOWN);
+  printf("run %zu lines? [y/N] ", lines);
+  fflush(stdout);
+
+  // Wait for the answer however long it takes
+  struct termios raw;
+  bool tty = tcgetattr(fd, &raw) == 0;
+  if (tty) {
+    struct termios blocking = raw;
+    blocking.c_cc[VMIN] = 1;
+    blocking.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &blocking);
+  }
+  key_discard();
+  char answer = '\0';
+  if (key_read(fd, &answer) != 1)
+    answer = '\0';
+  if (tty)
+    tcsetattr(fd, TCSANOW, &raw);
+  bool yes = answer == 'y' || answer == 'Y';
+  printf("%s", yes ? "y" : "n");
+  fflush(stdout);
+  return yes;
+}
+
+// The paste waiting to run, or NULL
+const Buffer *paste_batch() { return holding ? &batch : NULL; }
+
+// Takes over `text` as the paste to run next
+void paste_hold(Buffer *text) {
+  buffer_free(&batch);
+  batch = *text;
+  holding = true;
+  buffer_init(text);
+}
+
+// Runs the held paste as one piece of source: one parse for all of it and
+// one history write
+void paste_run(Buffer *pending) {
+  if (!holding)
+    return;
+  Buffer text = batch;
+  buffer_init(&batch);
+  holding = false;
+  history_add_lines(text.data);
+  run_source_line(pending, text.data);
+  buffer_free(&text);
+}
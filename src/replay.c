@@ -0,0 +1,380 @@
+#include "replay.h"
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+// A session log is one line per read, in the order they happened:
+//
+//   > 1250 ls\r      typed: microseconds since the start, then the bytes
+//   < 1262 ls\r\n    written by the program
+//
+// Bytes outside printable ASCII, and backslash, are escaped as \r, \n, \t,
+// \e, \\ or \xHH. Blank lines and lines starting with # are skipped, so a
+// session can also be written by hand.
+
+/***********************************************
+ * SESSION LOGS
+ ***********************************************/
+
+void replay_escape(Buffer *out, const char *bytes, size_t len) {
+  static const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)bytes[i];
+    if (c == '\\') {
+      buffer_append_str(out, "\\\\");
+    } else if (c == '\r') {
+      buffer_append_str(out, "\\r");
+    } else if (c == '\n') {
+      buffer_append_str(out, "\\n");
+    } else if (c == '\t') {
+      buffer_append_str(out, "\\t");
+    } else if (c == 27) {
+      buffer_append_str(out, "\\e");
+    } else if (c >= 32 && c <= 126) {
+      buffer_push(out, (char)c);
+    } else {
+      char code[] = {'\\', 'x', hex[c >> 4], hex[c & 15]};
+      buffer_append(out, code, sizeof(code));
+    }
+  }
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+bool replay_unescape(const char *text, Buffer *out) {
+  for (const char *p = text; *p; p++) {
+    if (*p != '\\') {
+      buffer_push(out, *p);
+      continue;
+    }
+    p++;
+    if (*p == '\\') {
+      buffer_push(out, '\\');
+    } else if (*p == 'r') {
+      buffer_push(out, '\r');
+    } else if (*p == 'n') {
+      buffer_push(out, '\n');
+    } else if (*p == 't') {
+      buffer_push(out, '\t');
+    } else if (*p == 'e') {
+      buffer_push(out, 27);
+    } else if (*p == 'x' && hex_digit(p[1]) >= 0 && hex_digit(p[2]) >= 0) {
+      buffer_push(out, (char)(hex_digit(p[1]) << 4 | hex_digit(p[2])));
+      p += 2;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+void replay_add_key(ReplaySession *session, const char *bytes, size_t len,
+                    uint64_t at_us) {
+  if (session->count == session->cap) {
+    session->cap = session->cap ? session->cap * 2 : 64;
+    session->keys = (ReplayKey *)shell_realloc(
+        session->keys, session->cap * sizeof(ReplayKey));
+  }
+  ReplayKey *key = &session->keys[session->count++];
+  *key = (ReplayKey){.len = len, .at_us = at_us};
+  key->bytes = (char *)shell_malloc(len);
+  memcpy(key->bytes, bytes, len);
+}
+
+// Adds the keys of a log to `session`. Output lines count towards the key
+// before them. Returns false, naming the line, if one cannot be read.
+bool replay_load(FILE *in, ReplaySession *session) {
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t len;
+  unsigned long number = 0;
+  bool ok = true;
+  Buffer bytes;
+  buffer_init(&bytes);
+
+  while (ok && (len = getline(&line, &cap, in)) != -1) {
+    number++;
+    if (len > 0 && line[len - 1] == '\n')
+      line[--len] = '\0';
+    if (len == 0 || line[0] == '#')
+      continue;
+
+    char *end = line;
+    unsigned long long at = 0;
+    ok = (line[0] == '>' || line[0] == '<') && line[1] == ' ';
+    if (ok) {
+      at = strtoull(line + 2, &end, 10);
+      ok = end > line + 2 && *end == ' ';
+    }
+    buffer_clear(&bytes);
+    if (ok)
+      ok = replay_unescape(end + 1, &bytes) && bytes.len > 0;
+    if (!ok) {
+      fprintf(stderr, "replay: line %lu: not a session record\n", number);
+    } else if (line[0] == '>') {
+      replay_add_key(session, bytes.data, bytes.len, at);
+    } else if (session->count > 0) {
+      session->keys[session->count - 1].recorded_len += bytes.len;
+    }
+  }
+  free(line);
+  buffer_free(&bytes);
+  return ok;
+}
+
+void replay_free(ReplaySession *session) {
+  for (size_t i = 0; i < session->count; i++) {
+    free(session->keys[i].bytes);
+  }
+  free(session->keys);
+  *session = (ReplaySession){0};
+}
+
+/***********************************************
+ * PSEUDO-TERMINAL
+ ***********************************************/
+
+static bool write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Starts `argv` on a new pseudo-terminal of `size`, in `dir` if given
+static pid_t spawn(char *const argv[], const char *dir,
+                   const struct winsize *size, int *master) {
+  fflush(NULL);
+  pid_t pid = forkpty(master, NULL, NULL, size);
+  if (pid != 0)
+    return pid;
+  if (dir && (chdir(dir) != 0 || setenv("HOME", dir, 1) != 0)) {
+    perror(dir);
+    _exit(127);
+  }
+  execvp(argv[0], argv);
+  perror(argv[0]);
+  _exit(127);
+}
+
+// Hangs up the terminal and collects the program's status, killing it if
+// it is still there after REPLAY_EXIT_MS
+static int finish(pid_t pid, int master) {
+  close(master);
+  int status = 0;
+  uint64_t deadline = stats_now() + REPLAY_EXIT_MS * 1000000ULL;
+  while (waitpid(pid, &status, WNOHANG) == 0) {
+    if (stats_now() >= deadline) {
+      kill(pid, SIGKILL);
+      waitpid(pid, &status, 0);
+      break;
+    }
+    usleep(1000);
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// The master shares the terminal's modes: an editor waiting for a key has
+// canonical mode off
+static bool reading_keys(int master) {
+  struct termios modes;
+  return tcgetattr(master, &modes) == 0 && !(modes.c_lflag & ICANON);
+}
+
+// Reads what the program writes into `out`. The first byte may take up to
+// `wait_ms`, and `*first` is when it came; then reading goes on until the
+// output has been quiet for `quiet_ms` and the program is reading keys
+// again, or REPLAY_LIMIT_MS passes. Returns false once the program is gone.
+static bool collect(int master, int wait_ms, int quiet_ms, Buffer *out,
+                    uint64_t *first) {
+  uint64_t start = stats_now();
+  uint64_t last = 0;
+  char chunk[4096];
+  while (stats_now() - start < REPLAY_LIMIT_MS * 1000000ULL) {
+    if (last && stats_now() - last >= quiet_ms * 1000000ULL &&
+        reading_keys(master))
+      return true;
+    struct pollfd ready = {.fd = master, .events = POLLIN};
+    int n = poll(&ready, 1, last ? 1 : wait_ms);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0) {
+      if (!last)
+        return true;
+      continue;
+    }
+    ssize_t len = read(master, chunk, sizeof(chunk));
+    if (len <= 0)
+      return false;
+    last = stats_now();
+    if (first && !*first)
+      *first = last;
+    buffer_append(out, chunk, len);
+  }
+  return true;
+}
+
+/***********************************************
+ * RECORDING AND REPLAY
+ ***********************************************/
+
+static void log_read(FILE *log, char kind, uint64_t start, const char *bytes,
+                     size_t len, Buffer *line) {
+  buffer_clear(line);
+  replay_escape(line, bytes, len);
+  fprintf(log, "%c %llu %s\n", kind,
+          (unsigned long long)((stats_now() - start) / 1000), line->data);
+}
+
+// Runs `argv` on a pseudo-terminal, passing it what is read from `in_fd`
+// and showing what it writes on `out_fd`, and logs both until it exits.
+// A terminal on `in_fd` is put in raw mode meanwhile, so every key goes
+// through as typed. Returns the program's status, or -1 if it could not
+// be started.
+int replay_record(int in_fd, int out_fd, FILE *log, char *const argv[]) {
+  struct winsize size = {.ws_row = REPLAY_ROWS, .ws_col = REPLAY_COLS};
+  ioctl(out_fd, TIOCGWINSZ, &size);
+  struct termios orig;
+  bool terminal = tcgetattr(in_fd, &orig) == 0;
+  if (terminal) {
+    struct termios raw = orig;
+    cfmakeraw(&raw);
+    tcsetattr(in_fd, TCSAFLUSH, &raw);
+  }
+
+  int master;
+  pid_t pid = spawn(argv, NULL, &size, &master);
+  if (pid == -1) {
+    if (terminal)
+      tcsetattr(in_fd, TCSAFLUSH, &orig);
+    return -1;
+  }
+
+  fprintf(log, "# %s on a %ux%u terminal\n", argv[0], size.ws_col,
+          size.ws_row);
+  uint64_t start = stats_now();
+  bool input = true;
+  Buffer line;
+  buffer_init(&line);
+  char chunk[4096];
+  while (true) {
+    struct pollfd ready[2] = {
+        {.fd = master, .events = POLLIN},
+        {.fd = input ? in_fd : -1, .events = POLLIN},
+    };
+    if (poll(ready, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (ready[1].revents) {
+      ssize_t len = read(in_fd, chunk, sizeof(chunk));
+      if (len <= 0) {
+        input = false;
+      } else {
+        log_read(log, '>', start, chunk, len, &line);
+        write_all(master, chunk, len);
+      }
+    }
+    if (ready[0].revents) {
+      ssize_t len = read(master, chunk, sizeof(chunk));
+      if (len <= 0)
+        break;
+      log_read(log, '<', start, chunk, len, &line);
+      write_all(out_fd, chunk, len);
+    }
+  }
+  fflush(log);
+  buffer_free(&line);
+  if (terminal)
+    tcsetattr(in_fd, TCSAFLUSH, &orig);
+  return finish(pid, master);
+}
+
+// Types the keys of `session` into `argv` on a pseudo-terminal, each as
+// soon as the answer to the one before has finished, and measures how long
+// each takes to be answered and how much is written. The keys get their
+// results; the totals go in `report`, which must be zeroed first. Returns
+// false if the program could not be started.
+bool replay_run(ReplaySession *session, char *const argv[],
+                const ReplayOptions *options, ReplayReport *report) {
+  int quiet_ms = options->quiet_ms ? options->quiet_ms : REPLAY_QUIET_MS;
+  int echo_ms = options->echo_ms ? options->echo_ms : REPLAY_ECHO_MS;
+  struct winsize size = {.ws_row = REPLAY_ROWS, .ws_col = REPLAY_COLS};
+  int master;
+  pid_t pid = spawn(argv, options->dir, &size, &master);
+  if (pid == -1)
+    return false;
+
+  // Up to the first prompt
+  bool open = collect(master, REPLAY_LIMIT_MS, quiet_ms, &report->output,
+                      NULL);
+  for (size_t i = 0; open && i < session->count; i++) {
+    ReplayKey *key = &session->keys[i];
+    key->out_at = report->output.len;
+    uint64_t sent = stats_now();
+    uint64_t first = 0;
+    open = write_all(master, key->bytes, key->len) &&
+           collect(master, echo_ms, quiet_ms, &report->output, &first);
+    key->out_len = report->output.len - key->out_at;
+    key->latency_ns = first ? first - sent : 0;
+
+    report->keys++;
+    if (first)
+      stats_record_ns(&report->latency, key->latency_ns);
+    else
+      report->silent++;
+    report->bytes += key->out_len;
+    if (key->out_len > report->max_bytes)
+      report->max_bytes = key->out_len;
+    report->recorded_bytes += key->recorded_len;
+  }
+  report->status = finish(pid, master);
+  return true;
+}
+
+void replay_report_free(ReplayReport *report) {
+  buffer_free(&report->output);
+}
+
+void replay_print(const ReplayReport *report, FILE *out) {
+  const LatencyHistogram *h = &report->latency;
+  double keys = report->keys ? (double)report->keys : 1;
+  fprintf(out, "keys         %llu (%llu without output)\n",
+          (unsigned long long)report->keys,
+          (unsigned long long)report->silent);
+  fprintf(out, "%-12s %8s %10s %10s %10s %10s %10s\n", "latency (us)",
+          "count", "min", "p50", "p90", "p99", "max");
+  fprintf(out, "%-12s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", "echo",
+          (unsigned long long)h->count, h->min / 1e3,
+          stats_percentile(h, 0.5) / 1e3, stats_percentile(h, 0.9) / 1e3,
+          stats_percentile(h, 0.99) / 1e3, h->max / 1e3);
+  fprintf(out, "bytes/key    %.1f mean, %llu max", report->bytes / keys,
+          (unsigned long long)report->max_bytes);
+  if (report->recorded_bytes)
+    fprintf(out, " (%.1f mean when recorded)", report->recorded_bytes / keys);
+  fprintf(out, "\nstatus       %d\n", report->status);
+}
@@ -0,0 +1,85 @@
+#include "replay.h"
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// shell-replay: records a session with the line editor, or types a
+// recorded one back in and reports how quickly each key was answered.
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s -r log command...\n"
+          "       %s [-C dir] [-q ms] [-m us] log command...\n",
+          name, name);
+}
+
+int main(int argc, char **argv) {
+  const char *record = NULL;
+  ReplayOptions options = {0};
+  double max_p99_us = 0;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "+r:C:q:m:")) != -1) {
+    switch (opt) {
+    case 'r':
+      record = optarg;
+      break;
+    case 'C':
+      options.dir = optarg;
+      break;
+    case 'q':
+      options.quiet_ms = atoi(optarg);
+      break;
+    case 'm':
+      max_p99_us = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (record) {
+    if (optind >= argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    FILE *log = fopen(record, "we");
+    if (!log) {
+      perror(record);
+      return 2;
+    }
+    int status = replay_record(STDIN_FILENO, STDOUT_FILENO, log, argv + optind);
+    fclose(log);
+    return status == -1 ? 127 : status;
+  }
+
+  if (argc - optind < 2) {
+    usage(argv[0]);
+    return 2;
+  }
+  FILE *log = fopen(argv[optind], "re");
+  if (!log) {
+    perror(argv[optind]);
+    return 2;
+  }
+  ReplaySession session = {0};
+  bool loaded = replay_load(log, &session);
+  fclose(log);
+  if (!loaded)
+    return 2;
+
+  ReplayReport report = {0};
+  if (!replay_run(&session, argv + optind + 1, &options, &report)) {
+    perror(argv[optind + 1]);
+    return 127;
+  }
+  replay_print(&report, stdout);
+  // -m makes a slow editor a failure, for use in CI
+  bool slow = max_p99_us > 0 &&
+              stats_percentile(&report.latency, 0.99) / 1e3 > max_p99_us;
+  replay_report_free(&report);
+  replay_free(&session);
+  return slow ? 1 : 0;
+}
@@ -0,0 +1,281 @@
+#include "scan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+typedef struct ScanKernels {
+  size_t (*count)(const char *p, size_t len, char c);
+  const char *(*find2)(const char *p, size_t len, char a, char b);
+  const char *(*high)(const char *p, size_t len);
+  const char *(*find)(const char *p, size_t len, const char *needle,
+                      size_t needle_len);
+} ScanKernels;
+
+/***********************************************
+ * SCALAR KERNELS
+ ***********************************************/
+
+static size_t count_scalar(const char *p, size_t len, char c) {
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    count += p[i] == c;
+  }
+  return count;
+}
+
+static const char *find2_scalar(const char *p, size_t len, char a, char b) {
+  for (size_t i = 0; i < len; i++) {
+    if (p[i] == a || p[i] == b)
+      return p + i;
+  }
+  return NULL;
+}
+
+static const char *high_scalar(const char *p, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if ((unsigned char)p[i] >= 0x80)
+      return p + i;
+  }
+  return NULL;
+}
+
+static const char *find_scalar(const char *p, size_t len, const char *needle,
+                               size_t needle_len) {
+  return (const char *)memmem(p, len, needle, needle_len);
+}
+
+/***********************************************
+ * SSE2 KERNELS
+ ***********************************************/
+#ifdef SCAN_X86
+
+// Equal bytes are -1, so subtracting counts them per lane; 255 rounds fill
+// a lane before the sums are folded into 64 bits
+__attribute__((target("sse2"))) static size_t
+count_sse2(const char *p, size_t len, char c) {
+  const __m128i match = _mm_set1_epi8(c);
+  const __m128i zero = _mm_setzero_si128();
+  size_t count = 0;
+  size_t i = 0;
+  while (len - i >= 16) {
+    size_t rounds = (len - i) / 16 < 255 ? (len - i) / 16 : 255;
+    __m128i lanes = zero;
+    for (size_t r = 0; r < rounds; r++, i += 16) {
+      __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+      lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(block, match));
+    }
+    __m128i sums = _mm_sad_epu8(lanes, zero);
+    count += (size_t)_mm_cvtsi128_si32(sums) +
+             (size_t)_mm_extract_epi16(sums, 4);
+  }
+  return count + count_scalar(p + i, len - i, c);
+}
+
+__attribute__((target("sse2"))) static const char *
+find2_sse2(const char *p, size_t len, char a, char b) {
+  const __m128i first = _mm_set1_epi8(a);
+  const __m128i second = _mm_set1_epi8(b);
+  size_t i = 0;
+  for (; len - i >= 16; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(p + i));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+        _mm_cmpeq_epi8(block, first), _mm_cmpeq_epi8(block, second)));
+    if (mask)
+      return p + i + __builtin_ctz(mask);
+  }
+  return find2_scalar(p + i, len - i, a, b);
+}
+
+__attribute__((target("sse2"))) static const char *
+high_sse2(const char *p, size_t len) {
+  size_t i = 0;
+  for (; len - i >= 16; i += 16) {
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i *)(p + i)));
+    if (mask)
+      return p + i + __builtin_ctz(mask);
+  }
+  return high_scalar(p + i, len - i);
+}
+
+// Candidates are positions whose first and last bytes both match; only
+// those are compared in full
+__attribute__((target("sse2"))) static const char *
+find_sse2(const char *p, size_t len, const char *needle, size_t needle_len) {
+  if (needle_len < 2 || needle_len > len)
+    return find_scalar(p, len, needle, needle_len);
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+  size_t i = 0;
+  for (; len - i >= needle_len - 1 + 16; i += 16) {
+    __m128i head = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i tail = _mm_loadu_si128((const __m128i *)(p + i + needle_len - 1));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+    while (mask) {
+      size_t at = i + __builtin_ctz(mask);
+      if (memcmp(p + at + 1, needle + 1, needle_len - 2) == 0)
+        return p + at;
+      mask &= mask - 1;
+    }
+  }
+  return find_scalar(p + i, len - i, needle, needle_len);
+}
+
+/***********************************************
+ * AVX2 KERNELS
+ ***********************************************/
+
+__attribute__((target("avx2"))) static size_t
+count_avx2(const char *p, size_t len, char c) {
+  const __m256i match = _mm256_set1_epi8(c);
+  const __m256i zero = _mm256_setzero_si256();
+  size_t count = 0;
+  size_t i = 0;
+  while (len - i >= 32) {
+    size_t rounds = (len - i) / 32 < 255 ? (len - i) / 32 : 255;
+    __m256i lanes = zero;
+    for (size_t r = 0; r < rounds; r++, i += 32) {
+      __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+      lanes = _mm256_sub_epi8(lanes, _mm256_cmpeq_epi8(block, match));
+    }
+    __m256i sums = _mm256_sad_epu8(lanes, zero);
+    __m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums),
+                                   _mm256_extracti128_si256(sums, 1));
+    count += (size_t)_mm_cvtsi128_si32(halves) +
+             (size_t)_mm_extract_epi16(halves, 4);
+  }
+  return count + count_sse2(p + i, len - i, c);
+}
+
+__attribute__((target("avx2"))) static const char *
+find2_avx2(const char *p, size_t len, char a, char b) {
+  const __m256i first = _mm256_set1_epi8(a);
+  const __m256i second = _mm256_set1_epi8(b);
+  size_t i = 0;
+  for (; len - i >= 32; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(p + i));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(block, first), _mm256_cmpeq_epi8(block, second)));
+    if (mask)
+      return p + i + __builtin_ctz(mask);
+  }
+  return find2_sse2(p + i, len - i, a, b);
+}
+
+__attribute__((target("avx2"))) static const char *
+high_avx2(const char *p, size_t len) {
+  size_t i = 0;
+  for (; len - i >= 32; i += 32) {
+    unsigned mask = (unsigned)_mm256_movemask_epi8(
+        _mm256_loadu_si256((const __m256i *)(p + i)));
+    if (mask)
+      return p + i + __builtin_ctz(mask);
+  }
+  return high_sse2(p + i, len - i);
+}
+
+__attribute__((target("avx2"))) static const char *
+find_avx2(const char *p, size_t len, const char *needle, size_t needle_len) {
+  if (needle_len < 2 || needle_len > len)
+    return find_scalar(p, len, needle, needle_len);
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+  size_t i = 0;
+  for (; len - i >= needle_len - 1 + 32; i += 32) {
+    __m256i head = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i tail =
+        _mm256_loadu_si256((const __m256i *)(p + i + needle_len - 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+    while (mask) {
+      size_t at = i + __builtin_ctz(mask);
+      if (memcmp(p + at + 1, needle + 1, needle_len - 2) == 0)
+        return p + at;
+      mask &= mask - 1;
+    }
+  }
+  return find_sse2(p + i, len - i, needle, needle_len);
+}
+
+#endif
+
+/***********************************************
+ * DISPATCH
+ ***********************************************/
+
+static const ScanKernels levels[] = {
+    [SCAN_SCALAR] = {count_scalar, find2_scalar, high_scalar, find_scalar},
+#ifdef SCAN_X86
+    [SCAN_SSE2] = {count_sse2, find2_sse2, high_sse2, find_sse2},
+    [SCAN_AVX2] = {count_avx2, find2_avx2, high_avx2, find_avx2},
+#endif
+};
+
+static const ScanKernels *kernels = NULL;
+static ScanLevel current = SCAN_SCALAR;
+
+ScanLevel scan_best() {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SCAN_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return SCAN_SSE2;
+#endif
+  return SCAN_SCALAR;
+}
+
+// Uses `level`, or the best this CPU has if that is lower. Returns the one
+// in use.
+ScanLevel scan_select(ScanLevel level) {
+  ScanLevel best = scan_best();
+  current = level < best ? level : best;
+  kernels = &levels[current];
+  return current;
+}
+
+ScanLevel scan_level() {
+  if (!kernels)
+    scan_select(SCAN_AVX2);
+  return current;
+}
+
+const char *scan_level_name(ScanLevel level) {
+  static const char *names[] = {"scalar", "sse2", "avx2"};
+  return names[level];
+}
+
+/***********************************************
+ * KERNELS
+ ***********************************************/
+
+// Occurrences of `c`
+size_t scan_count(const char *p, size_t len, char c) {
+  scan_level();
+  return kernels->count(p, len, c);
+}
+
+// First `a` or `b`, or NULL
+const char *scan_find2(const char *p, size_t len, char a, char b) {
+  scan_level();
+  return kernels->find2(p, len, a, b);
+}
+
+// First byte outside ASCII, or NULL
+const char *scan_high(const char *p, size_t len) {
+  scan_level();
+  return kernels->high(p, len);
+}
+
+// First occurrence of `needle`, as memmem() finds it
+const char *scan_find(const char *p, size_t len, const char *needle,
+                      size_t needle_len) {
+  scan_level();
+  return kernels->find(p, len, needle, needle_len);
+}
@@ -0,0 +1,338 @@
+#include "schedule.h"
+#include "vm.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static SchedPolicy current = {.policy = -1};
+static size_t stage = 0; // of the pipeline being launched
+
+/***********************************************
+ * PARSING
+ ***********************************************/
+
+// "0-3,6,8-9" into `set`
+bool sched_parse_cpus(const char *list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  const char *p = list;
+  while (*p) {
+    char *end;
+    long first = strtol(p, &end, 10);
+    long last = first;
+    if (end == p || first < 0)
+      return false;
+    if (*end == '-') {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first)
+        return false;
+    }
+    if (last >= CPU_SETSIZE)
+      return false;
+    for (long cpu = first; cpu <= last; cpu++) {
+      CPU_SET(cpu, set);
+    }
+    if (*end == ',')
+      end++;
+    else if (*end)
+      return false;
+    p = end;
+  }
+  return CPU_COUNT(set) > 0;
+}
+
+// "512K", "2G", "100" or "unlimited"
+bool sched_parse_size(const char *text, rlim_t *value) {
+  if (strcmp(text, "unlimited") == 0) {
+    *value = RLIM_INFINITY;
+    return true;
+  }
+
+  char *end;
+  errno = 0;
+  unsigned long long n = strtoull(text, &end, 10);
+  if (end == text || errno || *text == '-')
+    return false;
+  int shift = 0;
+  switch (toupper((unsigned char)*end)) {
+  case 'K':
+    shift = 10;
+    break;
+  case 'M':
+    shift = 20;
+    break;
+  case 'G':
+    shift = 30;
+    break;
+  case 'T':
+    shift = 40;
+    break;
+  case '\0':
+    break;
+  default:
+    return false;
+  }
+  if (*end && end[1])
+    return false;
+  if (shift && n > (~0ULL >> shift))
+    return false;
+  *value = (rlim_t)(n << shift);
+  return true;
+}
+
+static const struct {
+  const char *name;
+  int resource;
+  bool bytes; // accepts K/M/G suffixes
+} limit_names[] = {
+    {"as", RLIMIT_AS, true},          {"core", RLIMIT_CORE, true},
+    {"cpu", RLIMIT_CPU, false},       {"data", RLIMIT_DATA, true},
+    {"fsize", RLIMIT_FSIZE, true},    {"memlock", RLIMIT_MEMLOCK, true},
+    {"nofile", RLIMIT_NOFILE, false}, {"nproc", RLIMIT_NPROC, false},
+    {"stack", RLIMIT_STACK, true},
+};
+
+/***********************************************
+ * TOPOLOGY
+ ***********************************************/
+
+static long read_topology(int cpu, const char *field) {
+  char path[128];
+  snprintf(path, sizeof(path), SCHED_TOPOLOGY_DIR "/cpu%d/topology/%s", cpu,
+           field);
+  FILE *file = fopen(path, "re");
+  long value = -1;
+  if (file) {
+    if (fscanf(file, "%ld", &value) != 1)
+      value = -1;
+    fclose(file);
+  }
+  return value;
+}
+
+typedef struct CpuPlace {
+  long package;
+  long core;
+  int cpu;
+} CpuPlace;
+
+static int compare_places(const void *a, const void *b) {
+  const CpuPlace *x = (const CpuPlace *)a;
+  const CpuPlace *y = (const CpuPlace *)b;
+  if (x->package != y->package)
+    return x->package < y->package ? -1 : 1;
+  if (x->core != y->core)
+    return x->core < y->core ? -1 : 1;
+  return x->cpu - y->cpu;
+}
+
+// Lists the CPUs of `allowed` by socket, then core, then hardware thread,
+// so neighbours in `order` share a core where SMT exists and a socket
+// otherwise. Without sysfs topology this is plain CPU order.
+size_t sched_topology_order(const cpu_set_t *allowed, int *order) {
+  static CpuPlace places[CPU_SETSIZE];
+  size_t count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, allowed))
+      continue;
+    places[count++] = (CpuPlace){
+        .package = read_topology(cpu, "physical_package_id"),
+        .core = read_topology(cpu, "core_id"),
+        .cpu = cpu,
+    };
+  }
+  qsort(places, count, sizeof(CpuPlace), compare_places);
+  for (size_t i = 0; i < count; i++) {
+    order[i] = places[i].cpu;
+  }
+  return count;
+}
+
+/***********************************************
+ * STAGES
+ ***********************************************/
+
+const SchedPolicy *sched_policy() { return &current; }
+
+// Called by run_commands() before forking each stage
+void sched_stage(size_t index) { stage = index; }
+
+// Runs in the forked stage after its pipes are in place. A stage that
+// cannot get what was asked for does not run. What the stage starts itself
+// inherits the policy rather than having it applied again.
+void sched_child() {
+  if (!current.active)
+    return;
+
+  if (current.policy != -1) {
+    struct sched_param param = {.sched_priority = 0};
+    if (sched_setscheduler(0, current.policy, &param) == -1) {
+      perror("sched: sched_setscheduler");
+      exit(126);
+    }
+  }
+
+  errno = 0;
+  if (current.renice && nice(current.nice) == -1 && errno) {
+    perror("sched: nice");
+    exit(126);
+  }
+
+  if (current.colocate && current.order_count > 0) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(current.order[stage % current.order_count], &one);
+    if (sched_setaffinity(0, sizeof(one), &one) == -1) {
+      perror("sched: sched_setaffinity");
+      exit(126);
+    }
+  } else if (current.pin &&
+             sched_setaffinity(0, sizeof(current.cpus), &current.cpus) == -1) {
+    perror("sched: sched_setaffinity");
+    exit(126);
+  }
+
+  for (size_t i = 0; i < current.limit_count; i++) {
+    struct rlimit limit;
+    getrlimit(current.limits[i].resource, &limit);
+    limit.rlim_cur = current.limits[i].value;
+    if (limit.rlim_max != RLIM_INFINITY && limit.rlim_cur > limit.rlim_max)
+      limit.rlim_max = limit.rlim_cur; // fails unless privileged
+    if (setrlimit(current.limits[i].resource, &limit) == -1) {
+      perror("sched: setrlimit");
+      exit(126);
+    }
+  }
+  current.active = false;
+}
+
+/***********************************************
+ * BUILTIN
+ ***********************************************/
+
+static void usage() {
+  fprintf(stderr, "sched: usage: sched [--cpus list] [--colocate] "
+                  "[--nice n] [--policy other|batch|idle] "
+                  "[--rlimit-NAME value]... -- command...\n");
+  last_status = 2;
+}
+
+static bool parse_limit(SchedPolicy *policy, const char *name,
+                        const char *value) {
+  for (size_t i = 0; i < sizeof(limit_names) / sizeof(*limit_names); i++) {
+    if (strcmp(limit_names[i].name, name) != 0)
+      continue;
+    rlim_t limit;
+    if (!sched_parse_size(value, &limit) ||
+        (!limit_names[i].bytes && limit != RLIM_INFINITY &&
+         !isdigit((unsigned char)value[strlen(value) - 1])) ||
+        policy->limit_count == SCHED_MAX_LIMITS)
+      return false;
+    policy->limits[policy->limit_count++] =
+        (SchedLimit){.resource = limit_names[i].resource, .value = limit};
+    return true;
+  }
+  return false;
+}
+
+static bool parse_policy(const char *name, int *policy) {
+  if (strcmp(name, "other") == 0)
+    *policy = SCHED_OTHER;
+  else if (strcmp(name, "batch") == 0)
+    *policy = SCHED_BATCH;
+  else if (strcmp(name, "idle") == 0)
+    *policy = SCHED_IDLE;
+  else
+    return false;
+  return true;
+}
+
+// Fills `policy` from the options before "--"; returns the index of the
+// first word of the command, or 0 after printing what was wrong
+static int parse_options(const Command *cmd, SchedPolicy *policy) {
+  int i = 1;
+  for (; i < cmd->argc && strcmp(cmd->argv[i], "--") != 0; i++) {
+    const char *arg = cmd->argv[i];
+    const char *value = i + 1 < cmd->argc ? cmd->argv[i + 1] : NULL;
+    bool ok = value != NULL;
+    if (strcmp(arg, "--colocate") == 0) {
+      policy->colocate = true;
+      continue;
+    } else if (strcmp(arg, "--cpus") == 0) {
+      ok = ok && sched_parse_cpus(value, &policy->cpus);
+      policy->pin = true;
+    } else if (strcmp(arg, "--nice") == 0) {
+      char *end;
+      policy->nice = ok ? (int)strtol(value, &end, 10) : 0;
+      ok = ok && *value && !*end;
+      policy->renice = true;
+    } else if (strcmp(arg, "--policy") == 0) {
+      ok = ok && parse_policy(value, &policy->policy);
+    } else if (strncmp(arg, "--rlimit-", 9) == 0) {
+      ok = ok && parse_limit(policy, arg + 9, value);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      fprintf(stderr, "sched: %s%s%s: invalid option\n", arg, value ? " " : "",
+              value ? value : "");
+      return 0;
+    }
+    i++;
+  }
+  return i + 1 < cmd->argc ? i + 1 : 0;
+}
+
+// Works out which CPUs the stages may use: the --cpus list, limited to
+// what the shell itself is allowed
+static bool resolve_cpus(SchedPolicy *policy) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+    perror("sched: sched_getaffinity");
+    return false;
+  }
+  if (policy->pin)
+    CPU_AND(&policy->cpus, &policy->cpus, &allowed);
+  else
+    policy->cpus = allowed;
+  if (CPU_COUNT(&policy->cpus) == 0) {
+    fprintf(stderr, "sched: none of those CPUs are available\n");
+    return false;
+  }
+  if (policy->colocate)
+    policy->order_count = sched_topology_order(&policy->cpus, policy->order);
+  return true;
+}
+
+// sched [options] -- command...: runs the command with every process it
+// forks placed and limited as asked. A single word is run as shell source,
+// so `sched -- 'a | b'` covers a whole pipeline. Builtins that run in the
+// shell itself are not affected.
+void sched_builtin(const Command *cmd) {
+  SchedPolicy policy = {.active = true, .policy = -1};
+  int first = parse_options(cmd, &policy);
+  if (first == 0) {
+    usage();
+    return;
+  }
+  if (!resolve_cpus(&policy)) {
+    last_status = 1;
+    return;
+  }
+
+  // Nested `sched` replaces the outer settings until it returns
+  SchedPolicy outer = current;
+  current = policy;
+  if (first == cmd->argc - 1) {
+    last_status = run_source(cmd->argv[first]);
+  } else {
+    Command sub = {.argc = cmd->argc - first,
+                   .name = cmd->argv[first],
+                   .argv = cmd->argv + first};
+    run_commands(&sub);
+  }
+  current = outer;
+}
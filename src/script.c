@@ -0,0 +1,209 @@
+#include "script.h"
+#include "shell.h"
+#include "vm.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static struct timespec start_time = {0};
+
+/***********************************************
+ * LINE READER
+ ***********************************************/
+
+void script_mark_start() { clock_gettime(CLOCK_MONOTONIC, &start_time); }
+
+// Script output to a pipe or file is fully buffered, while the shell's own
+// messages would go straight out ahead of it. Everything written to stderr
+// goes through here, after what stdout holds.
+static ssize_t write_after_stdout(void *cookie, const char *buf, size_t size) {
+  (void)cookie;
+  fflush(stdout);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t n = write(STDERR_FILENO, buf + done, size - done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return done > 0 ? (ssize_t)done : -1;
+    done += n;
+  }
+  return (ssize_t)done;
+}
+
+// Keeps diagnostics in order with buffered output: `cd /nonexist` after
+// `echo one` reports after "one" even when both go to one pipe
+void script_order_stderr() {
+  cookie_io_functions_t io = {.write = write_after_stdout};
+  FILE *ordered = fopencookie(NULL, "w", io);
+  if (!ordered)
+    return;
+  setvbuf(ordered, NULL, _IONBF, 0);
+  stderr = ordered;
+}
+
+// Regular files are mapped and read ahead by the kernel while earlier lines
+// run; pipes and terminals are streamed in SCRIPT_READ_SIZE chunks.
+void script_open_fd(ScriptReader *reader, int fd) {
+  *reader = (ScriptReader){.fd = fd};
+  buffer_init(&reader->pending);
+  buffer_init(&reader->line);
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+      reader->fd = -1;
+      reader->map = map;
+      reader->map_len = st.st_size;
+      reader->unmap = true;
+    }
+  }
+}
+
+void script_open_string(ScriptReader *reader, const char *text) {
+  *reader = (ScriptReader){.fd = -1, .map = text, .map_len = strlen(text)};
+  buffer_init(&reader->pending);
+  buffer_init(&reader->line);
+}
+
+// Reads more of the stream, keeping the unread tail at the front
+static bool fill_pending(ScriptReader *reader) {
+  Buffer *pending = &reader->pending;
+  if (reader->pos > 0) {
+    memmove(pending->data, pending->data + reader->pos,
+            pending->len - reader->pos);
+    pending->len -= reader->pos;
+    reader->pos = 0;
+  }
+
+  buffer_reserve(pending, SCRIPT_READ_SIZE);
+  while (true) {
+    ssize_t n = read(reader->fd, pending->data + pending->len,
+                     pending->cap - pending->len - 1);
+    if (n > 0) {
+      pending->len += n;
+      pending->data[pending->len] = '\0';
+      return true;
+    } else if (n == 0 || errno != EINTR) {
+      reader->eof = true;
+      return false;
+    }
+  }
+}
+
+// Returns the next line without its newline, or NULL at end of input. The
+// line is a private copy, so it can be handed to run_line directly.
+char *script_next_line(ScriptReader *reader) {
+  const char *start;
+  size_t len;
+  size_t avail;
+
+  if (reader->fd == -1) {
+    if (reader->pos >= reader->map_len)
+      return NULL;
+    start = reader->map + reader->pos;
+    avail = reader->map_len - reader->pos;
+    const char *newline = memchr(start, '\n', avail);
+    len = newline ? (size_t)(newline - start) : avail;
+  } else {
+    const char *newline = NULL;
+    size_t scanned = 0;
+    while (true) {
+      start = reader->pending.data + reader->pos;
+      avail = reader->pending.len - reader->pos;
+      if (avail > scanned)
+        newline = memchr(start + scanned, '\n', avail - scanned);
+      if (newline || reader->eof)
+        break;
+      scanned = avail;
+      fill_pending(reader);
+    }
+    if (!newline && avail == 0)
+      return NULL;
+    len = newline ? (size_t)(newline - start) : avail;
+  }
+
+  reader->pos += len + (len < avail ? 1 : 0);
+  buffer_clear(&reader->line);
+  buffer_append(&reader->line, start, len);
+  if (len > 0 && reader->line.data[len - 1] == '\r') {
+    reader->line.data[--reader->line.len] = '\0';
+  }
+  return reader->line.data;
+}
+
+void script_close(ScriptReader *reader) {
+  if (reader->unmap) {
+    munmap((void *)reader->map, reader->map_len);
+  }
+  buffer_free(&reader->pending);
+  buffer_free(&reader->line);
+}
+
+/***********************************************
+ * EXECUTION
+ ***********************************************/
+
+static void report_latency() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  double ms = (now.tv_sec - start_time.tv_sec) * 1e3 +
+              (now.tv_nsec - start_time.tv_nsec) / 1e6;
+  fprintf(stderr, "startup: %.3f ms to first command\n", ms);
+}
+
+// Runs each line as soon as it completes a command, so a script fed through
+// a pipe starts executing before its writer has finished. Loops and
+// functions are gathered until closed, then compiled once. No prompt, no
+// history.
+int script_run(ScriptReader *reader) {
+  bool first = true;
+  Buffer pending;
+  char *line;
+
+  buffer_init(&pending);
+  last_status = 0;
+  while ((line = script_next_line(reader)) != NULL) {
+    char *text = line + strspn(line, " \t");
+    if (pending.len == 0 && (*text == '\0' || *text == '#'))
+      continue;
+
+    if (first && shell_options.report_latency) {
+      report_latency();
+    }
+    first = false;
+    // Continuation lines keep their indentation: it may be here-document
+    // text
+    run_source_line(&pending, pending.len > 0 ? line : text);
+  }
+
+  if (pending.len > 0) {
+    fprintf(stderr, "syntax error: unexpected end of file\n");
+    last_status = 2;
+  }
+  buffer_free(&pending);
+  return last_status;
+}
+
+int script_run_fd(int fd) {
+  ScriptReader reader;
+  script_open_fd(&reader, fd);
+  int status = script_run(&reader);
+  script_close(&reader);
+  return status;
+}
+
+int script_run_string(const char *text) {
+  ScriptReader reader;
+  script_open_string(&reader, text);
+  int status = script_run(&reader);
+  script_close(&reader);
+  return status;
+}
@@ -0,0 +1,403 @@
+#include "server.h"
+#include "shell.h"
+#include "stats.h"
+#include "vars.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int listen_fd = -1;
+static int epoll_fd = -1;
+static volatile sig_atomic_t stopping = 0;
+
+/***********************************************
+ * CONNECTIONS
+ ***********************************************/
+
+static void on_stop(int sig) {
+  (void)sig;
+  stopping = 1;
+}
+
+static void watch(int fd, void *ptr) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = ptr};
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    perror("epoll_ctl");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void close_stdio(ServerConn *conn) {
+  for (int i = 0; i < 3; i++) {
+    if (conn->stdio[i] != -1)
+      close(conn->stdio[i]);
+    conn->stdio[i] = -1;
+  }
+}
+
+static void close_conn(ServerConn *conn) {
+  close_stdio(conn);
+  if (conn->pidfd != -1)
+    close(conn->pidfd);
+  close(conn->fd);
+  buffer_free(&conn->request);
+  free(conn);
+}
+
+static void accept_conn() {
+  int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd == -1)
+    return;
+
+  ServerConn *conn = (ServerConn *)calloc(1, sizeof(ServerConn));
+  if (!conn) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  conn->fd = fd;
+  conn->stdio[0] = conn->stdio[1] = conn->stdio[2] = -1;
+  conn->pidfd = -1;
+  buffer_init(&conn->request);
+  watch(fd, conn);
+}
+
+// Whole request received: NULL while more bytes are due
+static const ServerRequestHeader *complete_request(const ServerConn *conn) {
+  if (conn->request.len < sizeof(ServerRequestHeader))
+    return NULL;
+  const ServerRequestHeader *hdr =
+      (const ServerRequestHeader *)conn->request.data;
+  size_t total = sizeof(*hdr) + (size_t)hdr->cwd_len + hdr->env_len +
+                 hdr->command_len;
+  return conn->request.len >= total ? hdr : NULL;
+}
+
+static bool valid_request(const ServerConn *conn) {
+  if (conn->request.len < sizeof(ServerRequestHeader))
+    return true;
+  const ServerRequestHeader *hdr =
+      (const ServerRequestHeader *)conn->request.data;
+  return hdr->magic == SERVER_MAGIC &&
+         (uint64_t)hdr->cwd_len + hdr->env_len + hdr->command_len <=
+             SERVER_MAX_REQUEST;
+}
+
+/***********************************************
+ * WORKERS
+ ***********************************************/
+
+// Runs the request in a child of the warm shell. Variables, functions,
+// aliases, resolved paths and compiled lines all carry over; the cwd and
+// environment changes die with it.
+static void run_worker(ServerConn *conn, const ServerRequestHeader *hdr) {
+  signal(SIGPIPE, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+
+  for (int i = 0; i < 3; i++) {
+    int fd = conn->stdio[i] != -1 ? conn->stdio[i] : open("/dev/null", O_RDWR);
+    if (fd != i) {
+      dup2(fd, i);
+      close(fd);
+    }
+  }
+  // Other clients' descriptors must not outlive their own workers
+  syscall(SYS_close_range, 3, ~0U, 0);
+
+  const char *cwd = (const char *)(hdr + 1);
+  const char *env = cwd + hdr->cwd_len;
+  char *command = strndup(env + hdr->env_len, hdr->command_len);
+
+  if (hdr->cwd_len > 0) {
+    char *dir = strndup(cwd, hdr->cwd_len);
+    if (chdir(dir) == -1) {
+      perror(dir);
+      exit(1);
+    }
+    free(dir);
+  }
+
+  for (const char *entry = env; entry < env + hdr->env_len;
+       entry += strlen(entry) + 1) {
+    const char *eq = strchr(entry, '=');
+    if (!eq || !var_is_valid_name(entry, eq - entry))
+      continue;
+    char *name = strndup(entry, eq - entry);
+    var_set(name, eq + 1, VAR_EXPORTED);
+    free(name);
+  }
+
+  run_source(command);
+  exit(last_status);
+}
+
+static void finish_worker(ServerConn *conn) {
+  int status = 0;
+  struct rusage usage;
+  if (wait4(conn->pid, &status, 0, &usage) == -1)
+    memset(&usage, 0, sizeof(usage));
+
+  ServerReply reply = {
+      .status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status),
+      .user_usec = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec,
+      .system_usec = usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec,
+      .max_rss_kb = usage.ru_maxrss,
+  };
+
+  // The reply is small enough for any socket buffer
+  if (send(conn->fd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply) &&
+      errno != EPIPE)
+    perror("send");
+  close_conn(conn);
+}
+
+static void start_worker(ServerConn *conn, const ServerRequestHeader *hdr) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+  fflush(stdout);
+  fflush(stderr);
+  conn->pid = shell_fork();
+  if (conn->pid == -1) {
+    perror("fork");
+    close_conn(conn);
+    return;
+  }
+  if (conn->pid == 0)
+    run_worker(conn, hdr);
+
+  // Only the worker may hold the client's stdio, or the client never
+  // sees end-of-file on its pipes
+  close_stdio(conn);
+  conn->pidfd = (int)syscall(SYS_pidfd_open, conn->pid, 0);
+  if (conn->pidfd == -1) {
+    finish_worker(conn);
+    return;
+  }
+  watch(conn->pidfd, conn);
+}
+
+// Reads what has arrived on the connection, taking the stdio descriptors
+// from the first message that carries them
+static void read_conn(ServerConn *conn) {
+  char data[SERVER_READ_SIZE];
+  char control[CMSG_SPACE(3 * sizeof(int))];
+  struct iovec iov = {.iov_base = data, .iov_len = sizeof(data)};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+
+  ssize_t n = recvmsg(conn->fd, &msg, MSG_CMSG_CLOEXEC);
+  if (n == -1 && (errno == EAGAIN || errno == EINTR))
+    return;
+
+  for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+    if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+      continue;
+    int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    int *fds = (int *)CMSG_DATA(c);
+    for (int i = 0; i < count; i++) {
+      if (i < 3 && conn->stdio[i] == -1)
+        conn->stdio[i] = fds[i];
+      else
+        close(fds[i]);
+    }
+  }
+
+  if (n <= 0) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close_conn(conn);
+    return;
+  }
+
+  buffer_append(&conn->request, data, n);
+  if (!valid_request(conn)) {
+    fprintf(stderr, "server: malformed request\n");
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close_conn(conn);
+    return;
+  }
+
+  const ServerRequestHeader *hdr = complete_request(conn);
+  if (hdr)
+    start_worker(conn, hdr);
+}
+
+/***********************************************
+ * SERVER
+ ***********************************************/
+
+static int listen_on(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "server: socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+
+  // Only this user may hand the shell commands
+  unlink(path);
+  mode_t mask = umask(077);
+  int bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if (bound == -1 || listen(fd, SERVER_BACKLOG) == -1) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Serves requests on the socket at `path` until SIGTERM or SIGINT
+int server_run(const char *path) {
+  listen_fd = listen_on(path);
+  if (listen_fd == -1)
+    return 1;
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    perror("epoll_create1");
+    return 1;
+  }
+  watch(listen_fd, NULL);
+  path_dirs(); // every worker starts with PATH already split
+
+  struct sigaction sa = {.sa_handler = on_stop};
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  struct epoll_event events[SERVER_MAX_EVENTS];
+  while (!stopping) {
+    int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+    if (n == -1 && errno != EINTR) {
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      ServerConn *conn = (ServerConn *)events[i].data.ptr;
+      if (!conn) {
+        accept_conn();
+      } else if (conn->pid > 0) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->pidfd, NULL);
+        finish_worker(conn);
+      } else {
+        read_conn(conn);
+      }
+    }
+  }
+
+  close(epoll_fd);
+  close(listen_fd);
+  unlink(path);
+  return 0;
+}
+
+/***********************************************
+ * CLIENT
+ ***********************************************/
+
+int server_connect(const char *path) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    data += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Sends one command over a fresh connection and waits for it to finish;
+// the server closes the connection after replying. `env` is a
+// NULL-terminated overlay of NAME=VALUE strings, or NULL.
+bool server_request(int sock, const char *cwd, char *const *env,
+                    const char *command, const int stdio[3],
+                    ServerReply *reply) {
+  Buffer payload;
+  buffer_init(&payload);
+  ServerRequestHeader hdr = {.magic = SERVER_MAGIC,
+                             .cwd_len = cwd ? strlen(cwd) : 0,
+                             .command_len = strlen(command)};
+  buffer_append(&payload, (const char *)&hdr, sizeof(hdr));
+  if (cwd)
+    buffer_append_str(&payload, cwd);
+  for (char *const *e = env; e && *e; e++) {
+    buffer_append(&payload, *e, strlen(*e) + 1);
+  }
+  buffer_append_str(&payload, command);
+  ((ServerRequestHeader *)payload.data)->env_len =
+      payload.len - sizeof(hdr) - hdr.cwd_len - hdr.command_len;
+
+  // The descriptors ride on the first byte; the rest follows as a stream
+  char control[CMSG_SPACE(3 * sizeof(int))] = {0};
+  struct iovec iov = {.iov_base = payload.data, .iov_len = 1};
+  struct msghdr msg = {.msg_iov = &iov,
+                       .msg_iovlen = 1,
+                       .msg_control = control,
+                       .msg_controllen = sizeof(control)};
+  struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+  c->cmsg_level = SOL_SOCKET;
+  c->cmsg_type = SCM_RIGHTS;
+  c->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  memcpy(CMSG_DATA(c), stdio, 3 * sizeof(int));
+
+  bool ok = sendmsg(sock, &msg, MSG_NOSIGNAL) == 1 &&
+            write_all(sock, payload.data + 1, payload.len - 1);
+  buffer_free(&payload);
+  if (!ok)
+    return false;
+
+  size_t got = 0;
+  while (got < sizeof(*reply)) {
+    ssize_t n = recv(sock, (char *)reply + got, sizeof(*reply) - got, 0);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    got += n;
+  }
+  return true;
+}
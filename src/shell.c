@@ -1,16 +1,49 @@
 #include "shell.h"
+#include "batch.h"
+#include "builtins.h"
+#include "capture.h"
 #include "colors.h"
+#include "expand.h"
+#include "glob_expand.h"
+#include "memo.h"
+#include "paste.h"
+#include "schedule.h"
+#include "stats.h"
+#include "subst.h"
+#include "suggest.h"
+#include "timeout.h"
+#include "vars.h"
+#include "vm.h"
 #include <ctype.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <termios.h>
 #include <unistd.h>
 
-extern char **environ;
 History cmd_history = {0};
+int last_status = 0;
+ShellOptions shell_options = {0};
+static int parse_depth = 0;
+
+typedef struct ShellOption {
+  const char *name;
+  bool *flag;
+} ShellOption;
+
+static ShellOption option_table[] = {
+    {"capture", &shell_options.capture_output},
+    {"filters", &shell_options.filters},
+    {"parallel_subst", &shell_options.parallel_subst},
+    {"report_latency", &shell_options.report_latency},
+};
 
 /***********************************************
  * TERMINAL MODE MANAGEMENT
@@ -30,9 +63,14 @@ void enable_raw_mode(struct termios *orig_termios) {
   raw.c_cc[VTIME] = 1;
 
   tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+  // Pastes arrive marked, so they can be taken whole
+  fputs(PASTE_ON, stdout);
+  fflush(stdout);
 }
 
 void disable_raw_mode(const struct termios *orig_termios) {
+  fputs(PASTE_OFF, stdout);
+  fflush(stdout);
   tcsetattr(STDIN_FILENO, TCSAFLUSH, orig_termios);
 }
 
@@ -50,9 +88,9 @@ void clear_current_line(size_t length) {
 size_t handle_arrow_key(char *buffer, size_t buffer_size,
                         size_t current_length) {
   char seq[2];
-  if (read(STDIN_FILENO, &seq[0], 1) != 1)
+  if (key_read(STDIN_FILENO, &seq[0]) != 1)
     return current_length;
-  if (read(STDIN_FILENO, &seq[1], 1) != 1)
+  if (key_read(STDIN_FILENO, &seq[1]) != 1)
     return current_length;
 
   if (seq[0] == '[') {
@@ -92,6 +130,42 @@ size_t handle_arrow_key(char *buffer, size_t buffer_size,
   return current_length;
 }
 
+// Takes a paste whose start marker was just read. One line is added to the
+// line being edited; more are shown and, if the user agrees, held for the
+// caller to run after what was typed before them. Returns true when the
+// line is over.
+static bool take_paste(char *buffer, size_t size, size_t *len) {
+  Buffer text;
+  buffer_init(&text);
+  buffer_append(&text, buffer, *len);
+  paste_read(STDIN_FILENO, &text);
+  while (text.len > 0 && text.data[text.len - 1] == '\n') {
+    text.data[--text.len] = '\0';
+  }
+
+  bool lines = text.len > 0 && memchr(text.data, '\n', text.len);
+  if (!lines) {
+    *len = paste_insert(text.data + *len, buffer, size, *len);
+  } else if (paste_confirm(&text, STDIN_FILENO)) {
+    paste_hold(&text);
+  }
+  buffer_free(&text);
+  if (lines) {
+    *len = 0;
+    buffer[0] = '\0';
+  }
+  return lines;
+}
+
+// In raw mode a read also returns nothing when no key came within VTIME, so
+// only a hangup, or the end of input that is not a terminal, means the
+// user has gone
+static bool input_gone(int fd) {
+  struct pollfd ready = {.fd = fd, .events = POLLIN};
+  return !isatty(fd) ||
+         (poll(&ready, 1, 0) == 1 && (ready.revents & POLLHUP));
+}
+
 void read_line(char *buffer, size_t size) {
   memset(buffer, 0, size);
   struct termios orig_termios;
@@ -101,9 +175,14 @@ void read_line(char *buffer, size_t size) {
   char c;
 
   while (i < size - 1) {
-    ssize_t nread = read(STDIN_FILENO, &c, 1);
-    if (nread <= 0)
+    ssize_t nread = key_read(STDIN_FILENO, &c);
+    if (nread <= 0 && input_gone(STDIN_FILENO)) {
+      disable_raw_mode(&orig_termios);
+      exit(last_status);
+    } else if (nread <= 0) {
       continue;
+    }
+    uint64_t start = stats_now();
 
     if (c == '\n' || c == '\r') {
       buffer[i] = '\0';
@@ -114,6 +193,9 @@ void read_line(char *buffer, size_t size) {
         buffer[i] = '\0';
         printf("\b \b");
       }
+    } else if (c == 27 && key_match(STDIN_FILENO, PASTE_START + 1)) {
+      if (take_paste(buffer, size, &i))
+        break;
     } else if (c == 27) {
       i = handle_arrow_key(buffer, size, i);
     } else if (c >= 32 && c <= 126) {
@@ -123,6 +205,7 @@ void read_line(char *buffer, size_t size) {
     }
 
     fflush(stdout);
+    stats_record(&shell_stats()->key, start);
   }
 
   disable_raw_mode(&orig_termios);
@@ -131,7 +214,7 @@ void read_line(char *buffer, size_t size) {
 
 void prompt(char cmd[], size_t size) {
   char cwd[INPUT_LEN];
-  char *home = getenv("HOME");
+  const char *home = var_get("HOME");
   size_t home_len = 0;
 
   if (!getcwd(cwd, INPUT_LEN)) {
@@ -154,6 +237,13 @@ void prompt(char cmd[], size_t size) {
   read_line(cmd, size);
 }
 
+// Shown while an if/while/for or quote is still open
+void prompt_continue(char cmd[], size_t size) {
+  printf("%s%s>%s ", BOLD, CYAN, RESET);
+  fflush(stdout);
+  read_line(cmd, size);
+}
+
 /***********************************************
  * HISTORY MANAGEMENT
  ***********************************************/
@@ -175,7 +265,7 @@ void init_history() {
 
   rewind(history_file);
 
-  char **lines = (char **)malloc(line_count * sizeof(char *));
+  char **lines = (char **)shell_malloc(line_count * sizeof(char *));
   if (!lines) {
     fclose(history_file);
     return;
@@ -184,13 +274,14 @@ void init_history() {
   int actual_lines = 0;
   while (actual_lines < line_count && fgets(buffer, INPUT_LEN, history_file)) {
     size_t len = strlen(buffer);
+    stats_count(&shell_stats()->history_read_bytes, len);
     if (len > 0 && buffer[len - 1] == '\n') {
       buffer[len - 1] = '\0';
     }
 
     char *tab_pos = strchr(buffer, '\t');
     if (tab_pos) {
-      lines[actual_lines++] = strdup(tab_pos + 1);
+      lines[actual_lines++] = shell_strdup(tab_pos + 1);
     }
   }
 
@@ -216,12 +307,55 @@ void history_display() {
   }
 
   while ((ch = read(read_fd, buffer, INPUT_LEN)) != 0) {
+    if (ch > 0)
+      stats_count(&shell_stats()->history_read_bytes, ch);
     printf("%s", buffer);
   }
 
   close(read_fd);
 }
 
+// The id after the last one in history.txt
+static size_t next_history_id() {
+  int read_fd = open("history.txt", O_RDONLY);
+  size_t line_id = 0;
+  char *last = NULL;
+
+  if (read_fd != -1) {
+    last = read_last_line_from_fd(read_fd);
+    close(read_fd);
+  }
+
+  if (last != NULL) {
+    char *id = strtok(last, "\t");
+    line_id = atoi(id) + 1;
+  }
+  free(last);
+  return line_id;
+}
+
+// One line of history.txt, cut to INPUT_LEN like the lines read back
+static void append_history_entry(Buffer *out, size_t line_id,
+                                 const char *cmd) {
+  char buffer[INPUT_LEN];
+  snprintf(buffer, INPUT_LEN, "%zu\t%s", line_id, cmd);
+  buffer_append_str(out, buffer);
+  if (strlen(cmd) > 0 && cmd[strlen(cmd) - 1] != '\n') {
+    buffer_push(out, '\n');
+  }
+}
+
+static void write_history(const Buffer *entries) {
+  int write_fd = open("history.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (write_fd != -1) {
+    ssize_t written = write(write_fd, entries->data, entries->len);
+    if (written > 0)
+      stats_count(&shell_stats()->history_written_bytes, written);
+
+    close(write_fd);
+  }
+}
+
 void history_add(const char *cmd) {
   if (strlen(cmd) == 0) {
     return;
@@ -234,12 +368,12 @@ void history_add(const char *cmd) {
   for (int i = HISTORY_LEN - 1; i > 0; i--) {
     if (cmd_history.history[i - 1]) {
       free(cmd_history.history[i]);
-      cmd_history.history[i] = strdup(cmd_history.history[i - 1]);
+      cmd_history.history[i] = shell_strdup(cmd_history.history[i - 1]);
     }
   }
 
   free(cmd_history.history[0]);
-  cmd_history.history[0] = strdup(cmd);
+  cmd_history.history[0] = shell_strdup(cmd);
 
   if (cmd_history.count < HISTORY_LEN) {
     cmd_history.count++;
@@ -247,33 +381,60 @@ void history_add(const char *cmd) {
 
   cmd_history.current_index = -1;
 
-  int read_fd = open("history.txt", O_RDONLY);
-  size_t line_id = 0;
-  char *last = NULL;
-
-  if (read_fd != -1) {
-    last = read_last_line_from_fd(read_fd);
-    close(read_fd);
-  }
+  Buffer entry;
+  buffer_init(&entry);
+  append_history_entry(&entry, next_history_id(), cmd);
+  write_history(&entry);
+  buffer_free(&entry);
+}
 
-  if (last != NULL) {
-    char *id = strtok(last, "\t");
-    line_id = atoi(id) + 1;
+// Adds every non-empty line of `text` as history_add() would one by one,
+// but copies only the lines that stay in memory and reads and appends to
+// history.txt once
+void history_add_lines(const char *text) {
+  char *copy = shell_strdup(text);
+  size_t cap = 16;
+  size_t count = 0;
+  char **lines = (char **)shell_malloc(cap * sizeof(char *));
+  const char *prev = cmd_history.count > 0 ? cmd_history.history[0] : NULL;
+  char *save = NULL;
+  for (char *line = strtok_r(copy, "\n", &save); line;
+       line = strtok_r(NULL, "\n", &save)) {
+    if (prev && strcmp(prev, line) == 0)
+      continue;
+    if (count == cap) {
+      cap *= 2;
+      lines = (char **)shell_realloc(lines, cap * sizeof(char *));
+    }
+    lines[count++] = line;
+    prev = line;
   }
-  free(last);
-
-  int write_fd = open("history.txt", O_WRONLY | O_APPEND | O_CREAT, 0644);
-  if (write_fd != -1) {
-    char buffer[INPUT_LEN];
-    snprintf(buffer, INPUT_LEN, "%zu\t%s", line_id, cmd);
-    write(write_fd, buffer, strlen(buffer));
 
-    if (strlen(cmd) > 0 && cmd[strlen(cmd) - 1] != '\n') {
-      write(write_fd, "\n", 1);
+  if (count > 0) {
+    size_t kept = count < HISTORY_LEN ? count : HISTORY_LEN;
+    for (size_t i = HISTORY_LEN - kept; i < HISTORY_LEN; i++) {
+      free(cmd_history.history[i]);
     }
-
-    close(write_fd);
+    memmove(&cmd_history.history[kept], &cmd_history.history[0],
+            (HISTORY_LEN - kept) * sizeof(char *));
+    for (size_t i = 0; i < kept; i++) {
+      cmd_history.history[i] = shell_strdup(lines[count - 1 - i]);
+    }
+    size_t total = cmd_history.count + count;
+    cmd_history.count = total < HISTORY_LEN ? total : HISTORY_LEN;
+    cmd_history.current_index = -1;
+
+    Buffer entries;
+    buffer_init(&entries);
+    size_t line_id = next_history_id();
+    for (size_t i = 0; i < count; i++) {
+      append_history_entry(&entries, line_id++, lines[i]);
+    }
+    write_history(&entries);
+    buffer_free(&entries);
   }
+  free(lines);
+  free(copy);
 }
 
 char *read_last_line_from_fd(int fd) {
@@ -286,11 +447,17 @@ char *read_last_line_from_fd(int fd) {
   int len = 0;
   char buffer[INPUT_LEN];
 
+  // Skip the newline terminating the last entry
+  lseek(fd, pos, SEEK_SET);
+  if (read(fd, &ch, 1) == 1 && ch == '\n')
+    pos--;
+
   while (pos >= 0 && len < INPUT_LEN - 1) {
     lseek(fd, pos, SEEK_SET);
     read(fd, &ch, 1);
+    stats_count(&shell_stats()->history_read_bytes, 1);
 
-    if (ch == '\n' && pos != filesize - 1)
+    if (ch == '\n')
       break;
 
     buffer[len++] = ch;
@@ -305,13 +472,15 @@ char *read_last_line_from_fd(int fd) {
     buffer[len - 1 - i] = tmp;
   }
 
-  return strdup(buffer);
+  return shell_strdup(buffer);
 }
 
+// Leaves the history empty, so freeing it twice is harmless
 void free_history() {
   for (int i = 0; i < cmd_history.count; i++) {
     free(cmd_history.history[i]);
   }
+  cmd_history = (History){.count = 0, .current_index = -1};
 }
 
 /***********************************************
@@ -319,14 +488,20 @@ void free_history() {
  ***********************************************/
 
 Command *create_command() {
-  Command *cmd = (Command *)malloc(sizeof(Command));
+  Command *cmd = (Command *)shell_malloc(sizeof(Command));
   cmd->next = NULL;
   cmd->argc = 0;
   cmd->name = NULL;
-  cmd->is_in_redirect = false;
-  cmd->is_out_redirect = false;
-  cmd->in_file_name = NULL;
-  cmd->out_file_name = NULL;
+  cmd->argv_cap = MAX_ARGS;
+  cmd->argv = (char **)shell_calloc(cmd->argv_cap, sizeof(char *));
+  cmd->assign_count = 0;
+  cmd->assigns = NULL;
+  cmd->redirects = NULL;
+  cmd->redirect_count = 0;
+  cmd->procsubs = NULL;
+  cmd->procsub_count = 0;
+  cmd->exec_path = NULL;
+  cmd->subst_status = -1;
   return cmd;
 }
 
@@ -334,6 +509,14 @@ Command *parse_pipeline(char *src) {
   Command *head = NULL;
   Command *tail = NULL;
 
+  // Directory listings are shared by all globs on this line only. Nested
+  // parses for command substitutions reuse the outer line's listings.
+  bool outermost = parse_depth++ == 0;
+  if (outermost) {
+    glob_cache_reset();
+    subst_prefetch(src);
+  }
+
   char *saveptr;
   char *segment = strtok_q(src, "|", &saveptr);
   while (segment != NULL) {
@@ -348,53 +531,214 @@ Command *parse_pipeline(char *src) {
     segment = strtok_q(NULL, "|", &saveptr);
   }
 
+  if (--parse_depth == 0) {
+    subst_finish();
+    glob_cache_reset();
+  }
   return head;
 }
 
-Command *parse_redirect(char *src) {
-  Command *command = NULL;
-  char *saveptr, *segment;
-  if (strchr(src, '<')) {
-    // Check if the command has redirect input
-    char *segment = strtok_q(src, "<", &saveptr);
-    if (segment != NULL) {
-      command = parse_command(segment);
-      command->in_file_name = trim(strtok_q(NULL, "<", &saveptr));
-      command->is_in_redirect = true;
-      return command;
+// Recognizes the redirection operator at `p`, setting the kind and default
+// descriptor of `r`. Returns the operator's length.
+static size_t redirect_operator(const char *p, Redirect *r) {
+  if (p[0] == '&') {
+    r->kind = REDIRECT_BOTH;
+    r->fd = STDOUT_FILENO;
+    return 2;
+  }
+
+  if (p[0] == '<') {
+    r->fd = STDIN_FILENO;
+    if (strncmp(p, "<<<", 3) == 0) {
+      r->kind = REDIRECT_STRING;
+      return 3;
+    }
+    if (p[1] == '<') {
+      r->kind = REDIRECT_HEREDOC;
+      return p[2] == '-' ? 3 : 2;
+    }
+    r->kind = p[1] == '&' ? REDIRECT_DUP : REDIRECT_IN;
+    return p[1] == '&' ? 2 : 1;
+  }
+
+  r->fd = STDOUT_FILENO;
+  if (p[1] == '>') {
+    r->kind = REDIRECT_APPEND;
+    return 2;
+  }
+  r->kind = p[1] == '&' ? REDIRECT_DUP : REDIRECT_OUT;
+  return p[1] == '&' || p[1] == '|' ? 2 : 1;
+}
+
+// Blanks out the operator from `op` through the target word after `cursor`,
+// returning the target as written.
+static char *take_redirect_target(char *op, char *cursor) {
+  char *word = scan_word(&cursor);
+  char *target = word ? shell_strdup(word) : NULL;
+  memset(op, ' ', cursor - op);
+
+  if (!target) {
+    fprintf(stderr, "syntax error near unexpected token `newline'\n");
+  }
+  return target;
+}
+
+// Strips every redirection out of `src` into `*redirects`, in order and with
+// targets unexpanded. A here-document's target is its delimiter until the
+// compiler swaps in the body. Returns the number of redirections.
+size_t take_redirects(char *src, Redirect **redirects) {
+  char quote = '\0';
+  size_t count = 0;
+  *redirects = NULL;
+
+  for (char *p = src; *p; p++) {
+    size_t subst = quote == '\'' ? 0 : substitution_length(p);
+    if (subst > 0) {
+      p += subst - 1;
+    } else if (quote) {
+      if (*p == '\\' && quote == '"' && p[1])
+        p++;
+      else if (*p == quote)
+        quote = '\0';
+    } else if (*p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else if (*p == '<' || *p == '>' || (p[0] == '&' && p[1] == '>')) {
+      Redirect r = {.opened = -1};
+      size_t len = redirect_operator(p, &r);
+      char *op = p;
+      // A single digit right before the operator names the descriptor
+      if (*p != '&' && p > src && isdigit((unsigned char)p[-1]) &&
+          (p - 1 == src || isspace((unsigned char)p[-2]))) {
+        r.fd = p[-1] - '0';
+        op--;
+      }
+      r.target = take_redirect_target(op, p + len);
+      if (!r.target)
+        continue;
+      r.literal = r.kind == REDIRECT_HEREDOC && strpbrk(r.target, "\\'\"");
+
+      *redirects =
+          (Redirect *)shell_realloc(*redirects, (count + 1) * sizeof(Redirect));
+      (*redirects)[count++] = r;
     }
   }
+  return count;
+}
 
-  if (strchr(src, '>')) {
-    // Check if the comman has redirect input
-    segment = strtok_q(NULL, ">", &saveptr);
-    if (segment != NULL) {
-      command = command ? command : parse_command(segment);
-      command->out_file_name = trim(strtok_q(NULL, ">", &saveptr));
-      command->is_out_redirect = true;
-      return command;
+static bool is_fd_number(const char *word) {
+  return *word && strspn(word, "0123456789") == strlen(word);
+}
+
+// Sets the command's redirections from unexpanded ones
+void set_redirects(Command *cmd, const Redirect *raw, size_t count) {
+  cmd->redirects = count ? (Redirect *)shell_calloc(count, sizeof(Redirect)) : NULL;
+  cmd->redirect_count = count;
+
+  for (size_t i = 0; i < count; i++) {
+    Redirect *r = &cmd->redirects[i];
+    *r = raw[i];
+    r->opened = -1;
+    if (r->kind == REDIRECT_HEREDOC) {
+      r->target = r->literal ? shell_strdup(raw[i].target)
+                             : expand_heredoc(raw[i].target);
+      continue;
     }
+
+    r->target = expand_word_single(raw[i].target);
+    if (r->kind == REDIRECT_STRING) {
+      size_t len = strlen(r->target);
+      r->target = (char *)shell_realloc(r->target, len + 2);
+      memcpy(r->target + len, "\n", 2);
+    } else if (r->kind == REDIRECT_DUP && r->fd == STDOUT_FILENO &&
+               strcmp(r->target, "-") != 0 && !is_fd_number(r->target)) {
+      // >&file is &>file
+      r->kind = REDIRECT_BOTH;
+    }
+  }
+}
+
+void free_redirects(Redirect *redirects, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    free(redirects[i].target);
   }
+  free(redirects);
+}
+
+// The last redirection that applies to `fd`, or NULL
+const Redirect *redirect_of(const Command *cmd, int fd) {
+  for (size_t i = cmd->redirect_count; i > 0; i--) {
+    const Redirect *r = &cmd->redirects[i - 1];
+    if (r->fd == fd || (r->kind == REDIRECT_BOTH && fd == STDERR_FILENO))
+      return r;
+  }
+  return NULL;
+}
+
+Command *parse_redirect(char *src) {
+  Redirect *raw;
+  size_t count = take_redirects(src, &raw);
 
-  return parse_command(src);
+  Command *command = parse_command(src);
+  set_redirects(command, raw, count);
+  free_redirects(raw, count);
+  return command;
+}
+
+static void add_assignment(Command *cmd, const char *token) {
+  cmd->assigns =
+      (char **)shell_realloc(cmd->assigns, (cmd->assign_count + 1) * sizeof(char *));
+  cmd->assigns[cmd->assign_count++] = expand_word_single(token);
+}
+
+static void finish_command(Command *cmd, WordList *words) {
+  procsub_claim(cmd);
+  cmd->subst_status = subst_take_status();
+  cmd->argv = words->words;
+  cmd->argv_cap = words->cap;
+  cmd->argc = words->count;
+  cmd->argv[cmd->argc] = NULL;
+  cmd->name = cmd->argv[0];
 }
 
 Command *parse_command(char *src) {
   Command *cmd = create_command();
-  size_t args_count = 0;
-  char *token = strtok(src, " \t\r\n");
+  subst_take_status(); // one run before this command is not its status
+  // Expansions append straight into the command's argv, growing it
+  WordList words = {.words = cmd->argv, .count = 0, .cap = cmd->argv_cap};
+
+  char *cursor = src;
+  char *token = scan_word(&cursor);
+  while (token != NULL) {
+    if (words.count == 0 && var_is_assignment(token)) {
+      add_assignment(cmd, token);
+    } else {
+      expand_word(token, &words);
+    }
+    token = scan_word(&cursor);
+  }
+
+  finish_command(cmd, &words);
+  return cmd;
+}
+
+// Builds a command from words split ahead of time, the first assign_count
+// of which are assignments
+Command *expand_command(char *const *raw, size_t count, size_t assign_count) {
+  Command *cmd = create_command();
+  subst_take_status();
+  WordList words = {.words = cmd->argv, .count = 0, .cap = cmd->argv_cap};
 
-  while (token != NULL && args_count < MAX_ARGS) {
-    cmd->argv[args_count] = token;
-    if (args_count == 0) {
-      cmd->name = cmd->argv[0];
+  for (size_t i = 0; i < count; i++) {
+    if (i < assign_count) {
+      add_assignment(cmd, raw[i]);
+    } else {
+      expand_word(raw[i], &words);
     }
-    args_count++;
-    token = strtok(NULL, " \t\r\n");
   }
 
-  cmd->argc = args_count;
-  cmd->argv[args_count] = NULL;
+  finish_command(cmd, &words);
   return cmd;
 }
 
@@ -403,40 +747,112 @@ void free_commands(Command **head) {
   while (current) {
     Command *deleted = current;
     current = current->next;
+
+    for (int i = 0; i < deleted->argc; i++) {
+      free(deleted->argv[i]);
+    }
+    free(deleted->argv);
+    for (int i = 0; i < deleted->assign_count; i++) {
+      free(deleted->assigns[i]);
+    }
+    free(deleted->assigns);
+    close_redirects(deleted);
+    free_redirects(deleted->redirects, deleted->redirect_count);
+    procsub_release(deleted);
     free(deleted);
   }
+  *head = NULL;
 }
 
 /***********************************************
  * COMMAND EXECUTION
  ***********************************************/
 
+bool is_builtin(const char *name) { return builtin_find(name) != NULL; }
+
 bool handle_builtins(const Command *cmd) {
-  if (strcmp(cmd->name, "exit") == 0) {
-    exit(EXIT_SUCCESS);
-  } else if (strcmp(cmd->name, "cd") == 0) {
-    change_dir(cmd);
-    return true;
-  } else if (strcmp(cmd->name, "history") == 0) {
-    history_display();
-    return true;
-  } else if (strcmp(cmd->name, "tree") == 0) {
-    char cwd[INPUT_LEN] = {0};
-    getcwd(cwd, INPUT_LEN);
-    tree(cwd, 0);
+  if (cmd->name == NULL) {
+    // A line made only of assignments sets shell variables, and returns the
+    // status of its last command substitution
+    apply_assignments(cmd, 0);
+    last_status = cmd->subst_status == -1 ? 0 : cmd->subst_status;
     return true;
   }
-  return false;
+
+  const Builtin *builtin = builtin_find(cmd->name);
+  if (!builtin)
+    return false;
+  builtin_run(builtin, cmd);
+  return true;
+}
+
+int run_line(char *line) {
+  Command *commands = parse_pipeline(line);
+  run_commands(commands);
+  free_commands(&commands);
+  return last_status;
+}
+
+static void run_redirected(const Command *cmd);
+
+// Whether the shell has something to run for `cmd`, checked in the parent
+// before forking. A command found on PATH is left in `path` for the child
+// to exec directly. Prefix assignments may change PATH for the child alone,
+// so those and explicit paths are left for the child to try.
+static bool command_found(const Command *cmd, char **path) {
+  *path = NULL;
+  if (!cmd->name || cmd->exec_path || cmd->assign_count > 0 ||
+      strchr(cmd->name, '/') || function_lookup(cmd->name) ||
+      builtin_find(cmd->name))
+    return true;
+  *path = resolve_command(cmd->name);
+  return *path != NULL;
 }
 
 void run_commands(const Command *head) {
   int prev_pipe_read = -1;
   const Command *current = head;
-  pid_t pids[MAX_ARGS];
   int cmd_index = 0;
 
+  size_t stages = 0;
+  for (const Command *cmd = head; cmd; cmd = cmd->next) {
+    stages++;
+  }
+
+  if (stages == 1 && batch_should_split(head)) {
+    BatchOptions opts = {.jobs = 1, .prefix = -1};
+    last_status = batch_run(head, head->argv, head->argc, &opts);
+    return;
+  }
+
+  pid_t *pids = (pid_t *)shell_malloc((stages + 1) * sizeof(pid_t));
+  bool capturing = false;
+  bool unopened = false;
+  bool missing = false;
+  uint64_t launch_start = 0;
+
   while (current) {
-    if (handle_builtins(current)) {
+    // Functions and builtins run in the shell itself only when they are the
+    // whole command; inside a pipeline or with redirections they get a child
+    // like any other
+    bool redirected = current->redirect_count > 0;
+    if (current->name == NULL && redirected) {
+      // Redirections on their own just create or check their files
+      if (!open_redirects(current)) {
+        last_status = 1;
+        current = current->next;
+        continue;
+      }
+      close_redirects(current);
+    }
+    if (stages == 1 && redirected && current->name &&
+        (function_lookup(current->name) || builtin_find(current->name))) {
+      run_redirected(current);
+      current = current->next;
+      continue;
+    }
+    if ((current->name == NULL || (stages == 1 && !redirected)) &&
+        (vm_call_function(current) || handle_builtins(current))) {
       current = current->next;
       continue;
     }
@@ -449,7 +865,33 @@ void run_commands(const Command *head) {
       exit(EXIT_FAILURE);
     }
 
-    pids[cmd_index++] = execute_command(current, prev_pipe_read, pipefd);
+    // A redirection that fails or a command that does not exist costs no
+    // process; the next stage reads EOF
+    bool opened = open_redirects(current);
+    char *path = NULL;
+    bool found = opened && command_found(current, &path);
+    if (opened && !found) {
+      suggest_not_found(current->name);
+      close_redirects(current);
+      missing = missing || !has_next;
+    }
+    if (found) {
+      // Only the final stage's output is the command's output
+      // A pipeline under a deadline must not block in the capture pump
+      if (!has_next && !timeout_active())
+        capturing = capture_begin(head);
+      sched_stage(cmd_index);
+      if (cmd_index == 0)
+        launch_start = stats_now();
+      pids[cmd_index++] =
+          execute_command(current, path, prev_pipe_read, pipefd);
+      if (timeout_active())
+        timeout_track(pids[cmd_index - 1], current->name);
+      close_redirects(current);
+    } else if (!opened && !has_next) {
+      unopened = true;
+    }
+    free(path);
 
     if (prev_pipe_read != -1)
       close(prev_pipe_read);
@@ -461,49 +903,254 @@ void run_commands(const Command *head) {
     current = current->next;
   }
 
-  for (int i = 0; i < cmd_index; ++i) {
-    int status;
-    waitpid(pids[i], &status, 0);
+  uint64_t wait_start = stats_now();
+  if (cmd_index > 0)
+    stats_record(&shell_stats()->launch, launch_start);
+
+  if (capturing)
+    capture_pump();
+
+  if (timeout_active() && cmd_index > 0) {
+    last_status = timeout_wait();
+  } else {
+    for (int i = 0; i < cmd_index; ++i) {
+      int status;
+      waitpid(pids[i], &status, 0);
+      if (i == cmd_index - 1) {
+        last_status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                        : 128 + WTERMSIG(status);
+      }
+    }
   }
+  if (cmd_index > 0)
+    stats_record(&shell_stats()->wait, wait_start);
+  if (unopened)
+    last_status = 1;
+  if (missing)
+    last_status = 127;
+  if (capturing)
+    capture_end(last_status);
+  free(pids);
+  stats_tick();
 }
 
-pid_t execute_command(const Command *cmd, int prev_pipe, int pipefd[2]) {
-  pid_t pid = fork();
+pid_t execute_command(const Command *cmd, const char *path, int prev_pipe,
+                      int pipefd[2]) {
+  // Script output is fully buffered; the child must not flush it again
+  fflush(stdout);
+  pid_t pid = shell_fork();
   if (pid == -1) {
     perror("fork");
     exit(EXIT_FAILURE);
   }
 
   if (pid == 0) {
+    timeout_child();
+    // Process substitution fds are close-on-exec everywhere but here
+    for (size_t i = 0; i < cmd->procsub_count; i++) {
+      fcntl(cmd->procsubs[i].fd, F_SETFD, 0);
+    }
     setup_pipes(prev_pipe, pipefd, cmd->next != NULL);
+    sched_child();
+    capture_child();
     setup_redirections(cmd);
-    execute(cmd);
+    apply_assignments(cmd, VAR_EXPORTED);
+    if (vm_call_function(cmd)) {
+      exit(last_status);
+    }
+    if (handle_builtins(cmd)) {
+      exit(last_status);
+    }
+    Command resolved = *cmd;
+    if (path)
+      resolved.exec_path = path;
+    execute(&resolved);
     exit(EXIT_FAILURE);
   }
 
   return pid;
 }
 
-void setup_redirections(const Command *cmd) {
-  if (cmd->is_out_redirect && cmd->out_file_name) {
-    int fd = open(cmd->out_file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+static int redirect_flags(RedirectKind kind) {
+  switch (kind) {
+  case REDIRECT_IN:
+    return O_RDONLY;
+  case REDIRECT_APPEND:
+    return O_WRONLY | O_CREAT | O_APPEND;
+  default:
+    return O_WRONLY | O_CREAT | O_TRUNC;
+  }
+}
+
+// Input text for <<< and here-documents, served from memory
+static int open_text(const char *text) {
+  int fd = memfd_create("heredoc", MFD_CLOEXEC);
+  if (fd == -1) {
+    perror("memfd_create");
+    return -1;
+  }
+  size_t len = strlen(text);
+  for (size_t done = 0; done < len;) {
+    ssize_t n = write(fd, text + done, len - done);
+    if (n <= 0) {
+      perror("heredoc");
+      close(fd);
+      return -1;
+    }
+    done += n;
+  }
+  lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
+// Opens every file and here-document of `cmd` in the shell, so a bad path
+// is reported before anything forks. FIFOs are left to the child: opening
+// one blocks until the other end is opened too.
+bool open_redirects(const Command *cmd) {
+  for (size_t i = 0; i < cmd->redirect_count; i++) {
+    Redirect *r = &cmd->redirects[i];
+    if (r->kind == REDIRECT_DUP)
+      continue;
+
+    int fd;
+    if (r->kind == REDIRECT_STRING || r->kind == REDIRECT_HEREDOC) {
+      fd = open_text(r->target);
+    } else {
+      struct stat st;
+      if (stat(r->target, &st) == 0 && S_ISFIFO(st.st_mode))
+        continue;
+      fd = open(r->target, redirect_flags(r->kind) | O_CLOEXEC, 0644);
+      if (fd == -1)
+        perror(r->target);
+    }
     if (fd == -1) {
-      perror(cmd->out_file_name);
-      exit(EXIT_FAILURE);
+      close_redirects(cmd);
+      return false;
     }
-    dup2(fd, STDOUT_FILENO);
+
+    // Out of the way of the descriptors being redirected
+    r->opened = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_MIN_FD);
     close(fd);
   }
+  return true;
+}
+
+void close_redirects(const Command *cmd) {
+  for (size_t i = 0; i < cmd->redirect_count; i++) {
+    if (cmd->redirects[i].opened != -1) {
+      close(cmd->redirects[i].opened);
+      cmd->redirects[i].opened = -1;
+    }
+  }
+}
 
-  if (cmd->is_in_redirect && cmd->in_file_name) {
-    int fd = open(cmd->in_file_name, O_RDONLY);
+// Applies the redirections left to right. Returns false, with the error
+// reported, when one cannot be applied.
+static bool apply_redirections(const Command *cmd) {
+  for (size_t i = 0; i < cmd->redirect_count; i++) {
+    const Redirect *r = &cmd->redirects[i];
+    if (r->kind == REDIRECT_DUP) {
+      if (strcmp(r->target, "-") == 0) {
+        close(r->fd);
+        continue;
+      }
+      int from = is_fd_number(r->target) ? atoi(r->target) : -1;
+      if (from < 0 || fcntl(from, F_GETFD) == -1) {
+        fprintf(stderr, "%s: bad file descriptor\n", r->target);
+        return false;
+      }
+      if (from == r->fd)
+        fcntl(from, F_SETFD, 0);
+      else
+        dup2(from, r->fd);
+      continue;
+    }
+
+    if (r->kind == REDIRECT_IN)
+      memo_note_input(r->target);
+    int fd = r->opened;
     if (fd == -1) {
-      perror(cmd->in_file_name);
-      exit(EXIT_FAILURE);
+      fd = open(r->target, redirect_flags(r->kind), 0644);
+      if (fd == -1) {
+        perror(r->target);
+        return false;
+      }
     }
-    dup2(fd, STDIN_FILENO);
-    close(fd);
+    if (r->kind == REDIRECT_BOTH)
+      dup2(fd, STDERR_FILENO);
+    if (fd != r->fd) {
+      dup2(fd, r->fd);
+      close(fd);
+    }
+    cmd->redirects[i].opened = -1;
+  }
+  return true;
+}
+
+// Applies the redirections in the child
+void setup_redirections(const Command *cmd) {
+  if (!apply_redirections(cmd))
+    exit(EXIT_FAILURE);
+}
+
+// A descriptor a builtin's redirection replaces, and the copy to restore
+typedef struct SavedFd {
+  int fd;
+  int copy;
+} SavedFd;
+
+// Keeps a copy of `fd` above REDIRECT_MIN_FD, once, to put back after a
+// builtin's redirections; -1 stands for a closed descriptor
+static void save_fd(SavedFd *saved, size_t *count, int fd) {
+  for (size_t i = 0; i < *count; i++) {
+    if (saved[i].fd == fd)
+      return;
+  }
+  saved[*count].fd = fd;
+  saved[*count].copy = fcntl(fd, F_DUPFD_CLOEXEC, REDIRECT_MIN_FD);
+  (*count)++;
+}
+
+// Runs a builtin or function that is the whole command in the shell, with
+// its redirections in place, so `cd dir 2>/dev/null` still changes
+// directory. The descriptors they replace are put back afterwards.
+static void run_redirected(const Command *cmd) {
+  if (!open_redirects(cmd)) {
+    last_status = 1;
+    return;
   }
+  SavedFd *saved =
+      (SavedFd *)shell_malloc((cmd->redirect_count + 1) * sizeof(SavedFd));
+  size_t count = 0;
+  for (size_t i = 0; i < cmd->redirect_count; i++) {
+    save_fd(saved, &count, cmd->redirects[i].fd);
+    if (cmd->redirects[i].kind == REDIRECT_BOTH)
+      save_fd(saved, &count, STDERR_FILENO);
+  }
+
+  // Output buffered so far belongs to the old descriptors, and what the
+  // builtin writes to the new ones
+  fflush(stdout);
+  if (apply_redirections(cmd)) {
+    if (!vm_call_function(cmd))
+      handle_builtins(cmd);
+  } else {
+    last_status = 1;
+  }
+  fflush(stdout);
+  fflush(stderr);
+
+  for (size_t i = count; i > 0; i--) {
+    if (saved[i - 1].copy == -1) {
+      close(saved[i - 1].fd);
+    } else {
+      dup2(saved[i - 1].copy, saved[i - 1].fd);
+      close(saved[i - 1].copy);
+    }
+  }
+  free(saved);
+  close_redirects(cmd);
+  memo_forget_inputs();
 }
 
 void setup_pipes(int prev_pipe_read, int pipefd[2], bool has_next) {
@@ -520,118 +1167,487 @@ void setup_pipes(int prev_pipe_read, int pipefd[2], bool has_next) {
 }
 
 bool execute(const Command *cmd) {
-  if (strncmp(".", cmd->name, strlen(".")) == 0) {
-    if (execve(cmd->name, cmd->argv, environ) == -1) {
-      return false;
-    }
+  // Only a failed execve returns; the two counts differ by the successes
+  stats_count(&shell_stats()->execs, 1);
+  if (cmd->exec_path) {
+    // Resolved ahead of time; fall back to a search if it went away
+    execve(cmd->exec_path, cmd->argv, vars_envp());
+  }
+
+  if (strchr(cmd->name, '/')) {
+    execve(cmd->name, cmd->argv, vars_envp());
+    perror(cmd->name);
+    stats_count(&shell_stats()->failed_execs, 1);
+    return false;
   }
 
-  const char *paths = getenv("PATH");
-  try_paths(paths, cmd);
-  // If code gets here means all paths tried
-  printf("ERROR: Command \'%s\' not found\n", cmd->name);
+  try_paths(path_dirs(), cmd);
+  // Normally caught before the fork; here PATH came from an assignment
+  fprintf(stderr, "%s: command not found\n", cmd->name);
+  stats_count(&shell_stats()->failed_execs, 1);
   return false;
 }
 
-void try_paths(const char *paths, const Command *cmd) {
-  char *all_paths = strdup(paths);
-  const char *path = strtok(all_paths, ":");
-  while (path != NULL) {
-    char full_path[INPUT_LEN];
-    snprintf(full_path, sizeof(full_path), "%s/%s", path, cmd->name);
+void try_paths(char *const *dirs, const Command *cmd) {
+  char *const *envp = vars_envp();
+  for (char *const *dir = dirs; *dir != NULL; dir++) {
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s/%s", *dir, cmd->name);
+
+    execve(full_path, cmd->argv, envp);
+  }
+}
+
+// Full path of the executable `name` would run, or NULL
+char *resolve_command(const char *name) {
+  for (char *const *dir = path_dirs(); *dir != NULL; dir++) {
+    char full_path[PATH_MAX];
+    snprintf(full_path, sizeof(full_path), "%s/%s", *dir, name);
+
+    struct stat st;
+    if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode) &&
+        access(full_path, X_OK) == 0)
+      return shell_strdup(full_path);
+  }
+  return NULL;
+}
+
+// PATH split into directories, cached until PATH is next assigned
+char *const *path_dirs() {
+  static char **dirs = NULL;
+  static char *storage = NULL;
+  static unsigned long epoch = 0;
 
-    execve(full_path, cmd->argv, environ);
-    path = strtok(NULL, ":");
+  if (dirs && epoch == vars_path_epoch())
+    return dirs;
+
+  free(dirs);
+  free(storage);
+
+  const char *paths = var_get("PATH");
+  storage = shell_strdup(paths ? paths : "");
+  size_t count = 1;
+  for (const char *p = storage; *p; p++) {
+    if (*p == ':')
+      count++;
+  }
+
+  dirs = (char **)shell_malloc((count + 1) * sizeof(char *));
+  size_t n = 0;
+  char *saveptr;
+  for (char *dir = strtok_r(storage, ":", &saveptr); dir != NULL;
+       dir = strtok_r(NULL, ":", &saveptr)) {
+    dirs[n++] = dir;
+  }
+  dirs[n] = NULL;
+
+  epoch = vars_path_epoch();
+  return dirs;
+}
+
+void apply_assignments(const Command *cmd, unsigned flags) {
+  for (int i = 0; i < cmd->assign_count; i++) {
+    const char *eq = strchr(cmd->assigns[i], '=');
+    char *name = strndup(cmd->assigns[i], eq - cmd->assigns[i]);
+    var_set(name, eq + 1, flags);
+    free(name);
   }
-  free(all_paths);
 }
 
 /***********************************************
  * BUILT-IN COMMANDS
  ***********************************************/
 
-void change_dir(const Command *cmd) {
-  if (cmd->argc < 2) {
-    fprintf(stderr, "cd: missing operand\n");
+// Calls `visit` for every entry of `path` in directory order, "." and ".."
+// included, with DT_UNKNOWN resolved, and goes into the directories for
+// which it returns true
+void tree_walk(const char *path, size_t level, TreeVisit visit, void *ctx) {
+  DIR *dir = opendir(path);
+  const struct dirent *direntp;
+  if (dir == NULL) {
     return;
   }
 
-  const char *target = cmd->argv[1];
-
-  if (target[0] == '~') {
-    const char *home = getenv("HOME");
-    if (!home) {
-      fprintf(stderr, "cd: HOME not set\n");
-      return;
+  while ((direntp = readdir(dir)) != NULL) {
+    const char *name = direntp->d_name;
+    unsigned char type = direntp->d_type;
+    struct stat st;
+    if (type == DT_UNKNOWN &&
+        fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+      type = IFTODT(st.st_mode);
     }
 
-    char path[INPUT_LEN];
-    if (strlen(target) > 1 && target[1] == '/') {
-      snprintf(path, INPUT_LEN, "%s/%s", home, target + 2);
-    } else {
-      snprintf(path, INPUT_LEN, "%s", home);
+    if (visit(path, name, type, level, ctx) && type == DT_DIR) {
+      char next_dir[PATH_MAX];
+      snprintf(next_dir, sizeof(next_dir), "%s/%s", path, name);
+      tree_walk(next_dir, level + 1, visit, ctx);
     }
+  }
 
-    if (chdir(path) != 0) {
-      perror("cd");
-    }
+  closedir(dir);
+}
 
-  } else if (target[0] == '/') {
-    if (chdir(target) != 0) {
-      perror("cd");
-    }
+static bool print_tree_entry(const char *dir, const char *name,
+                             unsigned char type, size_t level, void *ctx) {
+  (void)dir;
+  (void)ctx;
+  for (size_t i = 0; i < level; i++) {
+    printf("│   ");
+  }
 
-  } else {
-    char cwd[INPUT_LEN];
-    if (!getcwd(cwd, sizeof(cwd))) {
-      perror("cd: getcwd failed");
-      return;
+  printf("├── %s", name);
+  if (type == DT_DIR) {
+    printf("/\n");
+    return strncmp(name, ".", 1) != 0;
+  }
+  printf("\n");
+  return false;
+}
+
+void tree(const char *cwd, size_t level) {
+  tree_walk(cwd, level, print_tree_entry, NULL);
+}
+
+static void print_export(const Var *var, void *ctx) {
+  (void)ctx;
+  if (!(var->flags & VAR_EXPORTED))
+    return;
+  if (var->value)
+    printf("export %s=\"%s\"\n", var->name, var->value);
+  else
+    printf("export %s\n", var->name);
+}
+
+void export_vars(const Command *cmd) {
+  if (cmd->argc < 2) {
+    vars_foreach_sorted(print_export, NULL);
+    last_status = 0;
+    return;
+  }
+
+  last_status = 0;
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    const char *eq = strchr(arg, '=');
+    size_t name_len = eq ? (size_t)(eq - arg) : strlen(arg);
+
+    if (!var_is_valid_name(arg, name_len)) {
+      fprintf(stderr, "export: `%s': not a valid identifier\n", arg);
+      last_status = 1;
+      continue;
     }
 
-    char path[INPUT_LEN];
-    snprintf(path, INPUT_LEN, "%s/%s", cwd, target);
+    char *name = strndup(arg, name_len);
+    if (eq)
+      var_set(name, eq + 1, VAR_EXPORTED);
+    else
+      var_export(name);
+    free(name);
+  }
+}
 
-    if (chdir(path) != 0) {
-      perror("cd");
+void unset_vars(const Command *cmd) {
+  for (int i = 1; i < cmd->argc; i++) {
+    var_unset(cmd->argv[i]);
+  }
+  last_status = 0;
+}
+
+void echo_args(const Command *cmd) {
+  int first = 1;
+  bool newline = true;
+  if (cmd->argc > 1 && strcmp(cmd->argv[1], "-n") == 0) {
+    newline = false;
+    first = 2;
+  }
+
+  for (int i = first; i < cmd->argc; i++) {
+    fputs(cmd->argv[i], stdout);
+    if (i + 1 < cmd->argc)
+      putchar(' ');
+  }
+  if (newline)
+    putchar('\n');
+  last_status = 0;
+}
+
+bool set_option(const char *name, bool enable) {
+  size_t count = sizeof(option_table) / sizeof(*option_table);
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(name, option_table[i].name) == 0) {
+      *option_table[i].flag = enable;
+      if (option_table[i].flag == &shell_options.capture_output && enable)
+        capture_claim();
+      return true;
     }
   }
+  return false;
 }
 
-void tree(const char *cwd, size_t level) {
-  DIR *dir = opendir(cwd);
-  const struct dirent *direntp;
-  if (dir == NULL) {
+// set -o [name] enables an option (or lists them), set +o name disables it
+void set_options(const Command *cmd) {
+  size_t count = sizeof(option_table) / sizeof(*option_table);
+  last_status = 0;
+
+  if (cmd->argc < 3) {
+    for (size_t i = 0; i < count; i++) {
+      printf("%-16s%s\n", option_table[i].name,
+             *option_table[i].flag ? "on" : "off");
+    }
     return;
   }
 
-  while ((direntp = readdir(dir)) != NULL) {
-    const char *name = direntp->d_name;
-    for (int i = 0; i < level; i++) {
-      printf("│   ");
+  bool enable = strcmp(cmd->argv[1], "-o") == 0;
+  if (!enable && strcmp(cmd->argv[1], "+o") != 0) {
+    fprintf(stderr, "set: usage: set [-o|+o] option\n");
+    last_status = 2;
+    return;
+  }
+
+  for (int i = 2; i < cmd->argc; i++) {
+    if (!set_option(cmd->argv[i], enable)) {
+      fprintf(stderr, "set: %s: invalid option name\n", cmd->argv[i]);
+      last_status = 2;
     }
+  }
+}
 
-    printf("├── %s", name);
-    if (direntp->d_type == DT_DIR) {
-      printf("/\n");
-      if (strncmp(name, ".", 1) == 0) {
-        continue;
-      }
+typedef struct TestState {
+  char **args;
+  int pos;
+  int end;
+  bool error;
+} TestState;
 
-      char next_dir[INPUT_LEN];
-      snprintf(next_dir, sizeof(next_dir), "%s/%s", cwd, name);
-      tree(next_dir, level + 1);
-    } else {
-      printf("\n");
+static bool test_or(TestState *t);
+
+static bool test_integer(TestState *t, const char *text, long *value) {
+  char *end;
+  *value = strtol(text, &end, 10);
+  if (*text == '\0' || *end != '\0') {
+    fprintf(stderr, "test: %s: integer expression expected\n", text);
+    t->error = true;
+    return false;
+  }
+  return true;
+}
+
+static bool test_unary(const char *op, const char *arg) {
+  struct stat st;
+  switch (op[1]) {
+  case 'n': return *arg != '\0';
+  case 'z': return *arg == '\0';
+  case 'e': return stat(arg, &st) == 0;
+  case 'f': return stat(arg, &st) == 0 && S_ISREG(st.st_mode);
+  case 'd': return stat(arg, &st) == 0 && S_ISDIR(st.st_mode);
+  case 's': return stat(arg, &st) == 0 && st.st_size > 0;
+  case 'L':
+  case 'h': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+  case 'r': return access(arg, R_OK) == 0;
+  case 'w': return access(arg, W_OK) == 0;
+  case 'x': return access(arg, X_OK) == 0;
+  }
+  return false;
+}
+
+static bool is_unary_op(const char *op) {
+  return op[0] == '-' && op[1] && !op[2] && strchr("nzefdsLhrwx", op[1]);
+}
+
+static bool is_binary_op(const char *op) {
+  static const char *ops[] = {"=",   "==",  "!=",  "-eq", "-ne",
+                              "-lt", "-le", "-gt", "-ge"};
+  for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+    if (strcmp(op, ops[i]) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool test_binary(TestState *t, const char *lhs, const char *op,
+                        const char *rhs) {
+  if (op[0] != '-') {
+    bool equal = strcmp(lhs, rhs) == 0;
+    return op[0] == '!' ? !equal : equal;
+  }
+
+  long a, b;
+  if (!test_integer(t, lhs, &a) || !test_integer(t, rhs, &b))
+    return false;
+  if (strcmp(op, "-eq") == 0) return a == b;
+  if (strcmp(op, "-ne") == 0) return a != b;
+  if (strcmp(op, "-lt") == 0) return a < b;
+  if (strcmp(op, "-le") == 0) return a <= b;
+  if (strcmp(op, "-gt") == 0) return a > b;
+  return a >= b;
+}
+
+static bool test_primary(TestState *t) {
+  int left = t->end - t->pos;
+  if (left <= 0) {
+    t->error = true;
+    return false;
+  }
+
+  char **args = t->args + t->pos;
+  if (left >= 3 && is_binary_op(args[1])) {
+    t->pos += 3;
+    return test_binary(t, args[0], args[1], args[2]);
+  }
+  if (strcmp(args[0], "!") == 0 && left >= 2) {
+    t->pos++;
+    return !test_primary(t);
+  }
+  if (strcmp(args[0], "(") == 0 && left >= 3) {
+    t->pos++;
+    bool value = test_or(t);
+    if (t->pos >= t->end || strcmp(t->args[t->pos], ")") != 0)
+      t->error = true;
+    t->pos++;
+    return value;
+  }
+  if (left >= 2 && is_unary_op(args[0])) {
+    t->pos += 2;
+    return test_unary(args[0], args[1]);
+  }
+  t->pos++;
+  return args[0][0] != '\0';
+}
+
+static bool test_and(TestState *t) {
+  bool value = test_primary(t);
+  while (t->pos < t->end && strcmp(t->args[t->pos], "-a") == 0) {
+    t->pos++;
+    value = test_primary(t) && value;
+  }
+  return value;
+}
+
+static bool test_or(TestState *t) {
+  bool value = test_and(t);
+  while (t->pos < t->end && strcmp(t->args[t->pos], "-o") == 0) {
+    t->pos++;
+    value = test_and(t) || value;
+  }
+  return value;
+}
+
+// test EXPR and [ EXPR ]: 0 for true, 1 for false, 2 for a malformed EXPR
+void test_builtin(const Command *cmd) {
+  TestState t = {.args = cmd->argv + 1, .pos = 0, .end = cmd->argc - 1};
+  if (strcmp(cmd->name, "[") == 0) {
+    if (t.end < 0 || strcmp(cmd->argv[cmd->argc - 1], "]") != 0) {
+      fprintf(stderr, "[: missing `]'\n");
+      last_status = 2;
+      return;
     }
+    t.end--;
   }
 
-  closedir(dir);
+  if (t.end == 0) {
+    last_status = 1;
+    return;
+  }
+
+  bool value = test_or(&t);
+  if (t.pos != t.end && !t.error) {
+    fprintf(stderr, "%s: %s: unexpected argument\n", cmd->name,
+            t.args[t.pos]);
+    t.error = true;
+  }
+  last_status = t.error ? 2 : !value;
 }
 
 /***********************************************
  * STRING UTILITIES
  ***********************************************/
 
+// Length of the $(...), `...`, <(...) or >(...) starting at p, or 0 if p
+// starts none of them. Unterminated substitutions run to the end.
+size_t substitution_length(const char *p) {
+  if (p[0] == '`') {
+    for (size_t i = 1; p[i]; i++) {
+      if (p[i] == '\\' && p[i + 1])
+        i++;
+      else if (p[i] == '`')
+        return i + 1;
+    }
+    return strlen(p);
+  }
+
+  if ((p[0] != '$' && p[0] != '<' && p[0] != '>') || p[1] != '(')
+    return 0;
+
+  int depth = 0;
+  char quote = '\0';
+  for (size_t i = 1; p[i]; i++) {
+    char c = p[i];
+    if (quote == '\'') {
+      if (c == '\'')
+        quote = '\0';
+    } else if (c == '\\' && p[i + 1]) {
+      i++;
+    } else if (quote == '"') {
+      if (c == '"')
+        quote = '\0';
+      else if (c == '$' && p[i + 1] == '(')
+        i += substitution_length(p + i) - 1;
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+    } else if (c == '`') {
+      i += substitution_length(p + i) - 1;
+    } else if (c == '(') {
+      depth++;
+    } else if (c == ')' && --depth == 0) {
+      return i + 1;
+    }
+  }
+  return strlen(p);
+}
+
+// Splits off the next whitespace-delimited word, honouring quotes and
+// backslash escapes. The word is terminated in place.
+char *scan_word(char **cursor) {
+  char *p = *cursor;
+  while (*p && isspace((unsigned char)*p)) {
+    p++;
+  }
+  if (*p == '\0') {
+    *cursor = p;
+    return NULL;
+  }
+
+  char *start = p;
+  char quote = '\0';
+  while (*p) {
+    size_t subst = quote == '\'' ? 0 : substitution_length(p);
+    if (subst > 0) {
+      p += subst;
+      continue;
+    }
+
+    if (quote) {
+      if (*p == '\\' && quote == '"' && p[1])
+        p++;
+      else if (*p == quote)
+        quote = '\0';
+    } else if (*p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '"' || *p == '\'') {
+      quote = *p;
+    } else if (isspace((unsigned char)*p)) {
+      break;
+    }
+    p++;
+  }
+
+  if (*p) {
+    *p++ = '\0';
+  }
+  *cursor = p;
+  return start;
+}
+
 char *strtok_q(char *str, const char *delim, char **saveptr) {
   char *token_start;
   if (str != NULL) {
@@ -647,6 +1663,13 @@ char *strtok_q(char *str, const char *delim, char **saveptr) {
   char quote_char = '\0';
 
   while (**saveptr) {
+    size_t subst = in_quote && quote_char == '\'' ? 0
+                                                  : substitution_length(*saveptr);
+    if (subst > 0) {
+      *saveptr += subst;
+      continue;
+    }
+
     if ((**saveptr == '"' || **saveptr == '\'') &&
         (*saveptr == token_start || *(*saveptr - 1) != '\\')) {
       if (!in_quote) {
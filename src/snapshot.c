@@ -0,0 +1,354 @@
+#include "snapshot.h"
+#include "buffer.h"
+#include "dirs.h"
+#include "memo.h"
+#include "shell.h"
+#include "stats.h"
+#include "suggest.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HISTORY_FILE "history.txt"
+
+static pid_t owner = 0; // the shell that saves at exit, not its children
+static unsigned long lines_run = 0;
+
+/***********************************************
+ * LOCATION AND STAMPS
+ ***********************************************/
+
+const char *snapshot_path() {
+  static char path[PATH_MAX];
+  const char *base = var_get("SHELL_SNAPSHOT");
+  if (base && *base) {
+    snprintf(path, sizeof(path), "%s", base);
+  } else if ((base = var_get("XDG_CACHE_HOME")) && *base) {
+    snprintf(path, sizeof(path), "%s/" SNAPSHOT_NAME, base);
+  } else {
+    base = var_get("HOME");
+    snprintf(path, sizeof(path), "%s/.cache/" SNAPSHOT_NAME,
+             base ? base : "/tmp");
+  }
+  return path;
+}
+
+static uint32_t layout() {
+  return (uint32_t)(sizeof(DirEntry) | sizeof(NameRef) << 8 |
+                    sizeof(struct timespec) << 16 |
+                    sizeof(SnapshotHeader) << 24);
+}
+
+static uint64_t hash_text(const char *text) {
+  return memo_hash(MEMO_HASH_INIT, text ? text : "", text ? strlen(text) : 0);
+}
+
+static size_t path_dir_count() {
+  size_t count = 0;
+  for (char *const *dir = path_dirs(); *dir; dir++) {
+    count++;
+  }
+  return count;
+}
+
+/***********************************************
+ * SAVING
+ ***********************************************/
+
+static uint64_t begin_section(Buffer *out) {
+  while (out->len % 8)
+    buffer_push(out, '\0');
+  return out->len;
+}
+
+static SnapshotSpan end_section(const Buffer *out, uint64_t offset) {
+  return (SnapshotSpan){.offset = offset, .length = out->len - offset};
+}
+
+static void save_history(Buffer *out, SnapshotHeader *header) {
+  struct stat st;
+  if (stat(HISTORY_FILE, &st) == -1)
+    return;
+  header->history_mtime_sec = st.st_mtim.tv_sec;
+  header->history_mtime_nsec = st.st_mtim.tv_nsec;
+  header->history_size = st.st_size;
+  header->history_count = cmd_history.count;
+  uint64_t offset = begin_section(out);
+  for (int i = 0; i < cmd_history.count; i++) {
+    buffer_append(out, cmd_history.history[i],
+                  strlen(cmd_history.history[i]) + 1);
+  }
+  header->history = end_section(out, offset);
+}
+
+static void save_names(Buffer *out, SnapshotHeader *header) {
+  const NameIndex *names = suggest_index();
+  header->path_hash = hash_text(var_get("PATH"));
+  header->name_dirs = names->dir_count;
+  header->name_count = names->count;
+  header->name_bytes = names->names.len;
+  uint64_t offset = begin_section(out);
+  buffer_append(out, (const char *)names->mtimes,
+                names->dir_count * sizeof(struct timespec));
+  buffer_append(out, (const char *)names->by_length,
+                sizeof(names->by_length));
+  buffer_append(out, (const char *)names->refs,
+                names->count * sizeof(NameRef));
+  buffer_append(out, names->names.data, names->names.len);
+  header->names = end_section(out, offset);
+}
+
+static void save_dirs(Buffer *out, SnapshotHeader *header) {
+  const DirIndex *dirs = dirs_index();
+  if (!dirs->inode)
+    return; // no journal yet
+  header->dirs_path_hash = hash_text(dirs_index_path());
+  header->dirs_inode = dirs->inode;
+  header->dirs_read_to = dirs->read_to;
+  header->dirs_lines = dirs->lines;
+  header->dirs_count = dirs->count;
+  header->dirs_bytes = dirs->arena.len;
+  uint64_t offset = begin_section(out);
+  buffer_append(out, (const char *)dirs->entries,
+                dirs->count * sizeof(DirEntry));
+  buffer_append(out, dirs->arena.data, dirs->arena.len);
+  buffer_append(out, dirs->folded.data, dirs->folded.len);
+  header->dirs = end_section(out, offset);
+}
+
+static void make_parents(const char *file) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s", file);
+  for (char *slash = strchr(path + 1, '/'); slash;
+       slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(path, 0700);
+    *slash = '/';
+  }
+}
+
+// Writes the whole snapshot to a temporary file and renames it into place,
+// so a reader sees either the old snapshot or the new one
+bool snapshot_save() {
+  SnapshotHeader header = {.version = SNAPSHOT_VERSION, .layout = layout()};
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  Buffer out;
+  buffer_init(&out);
+  buffer_append(&out, (const char *)&header, sizeof(header));
+  save_history(&out, &header);
+  save_names(&out, &header);
+  save_dirs(&out, &header);
+  header.file_size = out.len;
+  memcpy(out.data, &header, sizeof(header));
+
+  const char *path = snapshot_path();
+  char tmp[PATH_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  make_parents(path);
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  bool ok = fd != -1;
+  size_t done = 0;
+  while (ok && done < out.len) {
+    ssize_t n = write(fd, out.data + done, out.len - done);
+    if (n == -1 && errno == EINTR)
+      continue;
+    ok = n > 0;
+    done += ok ? (size_t)n : 0;
+  }
+  if (fd != -1 && close(fd) == -1)
+    ok = false;
+  if (ok && rename(tmp, path) == -1)
+    ok = false;
+  if (!ok && fd != -1)
+    unlink(tmp);
+  buffer_free(&out);
+  return ok;
+}
+
+/***********************************************
+ * LOADING
+ ***********************************************/
+
+// Whether `span` lies within the file and is `expected` bytes long
+static bool span_fits(const SnapshotSpan *span, uint64_t file_size,
+                      uint64_t expected) {
+  return span->length > 0 && span->offset % 8 == 0 &&
+         span->offset <= file_size &&
+         span->length <= file_size - span->offset && span->length == expected;
+}
+
+static void *copy_out(const char *data, size_t len) {
+  char *copy = (char *)shell_malloc(len ? len : 1);
+  memcpy(copy, data, len);
+  return copy;
+}
+
+static bool load_history(const char *base, const SnapshotHeader *header) {
+  const SnapshotSpan *span = &header->history;
+  struct stat st;
+  if (span->length == 0 || span->offset > header->file_size ||
+      span->length > header->file_size - span->offset ||
+      header->history_count > HISTORY_LEN || stat(HISTORY_FILE, &st) == -1 ||
+      st.st_mtim.tv_sec != header->history_mtime_sec ||
+      st.st_mtim.tv_nsec != header->history_mtime_nsec ||
+      (uint64_t)st.st_size != header->history_size)
+    return false;
+
+  // Every line must end inside the section
+  const char *p = base + span->offset;
+  const char *end = p + span->length;
+  for (uint64_t i = 0; i < header->history_count; i++) {
+    const char *nul = (const char *)memchr(p, '\0', end - p);
+    if (!nul)
+      return false;
+    p = nul + 1;
+  }
+
+  free_history();
+  cmd_history = (History){.count = 0, .current_index = -1};
+  p = base + span->offset;
+  for (uint64_t i = 0; i < header->history_count; i++) {
+    size_t len = strlen(p);
+    cmd_history.history[cmd_history.count++] = (char *)copy_out(p, len + 1);
+    p += len + 1;
+  }
+  return true;
+}
+
+static bool load_names(const char *base, const SnapshotHeader *header) {
+  NameIndex index = {0};
+  size_t mtimes_size = header->name_dirs * sizeof(struct timespec);
+  size_t refs_size = header->name_count * sizeof(NameRef);
+  if (header->path_hash != hash_text(var_get("PATH")) ||
+      header->name_dirs != path_dir_count() ||
+      header->name_count > UINT32_MAX || header->name_bytes > UINT32_MAX ||
+      !span_fits(&header->names, header->file_size,
+                 mtimes_size + sizeof(index.by_length) + refs_size +
+                     header->name_bytes))
+    return false;
+
+  const char *p = base + header->names.offset;
+  const NameRef *refs = (const NameRef *)(p + mtimes_size +
+                                          sizeof(index.by_length));
+  const char *names = (const char *)refs + refs_size;
+  for (size_t i = 0; i < header->name_count; i++) {
+    if (refs[i].offset >= header->name_bytes ||
+        refs[i].len >= header->name_bytes - refs[i].offset ||
+        names[refs[i].offset + refs[i].len] != '\0')
+      return false;
+  }
+  memcpy(index.by_length, p + mtimes_size, sizeof(index.by_length));
+  size_t lengths = sizeof(index.by_length) / sizeof(*index.by_length);
+  for (size_t i = 0; i < lengths; i++) {
+    if (index.by_length[i] > header->name_count ||
+        (i > 0 && index.by_length[i] < index.by_length[i - 1]))
+      return false;
+  }
+
+  index.dir_count = header->name_dirs;
+  index.mtimes = (struct timespec *)copy_out(p, mtimes_size);
+  index.refs = (NameRef *)copy_out((const char *)refs, refs_size);
+  index.count = header->name_count;
+  index.names.data = (char *)copy_out(names, header->name_bytes);
+  index.names.len = index.names.cap = header->name_bytes;
+  suggest_adopt(&index);
+  return true;
+}
+
+static bool load_dirs(const char *base, const SnapshotHeader *header) {
+  size_t entries_size = header->dirs_count * sizeof(DirEntry);
+  if (header->dirs_path_hash != hash_text(dirs_index_path()) ||
+      header->dirs_count > UINT32_MAX || header->dirs_bytes > UINT32_MAX ||
+      !span_fits(&header->dirs, header->file_size,
+                 entries_size + 2 * header->dirs_bytes))
+    return false;
+
+  const char *p = base + header->dirs.offset;
+  const DirEntry *entries = (const DirEntry *)p;
+  const char *arena = p + entries_size;
+  const char *folded = arena + header->dirs_bytes;
+  for (size_t i = 0; i < header->dirs_count; i++) {
+    if (entries[i].path >= header->dirs_bytes ||
+        entries[i].len >= header->dirs_bytes - entries[i].path ||
+        arena[entries[i].path + entries[i].len] != '\0' ||
+        folded[entries[i].path + entries[i].len] != '\0' ||
+        (i > 0 && entries[i].path <= entries[i - 1].path))
+      return false;
+  }
+
+  DirIndex index = {0};
+  index.entries = (DirEntry *)copy_out(p, entries_size);
+  index.count = header->dirs_count;
+  index.arena.data = (char *)copy_out(arena, header->dirs_bytes);
+  index.arena.len = index.arena.cap = header->dirs_bytes;
+  index.folded.data = (char *)copy_out(folded, header->dirs_bytes);
+  index.folded.len = index.folded.cap = header->dirs_bytes;
+  index.read_to = header->dirs_read_to;
+  index.lines = header->dirs_lines;
+  index.inode = header->dirs_inode;
+  dirs_adopt(&index);
+  return true;
+}
+
+// Restores whatever in the snapshot still matches the files and PATH it
+// was built from, and returns which parts those were. Anything else is
+// built the usual way when it is first needed.
+unsigned snapshot_load() {
+  int fd = open(snapshot_path(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+    close(fd);
+    return 0;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  const char *base = (const char *)map;
+  const SnapshotHeader *header = (const SnapshotHeader *)map;
+  unsigned restored = 0;
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 &&
+      header->version == SNAPSHOT_VERSION && header->layout == layout() &&
+      header->file_size == (uint64_t)st.st_size) {
+    if (load_history(base, header))
+      restored |= SNAPSHOT_HISTORY;
+    if (load_names(base, header))
+      restored |= SNAPSHOT_NAMES;
+    if (load_dirs(base, header))
+      restored |= SNAPSHOT_DIRS;
+  }
+  munmap(map, st.st_size);
+  return restored;
+}
+
+/***********************************************
+ * WHEN TO SAVE
+ ***********************************************/
+
+// Called after each interactive line; saves every SNAPSHOT_EVERY lines so
+// a shell that is killed still leaves a recent snapshot
+void snapshot_tick() {
+  if (++lines_run % SNAPSHOT_EVERY == 0)
+    snapshot_save();
+}
+
+static void save_at_exit() {
+  if (getpid() == owner)
+    snapshot_save();
+}
+
+void snapshot_save_at_exit() {
+  if (owner == 0)
+    atexit(save_at_exit);
+  owner = getpid();
+}
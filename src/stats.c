@@ -0,0 +1,369 @@
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+// Counts land here until stats_init() moves them to shared memory
+static ShellStats local = {0};
+static ShellStats *current = &local;
+
+// Periodic dumps for monitoring
+static char *dump_path = NULL;
+static long dump_interval = STATS_DEFAULT_INTERVAL;
+static uint64_t last_dump = 0;
+
+/***********************************************
+ * COUNTERS
+ ***********************************************/
+
+// Maps the counters where forked children update the same copy. Counting
+// goes on in process-local memory if that fails.
+void stats_init() {
+  if (current != &local)
+    return;
+  ShellStats *shared = (ShellStats *)mmap(NULL, sizeof(ShellStats),
+                                          PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED)
+    return;
+  *shared = local;
+  current = shared;
+}
+
+ShellStats *shell_stats() { return current; }
+
+void stats_reset() {
+  memset(current, 0, sizeof(ShellStats));
+}
+
+// Stages of a pipeline update the counters at the same time
+void stats_count(uint64_t *counter, uint64_t n) {
+  __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+uint64_t stats_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+size_t stats_bucket(uint64_t ns) {
+  if (ns < (1u << STATS_SUB_BITS))
+    return ns;
+  int msb = 63 - __builtin_clzll(ns);
+  return ((size_t)(msb - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+         ((ns >> (msb - STATS_SUB_BITS)) & ((1u << STATS_SUB_BITS) - 1));
+}
+
+// The smallest value counted in `bucket`
+uint64_t stats_bucket_floor(size_t bucket) {
+  if (bucket < (1u << STATS_SUB_BITS))
+    return bucket;
+  size_t power = bucket >> STATS_SUB_BITS;
+  size_t step = bucket & ((1u << STATS_SUB_BITS) - 1);
+  return ((1ULL << STATS_SUB_BITS) + step) << (power - 1);
+}
+
+void stats_record_ns(LatencyHistogram *histogram, uint64_t ns) {
+  uint64_t count = __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->buckets[stats_bucket(ns)], 1,
+                     __ATOMIC_RELAXED);
+  uint64_t seen = __atomic_load_n(&histogram->min, __ATOMIC_RELAXED);
+  while ((count == 0 || ns < seen) &&
+         !__atomic_compare_exchange_n(&histogram->min, &seen, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  seen = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  while (ns > seen &&
+         !__atomic_compare_exchange_n(&histogram->max, &seen, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+void stats_record(LatencyHistogram *histogram, uint64_t start) {
+  stats_record_ns(histogram, stats_now() - start);
+}
+
+// The value below which `fraction` of the durations fall, to within the
+// width of a bucket
+uint64_t stats_percentile(const LatencyHistogram *histogram,
+                          double fraction) {
+  if (histogram->count == 0)
+    return 0;
+  uint64_t wanted = (uint64_t)(fraction * histogram->count + 0.5);
+  if (wanted == 0)
+    wanted = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < STATS_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen >= wanted) {
+      uint64_t top = i + 1 < STATS_BUCKETS ? stats_bucket_floor(i + 1) - 1
+                                           : UINT64_MAX;
+      return top < histogram->max ? top : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+// Resident set size, from the second field of /proc/self/statm
+long stats_rss_bytes() {
+  int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+  char text[128];
+  ssize_t n = read(fd, text, sizeof(text) - 1);
+  close(fd);
+  if (n <= 0)
+    return -1;
+  text[n] = '\0';
+  long size;
+  long resident;
+  if (sscanf(text, "%ld %ld", &size, &resident) != 2)
+    return -1;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+/***********************************************
+ * COUNTED ALLOCATION AND PROCESSES
+ ***********************************************/
+
+static void *counted(void *ptr, size_t size, const char *what) {
+  if (!ptr && size) {
+    perror(what);
+    exit(EXIT_FAILURE);
+  }
+  stats_count(&current->allocations, 1);
+  stats_count(&current->allocated_bytes, size);
+  return ptr;
+}
+
+void *shell_malloc(size_t size) {
+  return counted(malloc(size), size, "malloc");
+}
+
+void *shell_calloc(size_t count, size_t size) {
+  return counted(calloc(count, size), count * size, "calloc");
+}
+
+// Counts the new size: growing a block may copy it
+void *shell_realloc(void *ptr, size_t size) {
+  return counted(realloc(ptr, size), size, "realloc");
+}
+
+char *shell_strdup(const char *text) {
+  size_t len = strlen(text);
+  return (char *)counted(strdup(text), len + 1, "strdup");
+}
+
+char *shell_strndup(const char *text, size_t len) {
+  char *copy = strndup(text, len);
+  return (char *)counted(copy, copy ? strlen(copy) + 1 : len + 1, "strndup");
+}
+
+pid_t shell_fork() {
+  pid_t pid = fork();
+  if (pid > 0)
+    stats_count(&current->forks, 1);
+  else if (pid == -1)
+    stats_count(&current->fork_failures, 1);
+  return pid;
+}
+
+/***********************************************
+ * REPORTING
+ ***********************************************/
+
+static const struct {
+  const char *name;
+  size_t offset;
+} histograms[] = {
+    {"parse", offsetof(ShellStats, parse)},
+    {"launch", offsetof(ShellStats, launch)},
+    {"wait", offsetof(ShellStats, wait)},
+    {"key", offsetof(ShellStats, key)},
+};
+
+static const LatencyHistogram *histogram_at(size_t i) {
+  return (const LatencyHistogram *)((const char *)current +
+                                    histograms[i].offset);
+}
+
+static void write_text(FILE *out) {
+  const ShellStats *s = current;
+  long rss = stats_rss_bytes();
+  fprintf(out, "allocations  %llu (%llu bytes)\n",
+          (unsigned long long)s->allocations,
+          (unsigned long long)s->allocated_bytes);
+  fprintf(out, "forks        %llu (%llu failed)\n",
+          (unsigned long long)s->forks, (unsigned long long)s->fork_failures);
+  fprintf(out, "execs        %llu (%llu failed)\n",
+          (unsigned long long)s->execs, (unsigned long long)s->failed_execs);
+  fprintf(out, "history io   %llu bytes read, %llu written\n",
+          (unsigned long long)s->history_read_bytes,
+          (unsigned long long)s->history_written_bytes);
+  if (rss >= 0)
+    fprintf(out, "rss          %.1f MiB\n", rss / 1048576.0);
+  fprintf(out, "%-12s %8s %10s %10s %10s %10s %10s\n", "latency (us)",
+          "count", "min", "p50", "p90", "p99", "max");
+  for (size_t i = 0; i < sizeof(histograms) / sizeof(*histograms); i++) {
+    const LatencyHistogram *h = histogram_at(i);
+    fprintf(out, "%-12s %8llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            histograms[i].name, (unsigned long long)h->count, h->min / 1e3,
+            stats_percentile(h, 0.5) / 1e3, stats_percentile(h, 0.9) / 1e3,
+            stats_percentile(h, 0.99) / 1e3, h->max / 1e3);
+  }
+}
+
+// One JSON object, for monitoring to collect. Histograms list only their
+// non-empty buckets, as [lowest value in ns, count] pairs.
+void stats_write_json(FILE *out) {
+  const ShellStats *s = current;
+  fprintf(out,
+          "{\"pid\": %d, \"rss_bytes\": %ld, \"allocations\": %llu, "
+          "\"allocated_bytes\": %llu, \"forks\": %llu, "
+          "\"fork_failures\": %llu, \"execs\": %llu, \"failed_execs\": %llu, "
+          "\"history_read_bytes\": %llu, \"history_written_bytes\": %llu",
+          (int)getpid(), stats_rss_bytes(),
+          (unsigned long long)s->allocations,
+          (unsigned long long)s->allocated_bytes,
+          (unsigned long long)s->forks, (unsigned long long)s->fork_failures,
+          (unsigned long long)s->execs, (unsigned long long)s->failed_execs,
+          (unsigned long long)s->history_read_bytes,
+          (unsigned long long)s->history_written_bytes);
+  for (size_t i = 0; i < sizeof(histograms) / sizeof(*histograms); i++) {
+    const LatencyHistogram *h = histogram_at(i);
+    fprintf(out,
+            ", \"%s_ns\": {\"count\": %llu, \"sum\": %llu, \"min\": %llu, "
+            "\"max\": %llu, \"buckets\": [",
+            histograms[i].name, (unsigned long long)h->count,
+            (unsigned long long)h->sum, (unsigned long long)h->min,
+            (unsigned long long)h->max);
+    bool first = true;
+    for (size_t b = 0; b < STATS_BUCKETS; b++) {
+      if (h->buckets[b] == 0)
+        continue;
+      fprintf(out, "%s[%llu, %llu]", first ? "" : ", ",
+              (unsigned long long)stats_bucket_floor(b),
+              (unsigned long long)h->buckets[b]);
+      first = false;
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "}\n");
+}
+
+// Replaces the dump file in one step, so a collector never reads half
+static void dump() {
+  char tmp[PATH_MAX + 32];
+  snprintf(tmp, sizeof(tmp), "%s.%d", dump_path, (int)getpid());
+  FILE *out = fopen(tmp, "we");
+  if (!out)
+    return;
+  stats_write_json(out);
+  if (fclose(out) != 0 || rename(tmp, dump_path) != 0)
+    unlink(tmp);
+}
+
+// Called after each pipeline; dumps once the interval has passed
+void stats_tick() {
+  if (!dump_path)
+    return;
+  uint64_t now = stats_now();
+  if (now - last_dump < (uint64_t)dump_interval * 1000000000ULL)
+    return;
+  last_dump = now;
+  dump();
+}
+
+// Resolves the dump file's directory now, so a later cd doesn't move the
+// dump. NULL when that directory doesn't exist.
+static char *absolute_dump_path(const char *path) {
+  const char *slash = strrchr(path, '/');
+  const char *name = slash ? slash + 1 : path;
+  char dir[PATH_MAX];
+  if (!slash)
+    strcpy(dir, ".");
+  else if (slash == path)
+    strcpy(dir, "/");
+  else
+    snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+
+  char real[PATH_MAX];
+  if (!realpath(dir, real)) {
+    fprintf(stderr, "shellstats: %s: %s\n", dir, strerror(errno));
+    return NULL;
+  }
+  size_t len = strlen(real) + strlen(name) + 2;
+  char *absolute = (char *)shell_malloc(len);
+  snprintf(absolute, len, "%s%s%s", real,
+           real[strlen(real) - 1] == '/' ? "" : "/", name);
+  return absolute;
+}
+
+static void usage() {
+  fprintf(stderr, "shellstats: usage: shellstats [-j] [-r] "
+                  "[-d file [-i seconds] | -d -]\n");
+  last_status = 2;
+}
+
+// shellstats [-j] [-r] [-d file [-i seconds]]: reports the shell's own
+// costs, as text or with -j as JSON. -r zeroes the counters after the
+// report. -d dumps the JSON to `file` every `seconds` (60 by default) as
+// commands run; -d - stops.
+void shellstats_builtin(const Command *cmd) {
+  bool json = false;
+  bool reset = false;
+  const char *path = NULL;
+  long interval = STATS_DEFAULT_INTERVAL;
+  for (int i = 1; i < cmd->argc; i++) {
+    const char *arg = cmd->argv[i];
+    const char *value = i + 1 < cmd->argc ? cmd->argv[i + 1] : NULL;
+    if (strcmp(arg, "-j") == 0) {
+      json = true;
+    } else if (strcmp(arg, "-r") == 0) {
+      reset = true;
+    } else if (strcmp(arg, "-d") == 0 && value && *value) {
+      path = value;
+      i++;
+    } else if (strcmp(arg, "-i") == 0 && value) {
+      char *end;
+      interval = strtol(value, &end, 10);
+      if (*end || end == value || interval <= 0) {
+        usage();
+        return;
+      }
+      i++;
+    } else {
+      usage();
+      return;
+    }
+  }
+
+  last_status = 0;
+  if (path) {
+    char *absolute = NULL;
+    if (strcmp(path, "-") != 0 && !(absolute = absolute_dump_path(path))) {
+      last_status = 1;
+      return;
+    }
+    free(dump_path);
+    dump_path = absolute;
+    dump_interval = interval;
+    last_dump = stats_now();
+    if (dump_path)
+      dump();
+    return;
+  }
+  if (json)
+    stats_write_json(stdout);
+  else
+    write_text(stdout);
+  if (reset)
+    stats_reset();
+}
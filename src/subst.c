@@ -0,0 +1,400 @@
+#include "subst.h"
+#include "builtins.h"
+#include "cache.h"
+#include "shell.h"
+#include "stats.h"
+#include "vm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static PendingSubst *pending = NULL;
+static size_t pending_count = 0;
+static int prefetch_depth = 0; // prefetch calls nest; only the outermost runs
+static int latest_status = -1; // of the last substitution, until taken
+
+// Process substitutions expanded since the last procsub_claim()
+static ProcSub *unclaimed = NULL;
+static size_t unclaimed_count = 0;
+
+/***********************************************
+ * CAPTURE
+ ***********************************************/
+
+static int exit_code(int status) {
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static void trim_newlines(Buffer *out, size_t from) {
+  while (out->len > from && out->data[out->len - 1] == '\n') {
+    out->data[--out->len] = '\0';
+  }
+}
+
+bool subst_is_inline_builtin(const char *name) {
+  const Builtin *builtin = builtin_find(name);
+  return builtin && (builtin->flags & BUILTIN_INLINE);
+}
+
+// Runs a builtin with stdout pointed at an anonymous memory file
+static void capture_builtin(const Command *cmd, Buffer *out) {
+  fflush(stdout);
+  int memfd = memfd_create("subst", MFD_CLOEXEC);
+  int saved = dup(STDOUT_FILENO);
+  if (memfd == -1 || saved == -1) {
+    perror("memfd_create");
+    return;
+  }
+
+  dup2(memfd, STDOUT_FILENO);
+  handle_builtins(cmd);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  lseek(memfd, 0, SEEK_SET);
+  buffer_read_fd(out, memfd, SUBST_READ_SIZE);
+  close(memfd);
+}
+
+static pid_t spawn_capture(int *read_fd) {
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) == -1) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  fflush(stdout);
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    dup2(pipefd[1], STDOUT_FILENO);
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return 0;
+  }
+
+  close(pipefd[1]);
+  *read_fd = pipefd[0];
+  return pid;
+}
+
+/***********************************************
+ * PARALLEL PREFETCH
+ ***********************************************/
+
+static void collect_pending() {
+  struct pollfd *fds = (struct pollfd *)malloc(pending_count * sizeof(*fds));
+  size_t *owner = (size_t *)malloc(pending_count * sizeof(size_t));
+
+  while (true) {
+    size_t nfds = 0;
+    for (size_t i = 0; i < pending_count; i++) {
+      if (pending[i].fd != -1) {
+        fds[nfds] = (struct pollfd){.fd = pending[i].fd, .events = POLLIN};
+        owner[nfds++] = i;
+      }
+    }
+    if (nfds == 0)
+      break;
+
+    if (poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    for (size_t k = 0; k < nfds; k++) {
+      if (!fds[k].revents)
+        continue;
+      PendingSubst *sub = &pending[owner[k]];
+      buffer_reserve(&sub->output, SUBST_READ_SIZE);
+      ssize_t n = read(sub->fd, sub->output.data + sub->output.len,
+                       sub->output.cap - sub->output.len - 1);
+      if (n > 0) {
+        sub->output.len += n;
+        sub->output.data[sub->output.len] = '\0';
+      } else if (n == 0 || errno != EINTR) {
+        close(sub->fd);
+        sub->fd = -1;
+        waitpid(sub->pid, &sub->status, 0);
+        sub->pid = -1;
+      }
+    }
+  }
+
+  free(owner);
+  free(fds);
+}
+
+static void start_pending(const char *text, size_t len) {
+  pending = (PendingSubst *)realloc(pending,
+                                    (pending_count + 1) * sizeof(PendingSubst));
+  PendingSubst *sub = &pending[pending_count++];
+  sub->text = strndup(text, len);
+  sub->consumed = false;
+  sub->status = 0;
+  buffer_init(&sub->output);
+
+  sub->pid = spawn_capture(&sub->fd);
+  if (sub->pid == 0) {
+    // The child has no business with its siblings' pipes
+    pending_count = 0;
+    prefetch_depth = 0;
+    exit(run_source(sub->text));
+  }
+}
+
+static bool runs_inline(const char *text, size_t len) {
+  const char *end = text + len;
+  while (text < end && (*text == ' ' || *text == '\t'))
+    text++;
+
+  size_t word = 0;
+  while (text + word < end && text[word] != ' ' && text[word] != '\t')
+    word++;
+
+  char name[32];
+  if (word == 0 || word >= sizeof(name))
+    return false;
+  memcpy(name, text, word);
+  name[word] = '\0';
+
+  return subst_is_inline_builtin(name) && !memchr(text, '|', len) &&
+         !memchr(text, '<', len) && !memchr(text, '>', len) &&
+         !memchr(text, '`', len) && !memchr(text, '(', len);
+}
+
+// Starts every top-level substitution on the line at once, so independent
+// substitutions overlap. Their results are handed out in order of request.
+// Each call is paired with subst_finish().
+void subst_prefetch(const char *line) {
+  if (prefetch_depth++ > 0 || !shell_options.parallel_subst)
+    return;
+
+  const char *texts[64];
+  size_t lens[64];
+  size_t count = 0;
+  char quote = '\0';
+
+  for (const char *p = line; *p && count < 64; p++) {
+    if (quote == '\'') {
+      if (*p == '\'')
+        quote = '\0';
+      continue;
+    }
+    if (*p == '\\' && p[1]) {
+      p++;
+    } else if (*p == '"') {
+      quote = quote ? '\0' : '"';
+    } else if (*p == '\'' && !quote) {
+      quote = '\'';
+    } else if (*p == '`') {
+      // Backtick bodies need unescaping first; they run on demand
+      p += substitution_length(p) - 1;
+    } else if (*p == '$' && p[1] == '(' && p[2] != '(') {
+      size_t len = substitution_length(p);
+      size_t body = len - 2 - (p[len - 1] == ')' ? 1 : 0);
+      if (!runs_inline(p + 2, body)) {
+        texts[count] = p + 2;
+        lens[count++] = body;
+      }
+      p += len - 1;
+    }
+  }
+
+  if (count < 2)
+    return;
+  for (size_t i = 0; i < count; i++) {
+    start_pending(texts[i], lens[i]);
+  }
+}
+
+void subst_finish() {
+  if (prefetch_depth > 0 && --prefetch_depth > 0)
+    return;
+
+  for (size_t i = 0; i < pending_count; i++) {
+    if (pending[i].fd != -1)
+      close(pending[i].fd);
+    if (pending[i].pid > 0)
+      waitpid(pending[i].pid, NULL, 0);
+    free(pending[i].text);
+    buffer_free(&pending[i].output);
+  }
+  free(pending);
+  pending = NULL;
+  pending_count = 0;
+}
+
+/***********************************************
+ * COMMAND SUBSTITUTION
+ ***********************************************/
+
+// Appends the output of `text`, without trailing newlines, to `out`
+static void substitute(const char *text, Buffer *out) {
+  size_t start = out->len;
+
+  for (size_t i = 0; i < pending_count; i++) {
+    if (!pending[i].consumed && strcmp(pending[i].text, text) == 0) {
+      collect_pending();
+      pending[i].consumed = true;
+      buffer_append(out, pending[i].output.data ? pending[i].output.data : "",
+                    pending[i].output.len);
+      last_status = exit_code(pending[i].status);
+      trim_newlines(out, start);
+      return;
+    }
+  }
+
+  // Lists, loops and functions run whole in the child
+  Program *prog;
+  CompileResult result = cache_compile(text, &prog);
+  if (result != COMPILE_OK) {
+    if (result == COMPILE_INCOMPLETE)
+      fprintf(stderr, "syntax error: unexpected end of file\n");
+    last_status = 2;
+    return;
+  }
+  if (!program_is_simple(prog)) {
+    int fd;
+    pid_t pid = spawn_capture(&fd);
+    if (pid == 0) {
+      exit(vm_execute(prog));
+    }
+    program_release(prog);
+    buffer_read_fd(out, fd, SUBST_READ_SIZE);
+    close(fd);
+
+    int status;
+    waitpid(pid, &status, 0);
+    last_status = exit_code(status);
+    trim_newlines(out, start);
+    return;
+  }
+
+  // Commands borrow resolved paths from the program until they are freed
+  Command *commands = program_pipeline(prog);
+
+  if (commands && !commands->next && commands->name &&
+      commands->redirect_count == 0 &&
+      subst_is_inline_builtin(commands->name)) {
+    capture_builtin(commands, out);
+  } else if (commands) {
+    int fd;
+    pid_t pid = spawn_capture(&fd);
+    if (pid == 0) {
+      run_commands(commands);
+      exit(last_status);
+    }
+
+    buffer_read_fd(out, fd, SUBST_READ_SIZE);
+    close(fd);
+
+    int status;
+    waitpid(pid, &status, 0);
+    last_status = exit_code(status);
+  }
+
+  free_commands(&commands);
+  program_release(prog);
+  trim_newlines(out, start);
+}
+
+void command_substitute(const char *text, Buffer *out) {
+  substitute(text, out);
+  latest_status = last_status;
+}
+
+// Status of the last substitution since the previous call, or -1. An
+// assignment-only command returns it, so `x=$(false) || ...` sees failure.
+int subst_take_status() {
+  int status = latest_status;
+  latest_status = -1;
+  return status;
+}
+
+/***********************************************
+ * PROCESS SUBSTITUTION
+ ***********************************************/
+
+// Starts `text` with its stdout (input == true, for <(...)) or stdin (for
+// >(...)) on a pipe, and returns the /dev/fd path of the shell's end. That
+// end is close-on-exec; only the command that names it clears the flag.
+char *process_substitute(const char *text, bool input) {
+  int pipefd[2];
+  if (pipe2(pipefd, O_CLOEXEC) == -1) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+
+  int child_end = input ? pipefd[1] : pipefd[0];
+  int shell_end = input ? pipefd[0] : pipefd[1];
+
+  fflush(stdout);
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    // Earlier substitutions on this line must see EOF without our help
+    for (size_t i = 0; i < unclaimed_count; i++) {
+      close(unclaimed[i].fd);
+    }
+    unclaimed_count = 0;
+
+    dup2(child_end, input ? STDOUT_FILENO : STDIN_FILENO);
+    close(child_end);
+    close(shell_end);
+
+    exit(run_source(text));
+  }
+
+  close(child_end);
+  unclaimed = (ProcSub *)shell_realloc(
+      unclaimed, (unclaimed_count + 1) * sizeof(ProcSub));
+  unclaimed[unclaimed_count++] = (ProcSub){.fd = shell_end, .pid = pid};
+
+  char path[32];
+  snprintf(path, sizeof(path), "/dev/fd/%d", shell_end);
+  return shell_strdup(path);
+}
+
+void procsub_claim(Command *cmd) {
+  if (unclaimed_count == 0)
+    return;
+
+  cmd->procsubs = (ProcSub *)shell_realloc(
+      cmd->procsubs, (cmd->procsub_count + unclaimed_count) * sizeof(ProcSub));
+  memcpy(cmd->procsubs + cmd->procsub_count, unclaimed,
+         unclaimed_count * sizeof(ProcSub));
+  cmd->procsub_count += unclaimed_count;
+  unclaimed_count = 0;
+}
+
+// Closes the shell's pipe ends, so >(...) readers see EOF and <(...)
+// writers stop, then reaps the substitution children.
+void procsub_release(Command *cmd) {
+  for (size_t i = 0; i < cmd->procsub_count; i++) {
+    close(cmd->procsubs[i].fd);
+  }
+  for (size_t i = 0; i < cmd->procsub_count; i++) {
+    waitpid(cmd->procsubs[i].pid, NULL, 0);
+  }
+  free(cmd->procsubs);
+  cmd->procsubs = NULL;
+  cmd->procsub_count = 0;
+}
@@ -0,0 +1,314 @@
+#include "suggest.h"
+#include "alias.h"
+#include "builtins.h"
+#include "shell.h"
+#include "stats.h"
+#include "vars.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static NameIndex known = {0}; // executables on PATH
+
+/***********************************************
+ * EDIT DISTANCE
+ ***********************************************/
+
+// Which positions of the pattern hold each byte
+typedef struct Pattern {
+  uint64_t eq[256];
+  size_t len;
+} Pattern;
+
+static void pattern_init(Pattern *p, const char *text, size_t len) {
+  memset(p->eq, 0, sizeof(p->eq));
+  for (size_t i = 0; i < len; i++) {
+    p->eq[(unsigned char)text[i]] |= 1ULL << i;
+  }
+  p->len = len;
+}
+
+// Edit distance of `text` from the pattern, counting a swap of adjacent
+// characters as one edit. Computed a column of the DP matrix at a time as
+// bit vectors of vertical deltas: Myers' algorithm in Hyyrö's form, with
+// his extension for transpositions. Stops early and returns more than
+// `limit` once the distance cannot come back down to it.
+static size_t distance(const Pattern *p, const char *text, size_t n,
+                       size_t limit) {
+  uint64_t high = 1ULL << (p->len - 1);
+  uint64_t vp = ~0ULL;
+  uint64_t vn = 0;
+  uint64_t d0 = 0;
+  uint64_t prev_eq = 0;
+  size_t score = p->len;
+  for (size_t j = 0; j < n; j++) {
+    uint64_t eq = p->eq[(unsigned char)text[j]];
+    uint64_t tr = ((~d0 & eq) << 1) & prev_eq;
+    d0 = (((eq & vp) + vp) ^ vp) | eq | vn | tr;
+    uint64_t hp = vn | ~(d0 | vp);
+    uint64_t hn = vp & d0;
+    if (hp & high)
+      score++;
+    else if (hn & high)
+      score--;
+    // Each remaining character lowers the score by at most one
+    if (score > limit + (n - j - 1))
+      return limit + 1;
+    hp = (hp << 1) | 1; // the top row counts insertions
+    hn <<= 1;
+    vp = hn | ~(d0 | hp);
+    vn = hp & d0;
+    prev_eq = eq;
+  }
+  return score;
+}
+
+// Edit distance between two names; SIZE_MAX when `pattern` is empty or
+// longer than SUGGEST_MAX_NAME
+size_t suggest_distance(const char *pattern, const char *text) {
+  size_t m = strlen(pattern);
+  if (m == 0 || m > SUGGEST_MAX_NAME)
+    return SIZE_MAX;
+  Pattern p;
+  pattern_init(&p, pattern, m);
+  size_t n = strlen(text);
+  return distance(&p, text, n, m > n ? m : n);
+}
+
+/***********************************************
+ * NAME INDEX
+ ***********************************************/
+
+static int compare_refs(const void *a, const void *b) {
+  const NameRef *x = (const NameRef *)a;
+  const NameRef *y = (const NameRef *)b;
+  if (x->len != y->len)
+    return x->len < y->len ? -1 : 1;
+  return strcmp(known.names.data + x->offset, known.names.data + y->offset);
+}
+
+static void forget_index() {
+  free(known.mtimes);
+  buffer_free(&known.names);
+  free(known.refs);
+  known = (NameIndex){0};
+}
+
+// Whether the index still describes PATH: one stat per directory
+static bool index_fresh(char *const *dirs, size_t dir_count) {
+  if (!known.built || known.path_epoch != vars_path_epoch() ||
+      known.dir_count != dir_count)
+    return false;
+  for (size_t i = 0; i < dir_count; i++) {
+    struct stat st;
+    if (stat(dirs[i], &st) == -1)
+      st.st_mtim = (struct timespec){0};
+    if (st.st_mtim.tv_sec != known.mtimes[i].tv_sec ||
+        st.st_mtim.tv_nsec != known.mtimes[i].tv_nsec)
+      return false;
+  }
+  return true;
+}
+
+static void add_name(const char *name, size_t *cap) {
+  size_t len = strlen(name);
+  if (len > SUGGEST_MAX_NAME + SUGGEST_MAX_DISTANCE)
+    return;
+  if (known.count == *cap) {
+    *cap = *cap ? *cap * 2 : 1024;
+    known.refs = (NameRef *)shell_realloc(known.refs, *cap * sizeof(NameRef));
+  }
+  known.refs[known.count++] =
+      (NameRef){.offset = known.names.len, .len = len};
+  buffer_append(&known.names, name, len + 1);
+}
+
+// Reads the names in every PATH directory. Whether each is executable is
+// only checked for the few that end up being suggested.
+static void build_index(char *const *dirs, size_t dir_count) {
+  forget_index();
+  known.mtimes =
+      (struct timespec *)shell_calloc(dir_count + 1, sizeof(struct timespec));
+  known.dir_count = dir_count;
+  known.path_epoch = vars_path_epoch();
+
+  size_t cap = 0;
+  for (size_t i = 0; i < dir_count; i++) {
+    struct stat st;
+    if (stat(dirs[i], &st) == 0)
+      known.mtimes[i] = st.st_mtim;
+    DIR *dir = opendir(dirs[i]);
+    if (!dir)
+      continue;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] != '.' && entry->d_type != DT_DIR)
+        add_name(entry->d_name, &cap);
+    }
+    closedir(dir);
+  }
+
+  qsort(known.refs, known.count, sizeof(NameRef), compare_refs);
+  // The same name in several directories is kept once
+  size_t kept = 0;
+  for (size_t i = 0; i < known.count; i++) {
+    if (kept == 0 || compare_refs(&known.refs[kept - 1], &known.refs[i]) != 0)
+      known.refs[kept++] = known.refs[i];
+  }
+  known.count = kept;
+
+  size_t lengths = sizeof(known.by_length) / sizeof(*known.by_length);
+  size_t at = 0;
+  for (size_t len = 0; len < lengths; len++) {
+    while (at < known.count && known.refs[at].len < len)
+      at++;
+    known.by_length[len] = at;
+  }
+  known.built = true;
+}
+
+const NameIndex *suggest_index() {
+  char *const *dirs = path_dirs();
+  size_t dir_count = 0;
+  while (dirs[dir_count])
+    dir_count++;
+  if (!index_fresh(dirs, dir_count))
+    build_index(dirs, dir_count);
+  return &known;
+}
+
+// Installs an index loaded elsewhere, taking over its buffers. It is
+// checked against the PATH directories' mtimes on first use.
+void suggest_adopt(const NameIndex *index) {
+  forget_index();
+  known = *index;
+  known.built = true;
+  known.path_epoch = vars_path_epoch();
+}
+
+/***********************************************
+ * SUGGESTIONS
+ ***********************************************/
+
+typedef struct Candidate {
+  const char *name;
+  size_t distance;
+  bool runnable; // a builtin or alias, or an executable already checked
+} Candidate;
+
+typedef struct Candidates {
+  Candidate items[SUGGEST_MAX_SHOWN * 4];
+  size_t count;
+  size_t limit; // largest distance still wanted
+} Candidates;
+
+static int compare_candidates(const void *a, const void *b) {
+  const Candidate *x = (const Candidate *)a;
+  const Candidate *y = (const Candidate *)b;
+  if (x->distance != y->distance)
+    return x->distance < y->distance ? -1 : 1;
+  return strcmp(x->name, y->name);
+}
+
+// Keeps the closest few. Once the list is full only closer names get in,
+// which also tightens the limit the scan cuts off at.
+static void offer(Candidates *found, const char *name, size_t d,
+                  bool runnable) {
+  for (size_t i = 0; i < found->count; i++) {
+    if (strcmp(found->items[i].name, name) == 0) {
+      found->items[i].runnable |= runnable;
+      return;
+    }
+  }
+  size_t cap = sizeof(found->items) / sizeof(*found->items);
+  if (found->count == cap) {
+    if (d >= found->items[cap - 1].distance)
+      return;
+    found->count--;
+  }
+  found->items[found->count++] =
+      (Candidate){.name = name, .distance = d, .runnable = runnable};
+  qsort(found->items, found->count, sizeof(Candidate), compare_candidates);
+  if (found->count == cap && found->items[cap - 1].distance < found->limit)
+    found->limit = found->items[cap - 1].distance;
+}
+
+// How far a name may be from what was typed: one edit for very short
+// names, up to SUGGEST_MAX_DISTANCE for long ones
+static size_t distance_limit(size_t len) {
+  size_t limit = len < 4 ? 1 : len / 3 + 1;
+  return limit < SUGGEST_MAX_DISTANCE ? limit : SUGGEST_MAX_DISTANCE;
+}
+
+// Fills `out` with up to `max` runnable names close to `name`, closest
+// first; the caller frees them
+size_t suggest_commands(const char *name, char **out, size_t max) {
+  size_t m = strlen(name);
+  if (m == 0 || m > SUGGEST_MAX_NAME)
+    return 0;
+  Pattern p;
+  pattern_init(&p, name, m);
+  Candidates found = {.limit = distance_limit(m)};
+
+  const BuiltinTable *builtins = builtins_table();
+  for (size_t i = 0; i < builtins->count; i++) {
+    const char *other = builtins->items[i].name;
+    size_t d = distance(&p, other, strlen(other), found.limit);
+    if (d <= found.limit && d > 0)
+      offer(&found, other, d, true);
+  }
+  const AliasTable *aliases = aliases_table();
+  for (size_t i = 0; i < aliases->count; i++) {
+    const char *other = aliases->items[i].name;
+    size_t d = distance(&p, other, strlen(other), found.limit);
+    if (d <= found.limit && d > 0)
+      offer(&found, other, d, true);
+  }
+
+  // Only lengths within the limit of the typed name can be close enough
+  const NameIndex *names = suggest_index();
+  size_t first = names->by_length[m > found.limit ? m - found.limit : 0];
+  size_t end = names->by_length[m + found.limit + 1];
+  for (size_t i = first; i < end; i++) {
+    const NameRef *ref = &names->refs[i];
+    if (ref->len + found.limit < m || ref->len > m + found.limit)
+      continue;
+    const char *other = names->names.data + ref->offset;
+    size_t d = distance(&p, other, ref->len, found.limit);
+    if (d <= found.limit && d > 0)
+      offer(&found, other, d, false);
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < found.count && count < max; i++) {
+    Candidate *c = &found.items[i];
+    if (!c->runnable) {
+      char *path = resolve_command(c->name);
+      c->runnable = path != NULL;
+      free(path);
+    }
+    if (c->runnable) {
+      out[count] = shell_strdup(c->name);
+      count++;
+    }
+  }
+  return count;
+}
+
+// Reports a command that is not a function, builtin or executable, with the
+// closest names that are
+void suggest_not_found(const char *name) {
+  fprintf(stderr, "%s: command not found\n", name);
+  char *close[SUGGEST_MAX_SHOWN];
+  size_t count = suggest_commands(name, close, SUGGEST_MAX_SHOWN);
+  for (size_t i = 0; i < count; i++) {
+    fprintf(stderr, "%s%s", i == 0 ? "did you mean: " : ", ", close[i]);
+    free(close[i]);
+  }
+  if (count > 0)
+    fputc('\n', stderr);
+}
+
+void suggest_free() { forget_index(); }
@@ -0,0 +1,347 @@
+#include "timeout.h"
+#include "batch.h"
+#include "builtins.h"
+#include "cache.h"
+#include "stats.h"
+#include "vm.h"
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static Deadline current = {0};
+
+/***********************************************
+ * CLOCK
+ ***********************************************/
+
+static long long to_ns(const struct timespec *ts) {
+  return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static struct timespec from_ns(long long ns) {
+  return (struct timespec){.tv_sec = ns / 1000000000LL,
+                           .tv_nsec = ns % 1000000000LL};
+}
+
+static long long now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return to_ns(&now);
+}
+
+// "90", "1.5", "250ms", "2s", "5m", "1h" or "1d"; bare numbers are seconds
+bool timeout_parse_duration(const char *text, long *ms) {
+  char *end;
+  errno = 0;
+  double value = strtod(text, &end);
+  if (end == text || errno || value < 0 || !isdigit((unsigned char)*text))
+    return false;
+
+  double scale;
+  if (*end == '\0' || strcmp(end, "s") == 0)
+    scale = 1000;
+  else if (strcmp(end, "ms") == 0)
+    scale = 1;
+  else if (strcmp(end, "m") == 0)
+    scale = 60 * 1000;
+  else if (strcmp(end, "h") == 0)
+    scale = 60 * 60 * 1000;
+  else if (strcmp(end, "d") == 0)
+    scale = 24 * 60 * 60 * 1000;
+  else
+    return false;
+
+  value *= scale;
+  if (value > (double)(1L << 52))
+    return false;
+  *ms = (long)(value + 0.5);
+  return true;
+}
+
+/***********************************************
+ * STAGES
+ ***********************************************/
+
+bool timeout_active() { return current.active; }
+
+// In each forked stage, before anything else: joins the pipeline's group.
+// Pipelines the stage starts itself are not tracked again.
+void timeout_child() {
+  if (!current.active)
+    return;
+  setpgid(0, current.group);
+  current.active = false;
+}
+
+// In the shell after each fork. Both sides call setpgid, so the group is
+// right whichever runs first.
+void timeout_track(pid_t pid, const char *name) {
+  bool first = current.group == 0;
+  if (first)
+    current.group = pid;
+  setpgid(pid, current.group);
+  // Keystrokes such as Ctrl-C go to the pipeline, as they would without
+  // the separate group
+  if (first && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp())
+    current.took_terminal = tcsetpgrp(STDIN_FILENO, pid) == 0;
+
+  if (current.stage_count == current.stage_cap) {
+    current.stage_cap = current.stage_cap ? current.stage_cap * 2 : 8;
+    current.stages = (TimeoutStage *)shell_realloc(
+        current.stages, current.stage_cap * sizeof(TimeoutStage));
+  }
+  TimeoutStage *stage = &current.stages[current.stage_count++];
+  *stage = (TimeoutStage){.pid = pid, .name = shell_strdup(name ? name : "")};
+  stage->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+static void take_terminal_back() {
+  if (!current.took_terminal)
+    return;
+  sigset_t block;
+  sigset_t old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGTTOU);
+  sigprocmask(SIG_BLOCK, &block, &old);
+  tcsetpgrp(STDIN_FILENO, getpgrp());
+  sigprocmask(SIG_SETMASK, &old, NULL);
+  current.took_terminal = false;
+}
+
+static void report_overrun() {
+  double elapsed = (now_ns() - to_ns(&current.start)) / 1e9;
+  for (size_t i = 0; i < current.stage_count; i++) {
+    const TimeoutStage *stage = &current.stages[i];
+    if (!stage->done)
+      fprintf(stderr, "timeout: stage %zu (%s) still running after %.3f s\n",
+              i + 1, stage->name, elapsed);
+  }
+}
+
+static void reap(TimeoutStage *stage) {
+  while (waitpid(stage->pid, &stage->status, 0) == -1 && errno == EINTR) {
+  }
+  if (stage->pidfd != -1)
+    close(stage->pidfd);
+  stage->pidfd = -1;
+  stage->done = true;
+}
+
+// Waits for the stages of one pipeline, signalling their group when the
+// deadline passes and killing it once the grace period is over. Returns
+// the pipeline's status.
+int timeout_wait() {
+  struct pollfd *fds = (struct pollfd *)shell_malloc(
+      current.stage_count * sizeof(struct pollfd));
+  size_t running = 0;
+  for (size_t i = 0; i < current.stage_count; i++) {
+    fds[i] = (struct pollfd){.fd = current.stages[i].pidfd, .events = POLLIN};
+    if (current.stages[i].pidfd == -1)
+      reap(&current.stages[i]); // no pidfd support: no deadline either
+    else
+      running++;
+  }
+
+  long long limit = to_ns(&current.at);
+  int phase = 0; // 0 before the deadline, 1 signalled, 2 killed
+  while (running > 0) {
+    long long left = limit - now_ns();
+    if (phase < 2 && left <= 0) {
+      if (phase == 0) {
+        report_overrun();
+        kill(-current.group, current.signal);
+        kill(-current.group, SIGCONT);
+      } else {
+        kill(-current.group, SIGKILL);
+      }
+      if (phase == 0 && current.grace_ms >= 0) {
+        limit = now_ns() + current.grace_ms * 1000000LL;
+        phase = 1;
+      } else {
+        phase = 2;
+      }
+      continue;
+    }
+
+    struct timespec wait = from_ns(left);
+    int n = ppoll(fds, current.stage_count, phase < 2 ? &wait : NULL, NULL);
+    if (n == -1 && errno != EINTR) {
+      perror("timeout: ppoll");
+      break;
+    }
+    for (size_t i = 0; n > 0 && i < current.stage_count; i++) {
+      if (fds[i].fd != -1 && fds[i].revents) {
+        reap(&current.stages[i]);
+        fds[i].fd = -1;
+        running--;
+      }
+    }
+  }
+
+  // Anything left (only after a poll failure) is waited for plainly
+  int status = 0;
+  for (size_t i = 0; i < current.stage_count; i++) {
+    TimeoutStage *stage = &current.stages[i];
+    if (!stage->done)
+      reap(stage);
+    free(stage->name);
+    status = stage->status;
+  }
+  free(fds);
+  current.stage_count = 0;
+  current.group = 0;
+  take_terminal_back();
+
+  if (phase == 0)
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  return phase == 2 && current.grace_ms >= 0 ? 128 + SIGKILL : TIMEOUT_STATUS;
+}
+
+/***********************************************
+ * BUILTIN
+ ***********************************************/
+
+static const struct {
+  const char *name;
+  int number;
+} signal_names[] = {
+    {"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT},
+    {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+    {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+};
+
+static int parse_signal(const char *text) {
+  if (isdigit((unsigned char)*text)) {
+    int number = atoi(text);
+    return number > 0 && number < NSIG ? number : -1;
+  }
+  if (strncmp(text, "SIG", 3) == 0)
+    text += 3;
+  for (size_t i = 0; i < sizeof(signal_names) / sizeof(*signal_names); i++) {
+    if (strcmp(signal_names[i].name, text) == 0)
+      return signal_names[i].number;
+  }
+  return -1;
+}
+
+static void usage() {
+  fprintf(stderr, "timeout: usage: timeout [-k grace] [-s signal] "
+                  "duration command...\n");
+  last_status = 2;
+}
+
+// Whether `head` would run inside the shell itself, where no signal can
+// stop it without stopping the shell
+static bool runs_in_shell(const Command *head) {
+  if (head->next != NULL)
+    return false;
+  if (!head->name || batch_should_split(head))
+    return true;
+  return head->redirect_count == 0 &&
+         (function_lookup(head->name) || builtin_find(head->name));
+}
+
+// Runs in a subshell of its own group: loops, functions and builtins
+static void run_subshell(Program *prog, const Command *head, const char *text) {
+  fflush(stdout);
+  pid_t pid = shell_fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    timeout_child();
+    if (prog)
+      exit(vm_execute(prog));
+    run_commands(head);
+    exit(last_status);
+  }
+  timeout_track(pid, text);
+  last_status = timeout_wait();
+}
+
+// timeout [-k grace] [-s signal] duration command...: stops the command
+// once `duration` has passed. A single word is run as shell source, so
+// `timeout 5 'a | b'` bounds the whole pipeline.
+void timeout_builtin(const Command *cmd) {
+  long duration_ms;
+  long grace_ms = -1;
+  int signal_number = SIGTERM;
+  int i = 1;
+  for (; i < cmd->argc && cmd->argv[i][0] == '-'; i++) {
+    const char *arg = cmd->argv[i];
+    const char *value = i + 1 < cmd->argc ? cmd->argv[i + 1] : NULL;
+    if (strcmp(arg, "--") == 0) {
+      i++;
+      break;
+    } else if (strcmp(arg, "-k") == 0 && value &&
+               timeout_parse_duration(value, &grace_ms)) {
+      i++;
+    } else if (strcmp(arg, "-s") == 0 && value &&
+               (signal_number = parse_signal(value)) != -1) {
+      i++;
+    } else {
+      usage();
+      return;
+    }
+  }
+  if (i + 1 >= cmd->argc ||
+      !timeout_parse_duration(cmd->argv[i], &duration_ms)) {
+    usage();
+    return;
+  }
+  int first = i + 1;
+
+  if (current.active) {
+    fprintf(stderr, "timeout: already running under a timeout\n");
+    last_status = 1;
+    return;
+  }
+
+  Program *prog = NULL;
+  Command *head = NULL;
+  Command sub = {.argc = cmd->argc - first,
+                 .name = cmd->argv[first],
+                 .argv = cmd->argv + first};
+  if (first == cmd->argc - 1) {
+    if (cache_compile(cmd->argv[first], &prog) != COMPILE_OK) {
+      fprintf(stderr, "timeout: syntax error in command\n");
+      last_status = 2;
+      return;
+    }
+    if (program_is_simple(prog))
+      head = program_pipeline(prog);
+  } else {
+    head = &sub;
+  }
+
+  long long start = now_ns();
+  current = (Deadline){.active = true,
+                       .start = from_ns(start),
+                       .at = from_ns(start + duration_ms * 1000000LL),
+                       .grace_ms = grace_ms,
+                       .signal = signal_number};
+
+  if (head && !runs_in_shell(head)) {
+    // Every stage is a process: run_commands() tracks them by name
+    run_commands(head);
+  } else {
+    run_subshell(head ? NULL : prog, head, cmd->argv[first]);
+  }
+  current.active = false;
+  free(current.stages);
+  current.stages = NULL;
+  current.stage_cap = 0;
+
+  if (head && head != &sub)
+    free_commands(&head);
+  if (prog)
+    program_release(prog);
+}
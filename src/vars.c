@@ -0,0 +1,360 @@
+#include "vars.h"
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+VarTable shell_vars = {0};
+
+/***********************************************
+ * HASH TABLE INTERNALS
+ ***********************************************/
+
+static unsigned hash_name(const char *name, size_t len) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)name[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static void *xcalloc(size_t count, size_t size) {
+  void *ptr = calloc(count, size);
+  if (!ptr) {
+    perror("calloc");
+    exit(EXIT_FAILURE);
+  }
+  return ptr;
+}
+
+static char *xstrndup(const char *str, size_t len) {
+  char *copy = strndup(str, len);
+  if (!copy) {
+    perror("strndup");
+    exit(EXIT_FAILURE);
+  }
+  return copy;
+}
+
+// Returns the slot holding `name`, or the slot where it should be inserted
+// (preferring the first tombstone seen on the probe sequence).
+static Var *find_slot(const char *name, size_t len, unsigned hash) {
+  size_t mask = shell_vars.cap - 1;
+  size_t i = hash & mask;
+  Var *tombstone = NULL;
+
+  while (true) {
+    Var *slot = &shell_vars.slots[i];
+    if (slot->flags & VAR_TOMBSTONE) {
+      if (!tombstone)
+        tombstone = slot;
+    } else if (slot->name == NULL) {
+      return tombstone ? tombstone : slot;
+    } else if (slot->hash == hash && strncmp(slot->name, name, len) == 0 &&
+               slot->name[len] == '\0') {
+      return slot;
+    }
+    i = (i + 1) & mask;
+  }
+}
+
+// Rebuilds the table without tombstones. It doubles only when the live
+// entries alone fill more than half the load limit; a table full of
+// tombstones from set-and-unset churn is rehashed at the same size.
+static void grow_table() {
+  Var *old = shell_vars.slots;
+  size_t old_cap = shell_vars.cap;
+
+  if (old_cap == 0)
+    shell_vars.cap = VARS_INITIAL_CAP;
+  else if ((shell_vars.count + 1) * 20 >= old_cap * 7)
+    shell_vars.cap = old_cap * 2;
+  shell_vars.slots = (Var *)xcalloc(shell_vars.cap, sizeof(Var));
+  shell_vars.used = shell_vars.count;
+
+  for (size_t i = 0; i < old_cap; i++) {
+    if (old[i].name == NULL)
+      continue;
+    size_t mask = shell_vars.cap - 1;
+    size_t j = old[i].hash & mask;
+    while (shell_vars.slots[j].name != NULL) {
+      j = (j + 1) & mask;
+    }
+    shell_vars.slots[j] = old[i];
+  }
+
+  free(old);
+}
+
+static Var *lookup(const char *name, size_t len) {
+  if (shell_vars.cap == 0)
+    return NULL;
+  Var *slot = find_slot(name, len, hash_name(name, len));
+  return slot->name ? slot : NULL;
+}
+
+static void refresh_env_entry(Var *var) {
+  bool had_entry = var->env_entry != NULL;
+  free(var->env_entry);
+  var->env_entry = NULL;
+
+  if ((var->flags & VAR_EXPORTED) && var->value) {
+    size_t name_len = strlen(var->name);
+    size_t value_len = strlen(var->value);
+    var->env_entry = (char *)malloc(name_len + value_len + 2);
+    if (!var->env_entry) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+    memcpy(var->env_entry, var->name, name_len);
+    var->env_entry[name_len] = '=';
+    memcpy(var->env_entry + name_len + 1, var->value, value_len + 1);
+  }
+
+  if (had_entry || var->env_entry)
+    shell_vars.envp_dirty = true;
+  if (had_entry && !var->env_entry)
+    shell_vars.exported--;
+  else if (!had_entry && var->env_entry)
+    shell_vars.exported++;
+
+  if (strcmp(var->name, "PATH") == 0)
+    shell_vars.path_epoch++;
+}
+
+static Var *insert(const char *name, size_t len) {
+  if ((shell_vars.used + 1) * 10 >= shell_vars.cap * 7)
+    grow_table();
+
+  unsigned hash = hash_name(name, len);
+  Var *slot = find_slot(name, len, hash);
+  if (slot->name)
+    return slot;
+
+  if (!(slot->flags & VAR_TOMBSTONE))
+    shell_vars.used++;
+  slot->name = xstrndup(name, len);
+  slot->value = NULL;
+  slot->env_entry = NULL;
+  slot->hash = hash;
+  slot->flags = 0;
+  shell_vars.count++;
+  return slot;
+}
+
+/***********************************************
+ * VARIABLE STORE
+ ***********************************************/
+
+void vars_init(char **envp) {
+  vars_free();
+  grow_table();
+  shell_vars.envp_dirty = true;
+
+  for (char **env = envp; env && *env; env++) {
+    const char *eq = strchr(*env, '=');
+    if (!eq || !var_is_valid_name(*env, eq - *env))
+      continue;
+    Var *var = insert(*env, eq - *env);
+    free(var->value);
+    var->value = xstrndup(eq + 1, strlen(eq + 1));
+    var->flags |= VAR_EXPORTED;
+    refresh_env_entry(var);
+  }
+}
+
+void vars_free() {
+  vars_restore_positional(&(Positional){0});
+  free(shell_vars.params.arg0);
+  for (size_t i = 0; i < shell_vars.cap; i++) {
+    free(shell_vars.slots[i].name);
+    free(shell_vars.slots[i].value);
+    free(shell_vars.slots[i].env_entry);
+  }
+  free(shell_vars.slots);
+  free(shell_vars.envp);
+  unsigned long path_epoch = shell_vars.path_epoch;
+  shell_vars = (VarTable){0};
+  shell_vars.path_epoch = path_epoch + 1;
+}
+
+const char *var_get(const char *name) {
+  const Var *var = lookup(name, strlen(name));
+  return var ? var->value : NULL;
+}
+
+void var_set(const char *name, const char *value, unsigned flags) {
+  Var *var = insert(name, strlen(name));
+  char *copy = value ? xstrndup(value, strlen(value)) : NULL;
+  free(var->value);
+  var->value = copy;
+  var->flags |= flags;
+  refresh_env_entry(var);
+}
+
+bool var_unset(const char *name) {
+  Var *var = lookup(name, strlen(name));
+  if (!var)
+    return false;
+
+  free(var->value);
+  var->value = NULL;
+  var->flags = 0;
+  refresh_env_entry(var);
+
+  free(var->name);
+  var->name = NULL;
+  var->flags = VAR_TOMBSTONE;
+  shell_vars.count--;
+  return true;
+}
+
+void var_export(const char *name) {
+  Var *var = insert(name, strlen(name));
+  if (var->flags & VAR_EXPORTED)
+    return;
+  var->flags |= VAR_EXPORTED;
+  refresh_env_entry(var);
+}
+
+bool var_is_valid_name(const char *name, size_t len) {
+  if (len == 0 || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+    return false;
+  for (size_t i = 1; i < len; i++) {
+    if (!(isalnum((unsigned char)name[i]) || name[i] == '_'))
+      return false;
+  }
+  return true;
+}
+
+bool var_is_assignment(const char *word) {
+  const char *eq = strchr(word, '=');
+  return eq && var_is_valid_name(word, eq - word);
+}
+
+bool var_assign(const char *word) {
+  const char *eq = strchr(word, '=');
+  if (!eq || !var_is_valid_name(word, eq - word))
+    return false;
+
+  Var *var = insert(word, eq - word);
+  free(var->value);
+  var->value = xstrndup(eq + 1, strlen(eq + 1));
+  refresh_env_entry(var);
+  return true;
+}
+
+static int compare_vars(const void *a, const void *b) {
+  return strcmp((*(const Var *const *)a)->name, (*(const Var *const *)b)->name);
+}
+
+void vars_foreach_sorted(var_visitor visit, void *ctx) {
+  const Var **sorted = (const Var **)xcalloc(shell_vars.count + 1, sizeof(Var *));
+  size_t n = 0;
+  for (size_t i = 0; i < shell_vars.cap; i++) {
+    if (shell_vars.slots[i].name)
+      sorted[n++] = &shell_vars.slots[i];
+  }
+
+  qsort(sorted, n, sizeof(Var *), compare_vars);
+  for (size_t i = 0; i < n; i++) {
+    visit(sorted[i], ctx);
+  }
+  free(sorted);
+}
+
+/***********************************************
+ * ENVIRONMENT MATERIALIZATION
+ ***********************************************/
+
+char **vars_envp() {
+  if (!shell_vars.envp_dirty && shell_vars.envp)
+    return shell_vars.envp;
+
+  // Only the pointer array is rebuilt; each entry string is cached on its
+  // variable and replaced when that variable changes.
+  char **envp = (char **)realloc(shell_vars.envp,
+                                 (shell_vars.exported + 1) * sizeof(char *));
+  if (!envp) {
+    perror("realloc");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < shell_vars.cap; i++) {
+    if (shell_vars.slots[i].name && shell_vars.slots[i].env_entry)
+      envp[n++] = shell_vars.slots[i].env_entry;
+  }
+  envp[n] = NULL;
+
+  shell_vars.envp = envp;
+  shell_vars.envp_dirty = false;
+  return envp;
+}
+
+unsigned long vars_path_epoch() { return shell_vars.path_epoch; }
+
+// Invalidates everything derived from PATH as if it had been reassigned
+void vars_forget_paths() { shell_vars.path_epoch++; }
+
+/***********************************************
+ * POSITIONAL PARAMETERS
+ ***********************************************/
+
+void vars_set_arg0(const char *name) {
+  free(shell_vars.params.arg0);
+  shell_vars.params.arg0 = xstrndup(name, strlen(name));
+}
+
+// Replaces $1..$n, handing the previous set to `saved` when given
+void vars_set_positional(char *const *args, int count, Positional *saved) {
+  Positional *params = &shell_vars.params;
+  if (saved) {
+    saved->args = params->args;
+    saved->count = params->count;
+  } else {
+    vars_restore_positional(&(Positional){0});
+  }
+
+  params->args = (char **)xcalloc(count + 1, sizeof(char *));
+  for (int i = 0; i < count; i++) {
+    params->args[i] = xstrndup(args[i], strlen(args[i]));
+  }
+  params->count = count;
+}
+
+void vars_restore_positional(Positional *saved) {
+  Positional *params = &shell_vars.params;
+  for (int i = 0; i < params->count; i++) {
+    free(params->args[i]);
+  }
+  free(params->args);
+  params->args = saved->args;
+  params->count = saved->count;
+}
+
+const char *var_positional(int n) {
+  const Positional *params = &shell_vars.params;
+  if (n == 0)
+    return params->arg0 ? params->arg0 : "shell";
+  return n <= params->count ? params->args[n - 1] : NULL;
+}
+
+int vars_positional_count() { return shell_vars.params.count; }
+
+bool vars_shift(int n) {
+  Positional *params = &shell_vars.params;
+  if (n < 0 || n > params->count)
+    return false;
+
+  for (int i = 0; i < n; i++) {
+    free(params->args[i]);
+  }
+  memmove(params->args, params->args + n,
+          (params->count - n + 1) * sizeof(char *));
+  params->count -= n;
+  return true;
+}
@@ -0,0 +1,326 @@
+#include "vm.h"
+#include "cache.h"
+#include "expand.h"
+#include "glob_expand.h"
+#include "shell.h"
+#include "stats.h"
+#include "subst.h"
+#include "vars.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ForIter {
+  WordList words;
+  size_t next;
+} ForIter;
+
+typedef struct Function {
+  char *name;
+  unsigned hash;
+  Program *body;
+} Function;
+
+static Function *functions = NULL;
+static size_t function_count = 0;
+static int call_depth = 0;
+static bool returning = false; // `return` ran; unwind to the caller
+
+/***********************************************
+ * FUNCTION TABLE
+ ***********************************************/
+
+static unsigned hash_name(const char *name) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  for (; *name; name++) {
+    hash ^= (unsigned char)*name;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static Function *find_function(const char *name) {
+  unsigned hash = hash_name(name);
+  for (size_t i = 0; i < function_count; i++) {
+    if (functions[i].hash == hash && strcmp(functions[i].name, name) == 0)
+      return &functions[i];
+  }
+  return NULL;
+}
+
+static void define_function(const FunctionDef *def) {
+  program_retain(def->body);
+  Function *fn = find_function(def->name);
+  if (fn) {
+    program_release(fn->body);
+    fn->body = def->body;
+    return;
+  }
+
+  functions = (Function *)shell_realloc(
+      functions, (function_count + 1) * sizeof(Function));
+  functions[function_count++] = (Function){.name = shell_strdup(def->name),
+                                            .hash = hash_name(def->name),
+                                            .body = def->body};
+}
+
+Program *function_lookup(const char *name) {
+  if (function_count == 0)
+    return NULL;
+  Function *fn = find_function(name);
+  return fn ? fn->body : NULL;
+}
+
+void functions_free() {
+  for (size_t i = 0; i < function_count; i++) {
+    free(functions[i].name);
+    program_release(functions[i].body);
+  }
+  free(functions);
+  functions = NULL;
+  function_count = 0;
+}
+
+/***********************************************
+ * COMMAND DISPATCH
+ ***********************************************/
+
+// Runs `cmd` if it names a function. Its arguments become $1..$n for the
+// duration of the call.
+bool vm_call_function(const Command *cmd) {
+  Program *body = cmd->name ? function_lookup(cmd->name) : NULL;
+  if (!body)
+    return false;
+
+  if (call_depth >= VM_MAX_CALL_DEPTH) {
+    fprintf(stderr, "%s: maximum function nesting level exceeded\n",
+            cmd->name);
+    last_status = 1;
+    return true;
+  }
+
+  Positional saved;
+  apply_assignments(cmd, 0);
+  vars_set_positional(cmd->argv + 1, cmd->argc - 1, &saved);
+  call_depth++;
+  last_status = 0;
+  vm_execute(body);
+  call_depth--;
+  returning = false;
+  vars_restore_positional(&saved);
+  return true;
+}
+
+// Executable that `sc` runs, searched for again only after PATH changes.
+// Functions come first, and a prefix assignment may be setting PATH itself.
+static const char *command_path(SimpleCommand *sc, const Command *cmd) {
+  if (!sc->literal_name || sc->assign_count > 0 || function_lookup(cmd->name))
+    return NULL;
+
+  unsigned long epoch = vars_path_epoch();
+  if (sc->path_epoch == epoch && epoch != 0) {
+    cache_count_path(true);
+    return sc->path;
+  }
+  cache_count_path(false);
+  free(sc->path);
+  sc->path = resolve_command(cmd->name);
+  sc->path_epoch = epoch;
+  return sc->path;
+}
+
+// Expands `stages` commands starting at `first` into a pipeline. The
+// commands borrow resolved paths from `prog`.
+static Command *build_pipeline(Program *prog, size_t first, size_t stages) {
+  SimpleCommand *commands = &prog->commands[first];
+  Buffer line;
+  buffer_init(&line);
+  if (shell_options.parallel_subst) {
+    for (size_t i = 0; i < stages; i++) {
+      for (size_t j = 0; j < commands[i].count; j++) {
+        buffer_append_str(&line, commands[i].words[j]);
+        buffer_push(&line, ' ');
+      }
+      for (size_t j = 0; j < commands[i].redirect_count; j++) {
+        if (!commands[i].redirects[j].literal)
+          buffer_append_str(&line, commands[i].redirects[j].target);
+        buffer_push(&line, ' ');
+      }
+    }
+  }
+  subst_prefetch(line.data ? line.data : "");
+
+  Command *head = NULL;
+  Command *tail = NULL;
+  for (size_t i = 0; i < stages; i++) {
+    Command *cmd = expand_command(commands[i].words, commands[i].count,
+                                  commands[i].assign_count);
+    set_redirects(cmd, commands[i].redirects, commands[i].redirect_count);
+    if (head == NULL)
+      head = cmd;
+    else
+      tail->next = cmd;
+    tail = cmd;
+  }
+
+  subst_finish();
+  glob_cache_reset();
+  buffer_free(&line);
+
+  // Resolved only once expansion is over: substitutions may rerun this
+  // program and replace a path the pipeline would already be borrowing
+  size_t i = 0;
+  for (Command *cmd = head; cmd; cmd = cmd->next, i++) {
+    if (cmd->name)
+      cmd->exec_path = command_path(&commands[i], cmd);
+  }
+  return head;
+}
+
+Command *program_pipeline(Program *prog) {
+  const Instr *in = &prog->code[0];
+  return build_pipeline(prog, in->a, in->op == OP_PIPELINE ? in->b : 1);
+}
+
+// Expands and runs one simple command. Builtins, functions and
+// assignments run in-process through run_commands().
+static void run_simple(Program *prog, size_t index) {
+  Command *cmd = build_pipeline(prog, index, 1);
+
+  if (cmd->name && strcmp(cmd->name, "return") == 0) {
+    if (cmd->argc > 1)
+      last_status = atoi(cmd->argv[1]);
+    returning = true;
+  } else {
+    run_commands(cmd);
+  }
+  free_commands(&cmd);
+}
+
+/***********************************************
+ * DISPATCH LOOP
+ ***********************************************/
+
+int vm_execute(Program *prog) {
+  ForIter *iters = NULL;
+  size_t iter_count = 0;
+  size_t pc = 0;
+
+  // A function may redefine itself while its body is running
+  program_retain(prog);
+
+  while (pc < prog->len && !returning) {
+    const Instr *in = &prog->code[pc++];
+    switch (in->op) {
+    case OP_RUN:
+      run_simple(prog, in->a);
+      break;
+    case OP_PIPELINE: {
+      Command *cmds = build_pipeline(prog, in->a, in->b);
+      run_commands(cmds);
+      free_commands(&cmds);
+      break;
+    }
+    case OP_NOT:
+      last_status = !last_status;
+      break;
+    case OP_STATUS:
+      last_status = in->a;
+      break;
+    case OP_JUMP:
+      pc = in->a;
+      break;
+    case OP_JUMP_IF_FAIL:
+      if (last_status != 0)
+        pc = in->a;
+      break;
+    case OP_JUMP_IF_OK:
+      if (last_status == 0)
+        pc = in->a;
+      break;
+    case OP_FOR_INIT: {
+      const SimpleCommand *list = &prog->commands[in->a];
+      iters =
+          (ForIter *)shell_realloc(iters, (iter_count + 1) * sizeof(ForIter));
+      ForIter *iter = &iters[iter_count++];
+      wordlist_init(&iter->words);
+      iter->next = 0;
+      for (size_t i = 0; i < list->count; i++) {
+        expand_word(list->words[i], &iter->words);
+      }
+      glob_cache_reset();
+      break;
+    }
+    case OP_FOR_NEXT: {
+      ForIter *iter = &iters[iter_count - 1];
+      if (iter->next < iter->words.count) {
+        var_set(prog->strings[in->a], iter->words.words[iter->next++], 0);
+      } else {
+        pc = in->b;
+      }
+      break;
+    }
+    case OP_FOR_POP:
+      wordlist_free(&iters[--iter_count].words);
+      break;
+    case OP_DEFINE:
+      define_function(&prog->functions[in->a]);
+      last_status = 0;
+      break;
+    }
+  }
+
+  while (iter_count > 0) {
+    wordlist_free(&iters[--iter_count].words);
+  }
+  free(iters);
+  program_release(prog);
+  return last_status;
+}
+
+/***********************************************
+ * SOURCE ENTRY POINTS
+ ***********************************************/
+
+static int run_compiled(CompileResult result, Program *prog) {
+  if (result == COMPILE_INCOMPLETE) {
+    fprintf(stderr, "syntax error: unexpected end of file\n");
+  }
+  if (result != COMPILE_OK) {
+    last_status = 2;
+    return last_status;
+  }
+
+  vm_execute(prog);
+  program_release(prog);
+  returning = false;
+  return last_status;
+}
+
+int run_source(const char *src) {
+  Program *prog;
+  uint64_t start = stats_now();
+  CompileResult result = cache_compile(src, &prog);
+  stats_record(&shell_stats()->parse, start);
+  return run_compiled(result, prog);
+}
+
+// Adds a line to `pending` and runs it once it closes every construct.
+// Returns false while more lines are needed.
+bool run_source_line(Buffer *pending, const char *line) {
+  buffer_append_str(pending, line);
+  buffer_push(pending, '\n');
+
+  Program *prog;
+  uint64_t start = stats_now();
+  CompileResult result = cache_compile(pending->data, &prog);
+  stats_record(&shell_stats()->parse, start);
+  if (result == COMPILE_INCOMPLETE)
+    return false;
+
+  buffer_clear(pending);
+  run_compiled(result, prog);
+  return true;
+}
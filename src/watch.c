@@ -0,0 +1,328 @@
+#include "watch.h"
+#include "cache.h"
+#include "stats.h"
+#include "vm.h"
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static WatchPath *paths = NULL;
+static size_t path_count = 0;
+static WatchStats stats = {0};
+static volatile sig_atomic_t interrupted = 0;
+
+/***********************************************
+ * WATCHES
+ ***********************************************/
+
+static void add_watch(int fd, const char *path) {
+  int wd = inotify_add_watch(fd, path, WATCH_EVENTS);
+  if (wd == -1) {
+    perror(path);
+    return;
+  }
+  for (size_t i = 0; i < path_count; i++) {
+    if (paths[i].wd == wd)
+      return;
+  }
+  paths = (WatchPath *)shell_realloc(paths,
+                                     (path_count + 1) * sizeof(WatchPath));
+  paths[path_count++] = (WatchPath){.wd = wd, .path = shell_strdup(path)};
+}
+
+// Directories are watched with everything below them
+static void add_tree(int fd, const char *path) {
+  add_watch(fd, path);
+  DIR *dir = opendir(path);
+  if (!dir)
+    return;
+
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != NULL) {
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0 ||
+        ent->d_type != DT_DIR)
+      continue;
+    char child[PATH_MAX];
+    snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+    add_tree(fd, child);
+  }
+  closedir(dir);
+}
+
+static WatchPath *find_path(int wd) {
+  for (size_t i = 0; i < path_count; i++) {
+    if (paths[i].wd == wd)
+      return &paths[i];
+  }
+  return NULL;
+}
+
+static void free_paths() {
+  for (size_t i = 0; i < path_count; i++) {
+    free(paths[i].path);
+  }
+  free(paths);
+  paths = NULL;
+  path_count = 0;
+}
+
+// Drains the inotify queue, following new directories and replaced files.
+// Returns the number of events read.
+static unsigned long read_events(int fd) {
+  char buf[WATCH_READ_SIZE]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  unsigned long count = 0;
+
+  while (true) {
+    ssize_t len = read(fd, buf, sizeof(buf));
+    if (len <= 0)
+      return count;
+
+    for (char *p = buf; p < buf + len;) {
+      const struct inotify_event *ev = (const struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + ev->len;
+      count++;
+
+      WatchPath *watched = find_path(ev->wd);
+      if (!watched)
+        continue;
+      if ((ev->mask & IN_CREATE) && (ev->mask & IN_ISDIR) && ev->len) {
+        char child[PATH_MAX];
+        snprintf(child, sizeof(child), "%s/%s", watched->path, ev->name);
+        add_tree(fd, child);
+      } else if (ev->mask & IN_IGNORED) {
+        // Editors save by renaming a new file over the old one
+        char *path = watched->path;
+        *watched = paths[--path_count];
+        struct stat st;
+        if (stat(path, &st) == 0)
+          add_watch(fd, path);
+        free(path);
+      }
+    }
+  }
+}
+
+/***********************************************
+ * RUNS
+ ***********************************************/
+
+static unsigned long long now_usec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void on_interrupt(int sig) {
+  (void)sig;
+  interrupted = 1;
+}
+
+// Starts `prog`, or `cmd` when there is no program, in its own process
+// group, so a cancel reaches everything it started. Returns a pidfd for
+// the child.
+static int start_run(Program *prog, Command *cmd, pid_t *pid) {
+  fflush(stdout);
+  *pid = shell_fork();
+  if (*pid == -1) {
+    perror("fork");
+    return -1;
+  }
+
+  if (*pid == 0) {
+    setpgid(0, 0);
+    signal(SIGINT, SIG_DFL);
+    if (prog && !program_is_simple(prog))
+      exit(vm_execute(prog));
+    run_commands(prog ? program_pipeline(prog) : cmd);
+    exit(last_status);
+  }
+
+  setpgid(*pid, *pid);
+  int pidfd = (int)syscall(SYS_pidfd_open, *pid, 0);
+  if (pidfd == -1)
+    perror("pidfd_open");
+  return pidfd;
+}
+
+static void finish_run(int pidfd, pid_t pid) {
+  int status;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR) {
+  }
+  close(pidfd);
+  last_status = WIFEXITED(status) ? WEXITSTATUS(status)
+                                  : 128 + WTERMSIG(status);
+}
+
+static void cancel_run(int pidfd, pid_t pid) {
+  kill(-pid, SIGTERM);
+  finish_run(pidfd, pid);
+  stats.cancelled++;
+}
+
+/***********************************************
+ * BUILTIN
+ ***********************************************/
+
+const WatchStats *watch_stats() { return &stats; }
+
+static void usage() {
+  fprintf(stderr, "watch: usage: watch [-d ms] [-c runs] -f path... -- "
+                  "command...\n");
+  last_status = 2;
+}
+
+// Runs the command, then again after each burst of changes once
+// `debounce_ms` pass without another event, until interrupted or after
+// `max_runs` finished runs
+static void watch_loop(int fd, Program *prog, Command *cmd, long debounce_ms,
+                       unsigned long max_runs) {
+  pid_t pid = 0;
+  int pidfd = start_run(prog, cmd, &pid);
+  bool pending = false;
+  unsigned long long burst_start = 0;
+  unsigned long long deadline = 0;
+
+  while (!interrupted) {
+    struct pollfd fds[2] = {{.fd = fd, .events = POLLIN},
+                            {.fd = pidfd, .events = POLLIN}};
+    int timeout = -1;
+    if (pending) {
+      unsigned long long now = now_usec();
+      timeout = deadline > now ? (int)((deadline - now + 999) / 1000) : 0;
+    }
+
+    int ready = poll(fds, pidfd != -1 ? 2 : 1, timeout);
+    if (ready == -1) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    if (fds[0].revents) {
+      unsigned long count = read_events(fd);
+      stats.events += count;
+      if (count > 0) {
+        if (!pending)
+          burst_start = now_usec();
+        pending = true;
+        deadline = now_usec() + debounce_ms * 1000;
+        // The running output is already stale
+        if (pidfd != -1) {
+          cancel_run(pidfd, pid);
+          pidfd = -1;
+        }
+      }
+    }
+
+    if (pidfd != -1 && fds[1].revents) {
+      finish_run(pidfd, pid);
+      pidfd = -1;
+      if (++stats.runs >= max_runs && !pending)
+        break;
+    }
+
+    if (pending && pidfd == -1 && now_usec() >= deadline) {
+      pending = false;
+      stats.bursts++;
+      stats.latency_usec += now_usec() - burst_start;
+      pidfd = start_run(prog, cmd, &pid);
+    }
+  }
+
+  if (pidfd != -1)
+    cancel_run(pidfd, pid);
+}
+
+// watch [-d ms] [-c runs] -f path... -- command...: reruns the command
+// whenever a watched file, or anything under a watched directory, changes
+void watch_builtin(const Command *cmd) {
+  long debounce_ms = WATCH_DEFAULT_DEBOUNCE_MS;
+  unsigned long max_runs = (unsigned long)-1;
+  int first_path = 0;
+  int path_end = 0;
+  int i = 1;
+
+  for (; i < cmd->argc && strcmp(cmd->argv[i], "--") != 0; i++) {
+    const char *arg = cmd->argv[i];
+    if (first_path) {
+      path_end = i + 1;
+    } else if (strcmp(arg, "-d") == 0 && i + 1 < cmd->argc) {
+      debounce_ms = atol(cmd->argv[++i]);
+    } else if (strcmp(arg, "-c") == 0 && i + 1 < cmd->argc) {
+      max_runs = strtoul(cmd->argv[++i], NULL, 10);
+    } else if (strcmp(arg, "-f") == 0) {
+      first_path = i + 1;
+      path_end = i + 1;
+    } else {
+      usage();
+      return;
+    }
+  }
+  if (!first_path || path_end == first_path || i + 1 >= cmd->argc) {
+    usage();
+    return;
+  }
+
+  // One word is shell source, as in `watch -f src -- "make && ./test"`;
+  // several run as the command they already are
+  int first = i + 1;
+  Program *prog = NULL;
+  Command sub = {.argc = cmd->argc - first,
+                 .name = cmd->argv[first],
+                 .argv = cmd->argv + first};
+  if (first == cmd->argc - 1 &&
+      cache_compile(cmd->argv[first], &prog) != COMPILE_OK) {
+    fprintf(stderr, "watch: syntax error in command\n");
+    last_status = 2;
+    return;
+  }
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd == -1) {
+    perror("inotify_init1");
+    if (prog)
+      program_release(prog);
+    last_status = 1;
+    return;
+  }
+  for (int j = first_path; j < path_end; j++) {
+    add_tree(fd, cmd->argv[j]);
+  }
+
+  stats = (WatchStats){0};
+  interrupted = 0;
+  struct sigaction sa = {.sa_handler = on_interrupt};
+  struct sigaction old_int;
+  sigaction(SIGINT, &sa, &old_int);
+
+  if (path_count > 0)
+    watch_loop(fd, prog, &sub, debounce_ms, max_runs);
+  else
+    last_status = 1;
+
+  sigaction(SIGINT, &old_int, NULL);
+  close(fd);
+  free_paths();
+  if (prog)
+    program_release(prog);
+
+  if (stats.bursts > 0) {
+    fprintf(stderr,
+            "watch: %lu runs, %lu cancelled, %lu events in %lu bursts, "
+            "%.1f ms average latency\n",
+            stats.runs, stats.cancelled, stats.events, stats.bursts,
+            stats.latency_usec / 1000.0 / stats.bursts);
+  }
+}
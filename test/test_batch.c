@@ -0,0 +1,158 @@
+#include "batch.h"
+#include "shell.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+extern char **environ;
+
+#define TEST_OUTPUT_FILE "test_batch_output.txt"
+
+static Command *command_from(char **words, int count) {
+  Command *cmd = create_command();
+  free(cmd->argv);
+  cmd->argv = (char **)malloc((count + 1) * sizeof(char *));
+  for (int i = 0; i < count; i++) {
+    cmd->argv[i] = words[i];
+  }
+  cmd->argc = count;
+  cmd->argv[count] = NULL;
+  cmd->name = cmd->argv[0];
+  return cmd;
+}
+
+static void test_batch_plan() {
+  printf("Testing batch_plan...\n");
+
+  char *args[20];
+  for (int i = 0; i < 20; i++) {
+    args[i] = "aaaa";
+  }
+  size_t cost = batch_arg_cost("aaaa");
+  assert(cost == 5 + sizeof(char *));
+
+  BatchChunk *chunks;
+  size_t fixed = 20;
+  size_t limit = fixed + 6 * cost + 1;
+  size_t n = batch_plan(args, 20, fixed, limit, 0, &chunks);
+  assert(n == 4);
+  assert(chunks[0].start == 0 && chunks[0].count == 6);
+  assert(chunks[1].start == 6 && chunks[1].count == 6);
+  assert(chunks[3].start == 18 && chunks[3].count == 2);
+  free(chunks);
+
+  n = batch_plan(args, 20, fixed, limit, 5, &chunks);
+  assert(n == 4);
+  assert(chunks[0].count == 5);
+  free(chunks);
+
+  // No arguments still runs the command once
+  n = batch_plan(args, 0, fixed, limit, 0, &chunks);
+  assert(n == 1 && chunks[0].count == 0);
+  free(chunks);
+
+  // An argument that can never fit fails the whole plan
+  char *huge[] = {"this argument is far too long for the limit"};
+  assert(batch_plan(huge, 1, fixed, fixed + 10, 0, &chunks) == 0);
+
+  assert(batch_arg_limit(environ) > 0);
+
+  printf("batch_plan test passed!\n");
+}
+
+static void test_batch_ordered_output() {
+  printf("Testing ordered concurrent batches...\n");
+
+  char *words[202];
+  char numbers[200][8];
+  words[0] = "echo";
+  for (int i = 0; i < 200; i++) {
+    snprintf(numbers[i], sizeof(numbers[i]), "%d", i);
+    words[i + 1] = numbers[i];
+  }
+  Command *cmd = command_from(words, 201);
+  Redirect out = {.kind = REDIRECT_OUT,
+                  .fd = STDOUT_FILENO,
+                  .target = TEST_OUTPUT_FILE,
+                  .opened = -1};
+  cmd->redirects = &out;
+  cmd->redirect_count = 1;
+
+  BatchOptions opts = {.jobs = 4, .size_limit = 256, .prefix = 0};
+  assert(batch_run(cmd, cmd->argv, cmd->argc, &opts) == 0);
+
+  FILE *file = fopen(TEST_OUTPUT_FILE, "r");
+  assert(file != NULL);
+  int expected = 0;
+  int lines = 0;
+  int value;
+  char sep;
+  while (fscanf(file, "%d%c", &value, &sep) == 2) {
+    assert(value == expected++);
+    if (sep == '\n')
+      lines++;
+  }
+  fclose(file);
+  unlink(TEST_OUTPUT_FILE);
+
+  assert(expected == 200);
+  assert(lines > 1);
+
+  free(cmd->argv);
+  free(cmd);
+  printf("Ordered concurrent batches test passed!\n");
+}
+
+static void test_marked_commands() {
+  printf("Testing automatic batching of marked commands...\n");
+
+  char *mark_words[] = {"batch", "-m", "true"};
+  Command *mark = command_from(mark_words, 3);
+  batch_builtin(mark);
+  assert(batch_is_marked("true"));
+  assert(!batch_is_marked("false"));
+
+  size_t limit = batch_arg_limit(vars_envp());
+  size_t count = limit / 1000 + 10;
+  char *arg = (char *)malloc(1000);
+  memset(arg, 'x', 999);
+  arg[999] = '\0';
+
+  Command *big = create_command();
+  free(big->argv);
+  big->argv = (char **)malloc((count + 2) * sizeof(char *));
+  big->argv[0] = "true";
+  for (size_t i = 1; i <= count; i++) {
+    big->argv[i] = arg;
+  }
+  big->argc = count + 1;
+  big->argv[big->argc] = NULL;
+  big->name = big->argv[0];
+
+  assert(batch_should_split(big));
+  big->argc = 2;
+  assert(!batch_should_split(big));
+
+  free(big->argv);
+  free(big);
+  free(arg);
+  free(mark->argv);
+  free(mark);
+  printf("Automatic batching test passed!\n");
+}
+
+int main() {
+  printf("Running batch tests...\n");
+
+  vars_init(environ);
+  test_batch_plan();
+  test_batch_ordered_output();
+  test_marked_commands();
+
+  vars_free();
+  printf("All batch tests passed!\n");
+  return 0;
+}
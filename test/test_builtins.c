@@ -0,0 +1,84 @@
+#include "buffer.h"
+#include "builtins.h"
+#include "subst.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_registry() {
+  printf("Testing builtin registry...\n");
+
+  assert(builtin_find("cd") != NULL);
+  assert(builtin_find("[") != NULL);
+  assert(builtin_find("unset") != NULL);
+  assert(builtin_find("ls") == NULL);
+  assert(builtin_find("") == NULL);
+  assert(builtin_find("echo")->flags & BUILTIN_INLINE);
+  assert(subst_is_inline_builtin("pwd"));
+  assert(!subst_is_inline_builtin("cd"));
+
+  builtin_register("zz_extra", echo_args, 0);
+  check_output("zz_extra registered", "registered");
+  assert(is_builtin("zz_extra"));
+
+  printf("Builtin registry test passed!\n");
+}
+
+static void test_plugin() {
+  printf("Testing builtin plugins...\n");
+
+  assert(run_source("enable -f " UPCASE_PLUGIN " upcase") == 0);
+  const Builtin *builtin = builtin_find("upcase");
+  assert(builtin && builtin->plugin && builtin->handle);
+  assert(strcmp(builtin->plugin->name, "upcase") == 0);
+
+  check_output("upcase hello world", "HELLO WORLD");
+  check_output("echo piped | upcase", "PIPED");
+  check_output("for w in a b; do upcase $w; done", "A\nB");
+
+  // Loading again replaces the earlier copy; only loaded builtins unload
+  assert(run_source("enable -f " UPCASE_PLUGIN " upcase") == 0);
+  assert(builtin_load(UPCASE_PLUGIN, "upcase"));
+  assert(run_source("enable -d upcase") == 0);
+  assert(builtin_find("upcase") == NULL);
+  assert(run_source("enable -d upcase") == 1);
+  assert(run_source("enable -d cd") == 1);
+  assert(builtin_find("cd") != NULL);
+
+  // Missing libraries and symbols fail without side effects
+  assert(run_source("enable -f /nonexistent.so upcase") == 1);
+  assert(run_source("enable -f " UPCASE_PLUGIN " nosuch") == 1);
+  assert(builtin_find("nosuch") == NULL);
+  assert(run_source("enable -f") == 2);
+
+  printf("Builtin plugins test passed!\n");
+}
+
+int main() {
+  printf("Running builtin tests...\n");
+
+  vars_init(environ);
+  test_registry();
+  test_plugin();
+
+  builtins_free();
+  vars_free();
+  printf("All builtin tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include "alias.h"
+#include "buffer.h"
+#include "cache.h"
+#include "subst.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_aliases() {
+  printf("Testing aliases...\n");
+
+  alias_set("greet", "echo hello");
+  check_output("greet world", "hello world");
+  assert(strcmp(alias_get("greet", 5), "echo hello") == 0);
+  assert(alias_get("gree", 4) == NULL);
+
+  // An alias is not expanded again inside its own value
+  alias_set("echo", "echo -n");
+  check_output("echo a; echo b", "ab");
+  assert(alias_remove("echo"));
+  assert(!alias_remove("echo"));
+  check_output("echo a; echo b", "a\nb");
+  alias_set("x", "y");
+  alias_set("y", "x");
+  assert(run_source("x") != 0);
+
+  // Values may open compound commands; only command position is replaced
+  alias_set("twice", "for i in 1 2; do echo");
+  check_output("twice -n $i; done", "12");
+  check_output("echo -n greet", "greet");
+  check_output("if true; then greet; fi", "hello");
+
+  aliases_free();
+  assert(alias_get("greet", 5) == NULL);
+
+  printf("Aliases test passed!\n");
+}
+
+static void test_program_cache() {
+  printf("Testing program cache...\n");
+
+  cache_clear();
+  const CacheStats *stats = cache_stats();
+  unsigned long hits = stats->hits;
+  unsigned long misses = stats->misses;
+
+  Program *first;
+  Program *second;
+  assert(cache_compile("echo cached | cat", &first) == COMPILE_OK);
+  assert(cache_compile("echo cached | cat", &second) == COMPILE_OK);
+  assert(first == second);
+  assert(stats->hits == hits + 1 && stats->misses == misses + 1);
+  program_release(first);
+  program_release(second);
+
+  // Defining an alias recompiles lines that might use it
+  unsigned long invalidations = stats->invalidations;
+  alias_set("unused", "true");
+  assert(cache_compile("echo cached | cat", &second) == COMPILE_OK);
+  assert(stats->invalidations == invalidations + 1);
+  program_release(second);
+
+  // Incomplete input is never cached
+  assert(cache_compile("if true; then", &first) == COMPILE_INCOMPLETE);
+  assert(cache_compile("if true; then", &first) == COMPILE_INCOMPLETE);
+
+  // The oldest line makes room once the cache is full
+  unsigned long evictions = stats->evictions;
+  char line[32];
+  for (int i = 0; i < PROGRAM_CACHE_SIZE + 4; i++) {
+    snprintf(line, sizeof(line), "echo %d", i);
+    assert(cache_compile(line, &first) == COMPILE_OK);
+    program_release(first);
+  }
+  assert(stats->evictions >= evictions + 4);
+  hits = stats->hits;
+  assert(cache_compile("echo 0", &first) == COMPILE_OK);
+  assert(stats->hits == hits);
+  program_release(first);
+
+  aliases_free();
+  cache_clear();
+  printf("Program cache test passed!\n");
+}
+
+static void test_command_paths() {
+  printf("Testing command path resolution...\n");
+
+  const CacheStats *stats = cache_stats();
+  unsigned long lookups = stats->path_lookups;
+  unsigned long reuses = stats->path_reuses;
+
+  run_source("for i in 1 2 3; do printf %s $i > /dev/null; done");
+  assert(stats->path_lookups == lookups + 1);
+  assert(stats->path_reuses == reuses + 2);
+
+  // Assigning PATH, or hash -r, forces a new search
+  lookups = stats->path_lookups;
+  run_source("for i in 1 2; do printf %s $i | cat > /dev/null; PATH=$PATH;"
+             "done");
+  assert(stats->path_lookups == lookups + 4);
+  lookups = stats->path_lookups;
+  vars_forget_paths();
+  run_source("true | cat");
+  assert(stats->path_lookups == lookups + 1);
+
+  // Functions still shadow a command resolved earlier
+  check_output("for i in 1 2; do printf x; printf() { echo -n f; }; done",
+               "xf");
+
+  char *path = resolve_command("sh");
+  assert(path && path[0] == '/');
+  free(path);
+  assert(resolve_command("no-such-command-here") == NULL);
+
+  printf("Command path resolution test passed!\n");
+}
+
+int main() {
+  printf("Running cache tests...\n");
+
+  vars_init(environ);
+  test_aliases();
+  test_program_cache();
+  test_command_paths();
+
+  cache_clear();
+  functions_free();
+  vars_free();
+  printf("All cache tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include "buffer.h"
+#include "capture.h"
+#include "shell.h"
+#include "subst.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static Buffer passthrough;
+
+// Runs `src` with the shell's stdout pointed at a memory file, keeping what
+// reached it in `passthrough`
+static int run_quietly(const char *src) {
+  fflush(stdout);
+  int memfd = memfd_create("out", MFD_CLOEXEC);
+  int saved = dup(STDOUT_FILENO);
+  dup2(memfd, STDOUT_FILENO);
+  int status = run_source(src);
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  buffer_clear(&passthrough);
+  lseek(memfd, 0, SEEK_SET);
+  buffer_read_fd(&passthrough, memfd, 4096);
+  close(memfd);
+  return status;
+}
+
+static void check_entry(size_t n, const char *command, const char *text) {
+  const CaptureEntry *entry = capture_entry(n);
+  assert(entry);
+  Buffer out;
+  buffer_init(&out);
+  assert(capture_read(entry, &out) == 0);
+  if (strcmp(entry->command, command) != 0 ||
+      strcmp(out.data ? out.data : "", text) != 0) {
+    fprintf(stderr, "entry %zu: %s\n  got: %s\n  expected: %s\n", n,
+            entry->command, out.data, text);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_capture() {
+  printf("Testing output capture...\n");
+
+  // Nothing is kept until the option is on
+  run_quietly("printf 'a\\n'");
+  assert(capture_entry(1) == NULL);
+  assert(set_option("capture", true));
+
+  assert(run_quietly("printf 'one\\ntwo\\n'") == 0);
+  assert(strcmp(passthrough.data, "one\ntwo\n") == 0);
+  check_entry(1, "printf one\\ntwo\\n", "one\ntwo\n");
+
+  // Pipelines keep the final stage's output and status; stderr is kept too
+  assert(run_quietly("printf 'x\\ny\\n' | grep y") == 0);
+  assert(strcmp(passthrough.data, "y\n") == 0);
+  check_entry(1, "printf x\\ny\\n | grep y", "y\n");
+  assert(run_quietly("sh -c 'echo oops >&2; exit 3'") == 3);
+  check_entry(1, "sh -c echo oops >&2; exit 3", "oops\n");
+  assert(capture_entry(1)->status == 3);
+  check_entry(3, "printf one\\ntwo\\n", "one\ntwo\n");
+
+  // Builtins in the shell itself and redirected output are not captured
+  run_quietly("echo inline");
+  check_entry(1, "sh -c echo oops >&2; exit 3", "oops\n");
+  run_quietly("printf 'hidden\\n' > /dev/null");
+  check_entry(1, "printf hidden\\n", "");
+
+  // Replaying, with and without a filter
+  check_output("out 4", "one\ntwo");
+  check_output("last", "");
+  check_output("out 3 -g y", "y");
+  check_output("out 4 -g tw", "two");
+  assert(run_source("out 99") == 1);
+
+  printf("Output capture test passed!\n");
+}
+
+static void test_wraparound() {
+  printf("Testing capture ring wraparound...\n");
+
+  // A new size starts an empty ring
+  var_set("CAPTURE_BYTES", "4096", 0);
+  run_quietly("seq 1 3000");
+  assert(capture_entry(2) == NULL);
+
+  const CaptureEntry *entry = capture_entry(1);
+  assert(entry->len == passthrough.len);
+  assert(entry->len > 4096);
+
+  // Only the newest bytes survive, and they are intact
+  Buffer out;
+  buffer_init(&out);
+  size_t lost = capture_read(entry, &out);
+  assert(lost == entry->len - 4096);
+  assert(out.len == 4096);
+  assert(memcmp(out.data, passthrough.data + lost, 4096) == 0);
+
+  run_quietly("seq 1 5");
+  buffer_clear(&out);
+  assert(capture_read(capture_entry(2), &out) == entry->len - 4096 + 10);
+  buffer_clear(&out);
+  capture_read(capture_entry(1), &out);
+  assert(strcmp(out.data, "1\n2\n3\n4\n5\n") == 0);
+  buffer_free(&out);
+
+  printf("Capture ring wraparound test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  buffer_init(&passthrough);
+  test_capture();
+  test_wraparound();
+  capture_free();
+  buffer_free(&passthrough);
+  printf("All capture tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,216 @@
+#include "copy.h"
+#include "shell.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_copy"
+#define OTHER_FS "/dev/shm/test_copy" // tmpfs, unlike /tmp here
+
+extern char **environ;
+
+static void make_file(const char *path, size_t size, mode_t mode) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  assert(fd != -1);
+  char block[4096];
+  for (size_t done = 0; done < size; done += sizeof(block)) {
+    for (size_t i = 0; i < sizeof(block); i++) {
+      block[i] = (char)(done / sizeof(block) * 31 + i * 7);
+    }
+    size_t n = size - done < sizeof(block) ? size - done : sizeof(block);
+    assert(write(fd, block, n) == (ssize_t)n);
+  }
+  fchmod(fd, mode);
+  close(fd);
+}
+
+// A tree with a large file, an empty one, a link and a directory that can
+// only be written to before its mode is set
+static void make_tree(const char *root) {
+  char path[256];
+  snprintf(path, sizeof(path), "mkdir -p %s/sub/locked %s/empty", root, root);
+  assert(system(path) == 0);
+  for (int i = 0; i < 50; i++) {
+    snprintf(path, sizeof(path), "%s/f%d", root, i);
+    make_file(path, i * 1000, 0644);
+  }
+  snprintf(path, sizeof(path), "%s/sub/big", root);
+  make_file(path, 3 * COPY_CHUNK + 17, 0600);
+  snprintf(path, sizeof(path), "%s/sub/locked/run", root);
+  make_file(path, 0, 0755);
+  snprintf(path, sizeof(path), "%s/sub/link", root);
+  assert(symlink("big", path) == 0);
+
+  struct timespec old[2] = {{.tv_sec = 981173106}, {.tv_sec = 981173106}};
+  snprintf(path, sizeof(path), "%s/f3", root);
+  assert(utimensat(AT_FDCWD, path, old, 0) == 0);
+  snprintf(path, sizeof(path), "%s/sub/locked", root);
+  assert(chmod(path, 0500) == 0);
+  assert(utimensat(AT_FDCWD, path, old, 0) == 0);
+}
+
+static bool same_tree(const char *a, const char *b) {
+  char command[512];
+  snprintf(command, sizeof(command), "diff -r --no-dereference %s %s", a, b);
+  return system(command) == 0;
+}
+
+static void check_kept(const char *src, const char *dst) {
+  struct stat from;
+  struct stat to;
+  assert(lstat(src, &from) == 0 && lstat(dst, &to) == 0);
+  assert((from.st_mode & 07777) == (to.st_mode & 07777) ||
+         S_ISLNK(from.st_mode));
+  assert(from.st_mtim.tv_sec == to.st_mtim.tv_sec &&
+         from.st_mtim.tv_nsec == to.st_mtim.tv_nsec);
+}
+
+static void check_copy(const char *src, const char *dst) {
+  assert(same_tree(src, dst));
+  const char *paths[] = {"", "/f3", "/sub/big", "/sub/locked",
+                         "/sub/locked/run", "/sub/link", "/empty"};
+  for (size_t i = 0; i < sizeof(paths) / sizeof(*paths); i++) {
+    char from[256];
+    char to[256];
+    snprintf(from, sizeof(from), "%s%s", src, paths[i]);
+    snprintf(to, sizeof(to), "%s%s", dst, paths[i]);
+    check_kept(from, to);
+  }
+  char link[256];
+  char target[16] = {0};
+  snprintf(link, sizeof(link), "%s/sub/link", dst);
+  assert(readlink(link, target, sizeof(target) - 1) == 3);
+  assert(strcmp(target, "big") == 0);
+}
+
+static void test_copy_tree() {
+  printf("Testing copying a tree...\n");
+
+  make_tree(TEST_DIR "/src");
+  CopyRing ring;
+  bool uring = copy_ring_init(&ring, 8);
+  if (uring)
+    copy_ring_free(&ring);
+  printf("io_uring is %savailable\n", uring ? "" : "not ");
+
+  // Into a new name, through the ring where there is one
+  run_source("ucp -q " TEST_DIR "/src " TEST_DIR "/ring");
+  assert(last_status == 0);
+  check_copy(TEST_DIR "/src", TEST_DIR "/ring");
+
+  // With a queue shallower than the number of files
+  run_source("ucp -q -j 3 " TEST_DIR "/src " TEST_DIR "/shallow");
+  assert(last_status == 0);
+  check_copy(TEST_DIR "/src", TEST_DIR "/shallow");
+
+  // With copy_file_range
+  run_source("ucp -q -s " TEST_DIR "/src " TEST_DIR "/sync");
+  assert(last_status == 0);
+  check_copy(TEST_DIR "/src", TEST_DIR "/sync");
+
+  // Over an earlier copy
+  make_file(TEST_DIR "/ring/f1", 99999, 0600);
+  run_source("ucp -q " TEST_DIR "/src/. " TEST_DIR "/ring");
+  assert(last_status == 0);
+  check_copy(TEST_DIR "/src", TEST_DIR "/ring");
+
+  printf("Copying a tree test passed!\n");
+}
+
+static void test_destinations() {
+  printf("Testing destinations...\n");
+
+  assert(system("mkdir -p " TEST_DIR "/into") == 0);
+  run_source("ucp -q " TEST_DIR "/src/f5 " TEST_DIR "/src/sub/ " TEST_DIR
+             "/into");
+  assert(last_status == 0);
+  assert(same_tree(TEST_DIR "/src/f5", TEST_DIR "/into/f5"));
+  assert(same_tree(TEST_DIR "/src/sub", TEST_DIR "/into/sub"));
+
+  run_source("ucp -q " TEST_DIR "/src/f5 " TEST_DIR "/copied");
+  assert(last_status == 0);
+  assert(same_tree(TEST_DIR "/src/f5", TEST_DIR "/copied"));
+
+  // Several sources need a directory
+  run_source("ucp -q " TEST_DIR "/src/f5 " TEST_DIR "/src/f6 " TEST_DIR
+             "/copied 2>/dev/null");
+  assert(last_status == 1);
+
+  // A missing source fails the command, but the rest are copied
+  run_source("ucp -q " TEST_DIR "/missing " TEST_DIR "/src/f7 " TEST_DIR
+             "/into 2>/dev/null");
+  assert(last_status == 1);
+  assert(access(TEST_DIR "/into/f7", F_OK) == 0);
+
+  // A directory into itself
+  run_source("ucp -q " TEST_DIR "/src " TEST_DIR "/src/sub 2>/dev/null");
+  assert(last_status == 1);
+  assert(access(TEST_DIR "/src/sub/src", F_OK) == -1);
+
+  // A file onto itself, by name or into its own directory, is refused
+  // rather than truncated
+  run_source("ucp -q " TEST_DIR "/into/f5 " TEST_DIR "/into/f5 2>/dev/null");
+  assert(last_status == 1);
+  run_source("ucp -q " TEST_DIR "/into/f5 " TEST_DIR "/into 2>/dev/null");
+  assert(last_status == 1);
+  assert(same_tree(TEST_DIR "/src/f5", TEST_DIR "/into/f5"));
+
+  run_source("ucp 2>/dev/null");
+  assert(last_status == 2);
+  run_source("ucp -j 0 a b 2>/dev/null");
+  assert(last_status == 2);
+
+  printf("Destinations test passed!\n");
+}
+
+static void test_move() {
+  printf("Testing moving...\n");
+
+  // On one filesystem a move is a rename
+  assert(system("cp -a " TEST_DIR "/src " TEST_DIR "/before") == 0);
+  struct stat before;
+  assert(stat(TEST_DIR "/before/sub/big", &before) == 0);
+  run_source("umv -q " TEST_DIR "/before " TEST_DIR "/after");
+  assert(last_status == 0);
+  struct stat after;
+  assert(stat(TEST_DIR "/after/sub/big", &after) == 0);
+  assert(before.st_ino == after.st_ino);
+  assert(access(TEST_DIR "/before", F_OK) == -1);
+  check_copy(TEST_DIR "/src", TEST_DIR "/after");
+
+  // Across filesystems it is a copy, and the source goes afterwards
+  struct statfs here;
+  struct statfs there;
+  assert(system("mkdir -p " OTHER_FS) == 0);
+  if (statfs(TEST_DIR, &here) == 0 && statfs(OTHER_FS, &there) == 0 &&
+      memcmp(&here.f_fsid, &there.f_fsid, sizeof(here.f_fsid)) != 0) {
+    run_source("umv -q " TEST_DIR "/after " OTHER_FS "/moved");
+    assert(last_status == 0);
+    assert(access(TEST_DIR "/after", F_OK) == -1);
+    check_copy(TEST_DIR "/src", OTHER_FS "/moved");
+  } else {
+    printf("No second filesystem; skipping the copying move\n");
+  }
+  system("chmod -R u+w " OTHER_FS " && rm -rf " OTHER_FS);
+
+  printf("Moving test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  system("chmod -R u+w " TEST_DIR " 2>/dev/null; rm -rf " TEST_DIR
+         " && mkdir -p " TEST_DIR);
+  test_copy_tree();
+  test_destinations();
+  test_move();
+  system("chmod -R u+w " TEST_DIR " && rm -rf " TEST_DIR);
+  printf("All copy tests passed!\n");
+  return 0;
+}
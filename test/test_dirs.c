@@ -0,0 +1,220 @@
+#include "buffer.h"
+#include "dirs.h"
+#include "subst.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_dirs"
+#define TEST_INDEX TEST_DIR "/index"
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_cd() {
+  printf("Testing cd...\n");
+
+  check_output("cd " TEST_DIR "/a; pwd; echo $PWD", TEST_DIR "/a\n" TEST_DIR
+                                                    "/a");
+  check_output("cd " TEST_DIR "/a; cd ../b; echo $PWD $OLDPWD",
+               TEST_DIR "/b " TEST_DIR "/a");
+  check_output("cd " TEST_DIR "/a; cd " TEST_DIR "/b; cd -", TEST_DIR "/a");
+  check_output("HOME=" TEST_DIR "/b; cd " TEST_DIR "; cd; pwd; cd ~/../a; pwd",
+               TEST_DIR "/b\n" TEST_DIR "/a");
+  check_output("cd " TEST_DIR "/missing; echo $?", "1");
+
+  // CDPATH finds relative names, and the shell says where it went
+  check_output("CDPATH=:" TEST_DIR "/a; cd /; cd deep; pwd",
+               TEST_DIR "/a/deep\n" TEST_DIR "/a/deep");
+  check_output("CDPATH=" TEST_DIR "/a; cd " TEST_DIR "; cd b; pwd",
+               TEST_DIR "/b");
+
+  printf("cd test passed!\n");
+}
+
+static void test_stack() {
+  printf("Testing pushd, popd and dirs...\n");
+
+  check_output("HOME=/nowhere; cd " TEST_DIR "; pushd a; pushd ../b; dirs -v",
+               TEST_DIR "/a " TEST_DIR "\n" TEST_DIR "/b " TEST_DIR
+               "/a " TEST_DIR "\n 0  " TEST_DIR "/b\n 1  " TEST_DIR
+               "/a\n 2  " TEST_DIR);
+  // Redirected builtins run in a child, so these stay unredirected
+  check_output("cd " TEST_DIR "; pushd a; pushd " TEST_DIR "/b; popd; pwd",
+               TEST_DIR "/a " TEST_DIR "\n" TEST_DIR "/b " TEST_DIR
+               "/a " TEST_DIR "\n" TEST_DIR "/a " TEST_DIR "\n" TEST_DIR
+               "/a");
+  check_output("cd " TEST_DIR "/a; pushd missing; echo $?; dirs",
+               "1\n" TEST_DIR "/a");
+  check_output("HOME=" TEST_DIR "; cd ~/a; pushd ~/b; dirs -l",
+               "~/b ~/a\n" TEST_DIR "/b " TEST_DIR "/a");
+
+  // Swapping and rotating
+  check_output("cd " TEST_DIR "/a; pushd ../b; pushd; pushd",
+               TEST_DIR "/b " TEST_DIR "/a\n" TEST_DIR "/a " TEST_DIR
+               "/b\n" TEST_DIR "/b " TEST_DIR "/a");
+  check_output("cd /; pushd " TEST_DIR "/a; pushd " TEST_DIR "/b; "
+               "pushd +2; pwd",
+               TEST_DIR "/a /\n" TEST_DIR "/b " TEST_DIR "/a /\n/ " TEST_DIR
+               "/b " TEST_DIR "/a\n/");
+  check_output("cd /; pushd " TEST_DIR "/a; popd +1; pwd",
+               TEST_DIR "/a /\n" TEST_DIR "/a\n" TEST_DIR "/a");
+
+  check_output("popd; echo $?", "1");
+  check_output("pushd +3; echo $?", "1");
+  check_output("cd " TEST_DIR "; pushd a; dirs -c; dirs",
+               TEST_DIR "/a " TEST_DIR "\n" TEST_DIR "/a");
+
+  printf("pushd, popd and dirs test passed!\n");
+}
+
+static void write_index(const char *text) {
+  FILE *file = fopen(TEST_INDEX, "w");
+  assert(file);
+  fputs(text, file);
+  fclose(file);
+}
+
+static void test_frecency() {
+  printf("Testing z...\n");
+
+  long long now = time(NULL);
+  char text[512];
+  // b is visited more often but long ago; a recently
+  snprintf(text, sizeof(text),
+           "3|%lld|" TEST_DIR "/a\n"
+           "10|%lld|" TEST_DIR "/b\n"
+           "2|%lld|" TEST_DIR "/a/deep\n"
+           "5|%lld|" TEST_DIR "/gone\n",
+           now - 60, now - 30 * 24 * 3600, now - 60, now);
+  write_index(text);
+  dirs_free();
+
+  char *both[] = {"test_dirs"};
+  assert(strcmp(dirs_best(both, 1), TEST_DIR "/a") == 0);
+  char *b[] = {"/b"};
+  assert(strcmp(dirs_best(b, 1), TEST_DIR "/b") == 0);
+  char *deep[] = {"a", "DEEP"};
+  assert(dirs_best(deep, 2) == NULL); // uppercase turns off case folding
+  char *ordered[] = {"a", "deep"};
+  assert(strcmp(dirs_best(ordered, 2), TEST_DIR "/a/deep") == 0);
+  char *reversed[] = {"deep", "a"};
+  assert(dirs_best(reversed, 2) == NULL);
+  char *gone[] = {"gone"};
+  assert(dirs_best(gone, 1) == NULL); // no longer exists
+
+  check_output("cd /; z test_dirs; pwd", TEST_DIR "/a");
+  check_output("z -e /b", TEST_DIR "/b");
+  check_output("z -l deep | awk '{print $2}'", TEST_DIR "/a/deep");
+  check_output("z nothing; echo $?", "1");
+
+  // Visits are appended and picked up by the loaded index
+  check_output("cd " TEST_DIR "/b; cd " TEST_DIR "/b; cd /", "");
+  const DirIndex *index = dirs_index();
+  for (size_t i = 0; i < index->count; i++) {
+    const DirEntry *entry = &index->entries[i];
+    if (strcmp(index->arena.data + entry->path, TEST_DIR "/b") == 0)
+      assert(entry->rank == 12);
+  }
+
+  printf("z test passed!\n");
+}
+
+static void test_compaction() {
+  printf("Testing index compaction...\n");
+
+  // Far more journal lines than directories: folded into one each
+  FILE *file = fopen(TEST_INDEX, "w");
+  for (int i = 0; i < 3 * DIRS_COMPACT_SLACK; i++) {
+    fprintf(file, "1|%lld|" TEST_DIR "/%c\n", (long long)time(NULL),
+            i % 2 ? 'a' : 'b');
+  }
+  fclose(file);
+  dirs_free();
+  const DirIndex *index = dirs_index();
+  assert(index->count == 2);
+  struct stat st;
+  assert(stat(TEST_INDEX, &st) == 0 && st.st_size < 200);
+
+  // Past the total rank limit every rank is scaled down
+  file = fopen(TEST_INDEX, "w");
+  fprintf(file, "%f|%lld|" TEST_DIR "/a\n", DIRS_MAX_RANK,
+          (long long)time(NULL));
+  fprintf(file, "10|%lld|" TEST_DIR "/b\n", (long long)time(NULL));
+  fprintf(file, "0.5|%lld|" TEST_DIR "/a/deep\n", (long long)time(NULL));
+  fclose(file);
+  dirs_free();
+  index = dirs_index();
+  assert(index->count == 2);
+  double total = index->entries[0].rank + index->entries[1].rank;
+  assert(total <= DIRS_AGED_RANK + 0.01);
+
+  printf("Index compaction test passed!\n");
+}
+
+static void test_lookup_speed() {
+  printf("Testing lookup over a large index...\n");
+
+  enum { PATHS = 50000 };
+  FILE *file = fopen(TEST_INDEX, "w");
+  long long now = time(NULL);
+  for (int i = 0; i < PATHS; i++) {
+    fprintf(file, "1|%lld|/home/user/projects/group%03d/repo%05d/src\n",
+            now - i, i % 300, i);
+  }
+  fprintf(file, "1|%lld|" TEST_DIR "/b\n", now);
+  fclose(file);
+  dirs_free();
+  size_t loaded = dirs_index()->count; // the load is not what is timed
+  assert(loaded == PATHS + 1);
+
+  char *terms[] = {"test_dirs", "b"};
+  struct timespec start;
+  struct timespec end;
+  const int rounds = 20;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  const char *best = NULL;
+  for (int i = 0; i < rounds; i++) {
+    best = dirs_best(terms, 2);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ms = ((end.tv_sec - start.tv_sec) * 1e3 +
+               (end.tv_nsec - start.tv_nsec) / 1e6) /
+              rounds;
+  assert(best && strcmp(best, TEST_DIR "/b") == 0);
+  printf("  %d paths: %.3f ms per lookup\n", PATHS + 1, ms);
+  assert(ms < 20); // generous, for loaded and unoptimized builds
+
+  printf("Large index lookup test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR "/a/deep " TEST_DIR
+         "/b");
+  var_set("DIRS_INDEX", TEST_INDEX, 0);
+  test_cd();
+  test_stack();
+  test_frecency();
+  test_compaction();
+  test_lookup_speed();
+  dirs_free();
+  system("rm -rf " TEST_DIR);
+  printf("All directory tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,370 @@
+#include "filter.h"
+#include "scan.h"
+#include "shell.h"
+#include "stats.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_filter"
+
+extern char **environ;
+
+static void write_text(const char *path, const char *data, size_t len) {
+  FILE *file = fopen(path, "w");
+  assert(file);
+  assert(fwrite(data, 1, len, file) == len);
+  fclose(file);
+}
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *file = fopen(path, "r");
+  assert(file);
+  Buffer text;
+  buffer_init(&text);
+  buffer_reserve(&text, 0);
+  char chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    buffer_append(&text, chunk, n);
+  }
+  fclose(file);
+  *len = text.len;
+  return text.data;
+}
+
+// Fields of random words, some empty, some with tabs; a line longer than
+// a read block; and a last line without a newline
+static void make_inputs() {
+  Buffer text;
+  buffer_init(&text);
+  const char *words[] = {"alpha", "be", "gamma42", "", "x\tz", "needle"};
+  srand(7);
+  for (int i = 0; i < 60000; i++) {
+    int fields = rand() % 12;
+    for (int f = 0; f < fields; f++) {
+      if (f > 0)
+        buffer_push(&text, ':');
+      buffer_append_str(&text, words[rand() % 6]);
+    }
+    buffer_push(&text, '\n');
+    if (i == 30000) {
+      for (int k = 0; k < FILTER_BLOCK / 4; k++) {
+        buffer_append_str(&text, "be:");
+      }
+      buffer_append_str(&text, "needle\n");
+    }
+  }
+  buffer_append_str(&text, "no newline:needle");
+  write_text("fields", text.data, text.len);
+  buffer_free(&text);
+
+  write_text("empty", "", 0);
+  write_text("short", "a:b\n\nc", 6);
+  static const char nul[] = "xa\nx\0y\nxz\nxw\n";
+  write_text("nul", nul, sizeof(nul) - 1);
+  static const char utf8[] = "xa\nx\xffy\nxz\n\xc3\xa9x\n\xed\xa0\x80x\n";
+  write_text("utf8", utf8, sizeof(utf8) - 1);
+  static const char late[] = "xa\nxb\nx\0";
+  write_text("late", late, sizeof(late) - 1);
+}
+
+/***********************************************
+ * KERNELS
+ ***********************************************/
+
+static void test_kernels() {
+  printf("Testing scan kernels...\n");
+
+  char data[1024];
+  for (size_t i = 0; i < sizeof(data); i++) {
+    data[i] = "ab\n:c"[(i * 7 + i / 13) % 5];
+  }
+  data[700] = '\xe9';
+  memcpy(data + 1000, "needle", 6);
+  printf("Best kernels: %s\n", scan_level_name(scan_best()));
+
+  for (int level = SCAN_SCALAR; level <= (int)scan_best(); level++) {
+    assert(scan_select((ScanLevel)level) == (ScanLevel)level);
+    // Every start and length, so each falls on and off vector boundaries
+    for (size_t start = 0; start < 40; start++) {
+      for (size_t len = 0; start + len <= sizeof(data); len += 1 + len / 8) {
+        const char *p = data + start;
+        size_t newlines = 0;
+        const char *first = NULL;
+        for (size_t i = 0; i < len; i++) {
+          newlines += p[i] == '\n';
+          if (!first && (p[i] == ':' || p[i] == '\n'))
+            first = p + i;
+        }
+        assert(scan_count(p, len, '\n') == newlines);
+        assert(scan_find2(p, len, ':', '\n') == first);
+        const char *high = start + len > 700 && start <= 700 ? data + 700
+                                                              : NULL;
+        assert(scan_high(p, len) == high);
+        assert(scan_find(p, len, "needle", 6) == memmem(p, len, "needle", 6));
+        assert(scan_find(p, len, "c\nab", 4) == memmem(p, len, "c\nab", 4));
+        assert(scan_find(p, len, "b", 1) == memchr(p, 'b', len));
+      }
+    }
+  }
+  scan_select(SCAN_AVX2);
+
+  printf("Scan kernels test passed!\n");
+}
+
+static void test_cut_list() {
+  printf("Testing cut lists...\n");
+
+  CutList list = {0};
+  assert(cut_parse_list("5-,2,3-4,9", &list));
+  assert(list.count == 1 && list.items[0].lo == 2 &&
+         list.items[0].hi == SIZE_MAX);
+  assert(cut_parse_list("-3,7-8,5", &list));
+  assert(list.count == 3);
+  assert(list.items[0].lo == 1 && list.items[0].hi == 3);
+  assert(list.items[1].lo == 5 && list.items[1].hi == 5);
+  assert(list.items[2].lo == 7 && list.items[2].hi == 8);
+  assert(!cut_parse_list("0", &list));
+  assert(!cut_parse_list("3-2", &list));
+  assert(!cut_parse_list("-", &list));
+  assert(!cut_parse_list("1,,2", &list));
+  assert(!cut_parse_list("a", &list));
+  free(list.items);
+
+  printf("Cut lists test passed!\n");
+}
+
+/***********************************************
+ * AGAINST COREUTILS
+ ***********************************************/
+
+// What the real commands print, and their status, for `line`
+static char *expected(const char *line, size_t *len) {
+  char command[512];
+  int n = snprintf(command, sizeof(command),
+                   "sh -c '%s' > expected 2>&1; echo \"[$?]\" >> expected",
+                   line);
+  assert(n > 0 && (size_t)n < sizeof(command));
+  assert(system(command) != -1);
+  return read_file("expected", len);
+}
+
+// The same through the builtins: in the shell itself, with stdin and
+// stdout moved to files here, or as the last stage of a pipeline
+static char *actual(const char *line, bool in_shell, size_t *len) {
+  fflush(stdout);
+  int saved_out = dup(STDOUT_FILENO);
+  int saved_err = dup(STDERR_FILENO);
+  int saved_in = dup(STDIN_FILENO);
+  int fd = open("actual", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dup2(fd, STDOUT_FILENO);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+
+  char src[512];
+  const char *redirect = strchr(line, '<');
+  if (in_shell && redirect) {
+    fd = open(redirect + 2, O_RDONLY);
+    assert(fd != -1);
+    dup2(fd, STDIN_FILENO);
+    close(fd);
+    snprintf(src, sizeof(src), "%.*s", (int)(redirect - line - 1), line);
+  } else {
+    snprintf(src, sizeof(src), "%s", line);
+  }
+  run_source(src);
+  fflush(stdout);
+  fflush(stderr);
+
+  dup2(saved_out, STDOUT_FILENO);
+  dup2(saved_err, STDERR_FILENO);
+  dup2(saved_in, STDIN_FILENO);
+  close(saved_out);
+  close(saved_err);
+  close(saved_in);
+  FILE *file = fopen("actual", "a");
+  fprintf(file, "[%d]\n", last_status);
+  fclose(file);
+  return read_file("actual", len);
+}
+
+// Input after `<` is given on stdin: mapped in the shell, or piped by cat
+static void check_same(const char *line, bool in_shell) {
+  char piped[512];
+  const char *redirect = strchr(line, '<');
+  if (!in_shell && redirect) {
+    snprintf(piped, sizeof(piped), "cat %s | %.*s", redirect + 2,
+             (int)(redirect - line - 1), line);
+    line = piped;
+  }
+  size_t want_len;
+  size_t got_len;
+  char *want = expected(line, &want_len);
+  char *got = actual(line, in_shell, &got_len);
+  if (want_len != got_len || memcmp(want, got, want_len) != 0) {
+    fprintf(stderr, "%s (%s, %s kernels)\n  got: %.200s\n  expected: %.200s\n",
+            line, in_shell ? "in the shell" : "in a pipeline",
+            scan_level_name(scan_level()), got, want);
+    assert(0);
+  }
+  free(want);
+  free(got);
+}
+
+static void test_coreutils() {
+  printf("Testing output against coreutils...\n");
+
+  static const char *lines[] = {
+      "wc -l < fields",
+      "wc -c < fields",
+      "wc -lc < short",
+      "wc -l < empty",
+      "wc -l fields",
+      "wc -cl fields short empty",
+      "wc -l - short < fields",
+      "head -n 3 < fields",
+      "head -5 < short",
+      "head -n 0 < fields",
+      "head -n 59990 < fields",
+      "head short",
+      "tail < fields",
+      "tail -n 2 < short",
+      "tail -n 30010 < fields",
+      "tail -n +59995 < fields",
+      "tail -n +1 < short",
+      "tail -7 fields",
+      "grep -F needle < fields",
+      "grep -n gamma42:be < fields",
+      "grep -c alpha:alpha < fields",
+      "grep -v e < fields",
+      "grep -vn : < fields",
+      "grep -cv needle < fields",
+      "grep -q needle < fields",
+      "grep -F nothing < fields",
+      "grep -e ee short",
+      "grep -n x < nul",
+      "grep x < late",
+      "grep -c x < nul",
+      "grep -q x < nul",
+      "grep -F x utf8",
+      "LANG=C.UTF-8 grep -n x < utf8",
+      "LC_ALL=C.UTF-8 grep -v q < utf8",
+      "LC_ALL=C.UTF-8 grep -c x < utf8",
+      "cut -d: -f2 < fields",
+      "cut -d : -f 1,3-4 < fields",
+      "cut -d: -s -f5- < fields",
+      "cut -f2 < fields",
+      "cut -f1 -d: short fields",
+      "cut -c2-3,6 < fields",
+      "cut -b -2,4- < short",
+  };
+  for (int level = SCAN_SCALAR; level <= (int)scan_best(); level++) {
+    scan_select((ScanLevel)level);
+    for (size_t i = 0; i < sizeof(lines) / sizeof(*lines); i++) {
+      check_same(lines[i], true);
+      check_same(lines[i], false);
+    }
+  }
+  scan_select(SCAN_AVX2);
+
+  printf("Output against coreutils test passed!\n");
+}
+
+static void test_fallback() {
+  printf("Testing what is left to the real commands...\n");
+
+  static const char *lines[] = {
+      "wc < fields",
+      "wc -w short",
+      "wc -l missing",
+      "head -c 10 < fields",
+      "head -n -2 < short",
+      "head -n 2 short short",
+      "tail -c 5 < short",
+      "grep -i NEEDLE short",
+      "grep -F needle short fields",
+      "grep b.d < short",
+      "grep -F x missing",
+      "grep x < nul",
+      "grep -v q < nul",
+      "cut -d: -f2 --complement < short",
+      "cut -f0 < short",
+      "cut -d ab -f1 < short",
+      "cut -b1 -s < short",
+  };
+  for (size_t i = 0; i < sizeof(lines) / sizeof(*lines); i++) {
+    check_same(lines[i], true);
+    check_same(lines[i], false);
+  }
+
+  // No exec for the builtin in a pipeline; one for the real command
+  uint64_t execs = shell_stats()->execs;
+  run_source("cat short | wc -l > /dev/null");
+  assert(shell_stats()->execs == execs + 1);
+  run_source("cat short | wc -w > /dev/null");
+  assert(shell_stats()->execs == execs + 3);
+  set_option("filters", false);
+  run_source("cat short | wc -l > /dev/null");
+  assert(shell_stats()->execs == execs + 5);
+  set_option("filters", true);
+
+  printf("Left to the real commands test passed!\n");
+}
+
+// As with the real commands, head leaves seekable input just past the
+// lines it printed, so the next reader picks up there; grep reads it all
+static void test_offset() {
+  printf("Testing the input offset...\n");
+
+  fflush(stdout);
+  int saved_in = dup(STDIN_FILENO);
+  int saved_out = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+  close(null_fd);
+  int fd = open("short", O_RDONLY);
+  dup2(fd, STDIN_FILENO);
+  close(fd);
+  run_source("head -n 1");
+  off_t after_head = lseek(STDIN_FILENO, 0, SEEK_CUR);
+  run_source("grep -q b");
+  off_t after_grep = lseek(STDIN_FILENO, 0, SEEK_CUR);
+  fflush(stdout);
+  dup2(saved_in, STDIN_FILENO);
+  dup2(saved_out, STDOUT_FILENO);
+  close(saved_in);
+  close(saved_out);
+
+  assert(after_head == 4);
+  assert(after_grep == 6); // the whole of "a:b\n\nc"
+
+  printf("Input offset test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  stats_init();
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR);
+  assert(chdir(TEST_DIR) == 0);
+  var_set("LC_ALL", "", VAR_EXPORTED);
+  var_set("LANG", "C", VAR_EXPORTED);
+  setenv("LC_ALL", "", 1);
+  setenv("LANG", "C", 1);
+  make_inputs();
+  set_option("filters", true);
+  test_kernels();
+  test_cut_list();
+  test_coreutils();
+  test_fallback();
+  test_offset();
+  assert(chdir("/") == 0);
+  system("rm -rf " TEST_DIR);
+  printf("All filter tests passed!\n");
+  return 0;
+}
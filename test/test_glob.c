@@ -0,0 +1,157 @@
+#include "expand.h"
+#include "glob_expand.h"
+#include "shell.h"
+#include "vars.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static char test_root[] = "/tmp/test_glob_XXXXXX";
+
+static void touch(const char *path) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  assert(fd != -1);
+  close(fd);
+}
+
+static void setup_tree() {
+  assert(mkdtemp(test_root) != NULL);
+  assert(chdir(test_root) == 0);
+
+  touch("a.log");
+  touch("b.log");
+  touch("c.txt");
+  touch(".hidden.log");
+  touch("[x].txt");
+  mkdir("src", 0755);
+  touch("src/main.c");
+  touch("src/util.c");
+  mkdir("src/lib", 0755);
+  touch("src/lib/deep.c");
+
+  char name[32];
+  for (int i = 0; i < 50; i++) {
+    snprintf(name, sizeof(name), "many_%02d.dat", i);
+    touch(name);
+  }
+}
+
+static void cleanup_tree() {
+  char cmd[64];
+  assert(chdir("/") == 0);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", test_root);
+  system(cmd);
+}
+
+static void assert_expands(const char *pattern, const char **expected) {
+  WordList out;
+  wordlist_init(&out);
+  size_t n = glob_expand(pattern, &out);
+
+  size_t count = 0;
+  while (expected[count])
+    count++;
+
+  assert(n == count);
+  assert(out.count == count);
+  for (size_t i = 0; i < count; i++) {
+    assert(strcmp(out.words[i], expected[i]) == 0);
+  }
+  wordlist_free(&out);
+  glob_cache_reset();
+}
+
+static void test_segment_matching() {
+  printf("Testing glob segment matching...\n");
+
+  GlobPattern pattern;
+  assert(glob_compile("*.log", &pattern));
+  assert(glob_match_segment(&pattern.segments[0], "a.log"));
+  assert(glob_match_segment(&pattern.segments[0], ".log"));
+  assert(!glob_match_segment(&pattern.segments[0], "a.txt"));
+  glob_pattern_free(&pattern);
+
+  assert(glob_compile("[a-c]?[!0-9]", &pattern));
+  assert(glob_match_segment(&pattern.segments[0], "bxy"));
+  assert(!glob_match_segment(&pattern.segments[0], "dxy"));
+  assert(!glob_match_segment(&pattern.segments[0], "bx1"));
+  glob_pattern_free(&pattern);
+
+  // Pathological for backtracking matchers
+  assert(glob_compile("*a*a*a*a*a*a*a*a*a*a*b", &pattern));
+  char name[256];
+  memset(name, 'a', sizeof(name) - 1);
+  name[sizeof(name) - 1] = '\0';
+  assert(!glob_match_segment(&pattern.segments[0], name));
+  glob_pattern_free(&pattern);
+
+  assert(glob_compile("\\*.c", &pattern));
+  assert(pattern.segments[0].literal != NULL);
+  assert(strcmp(pattern.segments[0].literal, "*.c") == 0);
+  glob_pattern_free(&pattern);
+
+  printf("Glob segment matching test passed!\n");
+}
+
+static void test_glob_expand() {
+  printf("Testing glob_expand...\n");
+
+  assert_expands("*.log", (const char *[]){"a.log", "b.log", NULL});
+  assert_expands(".*.log", (const char *[]){".hidden.log", NULL});
+  assert_expands("?.*", (const char *[]){"a.log", "b.log", "c.txt", NULL});
+  assert_expands("src/*.c", (const char *[]){"src/main.c", "src/util.c", NULL});
+  assert_expands("*/", (const char *[]){"src/", NULL});
+  assert_expands("**/*.c", (const char *[]){"src/lib/deep.c", "src/main.c",
+                                            "src/util.c", NULL});
+  assert_expands("src/**", (const char *[]){"src/lib", "src/lib/deep.c",
+                                            "src/main.c", "src/util.c", NULL});
+  assert_expands("*.none", (const char *[]){NULL});
+
+  printf("glob_expand test passed!\n");
+}
+
+static void test_parse_with_globs() {
+  printf("Testing glob expansion while parsing...\n");
+
+  char line[] = "ls *.log '*.log' \\*.txt many_*.dat [x].txt";
+  Command *cmd = parse_pipeline(line);
+  assert(cmd->argc == 56);
+  assert(strcmp(cmd->argv[1], "a.log") == 0);
+  assert(strcmp(cmd->argv[2], "b.log") == 0);
+  assert(strcmp(cmd->argv[3], "*.log") == 0);
+  assert(strcmp(cmd->argv[4], "*.txt") == 0);
+  assert(strcmp(cmd->argv[5], "many_00.dat") == 0);
+  assert(strcmp(cmd->argv[54], "many_49.dat") == 0);
+  // No file named "x.txt", so the bracket pattern is kept literally
+  assert(strcmp(cmd->argv[55], "[x].txt") == 0);
+  assert(cmd->argv[56] == NULL);
+  free_commands(&cmd);
+
+  char quoted[] = "ls \"[x]\".txt";
+  cmd = parse_pipeline(quoted);
+  assert(cmd->argc == 2);
+  assert(strcmp(cmd->argv[1], "[x].txt") == 0);
+  free_commands(&cmd);
+
+  printf("Glob expansion while parsing test passed!\n");
+}
+
+int main() {
+  printf("Running glob tests...\n");
+
+  char *initial[] = {NULL};
+  vars_init(initial);
+  setup_tree();
+
+  test_segment_matching();
+  test_glob_expand();
+  test_parse_with_globs();
+
+  cleanup_tree();
+  printf("All glob tests passed!\n");
+  return 0;
+}
@@ -20,10 +20,8 @@ void test_create_command() {
   assert(cmd->next == NULL);
   assert(cmd->argc == 0);
   assert(cmd->name == NULL);
-  assert(cmd->is_in_redirect == false);
-  assert(cmd->is_out_redirect == false);
-  assert(cmd->in_file_name == NULL);
-  assert(cmd->out_file_name == NULL);
+  assert(cmd->redirects == NULL);
+  assert(cmd->redirect_count == 0);
 
   free(cmd);
   printf("create_command test passed!\n");
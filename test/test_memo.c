@@ -0,0 +1,175 @@
+#include "buffer.h"
+#include "memo.h"
+#include "subst.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <dirent.h>
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static char dir[] = "/tmp/test_memo.XXXXXX";
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static size_t count_files(const char *sub) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/store/%s", dir, sub);
+  DIR *d = opendir(path);
+  assert(d);
+  size_t n = 0;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (ent->d_name[0] != '.')
+      n++;
+  }
+  closedir(d);
+  return n;
+}
+
+static void write_file(const char *name, const char *text) {
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  FILE *f = fopen(path, "w");
+  assert(f);
+  fputs(text, f);
+  fclose(f);
+}
+
+static void test_memo_hits() {
+  printf("Testing memo hits and misses...\n");
+
+  // Each real run leaves a line in runs
+  check_output("memo sh -c 'echo ran >> runs; echo out; exit 3'", "out");
+  assert(last_status == 3);
+  check_output("memo sh -c 'echo ran >> runs; echo out; exit 3'", "out");
+  assert(last_status == 3);
+  check_output("cat runs", "ran");
+
+  // Different arguments or variables are different keys
+  check_output("memo sh -c 'echo ran >> runs; echo other'", "other");
+  const char *show_x = "memo --env X sh -c 'echo ran >> runs; echo $X'";
+  var_set("X", "1", VAR_EXPORTED);
+  check_output(show_x, "1");
+  var_set("X", "2", VAR_EXPORTED);
+  check_output(show_x, "2");
+  check_output(show_x, "2");
+  check_output("wc -l < runs", "4");
+
+  // Identical outputs share one stored object
+  check_output("memo echo out", "out");
+  assert(count_files("keys") == 5);
+  assert(count_files("objects") == 4);
+
+  printf("Memo hits and misses test passed!\n");
+}
+
+static void test_memo_deps() {
+  printf("Testing memo dependencies...\n");
+
+  write_file("input", "one\n");
+  check_output("memo --dep input sh -c 'cat input; echo ran >> runs'", "one");
+  check_output("memo cat < input", "one");
+  check_output("wc -l < runs", "5");
+
+  // Changing a dependency's size invalidates both forms
+  write_file("input", "two!\n");
+  check_output("memo --dep input sh -c 'cat input; echo ran >> runs'", "two!");
+  check_output("memo cat < input", "two!");
+  check_output("wc -l < runs", "6");
+
+  // Piped input is not in the key, so the command runs every time
+  check_output("echo a | memo tr a-z A-Z; echo b | memo tr a-z A-Z", "A\nB");
+  assert(count_files("keys") == 9);
+
+  // A terminal is not read by what is worth caching, so it keys as nothing
+  int master;
+  int tty;
+  assert(openpty(&master, &tty, NULL, NULL, NULL) == 0);
+  int saved = dup(STDIN_FILENO);
+  dup2(tty, STDIN_FILENO);
+  check_output("memo sh -c 'echo ran >> runs; echo tty'", "tty");
+  check_output("memo sh -c 'echo ran >> runs; echo tty'", "tty");
+  dup2(saved, STDIN_FILENO);
+  close(saved);
+  close(tty);
+  close(master);
+  check_output("wc -l < runs", "7");
+  assert(count_files("keys") == 10);
+
+  assert(run_source("memo --bogus true") == 2);
+
+  printf("Memo dependencies test passed!\n");
+}
+
+static void test_memo_eviction() {
+  printf("Testing memo eviction...\n");
+
+  // Only the most recently used results that fit are kept
+  check_output("memo --clear", "memo: dropped 10 results");
+  assert(count_files("keys") == 0 && count_files("objects") == 0);
+
+  var_set("MEMO_MAX_BYTES", "10", 0);
+  check_output("memo echo 12345", "12345");
+  check_output("memo echo 67890", "67890");
+  assert(count_files("keys") == 1);
+  // A result too big to keep at all does not push out the others
+  check_output("memo echo 12345678901", "12345678901");
+  assert(count_files("keys") == 1 && count_files("objects") == 1);
+  check_output("memo echo 67890", "67890");
+
+  var_set("MEMO_MAX_BYTES", "1000", 0);
+  check_output("memo echo a; memo echo b", "a\nb");
+  assert(count_files("keys") == 3);
+  var_set("MEMO_MAX_AGE", "0", 0);
+  struct timespec old[2] = {{.tv_sec = 1}, {.tv_sec = 1}};
+  char path[256];
+  snprintf(path, sizeof(path), "%s/store/keys", dir);
+  DIR *d = opendir(path);
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    if (ent->d_name[0] != '.')
+      utimensat(dirfd(d), ent->d_name, old, 0);
+  }
+  closedir(d);
+  check_output("memo --gc", "memo: dropped 3 results");
+  assert(count_files("objects") == 0);
+
+  printf("Memo eviction test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  assert(mkdtemp(dir));
+  assert(chdir(dir) == 0);
+  char store[256];
+  snprintf(store, sizeof(store), "%s/store", dir);
+  var_set("MEMO_DIR", store, 0);
+  // A terminal on stdin would run every command uncached
+  assert(freopen("/dev/null", "r", stdin));
+
+  test_memo_hits();
+  test_memo_deps();
+  test_memo_eviction();
+
+  char cleanup[300];
+  snprintf(cleanup, sizeof(cleanup), "rm -rf %s", dir);
+  assert(system(cleanup) == 0);
+  printf("All memo tests passed!\n");
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // External declarations of functions from shell.c
 extern History cmd_history;
@@ -21,21 +22,23 @@ static void assert_command_equals(Command *cmd, const char *name, int argc,
   assert(cmd != NULL);
   assert(strcmp(cmd->name, name) == 0);
   assert(cmd->argc == argc);
-  assert(cmd->is_in_redirect == is_in_redirect);
-  assert(cmd->is_out_redirect == is_out_redirect);
+  const Redirect *in = redirect_of(cmd, STDIN_FILENO);
+  const Redirect *out = redirect_of(cmd, STDOUT_FILENO);
+  assert((in != NULL) == is_in_redirect);
+  assert((out != NULL) == is_out_redirect);
 
   if (in_file) {
-    assert(cmd->in_file_name != NULL);
-    assert(strcmp(cmd->in_file_name, in_file) == 0);
+    assert(in != NULL);
+    assert(strcmp(in->target, in_file) == 0);
   } else {
-    assert(cmd->in_file_name == NULL);
+    assert(in == NULL);
   }
 
   if (out_file) {
-    assert(cmd->out_file_name != NULL);
-    assert(strcmp(cmd->out_file_name, out_file) == 0);
+    assert(out != NULL);
+    assert(strcmp(out->target, out_file) == 0);
   } else {
-    assert(cmd->out_file_name == NULL);
+    assert(out == NULL);
   }
 }
 
@@ -0,0 +1,297 @@
+#include "buffer.h"
+#include "paste.h"
+#include "shell.h"
+#include "stats.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_paste"
+
+extern char **environ;
+
+// A pipe whose writer sends `parts` one after another with a pause
+// between, so the reader sees them in separate reads
+static int feed(const char *const *parts, size_t count, pid_t *writer) {
+  int pipefd[2];
+  assert(pipe(pipefd) == 0);
+  fflush(stdout);
+  *writer = fork();
+  assert(*writer != -1);
+  if (*writer == 0) {
+    close(pipefd[0]);
+    for (size_t i = 0; i < count; i++) {
+      if (i > 0)
+        usleep(20000);
+      size_t len = strlen(parts[i]);
+      assert(write(pipefd[1], parts[i], len) == (ssize_t)len);
+    }
+    _exit(0);
+  }
+  close(pipefd[1]);
+  return pipefd[0];
+}
+
+static void finish(int fd, pid_t writer) {
+  close(fd);
+  int status;
+  waitpid(writer, &status, 0);
+  key_discard();
+}
+
+static char *read_file(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return NULL;
+  Buffer text;
+  buffer_init(&text);
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    buffer_append(&text, chunk, n);
+  }
+  fclose(file);
+  return text.data;
+}
+
+static double elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 +
+         (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void test_read() {
+  printf("Testing reading pastes...\n");
+
+  // The end marker split across reads, and terminal line ends
+  const char *parts[] = {"echo a\r\necho b\r", "\necho c\rpwd\033[2",
+                         "01~ls"};
+  pid_t writer;
+  int fd = feed(parts, 3, &writer);
+  Buffer text;
+  buffer_init(&text);
+  assert(paste_read(fd, &text));
+  assert(strcmp(text.data, "echo a\necho b\necho c\npwd") == 0);
+  // What follows the paste is still there to be read as keys
+  char c;
+  assert(key_read(fd, &c) == 1 && c == 'l');
+  assert(key_read(fd, &c) == 1 && c == 's');
+  assert(key_read(fd, &c) == 0);
+  finish(fd, writer);
+
+  // Input that ends inside the paste keeps what came
+  const char *cut[] = {"echo a\n\033[20"};
+  fd = feed(cut, 1, &writer);
+  buffer_clear(&text);
+  assert(!paste_read(fd, &text));
+  assert(strcmp(text.data, "echo a\n\033[20") == 0);
+  finish(fd, writer);
+  buffer_free(&text);
+
+  printf("Reading pastes test passed!\n");
+}
+
+static void test_keys() {
+  printf("Testing key input...\n");
+
+  // An arrow key is not a paste, and is left for the arrow handling
+  const char *arrow[] = {"\033[A", "\033[200~x"};
+  pid_t writer;
+  int fd = feed(arrow, 2, &writer);
+  char c;
+  assert(key_read(fd, &c) == 1 && c == '\033');
+  assert(!key_match(fd, PASTE_START + 1));
+  assert(key_read(fd, &c) == 1 && c == '[');
+  assert(key_read(fd, &c) == 1 && c == 'A');
+  // A marker arriving in pieces is still one
+  assert(key_read(fd, &c) == 1 && c == '\033');
+  assert(key_match(fd, PASTE_START + 1));
+  assert(key_read(fd, &c) == 1 && c == 'x');
+  finish(fd, writer);
+
+  printf("Key input test passed!\n");
+}
+
+static void test_insert() {
+  printf("Testing one-line pastes...\n");
+
+  char line[16] = "ls ";
+  size_t len = paste_insert("-l\t\001/tmp/some/long/path", line, sizeof(line),
+                            3);
+  assert(len == sizeof(line) - 1);
+  assert(strcmp(line, "ls -l /tmp/some") == 0);
+  printf("\n");
+
+  printf("One-line pastes test passed!\n");
+}
+
+static void test_confirm() {
+  printf("Testing confirmation...\n");
+
+  Buffer text;
+  buffer_init(&text);
+  for (int i = 0; i < 8; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "echo %d\n", i);
+    buffer_append_str(&text, line);
+  }
+  const char *yes[] = {"", "y"};
+  pid_t writer;
+  int fd = feed(yes, 2, &writer);
+  assert(paste_confirm(&text, fd));
+  finish(fd, writer);
+
+  // Keys typed before the question do not answer it
+  const char *typed_ahead[] = {"y", "n"};
+  fd = feed(typed_ahead, 2, &writer);
+  assert(!key_match(fd, "yes"));
+  assert(!paste_confirm(&text, fd));
+  finish(fd, writer);
+  printf("\n");
+  buffer_free(&text);
+
+  printf("Confirmation test passed!\n");
+}
+
+static void test_history() {
+  printf("Testing history from a paste...\n");
+
+  unlink("history.txt");
+  init_history();
+  history_add("make");
+  history_add_lines("make\ngit status\n\ngit status\nls\n");
+  assert(cmd_history.count == 3);
+  assert(strcmp(cmd_history.history[0], "ls") == 0);
+  assert(strcmp(cmd_history.history[1], "git status") == 0);
+  assert(strcmp(cmd_history.history[2], "make") == 0);
+  char *saved = read_file("history.txt");
+  assert(strcmp(saved, "0\tmake\n1\tgit status\n2\tls\n") == 0);
+  free(saved);
+
+  // Only the last HISTORY_LEN lines stay in memory
+  Buffer text;
+  buffer_init(&text);
+  for (int i = 0; i < 250; i++) {
+    char line[32];
+    snprintf(line, sizeof(line), "echo %d\n", i);
+    buffer_append_str(&text, line);
+  }
+  history_add_lines(text.data);
+  buffer_free(&text);
+  assert(cmd_history.count == HISTORY_LEN);
+  assert(strcmp(cmd_history.history[0], "echo 249") == 0);
+  assert(strcmp(cmd_history.history[HISTORY_LEN - 1], "echo 150") == 0);
+  assert(cmd_history.current_index == -1);
+
+  // Ids go on from the last line written
+  history_add("ls");
+  saved = read_file("history.txt");
+  assert(strstr(saved, "252\techo 249\n253\tls\n"));
+  free(saved);
+
+  printf("History from a paste test passed!\n");
+}
+
+static void test_run() {
+  printf("Testing running a paste...\n");
+
+  Buffer text;
+  buffer_init(&text);
+  buffer_append_str(&text, "a=1\nif test $a = 1; then\n  b=two\nfi\nc=$b");
+  paste_hold(&text);
+  assert(paste_batch() && text.data == NULL);
+
+  // The whole paste is parsed once
+  uint64_t parses = shell_stats()->parse.count;
+  Buffer pending;
+  buffer_init(&pending);
+  paste_run(&pending);
+  assert(!paste_batch());
+  assert(shell_stats()->parse.count == parses + 1);
+  assert(strcmp(var_get("c"), "two") == 0);
+  assert(pending.len == 0);
+
+  // One that leaves a construct open waits for the rest like typed lines
+  buffer_append_str(&text, "if true; then\n  d=1");
+  paste_hold(&text);
+  paste_run(&pending);
+  assert(pending.len > 0 && var_get("d") == NULL);
+  assert(run_source_line(&pending, "fi"));
+  assert(strcmp(var_get("d"), "1") == 0);
+  buffer_free(&pending);
+
+  printf("Running a paste test passed!\n");
+}
+
+static void test_large_paste() {
+  printf("Testing a 5000-line paste...\n");
+
+  Buffer lines;
+  buffer_init(&lines);
+  buffer_append_str(&lines, "\033[200~");
+  for (int i = 0; i < 5000; i++) {
+    char line[64];
+    snprintf(line, sizeof(line), "v%d=%d\r", i % 50, i);
+    buffer_append_str(&lines, line);
+  }
+  buffer_append_str(&lines, "\033[201~");
+  const char *parts[] = {lines.data};
+
+  unlink("history.txt");
+  init_history();
+  pid_t writer;
+  int fd = feed(parts, 1, &writer);
+  usleep(20000);
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  char c;
+  ssize_t got = key_read(fd, &c);
+  bool marked = key_match(fd, PASTE_START + 1);
+  Buffer text;
+  buffer_init(&text);
+  bool ended = paste_read(fd, &text);
+  paste_hold(&text);
+  Buffer pending;
+  buffer_init(&pending);
+  paste_run(&pending);
+  double ms = elapsed_ms(&start);
+  finish(fd, writer);
+
+  assert(got == 1 && c == '\033' && marked && ended);
+  assert(strcmp(var_get("v49"), "4999") == 0);
+  assert(cmd_history.count == HISTORY_LEN);
+  char *saved = read_file("history.txt");
+  assert(strstr(saved, "4999\tv49=4999\n"));
+  free(saved);
+  printf("5000 lines read, recorded and run in %.2f ms\n", ms);
+  assert(ms < 200);
+  buffer_free(&pending);
+  buffer_free(&lines);
+  free_history();
+
+  printf("5000-line paste test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR);
+  assert(chdir(TEST_DIR) == 0); // history.txt is kept here
+  test_read();
+  test_keys();
+  test_insert();
+  test_confirm();
+  test_history();
+  test_run();
+  test_large_paste();
+  system("rm -rf " TEST_DIR);
+  printf("All paste tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include "buffer.h"
+#include "shell.h"
+#include "subst.h"
+#include "vars.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_redirect"
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_parse() {
+  printf("Testing redirection parsing...\n");
+
+  char src[] = "cmd 2>&1 >>log <<<'a b' 3<in <<-'END'";
+  Redirect *redirects;
+  size_t count = take_redirects(src, &redirects);
+  // Redirections are blanked out of the command text
+  assert(strncmp(src, "cmd", 3) == 0);
+  assert(src[3 + strspn(src + 3, " ")] == '\0');
+  assert(count == 5);
+
+  assert(redirects[0].kind == REDIRECT_DUP);
+  assert(redirects[0].fd == 2);
+  assert(strcmp(redirects[0].target, "1") == 0);
+  assert(redirects[1].kind == REDIRECT_APPEND);
+  assert(redirects[1].fd == 1);
+  assert(strcmp(redirects[1].target, "log") == 0);
+  assert(redirects[2].kind == REDIRECT_STRING);
+  assert(strcmp(redirects[2].target, "'a b'") == 0);
+  assert(redirects[3].kind == REDIRECT_IN);
+  assert(redirects[3].fd == 3);
+  assert(redirects[4].kind == REDIRECT_HEREDOC);
+  assert(redirects[4].literal);
+  free_redirects(redirects, count);
+
+  char both[] = "ls &>all";
+  count = take_redirects(both, &redirects);
+  assert(count == 1);
+  assert(redirects[0].kind == REDIRECT_BOTH);
+  assert(strcmp(redirects[0].target, "all") == 0);
+  free_redirects(redirects, count);
+
+  printf("Redirection parsing test passed!\n");
+}
+
+static void test_files() {
+  printf("Testing file redirections...\n");
+
+  check_output("echo a > " TEST_DIR "/f; echo b >> " TEST_DIR "/f; "
+               "cat " TEST_DIR "/f",
+               "a\nb");
+  check_output("ls " TEST_DIR "/none 2> " TEST_DIR "/err; "
+               "wc -l < " TEST_DIR "/err",
+               "1");
+  check_output("ls " TEST_DIR "/none " TEST_DIR "/f 2>&1 | wc -l", "2");
+  check_output("ls " TEST_DIR "/none " TEST_DIR "/f &> " TEST_DIR "/all; "
+               "wc -l < " TEST_DIR "/all",
+               "2");
+  check_output("echo x 2>/dev/null 1>&2", "");
+
+  printf("File redirections test passed!\n");
+}
+
+static void test_text() {
+  printf("Testing here-strings and here-documents...\n");
+
+  check_output("X=there; cat <<< \"hi $X\"", "hi there");
+  check_output("X=there\ncat <<END\nhello $X\n  indented\nEND\n",
+               "hello there\n  indented");
+  check_output("X=there\ncat <<'END'\nkept $X\nEND\n", "kept $X");
+  check_output("cat <<-END\n\t\ttabs\n\tEND\n", "tabs");
+  check_output("cat <<A; cat <<B\none\nA\ntwo\nB\n", "one\ntwo");
+  check_output("f() {\ncat <<END\nin $1\nEND\n}\nf body\n", "in body");
+  check_output("echo $((1<<3)) \"<<no\"", "8 <<no");
+
+  printf("Here-strings and here-documents test passed!\n");
+}
+
+static void test_builtins() {
+  printf("Testing redirected builtins...\n");
+
+  // Alone, they run in the shell, so what they change sticks, and the
+  // shell's own descriptors come back afterwards
+  check_output("cd /usr 2>/dev/null; pwd", "/usr");
+  check_output("cd " TEST_DIR "/none 2>/dev/null || echo failed", "failed");
+  check_output("export Y=2 > /dev/null; f() { Z=3; echo in-f; }; "
+               "f > " TEST_DIR "/out; echo $Y $Z; cat " TEST_DIR "/out",
+               "2 3\nin-f");
+  check_output("echo one; echo two >&- ; echo three", "one\nthree");
+  check_output("echo kept 2>&1 2>/dev/null", "kept");
+  check_output("exit 3 2>/dev/null; echo still-running", "");
+  // A builtin in a pipeline still gets a process
+  check_output("cd / 2>/dev/null | cat; pwd", TEST_DIR);
+
+  printf("Redirected builtins test passed!\n");
+}
+
+static void test_early_failure() {
+  printf("Testing parent-side opens...\n");
+
+  // The missing input is found before the output file would be created
+  check_output("cat < " TEST_DIR "/missing > " TEST_DIR "/made; echo $?; "
+               "ls " TEST_DIR "/made 2>/dev/null | wc -l",
+               "1\n0");
+
+  char src[] = "cat < " TEST_DIR "/missing";
+  Command *cmd = parse_redirect(src);
+  assert(!open_redirects(cmd));
+  assert(cmd->redirects[0].opened == -1);
+  free_commands(&cmd);
+
+  char good[] = "cat < " TEST_DIR "/f";
+  cmd = parse_redirect(good);
+  assert(open_redirects(cmd));
+  int fd = cmd->redirects[0].opened;
+  assert(fd >= REDIRECT_MIN_FD);
+  assert(fcntl(fd, F_GETFD) & FD_CLOEXEC);
+  close_redirects(cmd);
+  assert(fcntl(fd, F_GETFD) == -1);
+  free_commands(&cmd);
+
+  printf("Parent-side opens test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR);
+  assert(chdir(TEST_DIR) == 0);
+  test_parse();
+  test_files();
+  test_text();
+  test_builtins();
+  test_early_failure();
+  system("rm -rf " TEST_DIR);
+  printf("All redirection tests passed!\n");
+  return 0;
+}
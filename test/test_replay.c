@@ -0,0 +1,213 @@
+#include "buffer.h"
+#include "paste.h"
+#include "replay.h"
+#include "stats.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_replay"
+// Generous, so a loaded machine passes: the shell itself answers a key in
+// microseconds
+#define MAX_P99_US 200000
+
+static void test_escape() {
+  printf("Testing session log escapes...\n");
+  char all[256];
+  for (int i = 0; i < 256; i++) {
+    all[i] = (char)i;
+  }
+  Buffer text;
+  buffer_init(&text);
+  replay_escape(&text, all, sizeof(all));
+  assert(!strchr(text.data, '\n') && !strchr(text.data, 27));
+  Buffer bytes;
+  buffer_init(&bytes);
+  assert(replay_unescape(text.data, &bytes));
+  assert(bytes.len == sizeof(all) && memcmp(bytes.data, all, 256) == 0);
+
+  buffer_clear(&text);
+  replay_escape(&text, "a\\b\r\033[A", 7);
+  assert(strcmp(text.data, "a\\\\b\\r\\e[A") == 0);
+  buffer_clear(&bytes);
+  assert(!replay_unescape("\\q", &bytes));
+  buffer_clear(&bytes);
+  assert(!replay_unescape("\\x4", &bytes));
+  buffer_free(&text);
+  buffer_free(&bytes);
+  printf("Session log escape test passed!\n");
+}
+
+static void test_load() {
+  printf("Testing session log loading...\n");
+  const char *text = "# by hand\n"
+                     "< 0 prompt \n"
+                     "\n"
+                     "> 100 l\n"
+                     "< 120 l\n"
+                     "> 200 \\e[A\n"
+                     "< 210 \\x08 \\x08\n"
+                     "< 215 xy\n";
+  FILE *log = fmemopen((void *)text, strlen(text), "r");
+  ReplaySession session = {0};
+  assert(replay_load(log, &session));
+  fclose(log);
+  assert(session.count == 2);
+  assert(session.keys[0].len == 1 && session.keys[0].bytes[0] == 'l');
+  assert(session.keys[0].at_us == 100 && session.keys[0].recorded_len == 1);
+  assert(session.keys[1].len == 3 &&
+         memcmp(session.keys[1].bytes, "\033[A", 3) == 0);
+  assert(session.keys[1].recorded_len == 5);
+  replay_free(&session);
+
+  const char *bad[] = {"> x\n", ">100 a\n", "> 100\n", "> 100 \n",
+                       "= 100 a\n", "> 100 \\z\n"};
+  for (size_t i = 0; i < sizeof(bad) / sizeof(*bad); i++) {
+    log = fmemopen((void *)bad[i], strlen(bad[i]), "r");
+    assert(!replay_load(log, &session));
+    fclose(log);
+    replay_free(&session);
+  }
+  printf("Session log loading test passed!\n");
+}
+
+static const char *answer(const ReplayReport *report, const ReplayKey *key) {
+  static char text[4096];
+  assert(key->out_len < sizeof(text));
+  memcpy(text, report->output.data + key->out_at, key->out_len);
+  text[key->out_len] = '\0';
+  return text;
+}
+
+// Types a line with a correction, runs it, brings it back from history and
+// runs it again, checking what the editor writes for each key and that it
+// answers every one
+static void test_editor() {
+  printf("Testing the line editor through a pseudo-terminal...\n");
+  unlink(TEST_DIR "/history.txt");
+  const char *keys[] = {"e", "c", "h", "o", " ", "h", "o", "\x7f", "i",
+                        "\r", "\033[A", "\r", "e", "x", "i", "t", "\r"};
+  size_t count = sizeof(keys) / sizeof(*keys);
+  ReplaySession session = {0};
+  for (size_t i = 0; i < count; i++) {
+    replay_add_key(&session, keys[i], strlen(keys[i]), i * 1000);
+  }
+
+  char *argv[] = {SHELL_BINARY, NULL};
+  ReplayOptions options = {.dir = TEST_DIR};
+  ReplayReport report = {0};
+  assert(replay_run(&session, argv, &options, &report));
+  assert(report.status == 0);
+  assert(report.keys == count && report.silent == 0);
+  assert(report.latency.count == count);
+
+  for (size_t i = 0; i < count; i++) {
+    const ReplayKey *key = &session.keys[i];
+    const char *text = answer(&report, key);
+    assert(key->latency_ns > 0);
+    if (keys[i][0] >= 32 && keys[i][0] <= 126) {
+      // A typed character is echoed as itself and nothing else
+      assert(strcmp(text, keys[i]) == 0);
+    } else if (keys[i][0] == 0x7f) {
+      assert(strcmp(text, "\b \b") == 0);
+    } else if (keys[i][0] == 27) {
+      // The line was empty, so history replaces nothing
+      assert(strcmp(text, "echo hi") == 0);
+    }
+  }
+  assert(strstr(answer(&report, &session.keys[9]), "hi\r\n"));
+  assert(strstr(answer(&report, &session.keys[11]), "hi\r\n"));
+  assert(strstr(answer(&report, &session.keys[11]), "|>"));
+
+  uint64_t p99 = stats_percentile(&report.latency, 0.99);
+  printf("  p50 %.1f us, p99 %.1f us, %.1f bytes per key\n",
+         stats_percentile(&report.latency, 0.5) / 1e3, p99 / 1e3,
+         (double)report.bytes / report.keys);
+  assert(p99 / 1000 < MAX_P99_US);
+
+  FILE *out = fopen("/dev/null", "w");
+  replay_print(&report, out);
+  fclose(out);
+  replay_report_free(&report);
+  replay_free(&session);
+  printf("Line editor test passed!\n");
+}
+
+// Records a session typed through a pipe, then reads the log back
+static void test_record() {
+  printf("Testing session recording...\n");
+  const char *keys[] = {"e", "x", "i", "t", "\r"};
+  int pipefd[2];
+  assert(pipe(pipefd) == 0);
+  fflush(stdout);
+  pid_t writer = fork();
+  assert(writer != -1);
+  if (writer == 0) {
+    close(pipefd[0]);
+    // Past the first prompt, then at typing speed
+    usleep(500000);
+    for (size_t i = 0; i < sizeof(keys) / sizeof(*keys); i++) {
+      assert(write(pipefd[1], keys[i], 1) == 1);
+      usleep(20000);
+    }
+    _exit(0);
+  }
+  close(pipefd[1]);
+
+  int null = open("/dev/null", O_WRONLY);
+  FILE *log = fopen(TEST_DIR "/session.log", "w");
+  char *argv[] = {SHELL_BINARY, NULL};
+  assert(replay_record(pipefd[0], null, log, argv) == 0);
+  fclose(log);
+  close(null);
+  close(pipefd[0]);
+  int status;
+  waitpid(writer, &status, 0);
+
+  log = fopen(TEST_DIR "/session.log", "r");
+  ReplaySession session = {0};
+  assert(replay_load(log, &session));
+  fclose(log);
+  assert(session.count == 5);
+  for (size_t i = 0; i < session.count; i++) {
+    assert(session.keys[i].len == 1);
+    assert(session.keys[i].bytes[0] == keys[i][0]);
+    if (i > 0)
+      assert(session.keys[i].at_us > session.keys[i - 1].at_us);
+    if (i < 4)
+      assert(session.keys[i].recorded_len == 1);
+  }
+
+  // The recording replays to the same answers
+  ReplayReport report = {0};
+  ReplayOptions options = {0};
+  assert(replay_run(&session, argv, &options, &report));
+  assert(report.status == 0 && report.keys == 5 && report.silent == 0);
+  for (size_t i = 0; i < 4; i++) {
+    assert(session.keys[i].out_len == session.keys[i].recorded_len);
+  }
+  replay_report_free(&report);
+  replay_free(&session);
+  printf("Session recording test passed!\n");
+}
+
+int main() {
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR);
+  // The shell keeps history.txt in its directory and its snapshot under
+  // HOME
+  assert(chdir(TEST_DIR) == 0);
+  setenv("HOME", TEST_DIR, 1);
+  unsetenv("XDG_CACHE_HOME");
+  unsetenv("SHELL_SNAPSHOT");
+  test_escape();
+  test_load();
+  test_editor();
+  test_record();
+  system("rm -rf " TEST_DIR);
+  printf("All replay tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include "buffer.h"
+#include "schedule.h"
+#include "subst.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_parsing() {
+  printf("Testing sched option parsing...\n");
+
+  cpu_set_t set;
+  assert(sched_parse_cpus("0-3,6", &set));
+  assert(CPU_COUNT(&set) == 5);
+  assert(CPU_ISSET(6, &set) && !CPU_ISSET(4, &set));
+  assert(sched_parse_cpus("2", &set) && CPU_COUNT(&set) == 1);
+  assert(!sched_parse_cpus("", &set));
+  assert(!sched_parse_cpus("3-1", &set));
+  assert(!sched_parse_cpus("1,x", &set));
+
+  rlim_t value;
+  assert(sched_parse_size("2G", &value) && value == 2ULL << 30);
+  assert(sched_parse_size("512k", &value) && value == 512 << 10);
+  assert(sched_parse_size("100", &value) && value == 100);
+  assert(sched_parse_size("unlimited", &value) && value == RLIM_INFINITY);
+  assert(!sched_parse_size("2GB", &value));
+  assert(!sched_parse_size("-1", &value));
+
+  printf("Sched option parsing test passed!\n");
+}
+
+static void test_topology() {
+  printf("Testing topology order...\n");
+
+  cpu_set_t allowed;
+  assert(sched_getaffinity(0, sizeof(allowed), &allowed) == 0);
+  static int order[CPU_SETSIZE];
+  size_t count = sched_topology_order(&allowed, order);
+  assert(count == (size_t)CPU_COUNT(&allowed));
+  for (size_t i = 0; i < count; i++) {
+    assert(CPU_ISSET(order[i], &allowed));
+  }
+
+  printf("Topology order test passed!\n");
+}
+
+static void test_sched_builtin() {
+  printf("Testing sched builtin...\n");
+
+  check_output("sched --rlimit-nofile 64 -- sh -c 'ulimit -n'", "64");
+  check_output("sched --nice 3 -- sh -c 'cut -d\" \" -f19 /proc/self/stat'",
+               "3");
+  // A pipeline a stage starts itself inherits the setting, once
+  check_output("f() { sh -c nice | cat; }; sched --nice 5 -- 'f | cat'", "5");
+  check_output("sched --policy batch -- "
+               "sh -c 'cut -d\" \" -f41 /proc/self/stat'",
+               "3");
+
+  cpu_set_t allowed;
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  int cpu = 0;
+  while (!CPU_ISSET(cpu, &allowed))
+    cpu++;
+  char src[128];
+  char expected[32];
+  snprintf(src, sizeof(src),
+           "sched --cpus %d -- grep Cpus_allowed_list: /proc/self/status",
+           cpu);
+  snprintf(expected, sizeof(expected), "Cpus_allowed_list:\t%d", cpu);
+  check_output(src, expected);
+
+  // Each stage of a co-located pipeline gets its own CPU, in topology order
+  static int order[CPU_SETSIZE];
+  size_t count = sched_topology_order(&allowed, order);
+  char colocated[96];
+  snprintf(colocated, sizeof(colocated),
+           "Cpus_allowed_list:\t%d\nCpus_allowed_list:\t%d", order[0],
+           order[1 % count]);
+  check_output("sched --colocate -- \""
+               "sh -c 'grep Cpus_allowed_list: /proc/self/status' | "
+               "sh -c 'cat; grep Cpus_allowed_list: /proc/self/status'\"",
+               colocated);
+
+  // Settings end with the command
+  check_output("sched --rlimit-nofile 64 -- true; sh -c 'ulimit -n' | "
+               "grep -vc '^64$'",
+               "1");
+  check_output("sched --bogus 1 -- true; echo $?", "2");
+  check_output("sched --rlimit-cpu 1K -- true; echo $?", "2");
+
+  printf("Sched builtin test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  test_parsing();
+  test_topology();
+  test_sched_builtin();
+  printf("All sched tests passed!\n");
+  return 0;
+}
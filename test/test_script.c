@@ -0,0 +1,135 @@
+#include "script.h"
+#include "shell.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static void test_reader() {
+  printf("Testing script line reader...\n");
+
+  ScriptReader reader;
+  script_open_string(&reader, "a\n\nb c\r\nlast");
+  assert(strcmp(script_next_line(&reader), "a") == 0);
+  assert(strcmp(script_next_line(&reader), "") == 0);
+  assert(strcmp(script_next_line(&reader), "b c") == 0);
+  assert(strcmp(script_next_line(&reader), "last") == 0);
+  assert(script_next_line(&reader) == NULL);
+  script_close(&reader);
+
+  // Lines longer than one read, streamed through a pipe
+  int pipefd[2];
+  assert(pipe(pipefd) == 0);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(pipefd[0]);
+    char *chunk = malloc(SCRIPT_READ_SIZE);
+    memset(chunk, 'x', SCRIPT_READ_SIZE);
+    for (int i = 0; i < 3; i++) {
+      write(pipefd[1], chunk, SCRIPT_READ_SIZE);
+      write(pipefd[1], "\n", 1);
+    }
+    write(pipefd[1], "tail", 4);
+    exit(0);
+  }
+  close(pipefd[1]);
+
+  script_open_fd(&reader, pipefd[0]);
+  for (int i = 0; i < 3; i++) {
+    char *line = script_next_line(&reader);
+    assert(strlen(line) == SCRIPT_READ_SIZE);
+    assert(line[0] == 'x' && line[SCRIPT_READ_SIZE - 1] == 'x');
+  }
+  assert(strcmp(script_next_line(&reader), "tail") == 0);
+  assert(script_next_line(&reader) == NULL);
+  script_close(&reader);
+  close(pipefd[0]);
+  waitpid(pid, NULL, 0);
+
+  printf("Script line reader test passed!\n");
+}
+
+static void test_run() {
+  printf("Testing script execution...\n");
+
+  // Mapped file: shebang and comments skipped, status of the last line
+  char path[] = "/tmp/test_script_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  const char *script = "#!/usr/bin/env shell\n"
+                       "  # comment\n"
+                       "GREETING=hello\n"
+                       "\n"
+                       "WHO=$(echo world)\n"
+                       "false\n";
+  write(fd, script, strlen(script));
+  lseek(fd, 0, SEEK_SET);
+  assert(script_run_fd(fd) == 1);
+  close(fd);
+  unlink(path);
+  assert(strcmp(var_get("GREETING"), "hello") == 0);
+  assert(strcmp(var_get("WHO"), "world") == 0);
+
+  // -c text
+  assert(script_run_string("X=1\ntrue_status=$X\ntrue") == 0);
+  assert(strcmp(var_get("true_status"), "1") == 0);
+
+  printf("Script execution test passed!\n");
+}
+
+// Diagnostics and buffered output sharing one pipe come out in order
+static void test_order() {
+  printf("Testing output and diagnostic order...\n");
+
+  int pipefd[2];
+  assert(pipe(pipefd) == 0);
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid != -1);
+  if (pid == 0) {
+    close(pipefd[0]);
+    dup2(pipefd[1], STDOUT_FILENO);
+    dup2(pipefd[1], STDERR_FILENO);
+    close(pipefd[1]);
+    setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+    script_order_stderr();
+    exit(script_run_string("echo one; cd /nonexistent; echo two; "
+                           "no_such_command_x; echo three"));
+  }
+  close(pipefd[1]);
+  char out[512] = {0};
+  size_t len = 0;
+  ssize_t n;
+  while ((n = read(pipefd[0], out + len, sizeof(out) - 1 - len)) > 0)
+    len += n;
+  close(pipefd[0]);
+  waitpid(pid, NULL, 0);
+
+  char *one = strstr(out, "one\n");
+  char *cd = strstr(out, "/nonexistent");
+  char *two = strstr(out, "two\n");
+  char *missing = strstr(out, "no_such_command_x: command not found");
+  char *three = strstr(out, "three\n");
+  assert(one && cd && two && missing && three);
+  assert(one < cd && cd < two && two < missing && missing < three);
+
+  printf("Output and diagnostic order test passed!\n");
+}
+
+int main() {
+  printf("Running script mode tests...\n");
+
+  vars_init(environ);
+  test_reader();
+  test_run();
+  test_order();
+
+  vars_free();
+  printf("All script mode tests passed!\n");
+  return 0;
+}
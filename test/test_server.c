@@ -0,0 +1,149 @@
+#include "server.h"
+#include "shell.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static char sock_path[64];
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs `command` in the server and returns its status, with its output in
+// `out`
+static int request(const char *cwd, char *const *env, const char *command,
+                   char *out, size_t size) {
+  int pipefd[2];
+  assert(pipe(pipefd) == 0);
+  const int stdio[3] = {STDIN_FILENO, pipefd[1], STDERR_FILENO};
+
+  int sock = server_connect(sock_path);
+  assert(sock != -1);
+  ServerReply reply;
+  assert(server_request(sock, cwd, env, command, stdio, &reply));
+  close(sock);
+  close(pipefd[1]);
+
+  size_t len = 0;
+  ssize_t n;
+  while (len + 1 < size && (n = read(pipefd[0], out + len, size - len - 1)) > 0)
+    len += n;
+  out[len] = '\0';
+  close(pipefd[0]);
+  assert(reply.user_usec >= 0 && reply.max_rss_kb > 0);
+  return reply.status;
+}
+
+static pid_t start_server() {
+  snprintf(sock_path, sizeof(sock_path), "/tmp/test_server_%d.sock",
+           (int)getpid());
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // State set up before serving is visible to every request
+    run_source("greet() { echo \"hello $1\"; }");
+    exit(server_run(sock_path));
+  }
+
+  for (int tries = 0; tries < 200; tries++) {
+    int sock = server_connect(sock_path);
+    if (sock != -1) {
+      close(sock);
+      return pid;
+    }
+    usleep(10000);
+  }
+  assert(0);
+  return -1;
+}
+
+static void test_requests() {
+  printf("Testing server requests...\n");
+
+  char out[256];
+  assert(request(NULL, NULL, "echo one; echo two", out, sizeof(out)) == 0);
+  assert(strcmp(out, "one\ntwo\n") == 0);
+  assert(request(NULL, NULL, "greet server", out, sizeof(out)) == 0);
+  assert(strcmp(out, "hello server\n") == 0);
+  assert(request(NULL, NULL, "exit 7", out, sizeof(out)) == 7);
+  assert(request(NULL, NULL, "if true; then", out, sizeof(out)) == 2);
+
+  // Each request gets its own directory and environment
+  char *env[] = {"GREETING=hi", "BAD NAME=x", NULL};
+  assert(request("/", env, "pwd; echo $GREETING; printenv GREETING", out,
+                 sizeof(out)) == 0);
+  assert(strcmp(out, "/\nhi\nhi\n") == 0);
+  assert(request(NULL, NULL, "cd /; X=1; echo -n $GREETING", out,
+                 sizeof(out)) == 0);
+  assert(strcmp(out, "") == 0);
+  assert(request(NULL, NULL, "echo -n $X", out, sizeof(out)) == 0);
+  assert(strcmp(out, "") == 0);
+  assert(request("/nonexistent", NULL, "true", out, sizeof(out)) == 1);
+
+  printf("Server requests test passed!\n");
+}
+
+static void test_concurrency() {
+  printf("Testing concurrent clients...\n");
+
+  double start = now_seconds();
+  pid_t clients[4];
+  fflush(stdout);
+  for (int i = 0; i < 4; i++) {
+    if ((clients[i] = fork()) == 0) {
+      char out[64];
+      exit(request(NULL, NULL, "sleep 0.3; echo done", out, sizeof(out)) == 0 &&
+                   strcmp(out, "done\n") == 0
+               ? 0
+               : 1);
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    int status;
+    waitpid(clients[i], &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  assert(now_seconds() - start < 1.0);
+
+  // A request the server cannot parse closes the connection
+  int sock = server_connect(sock_path);
+  assert(sock != -1);
+  char junk[32] = "not a request header";
+  assert(send(sock, junk, sizeof(junk), 0) == sizeof(junk));
+  assert(recv(sock, junk, sizeof(junk), 0) == 0);
+  close(sock);
+
+  printf("Concurrent clients test passed!\n");
+}
+
+int main() {
+  printf("Running server tests...\n");
+
+  vars_init(environ);
+  pid_t server = start_server();
+  test_requests();
+  test_concurrency();
+
+  kill(server, SIGTERM);
+  int status;
+  waitpid(server, &status, 0);
+  assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  assert(access(sock_path, F_OK) == -1);
+
+  vars_free();
+  printf("All server tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include "dirs.h"
+#include "shell.h"
+#include "snapshot.h"
+#include "suggest.h"
+#include "vars.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_snapshot"
+#define TEST_SNAPSHOT TEST_DIR "/cache/snapshot"
+#define TEST_JOURNAL TEST_DIR "/dirs"
+
+extern char **environ;
+
+static void make_file(const char *path, mode_t mode) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  assert(fd != -1);
+  close(fd);
+}
+
+static void append(const char *path, const char *text) {
+  FILE *file = fopen(path, "a");
+  assert(file);
+  fputs(text, file);
+  fclose(file);
+}
+
+// Everything the snapshot covers, as if the shell had just started
+static void forget_all() {
+  free_history();
+  cmd_history = (History){.count = 0, .current_index = -1};
+  suggest_free();
+  dirs_free();
+}
+
+static void set_up() {
+  make_file(TEST_DIR "/bin/git", 0755);
+  make_file(TEST_DIR "/bin/grep", 0755);
+  make_file(TEST_DIR "/sbin/mount", 0755);
+  var_set("PATH", TEST_DIR "/bin:" TEST_DIR "/sbin", VAR_EXPORTED);
+  var_set("SHELL_SNAPSHOT", TEST_SNAPSHOT, 0);
+  var_set("DIRS_INDEX", TEST_JOURNAL, 0);
+
+  char line[128];
+  unlink(TEST_JOURNAL);
+  for (int i = 0; i < 3; i++) {
+    snprintf(line, sizeof(line), "1|%lld|" TEST_DIR "/%s\n",
+             (long long)time(NULL), i == 2 ? "sbin" : "bin");
+    append(TEST_JOURNAL, line);
+  }
+  init_history();
+  history_add("make test");
+  history_add("git status");
+}
+
+static void test_round_trip() {
+  printf("Testing save and load...\n");
+
+  set_up();
+  assert(snapshot_save());
+  struct stat st;
+  assert(stat(TEST_SNAPSHOT, &st) == 0 && st.st_size > 0);
+
+  forget_all();
+  unsigned restored = snapshot_load();
+  assert(restored == (SNAPSHOT_HISTORY | SNAPSHOT_NAMES | SNAPSHOT_DIRS));
+  assert(cmd_history.count >= 2);
+  assert(strcmp(cmd_history.history[0], "git status") == 0);
+  assert(strcmp(cmd_history.history[1], "make test") == 0);
+  assert(cmd_history.current_index == -1);
+
+  // The restored indexes answer without reading PATH or the journal again
+  const NameIndex *names = suggest_index();
+  assert(names->count == 3);
+  char *found[SUGGEST_MAX_SHOWN];
+  assert(suggest_commands("gti", found, SUGGEST_MAX_SHOWN) == 1);
+  assert(strcmp(found[0], "git") == 0);
+  free(found[0]);
+
+  const DirIndex *dirs = dirs_index();
+  assert(dirs->count == 2 && dirs->lines == 3);
+  char *terms[] = {"sbin"};
+  assert(strcmp(dirs_best(terms, 1), TEST_DIR "/sbin") == 0);
+
+  printf("Save and load test passed!\n");
+}
+
+static void test_stale_parts() {
+  printf("Testing stale snapshots...\n");
+
+  forget_all();
+  set_up();
+  assert(snapshot_save());
+
+  // Visits since the save are read on from where the snapshot left off
+  char line[128];
+  snprintf(line, sizeof(line), "5|%lld|" TEST_DIR "/cache\n",
+           (long long)time(NULL));
+  append(TEST_JOURNAL, line);
+  forget_all();
+  assert(snapshot_load() & SNAPSHOT_DIRS);
+  assert(dirs_index()->count == 3 && dirs_index()->lines == 4);
+
+  // New history makes the saved copy stale; a different PATH the names
+  forget_all();
+  history_add("ls");
+  var_set("PATH", TEST_DIR "/bin", VAR_EXPORTED);
+  forget_all();
+  assert(snapshot_load() == SNAPSHOT_DIRS);
+  assert(cmd_history.count == 0);
+  var_set("PATH", TEST_DIR "/bin:" TEST_DIR "/sbin", VAR_EXPORTED);
+  forget_all();
+  assert(snapshot_load() == (SNAPSHOT_NAMES | SNAPSHOT_DIRS));
+
+  // A restored name index still notices a new executable
+  make_file(TEST_DIR "/bin/make", 0755);
+  assert(suggest_index()->count == 4);
+
+  // Another journal: the saved visits are not its visits
+  var_set("DIRS_INDEX", TEST_DIR "/other", 0);
+  forget_all();
+  assert(!(snapshot_load() & SNAPSHOT_DIRS));
+  var_set("DIRS_INDEX", TEST_JOURNAL, 0);
+
+  printf("Stale snapshots test passed!\n");
+}
+
+static void test_damaged() {
+  printf("Testing damaged snapshots...\n");
+
+  forget_all();
+  set_up();
+  assert(snapshot_save());
+  struct stat st;
+  assert(stat(TEST_SNAPSHOT, &st) == 0);
+
+  // Cut short
+  assert(truncate(TEST_SNAPSHOT, st.st_size - 1) == 0);
+  forget_all();
+  assert(snapshot_load() == 0);
+  assert(truncate(TEST_SNAPSHOT, 4) == 0);
+  assert(snapshot_load() == 0);
+
+  // Another version
+  assert(snapshot_save());
+  int fd = open(TEST_SNAPSHOT, O_WRONLY);
+  uint32_t version = SNAPSHOT_VERSION + 1;
+  assert(pwrite(fd, &version, sizeof(version),
+                offsetof(SnapshotHeader, version)) == sizeof(version));
+  close(fd);
+  forget_all();
+  assert(snapshot_load() == 0);
+
+  // A name pointing outside its section
+  assert(snapshot_save());
+  SnapshotHeader header;
+  fd = open(TEST_SNAPSHOT, O_RDWR);
+  assert(pread(fd, &header, sizeof(header), 0) == sizeof(header));
+  NameRef bad = {.offset = 1 << 30, .len = 3};
+  off_t at = header.names.offset + header.name_dirs * sizeof(struct timespec) +
+             sizeof(((NameIndex *)NULL)->by_length);
+  assert(pwrite(fd, &bad, sizeof(bad), at) == sizeof(bad));
+  close(fd);
+  forget_all();
+  assert(!(snapshot_load() & SNAPSHOT_NAMES));
+
+  unlink(TEST_SNAPSHOT);
+  assert(snapshot_load() == 0);
+
+  printf("Damaged snapshots test passed!\n");
+}
+
+static void test_children_do_not_save() {
+  printf("Testing saving at exit...\n");
+
+  forget_all();
+  set_up();
+  unlink(TEST_SNAPSHOT);
+  snapshot_save_at_exit();
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0)
+    exit(0); // a forked command exiting
+  int status;
+  waitpid(pid, &status, 0);
+  assert(access(TEST_SNAPSHOT, F_OK) == -1);
+
+  for (int i = 0; i < SNAPSHOT_EVERY; i++) {
+    snapshot_tick();
+  }
+  assert(access(TEST_SNAPSHOT, F_OK) == 0);
+
+  printf("Saving at exit test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR "/bin " TEST_DIR
+         "/sbin " TEST_DIR "/work");
+  assert(chdir(TEST_DIR "/work") == 0); // history.txt is kept here
+  test_round_trip();
+  test_stale_parts();
+  test_damaged();
+  test_children_do_not_save();
+  forget_all();
+  // The exit handler registered above would save once more
+  var_set("SHELL_SNAPSHOT", "/dev/null/snapshot", 0);
+  system("rm -rf " TEST_DIR);
+  printf("All snapshot tests passed!\n");
+  return 0;
+}
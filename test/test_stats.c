@@ -0,0 +1,221 @@
+#include "buffer.h"
+#include "shell.h"
+#include "stats.h"
+#include "subst.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_stats"
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static char *read_file(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return NULL;
+  Buffer text;
+  buffer_init(&text);
+  char chunk[256];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    buffer_append(&text, chunk, n);
+  }
+  fclose(file);
+  return text.data;
+}
+
+static void test_buckets() {
+  printf("Testing histogram buckets...\n");
+
+  for (uint64_t v = 0; v < (1u << STATS_SUB_BITS); v++) {
+    assert(stats_bucket(v) == v);
+    assert(stats_bucket_floor(v) == v);
+  }
+
+  // Every value lies in its bucket, which is at most an eighth as wide
+  size_t last = 0;
+  for (uint64_t v = 1; v < (1ULL << 40); v += v / 7 + 1) {
+    size_t bucket = stats_bucket(v);
+    assert(bucket >= last);
+    last = bucket;
+    uint64_t floor = stats_bucket_floor(bucket);
+    uint64_t next = stats_bucket_floor(bucket + 1);
+    assert(floor <= v && v < next);
+    assert(next - floor <= (floor >> STATS_SUB_BITS) + 1);
+  }
+  assert(stats_bucket(UINT64_MAX) == STATS_BUCKETS - 1);
+  assert(stats_bucket_floor(STATS_BUCKETS - 1) ==
+         UINT64_MAX - (UINT64_MAX >> (STATS_SUB_BITS + 1)));
+
+  printf("Histogram buckets test passed!\n");
+}
+
+static void test_percentiles() {
+  printf("Testing percentiles...\n");
+
+  static LatencyHistogram h;
+  assert(stats_percentile(&h, 0.5) == 0);
+
+  for (uint64_t us = 1000; us >= 1; us--) {
+    stats_record_ns(&h, us * 1000);
+  }
+  assert(h.count == 1000);
+  assert(h.min == 1000 && h.max == 1000000);
+  assert(h.sum == 500500ULL * 1000);
+
+  uint64_t p50 = stats_percentile(&h, 0.5);
+  uint64_t p99 = stats_percentile(&h, 0.99);
+  assert(p50 >= 500000 && p50 <= 500000 + 500000 / 8);
+  assert(p99 >= 990000 && p99 <= 1000000);
+  assert(stats_percentile(&h, 1.0) == h.max);
+  assert(stats_percentile(&h, 0.0) <= 1000 + 1000 / 8);
+
+  printf("Percentiles test passed!\n");
+}
+
+static void test_counting() {
+  printf("Testing counters...\n");
+
+  stats_reset();
+  const ShellStats *s = shell_stats();
+  assert(s->forks == 0 && s->execs == 0 && s->allocations == 0);
+
+  run_source("sleep 0 | sleep 0");
+  assert(s->forks == 2);
+  // The children exec'd, and counted it where the shell can see
+  assert(s->execs == 2 && s->failed_execs == 0);
+  assert(s->parse.count == 1);
+  assert(s->launch.count == 1 && s->wait.count == 1);
+  assert(s->allocations > 0 && s->allocated_bytes > 0);
+
+  // Only the command sees this PATH, so its exec fails in the child
+  run_source("PATH=/nowhere sleep 0 2>/dev/null");
+  assert(s->forks == 3 && s->execs == 3 && s->failed_execs == 1);
+
+  // Builtins run in the shell cost no process
+  run_source("cd .");
+  assert(s->forks == 3 && s->launch.count == 2);
+
+  // Every other fork in the shell is counted as well, as are the forks
+  // of its children
+  check_output("sleep 0; echo inner", "inner");
+  assert(s->forks == 5);
+
+  stats_reset();
+  assert(s->forks == 0 && s->wait.count == 0 && s->wait.max == 0);
+
+  printf("Counters test passed!\n");
+}
+
+static void test_history_io() {
+  printf("Testing history I/O counts...\n");
+
+  unlink("history.txt");
+  init_history();
+  stats_reset();
+  history_add("echo hi");
+  const ShellStats *s = shell_stats();
+  assert(s->history_written_bytes == strlen("0\techo hi\n"));
+
+  free_history();
+  uint64_t read_before = s->history_read_bytes;
+  init_history();
+  assert(s->history_read_bytes - read_before == strlen("0\techo hi\n"));
+  free_history();
+
+  printf("History I/O counts test passed!\n");
+}
+
+static void test_shellstats() {
+  printf("Testing shellstats...\n");
+
+  check_output("shellstats | grep -c '^forks'", "1");
+  check_output("shellstats | grep -c '^wait'", "1");
+  check_output("shellstats -j | grep -c '\"execs\": '", "1");
+  check_output("shellstats -x 2>/dev/null; echo $?", "2");
+  check_output("shellstats -d 2>/dev/null; echo $?", "2");
+  check_output("shellstats -d " TEST_DIR "/dump -i 0 2>/dev/null; echo $?",
+               "2");
+
+  // The report covers what happened so far, then -r starts over
+  run_source("true");
+  shell_stats()->execs = 41;
+  run_source("shellstats -j -r > " TEST_DIR "/report");
+  char *report = read_file(TEST_DIR "/report");
+  assert(report && strstr(report, "\"execs\": 41, "));
+  free(report);
+  assert(shell_stats()->execs == 0);
+
+  printf("Shellstats test passed!\n");
+}
+
+static void test_dump() {
+  printf("Testing periodic dumps...\n");
+
+  // The first dump is written at once; later ones after the interval
+  run_source("shellstats -d " TEST_DIR "/dump -i 1");
+  char *text = read_file(TEST_DIR "/dump");
+  assert(text && strncmp(text, "{\"pid\": ", 8) == 0);
+  assert(strstr(text, "\"launch_ns\": {\"count\": "));
+  free(text);
+
+  unlink(TEST_DIR "/dump");
+  run_source("true");
+  assert(access(TEST_DIR "/dump", F_OK) == -1);
+  usleep(1100000);
+  run_source("true");
+  assert(access(TEST_DIR "/dump", F_OK) == 0);
+
+  run_source("shellstats -d -");
+  unlink(TEST_DIR "/dump");
+  usleep(1100000);
+  run_source("true");
+  assert(access(TEST_DIR "/dump", F_OK) == -1);
+
+  // A relative file stays where it was named, whatever the shell's cwd
+  mkdir(TEST_DIR "/elsewhere", 0755);
+  run_source("shellstats -d dump -i 1; cd elsewhere");
+  unlink(TEST_DIR "/dump");
+  usleep(1100000);
+  run_source("true");
+  assert(access(TEST_DIR "/dump", F_OK) == 0);
+  assert(access(TEST_DIR "/elsewhere/dump", F_OK) == -1);
+  run_source("shellstats -d -; cd " TEST_DIR);
+  check_output("shellstats -d missing/dump 2>/dev/null; echo $?", "1");
+
+  printf("Periodic dumps test passed!\n");
+}
+
+int main() {
+  stats_init();
+  vars_init(environ);
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR);
+  assert(chdir(TEST_DIR) == 0); // history.txt is kept here
+  test_buckets();
+  test_percentiles();
+  test_counting();
+  test_history_io();
+  test_shellstats();
+  test_dump();
+  system("rm -rf " TEST_DIR);
+  printf("All stats tests passed!\n");
+  return 0;
+}
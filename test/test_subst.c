@@ -0,0 +1,165 @@
+#include "shell.h"
+#include "subst.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static Command *parse(const char *line) {
+  char *copy = strdup(line);
+  Command *cmd = parse_pipeline(copy);
+  free(copy);
+  return cmd;
+}
+
+static void test_capture() {
+  printf("Testing command substitution capture...\n");
+
+  Buffer out;
+  buffer_init(&out);
+  command_substitute("printf 'a\\nb\\n\\n\\n'", &out);
+  assert(strcmp(out.data, "a\nb") == 0);
+  assert(last_status == 0);
+  buffer_free(&out);
+
+  // In-process builtin, no child needed
+  command_substitute("echo inline", &out);
+  assert(strcmp(out.data, "inline") == 0);
+  buffer_free(&out);
+
+  command_substitute("false", &out);
+  assert(out.len == 0);
+  assert(last_status == 1);
+  buffer_free(&out);
+
+  // Output larger than a pipe buffer
+  command_substitute("head -c 200000 /dev/zero", &out);
+  assert(out.len == 200000);
+  buffer_free(&out);
+
+  printf("Command substitution capture test passed!\n");
+}
+
+static void test_expansion() {
+  printf("Testing substitution during parsing...\n");
+
+  Command *cmd = parse("echo $(echo a   b) \"$(echo a   b)\" `echo c` x$(echo d)y");
+  assert(cmd->argc == 6);
+  assert(strcmp(cmd->argv[1], "a") == 0);
+  assert(strcmp(cmd->argv[2], "b") == 0);
+  assert(strcmp(cmd->argv[3], "a b") == 0);
+  assert(strcmp(cmd->argv[4], "c") == 0);
+  assert(strcmp(cmd->argv[5], "xdy") == 0);
+  free_commands(&cmd);
+
+  cmd = parse("echo $(echo $(echo nested | tr a-z A-Z))");
+  assert(cmd->argc == 2);
+  assert(strcmp(cmd->argv[1], "NESTED") == 0);
+  free_commands(&cmd);
+
+  // Pipes and redirections inside a substitution belong to it
+  cmd = parse("echo $(echo x | tr x y) | cat");
+  assert(cmd->argc == 2);
+  assert(strcmp(cmd->argv[1], "y") == 0);
+  assert(cmd->next != NULL && strcmp(cmd->next->name, "cat") == 0);
+  free_commands(&cmd);
+
+  cmd = parse("echo '$(echo literal)'");
+  assert(strcmp(cmd->argv[1], "$(echo literal)") == 0);
+  free_commands(&cmd);
+
+  // An assignment alone returns its last substitution's status
+  cmd = parse("x=$(true)$(exit 4)");
+  assert(cmd->subst_status == 4);
+  run_commands(cmd);
+  assert(last_status == 4);
+  free_commands(&cmd);
+  cmd = parse("x=1");
+  assert(cmd->subst_status == -1);
+  run_commands(cmd);
+  assert(last_status == 0);
+  free_commands(&cmd);
+
+  printf("Substitution during parsing test passed!\n");
+}
+
+static void test_parallel() {
+  printf("Testing parallel substitutions...\n");
+
+  shell_options.parallel_subst = true;
+  double start = now_seconds();
+  Command *cmd = parse("echo $(sleep 0.3 | echo a) $(sleep 0.3 | echo b) "
+                       "$(sleep 0.3 | echo c)");
+  double elapsed = now_seconds() - start;
+  shell_options.parallel_subst = false;
+
+  assert(cmd->argc == 4);
+  assert(strcmp(cmd->argv[1], "a") == 0);
+  assert(strcmp(cmd->argv[2], "b") == 0);
+  assert(strcmp(cmd->argv[3], "c") == 0);
+  assert(elapsed < 0.8);
+  free_commands(&cmd);
+
+  printf("Parallel substitutions test passed!\n");
+}
+
+static void test_process() {
+  printf("Testing process substitution...\n");
+
+  Command *cmd = parse("cat <(echo a) < b.txt \"<(x)\"");
+  assert(cmd->argc == 3);
+  assert(strncmp(cmd->argv[1], "/dev/fd/", 8) == 0);
+  assert(strcmp(cmd->argv[2], "<(x)") == 0);
+  assert(strcmp(redirect_of(cmd, 0)->target, "b.txt") == 0);
+  assert(cmd->procsub_count == 1);
+  free_commands(&cmd);
+
+  // <(...) feeds the command, and releasing the command reaps the writer
+  char path[] = "/tmp/test_procsub_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd != -1);
+  close(fd);
+  char line[128];
+  snprintf(line, sizeof(line), "diff <(echo same) <(echo same) > %s", path);
+  last_status = 1;
+  assert(run_line(line) == 0);
+
+  // >(...) sees EOF once the shell drops its end
+  snprintf(line, sizeof(line), "echo hello | tee >(tr a-z A-Z > %s) > /dev/null",
+           path);
+  run_line(line);
+  Buffer out;
+  buffer_init(&out);
+  snprintf(line, sizeof(line), "cat %s", path);
+  command_substitute(line, &out);
+  assert(strcmp(out.data, "HELLO") == 0);
+  buffer_free(&out);
+  unlink(path);
+
+  printf("Process substitution test passed!\n");
+}
+
+int main() {
+  printf("Running substitution tests...\n");
+
+  vars_init(environ);
+  test_capture();
+  test_expansion();
+  test_parallel();
+  test_process();
+
+  vars_free();
+  printf("All substitution tests passed!\n");
+  return 0;
+}
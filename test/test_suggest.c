@@ -0,0 +1,230 @@
+#include "alias.h"
+#include "buffer.h"
+#include "subst.h"
+#include "suggest.h"
+#include "vars.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TEST_DIR "/tmp/test_suggest"
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void make_file(const char *path, mode_t mode) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode);
+  assert(fd != -1);
+  const char *script = "#!/bin/sh\necho ran\n";
+  assert(write(fd, script, strlen(script)) == (ssize_t)strlen(script));
+  close(fd);
+}
+
+// Textbook DP for the same distance, adjacent swaps costing one
+static size_t slow_distance(const char *a, const char *b) {
+  size_t m = strlen(a);
+  size_t n = strlen(b);
+  size_t d[16][16];
+  for (size_t i = 0; i <= m; i++) {
+    for (size_t j = 0; j <= n; j++) {
+      if (i == 0 || j == 0) {
+        d[i][j] = i + j;
+        continue;
+      }
+      size_t best = d[i - 1][j - 1] + (a[i - 1] != b[j - 1]);
+      if (d[i - 1][j] + 1 < best)
+        best = d[i - 1][j] + 1;
+      if (d[i][j - 1] + 1 < best)
+        best = d[i][j - 1] + 1;
+      if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] &&
+          d[i - 2][j - 2] + 1 < best)
+        best = d[i - 2][j - 2] + 1;
+      d[i][j] = best;
+    }
+  }
+  return d[m][n];
+}
+
+static void test_distance() {
+  printf("Testing edit distance...\n");
+
+  assert(suggest_distance("git", "git") == 0);
+  assert(suggest_distance("gti", "git") == 1);
+  assert(suggest_distance("grpe", "grep") == 1);
+  assert(suggest_distance("kitten", "sitting") == 3);
+  assert(suggest_distance("ls", "") == 2);
+  assert(suggest_distance("a", "abc") == 2);
+  assert(suggest_distance("", "abc") == SIZE_MAX);
+
+  // Random short strings over a small alphabet hit every case
+  srand(1);
+  for (int round = 0; round < 20000; round++) {
+    char a[16];
+    char b[16];
+    size_t m = 1 + rand() % 12;
+    size_t n = rand() % 13;
+    for (size_t i = 0; i < m; i++) {
+      a[i] = "abc"[rand() % 3];
+    }
+    for (size_t i = 0; i < n; i++) {
+      b[i] = "abc"[rand() % 3];
+    }
+    a[m] = '\0';
+    b[n] = '\0';
+    if (suggest_distance(a, b) != slow_distance(a, b)) {
+      fprintf(stderr, "%s %s: %zu, expected %zu\n", a, b,
+              suggest_distance(a, b), slow_distance(a, b));
+      assert(0);
+    }
+  }
+
+  // A full machine word of pattern
+  char long_name[SUGGEST_MAX_NAME + 1];
+  memset(long_name, 'x', SUGGEST_MAX_NAME);
+  long_name[SUGGEST_MAX_NAME] = '\0';
+  char other[SUGGEST_MAX_NAME + 1];
+  memcpy(other, long_name, sizeof(other));
+  other[SUGGEST_MAX_NAME - 1] = 'y';
+  assert(suggest_distance(long_name, other) == 1);
+  assert(suggest_distance(long_name, long_name) == 0);
+
+  printf("Edit distance test passed!\n");
+}
+
+static void test_suggestions() {
+  printf("Testing suggestions...\n");
+
+  make_file(TEST_DIR "/bin/git", 0755);
+  make_file(TEST_DIR "/bin/grep", 0755);
+  make_file(TEST_DIR "/bin/gist", 0755);
+  make_file(TEST_DIR "/bin/gut", 0644); // not executable
+  make_file(TEST_DIR "/other/git", 0755);
+  var_set("PATH", TEST_DIR "/bin:" TEST_DIR "/other", VAR_EXPORTED);
+
+  char *found[SUGGEST_MAX_SHOWN];
+  size_t count = suggest_commands("gti", found, SUGGEST_MAX_SHOWN);
+  assert(count == 1 && strcmp(found[0], "git") == 0);
+  free(found[0]);
+
+  count = suggest_commands("gux", found, SUGGEST_MAX_SHOWN);
+  assert(count == 0); // gut is close but cannot be run
+
+  count = suggest_commands("gitt", found, SUGGEST_MAX_SHOWN);
+  assert(count == 2);
+  assert(strcmp(found[0], "gist") == 0 && strcmp(found[1], "git") == 0);
+  free(found[0]);
+  free(found[1]);
+
+  // Builtins and aliases are candidates too
+  alias_set("deploy", "echo deploying");
+  count = suggest_commands("deplyo", found, SUGGEST_MAX_SHOWN);
+  assert(count == 1 && strcmp(found[0], "deploy") == 0);
+  free(found[0]);
+  count = suggest_commands("ehco", found, SUGGEST_MAX_SHOWN);
+  assert(count == 1 && strcmp(found[0], "echo") == 0);
+  free(found[0]);
+  aliases_free();
+
+  // Names are read once; a new executable is noticed by directory mtime
+  const NameIndex *index = suggest_index();
+  assert(index->count == 4);
+  assert(suggest_index() == index && index->count == 4);
+  make_file(TEST_DIR "/bin/make", 0755);
+  count = suggest_commands("mkae", found, SUGGEST_MAX_SHOWN);
+  assert(count == 1 && strcmp(found[0], "make") == 0);
+  free(found[0]);
+  assert(suggest_index()->count == 5);
+
+  printf("Suggestions test passed!\n");
+}
+
+static void test_not_found() {
+  printf("Testing unknown commands...\n");
+
+  // Caught in the shell: no process, status 127, later stages still run
+  check_output("gti status; echo $?", "127");
+  check_output("gti status | git", "ran");
+  check_output("git | gti; echo $?", "127");
+  check_output("gti > " TEST_DIR "/out; echo $?; test -f " TEST_DIR
+               "/out && echo created",
+               "127\ncreated");
+  // A PATH given to the command alone is still searched by the child
+  check_output("PATH=" TEST_DIR "/missing git; echo $?", "1");
+  check_output("PATH=/nowhere " TEST_DIR "/bin/git", "ran");
+
+  printf("Unknown commands test passed!\n");
+}
+
+static void test_many_executables() {
+  printf("Testing suggestions over many executables...\n");
+
+  enum { NAMES = 30000 };
+  system("mkdir -p " TEST_DIR "/many");
+  char path[128];
+  for (int i = 0; i < NAMES; i++) {
+    snprintf(path, sizeof(path), TEST_DIR "/many/tool-%05d-%c", i,
+             'a' + i % 26);
+    int fd = open(path, O_WRONLY | O_CREAT, 0755);
+    assert(fd != -1);
+    close(fd);
+  }
+  var_set("PATH", TEST_DIR "/many:" TEST_DIR "/bin", VAR_EXPORTED);
+  size_t names = suggest_index()->count; // read once, not timed
+  assert(names == NAMES + 5);
+
+  char *found[SUGGEST_MAX_SHOWN];
+  struct timespec start;
+  struct timespec end;
+  const int rounds = 20;
+  size_t count = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < rounds; i++) {
+    count = suggest_commands("tool-01234-x", found, SUGGEST_MAX_SHOWN);
+    for (size_t j = 0; j < count; j++) {
+      free(found[j]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double ms = ((end.tv_sec - start.tv_sec) * 1e3 +
+               (end.tv_nsec - start.tv_nsec) / 1e6) /
+              rounds;
+  printf("  %zu names: %.3f ms per lookup\n", names, ms);
+  assert(count == SUGGEST_MAX_SHOWN);
+  assert(ms < 50); // generous, for loaded and unoptimized builds
+
+  count = suggest_commands("tool-01234-x", found, SUGGEST_MAX_SHOWN);
+  assert(strcmp(found[0], "tool-01234-m") == 0);
+  for (size_t j = 0; j < count; j++) {
+    free(found[j]);
+  }
+
+  printf("Many executables test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  system("rm -rf " TEST_DIR " && mkdir -p " TEST_DIR "/bin " TEST_DIR
+         "/other");
+  test_distance();
+  test_suggestions();
+  test_not_found();
+  test_many_executables();
+  suggest_free();
+  system("rm -rf " TEST_DIR);
+  printf("All suggestion tests passed!\n");
+  return 0;
+}
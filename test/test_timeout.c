@@ -0,0 +1,98 @@
+#include "buffer.h"
+#include "subst.h"
+#include "timeout.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static double seconds_since(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void test_durations() {
+  printf("Testing duration parsing...\n");
+
+  long ms;
+  assert(timeout_parse_duration("2", &ms) && ms == 2000);
+  assert(timeout_parse_duration("1.5", &ms) && ms == 1500);
+  assert(timeout_parse_duration("250ms", &ms) && ms == 250);
+  assert(timeout_parse_duration("3s", &ms) && ms == 3000);
+  assert(timeout_parse_duration("2m", &ms) && ms == 120000);
+  assert(timeout_parse_duration("1h", &ms) && ms == 3600000);
+  assert(!timeout_parse_duration("-1", &ms));
+  assert(!timeout_parse_duration("5x", &ms));
+  assert(!timeout_parse_duration("", &ms));
+
+  printf("Duration parsing test passed!\n");
+}
+
+static void test_deadlines() {
+  printf("Testing timeout...\n");
+
+  check_output("timeout 5 echo fast; echo $?", "fast\n0");
+  check_output("timeout 5 sh -c 'exit 3'; echo $?", "3");
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  check_output("timeout 200ms sleep 5; echo $?", "124");
+  double elapsed = seconds_since(&start);
+  assert(elapsed >= 0.2 && elapsed < 1.0);
+
+  // The whole pipeline, and what its stages started, goes at once
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  check_output("timeout 200ms 'sleep 5 | sh -c \"sleep 5; echo late\"'; "
+               "echo $?",
+               "124");
+  assert(seconds_since(&start) < 1.0);
+
+  // The overrunning stages are named
+  check_output("timeout 100ms 'true | sleep 5' 2>&1 | cut -d' ' -f1-4",
+               "timeout: stage 2 (sleep)");
+
+  // A stage ignoring SIGTERM is killed after the grace period
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  check_output("timeout -k 200ms 100ms sh -c 'trap \"\" TERM; sleep 5'; "
+               "echo $?",
+               "137");
+  elapsed = seconds_since(&start);
+  assert(elapsed >= 0.3 && elapsed < 1.5);
+
+  check_output("timeout -s INT 100ms sleep 5; echo $?", "124");
+
+  // Loops run in a subshell of their own, which is stopped as a whole
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  check_output("timeout 200ms 'while true; do sleep 1; done'; echo $?", "124");
+  assert(seconds_since(&start) < 1.0);
+
+  check_output("timeout 1 'f() { echo in f; }; f'", "in f");
+  check_output("timeout; echo $?", "2");
+  check_output("timeout 5x true; echo $?", "2");
+
+  printf("Timeout test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  test_durations();
+  test_deadlines();
+  printf("All timeout tests passed!\n");
+  return 0;
+}
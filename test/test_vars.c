@@ -0,0 +1,147 @@
+#include "expand.h"
+#include "shell.h"
+#include "vars.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern VarTable shell_vars;
+
+static bool envp_contains(char **envp, const char *entry) {
+  for (char **env = envp; *env; env++) {
+    if (strcmp(*env, entry) == 0)
+      return true;
+  }
+  return false;
+}
+
+static void test_var_store() {
+  printf("Testing variable store...\n");
+
+  char *initial[] = {"HOME=/home/test", "PATH=/bin:/usr/bin", NULL};
+  vars_init(initial);
+
+  assert(strcmp(var_get("HOME"), "/home/test") == 0);
+  assert(var_get("MISSING") == NULL);
+
+  var_set("LOCAL", "value", 0);
+  assert(strcmp(var_get("LOCAL"), "value") == 0);
+
+  // Force several rehashes and make sure nothing is lost
+  char name[32];
+  for (int i = 0; i < 500; i++) {
+    snprintf(name, sizeof(name), "VAR_%d", i);
+    var_set(name, name, 0);
+  }
+  for (int i = 0; i < 500; i += 2) {
+    snprintf(name, sizeof(name), "VAR_%d", i);
+    assert(var_unset(name));
+  }
+  for (int i = 0; i < 500; i++) {
+    snprintf(name, sizeof(name), "VAR_%d", i);
+    if (i % 2 == 0)
+      assert(var_get(name) == NULL);
+    else
+      assert(strcmp(var_get(name), name) == 0);
+  }
+
+  // Churn through many names that never live at once: tombstones are
+  // swept out at the same size instead of growing the table
+  size_t cap = shell_vars.cap;
+  for (int i = 0; i < 20000; i++) {
+    snprintf(name, sizeof(name), "TMP_%d", i);
+    var_set(name, "x", 0);
+    assert(var_unset(name));
+  }
+  assert(shell_vars.cap == cap);
+  assert(strcmp(var_get("VAR_1"), "VAR_1") == 0);
+
+  assert(var_assign("GREETING=hello world"));
+  assert(strcmp(var_get("GREETING"), "hello world") == 0);
+  assert(!var_assign("1BAD=value"));
+  assert(var_is_assignment("A_1=x"));
+  assert(!var_is_assignment("-flag=x"));
+
+  printf("Variable store test passed!\n");
+}
+
+static void test_envp_cache() {
+  printf("Testing envp materialization...\n");
+
+  char *initial[] = {"HOME=/home/test", NULL};
+  vars_init(initial);
+
+  char **envp = vars_envp();
+  assert(envp_contains(envp, "HOME=/home/test"));
+
+  // Local variables do not dirty the cached environment
+  var_set("LOCAL", "1", 0);
+  assert(!shell_vars.envp_dirty);
+  assert(vars_envp() == envp);
+  assert(!envp_contains(vars_envp(), "LOCAL=1"));
+
+  var_export("LOCAL");
+  assert(shell_vars.envp_dirty);
+  assert(envp_contains(vars_envp(), "LOCAL=1"));
+  assert(!shell_vars.envp_dirty);
+
+  var_unset("HOME");
+  assert(!envp_contains(vars_envp(), "HOME=/home/test"));
+
+  unsigned long epoch = vars_path_epoch();
+  var_set("PATH", "/opt/bin", VAR_EXPORTED);
+  assert(vars_path_epoch() != epoch);
+  assert(strcmp(path_dirs()[0], "/opt/bin") == 0);
+  assert(path_dirs()[1] == NULL);
+
+  printf("envp materialization test passed!\n");
+}
+
+static void test_expansion() {
+  printf("Testing variable expansion...\n");
+
+  char *initial[] = {"HOME=/home/test", NULL};
+  vars_init(initial);
+  var_set("LIST", "a b  c", 0);
+  var_set("EMPTY", "", 0);
+
+  char line[] = "echo $HOME ${HOME}/x \"$LIST\" $LIST '$HOME' $EMPTY \"\"";
+  Command *cmd = parse_command(line);
+  assert(cmd->argc == 9);
+  assert(strcmp(cmd->argv[1], "/home/test") == 0);
+  assert(strcmp(cmd->argv[2], "/home/test/x") == 0);
+  assert(strcmp(cmd->argv[3], "a b  c") == 0);
+  assert(strcmp(cmd->argv[4], "a") == 0);
+  assert(strcmp(cmd->argv[5], "b") == 0);
+  assert(strcmp(cmd->argv[6], "c") == 0);
+  assert(strcmp(cmd->argv[7], "$HOME") == 0);
+  assert(strcmp(cmd->argv[8], "") == 0);
+  free_commands(&cmd);
+
+  char assign[] = "FOO=$HOME/bin env";
+  cmd = parse_command(assign);
+  assert(cmd->assign_count == 1);
+  assert(strcmp(cmd->assigns[0], "FOO=/home/test/bin") == 0);
+  assert(strcmp(cmd->name, "env") == 0);
+  free_commands(&cmd);
+
+  char redirect[] = "cat < $HOME/in.txt";
+  cmd = parse_redirect(redirect);
+  assert(strcmp(redirect_of(cmd, 0)->target, "/home/test/in.txt") == 0);
+  free_commands(&cmd);
+
+  printf("Variable expansion test passed!\n");
+}
+
+int main() {
+  printf("Running variable tests...\n");
+
+  test_var_store();
+  test_envp_cache();
+  test_expansion();
+
+  vars_free();
+  printf("All variable tests passed!\n");
+  return 0;
+}
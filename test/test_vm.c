@@ -0,0 +1,151 @@
+#include "buffer.h"
+#include "subst.h"
+#include "vars.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+
+static void check_output(const char *src, const char *expected) {
+  Buffer out;
+  buffer_init(&out);
+  command_substitute(src, &out);
+  if (strcmp(out.data ? out.data : "", expected) != 0) {
+    fprintf(stderr, "%s\n  got: %s\n  expected: %s\n", src, out.data, expected);
+    assert(0);
+  }
+  buffer_free(&out);
+}
+
+static void test_compile() {
+  printf("Testing compilation...\n");
+
+  Program *prog;
+  assert(compile_program("echo a; echo b", &prog) == COMPILE_OK);
+  assert(prog->len == 2 && prog->code[0].op == OP_RUN);
+  assert(prog->commands[0].count == 2);
+  program_release(prog);
+
+  assert(compile_program("ls | wc -l", &prog) == COMPILE_OK);
+  assert(program_is_simple(prog) && prog->code[0].op == OP_PIPELINE);
+  program_release(prog);
+
+  // Open constructs ask for more input
+  assert(compile_program("if true; then", &prog) == COMPILE_INCOMPLETE);
+  assert(compile_program("for i in 1 2\ndo echo", &prog) == COMPILE_INCOMPLETE);
+  assert(compile_program("echo \"abc", &prog) == COMPILE_INCOMPLETE);
+  assert(compile_program("true &&", &prog) == COMPILE_INCOMPLETE);
+  assert(compile_program("f() {", &prog) == COMPILE_INCOMPLETE);
+
+  assert(compile_program("fi", &prog) == COMPILE_ERROR);
+  assert(compile_program("if true; fi", &prog) == COMPILE_ERROR);
+
+  printf("Compilation test passed!\n");
+}
+
+static void test_control_flow() {
+  printf("Testing control flow...\n");
+
+  check_output("if true; then echo yes; else echo no; fi", "yes");
+  check_output("if false; then echo 1; elif [ a = a ]; then echo 2; fi", "2");
+  check_output("for i in a b c; do echo -n $i; done", "abc");
+  check_output("i=0; while [ $i -lt 5 ]; do i=$((i+1)); done; echo $i", "5");
+  check_output("i=0; until [ $i -ge 3 ]; do echo -n $i; i=$((i+1)); done",
+               "012");
+  check_output("true && echo a || echo b; false && echo c || echo d", "a\nd");
+  check_output("! false && echo negated", "negated");
+  check_output("for i in 1 2 3 4; do\n"
+               "  if [ $i = 2 ]; then continue; fi\n"
+               "  if [ $i = 4 ]; then break; fi\n"
+               "  echo -n $i\n"
+               "done",
+               "13");
+  check_output("for i in 1 2; do for j in a b; do\n"
+               "  if [ $j = b ]; then continue 2; fi; echo -n $i$j\n"
+               "done; done",
+               "1a2a");
+  check_output("for w in x y; do echo $w | tr a-z A-Z; done", "X\nY");
+  check_output("x=$(false) || echo failed; if y=$(exit 4); then echo yes; "
+               "else echo no $?; fi; false; z=1; echo $?",
+               "failed\nno 4\n0");
+
+  printf("Control flow test passed!\n");
+}
+
+static void test_functions() {
+  printf("Testing functions...\n");
+
+  assert(run_source("greet() { echo \"hi $1 ($#)\"; }\n"
+                    "function twice { \"$@\"; \"$@\"; }") == 0);
+  check_output("greet bob", "hi bob (1)");
+  check_output("twice echo x", "x\nx");
+  check_output("f() { return 3; echo unreachable; }; f; echo $?", "3");
+  check_output("fact() {\n"
+               "  if [ $1 -le 1 ]; then echo 1; return; fi\n"
+               "  echo $(( $1 * $(fact $(( $1 - 1 ))) ))\n"
+               "}\n"
+               "fact 10",
+               "3628800");
+  check_output("count() { for a; do echo -n .; done; }; count 1 2 3", "...");
+  // "$@" where one word is wanted joins its fields, and is empty with none
+  check_output("j() { x=\"$@\"; echo \"[$x]\"; cat <<< \"$@\"; }; j; j a b",
+               "[]\n\n[a b]\na b");
+  check_output("r() { echo a > \"$@\"; }; r 2>/dev/null; echo $?", "1");
+  functions_free();
+
+  printf("Functions test passed!\n");
+}
+
+static void test_arithmetic() {
+  printf("Testing arithmetic...\n");
+
+  check_output("echo $((1 + 2 * 3)) $(( (1+2)*3 )) $((7 / 2)) $((7 % 3))",
+               "7 9 3 1");
+  check_output("x=5; echo $((x << 2)) $((x > 3 && x < 10)) $((-x)) $((x ? 1 : 2))",
+               "20 1 -5 1");
+  check_output("n=1; echo $((n += 4)) $n $((n++)) $n", "5 5 5 6");
+  check_output("echo $((0x10 + 010))", "24");
+  check_output("echo \"$((2 ** 10))\"", "1024");
+  check_output("echo $((3 ** 13)) $((2 ** 64)) $((2 ** 99999999999))",
+               "1594323 0 0");
+  check_output("echo $((2 ** -1)) 2>/dev/null", "");
+  // The one quotient that overflows wraps instead of trapping
+  check_output("m=$((-9223372036854775807 - 1)); echo $((m / -1)) "
+               "$((m % -1)) $((m /= -1)) $((m %= -1))",
+               "-9223372036854775808 0 -9223372036854775808 0");
+  check_output("x=5; echo $((x /= 0)) 2>/dev/null; echo $x", "\n5");
+
+  printf("Arithmetic test passed!\n");
+}
+
+static void test_test_builtin() {
+  printf("Testing test builtin...\n");
+
+  assert(run_source("[ 3 -gt 2 ]") == 0);
+  assert(run_source("[ 3 -gt 5 ]") == 1);
+  assert(run_source("test -z '' -a -n x") == 0);
+  assert(run_source("[ ! -d /nonexistent ]") == 0);
+  assert(run_source("[ -d / ] && [ x != y ]") == 0);
+  assert(run_source("[ abc -eq 1 ]") == 2);
+  assert(run_source("[ 1 = 1") == 2);
+
+  printf("Test builtin test passed!\n");
+}
+
+int main() {
+  printf("Running bytecode VM tests...\n");
+
+  vars_init(environ);
+  test_compile();
+  test_control_flow();
+  test_functions();
+  test_arithmetic();
+  test_test_builtin();
+
+  vars_free();
+  printf("All bytecode VM tests passed!\n");
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include "vars.h"
+#include "vm.h"
+#include "watch.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static char dir[] = "/tmp/test_watch.XXXXXX";
+
+static void pause_ms(long ms) {
+  struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+// Appends `text` to `name` after each delay, from a separate process
+static pid_t write_later(const char *name, const long *delays,
+                         const char *const *texts, size_t count) {
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid != -1);
+  if (pid == 0) {
+    for (size_t i = 0; i < count; i++) {
+      pause_ms(delays[i]);
+      FILE *f = fopen(name, "a");
+      fputs(texts[i], f);
+      fclose(f);
+    }
+    _exit(0);
+  }
+  return pid;
+}
+
+static void test_rerun() {
+  printf("Testing watch reruns...\n");
+
+  // Two quick writes are one change: one initial run and one rerun
+  assert(run_source(": > log; : > src/a") == 0);
+  long delays[] = {300, 20};
+  const char *texts[] = {"x", "y"};
+  pid_t writer = write_later("src/a", delays, texts, 2);
+  assert(run_source("watch -d 150 -c 2 -f src -- 'cat src/a > log'") == 0);
+  waitpid(writer, NULL, 0);
+
+  const WatchStats *stats = watch_stats();
+  assert(stats->runs == 2);
+  assert(stats->bursts == 1);
+  assert(stats->events >= 2);
+  assert(stats->cancelled == 0);
+  assert(stats->latency_usec >= 150000);
+
+  FILE *f = fopen("log", "r");
+  char line[16] = {0};
+  assert(fgets(line, sizeof(line), f));
+  assert(strcmp(line, "xy") == 0);
+  fclose(f);
+
+  printf("Watch reruns test passed!\n");
+}
+
+static void test_cancel() {
+  printf("Testing watch cancellation...\n");
+
+  // The first run waits for a change, which cancels it; the rerun finishes
+  assert(run_source(": > src/b") == 0);
+  long delays[] = {300};
+  const char *texts[] = {"z"};
+  pid_t writer = write_later("src/b", delays, texts, 1);
+  assert(run_source("watch -d 50 -c 1 -f src/b -- "
+                    "'test -s src/b || sleep 10'") == 0);
+  waitpid(writer, NULL, 0);
+
+  const WatchStats *stats = watch_stats();
+  assert(stats->cancelled == 1);
+  assert(stats->runs == 1);
+  assert(stats->bursts == 1);
+
+  assert(run_source("watch -f src") == 2);
+  assert(run_source("watch -c 1 -f /nonexistent -- true") == 1);
+
+  // Several words are run as they are, quoting and all
+  assert(run_source("watch -c 1 -f src -- sh -c 'printf \"%s|\" \"$@\" > "
+                    "words' sh 'a b' c") == 0);
+  FILE *f = fopen("words", "r");
+  char line[16] = {0};
+  assert(fgets(line, sizeof(line), f));
+  assert(strcmp(line, "a b|c|") == 0);
+  fclose(f);
+
+  printf("Watch cancellation test passed!\n");
+}
+
+int main() {
+  vars_init(environ);
+  assert(mkdtemp(dir));
+  assert(chdir(dir) == 0);
+  assert(run_source("mkdir -p src/sub") == 0);
+
+  test_rerun();
+  test_cancel();
+
+  char cleanup[64];
+  snprintf(cleanup, sizeof(cleanup), "rm -rf %s", dir);
+  assert(system(cleanup) == 0);
+  printf("All watch tests passed!\n");
+  return 0;
+}